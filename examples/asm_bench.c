@@ -0,0 +1,196 @@
+// assembler throughput: generates a VASM source of the given number of lines, times vm_translate_source() on it on one
+// thread and on several and reports lines per second, checking the two assemble it to the same bytes, then times the
+// mnemonic lookup alone against the linear search over get_inst_name() that vm_translate_line() used to do
+// make asm_bench && ./bin/non_nanboxed/asm_bench [lines] [runs] [threads, 0 for one per processor]
+#define _VM_IMPLEMENTATION
+#include "../src/non_nanboxed/virt_mach.h"
+
+static double seconds_since(struct timespec begin)
+{
+    struct timespec end;
+    timespec_get(&end, TIME_UTC);
+    return (double)(end.tv_sec - begin.tv_sec) + (double)(end.tv_nsec - begin.tv_nsec) / 1e9;
+}
+
+// a mix of the instruction set as programs use it: pushes with operands of every type, arithmetic, memory, jumps
+// forward to the next label, with a label every 16 lines and some labelled data every 4096
+static String_View generate_source(size_t lines)
+{
+    static const char *const body[] = {
+        "    upush 1024", "    spush -7", "    fpush 2.5", "    uplus", "    rdup 1", "    rswap 2", "    load64",
+        "    store64", "    umult", "    sminus", "    lu", "    ujmp_if block%zu", "    pop", "    fmult", "    native 4",
+        "    zeload8", "    seload32", "    jmp block%zu", "    equ", "    ftu",
+    };
+    size_t capacity = 64 * (lines + 2);
+    char *text = malloc(capacity);
+    if (!text)
+    {
+        fprintf(stderr, "ERROR: source allocation failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    size_t size = (size_t)snprintf(text, capacity, ".text\nstart:\n");
+    for (size_t i = 0; i < lines; i++)
+    {
+        if (i % 4096 == 4095)
+        {
+            size += (size_t)snprintf(text + size, capacity - size, ".data\ndata%zu: .quadword %zu\n.string \"bench\"\n.text\n", i, i);
+        }
+        else if (i % 16 == 0)
+        {
+            size += (size_t)snprintf(text + size, capacity - size, "block%zu:\n", i / 16);
+        }
+        else
+        {
+            size += (size_t)snprintf(text + size, capacity - size, body[(i * 7) % ARRAY_SIZE(body)], i / 16 + 1);
+            size += (size_t)snprintf(text + size, capacity - size, " ; line %zu\n", i);
+        }
+    }
+    size += (size_t)snprintf(text + size, capacity - size, "block%zu:\n    halt\n", lines > 0 ? (lines - 1) / 16 + 1 : 0);
+    return (String_View){.data = text, .count = size};
+}
+
+// the lookup vm_translate_line() did before vm_inst_lookup()
+static Inst_Type linear_lookup(String_View name)
+{
+    for (size_t i = 1; i < (size_t)INST_COUNT; i++)
+    {
+        if (sv_eq(name, cstr_as_sv(get_inst_name(i))))
+        {
+            return i;
+        }
+    }
+    return 0;
+}
+
+typedef struct
+{
+    Vm_Assembler as;
+    Inst *program;
+    uint8_t *data_section;
+    vm_header_ header;
+} Assembly;
+
+static void assembly_free(Assembly *assembly)
+{
+    free((void *)assembly->program);
+    free((void *)assembly->data_section);
+    vm_assembler_free(&assembly->as);
+}
+
+// the best time of 'runs' assemblies of source on vm_asm_threads threads; the last one is left in *kept
+static double time_assembly(String_View source, size_t runs, Assembly *kept)
+{
+    double best = 0;
+    for (size_t run = 0; run < runs; run++)
+    {
+        struct timespec begin;
+        timespec_get(&begin, TIME_UTC);
+
+        Assembly assembly;
+        vm_assembler_init(&assembly.as, "asm_bench.vasm", false);
+        assembly.header = vm_translate_source(&assembly.as, source, &assembly.program, &assembly.data_section);
+        label_free(&assembly.as);
+        double seconds = seconds_since(begin);
+
+        if (!assembly.as.compilation_successful || assembly.header.code_section_size == 0)
+        {
+            fprintf(stderr, "ERROR: the generated source didn't assemble\n");
+            exit(EXIT_FAILURE);
+        }
+        if (run + 1 < runs)
+        {
+            assembly_free(&assembly);
+        }
+        else
+        {
+            *kept = assembly;
+        }
+        best = run == 0 || seconds < best ? seconds : best;
+    }
+    return best;
+}
+
+static bool same_assembly(const Assembly *a, const Assembly *b)
+{
+    if (a->header.code_section_size != b->header.code_section_size || a->header.data_section_size != b->header.data_section_size ||
+        a->header.start_location != b->header.start_location || a->as.debug_lines_size != b->as.debug_lines_size ||
+        a->as.debug_symbols_size != b->as.debug_symbols_size ||
+        memcmp(a->data_section, b->data_section, a->header.data_section_size) != 0 ||
+        memcmp(a->as.debug_lines, b->as.debug_lines, a->as.debug_lines_size) != 0 ||
+        memcmp(a->as.debug_symbols, b->as.debug_symbols, a->as.debug_symbols_size) != 0)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < a->header.code_section_size; i++)
+    {
+        if (a->program[i].type != b->program[i].type || a->program[i].operand._as_u64 != b->program[i].operand._as_u64)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    size_t lines = argc > 1 ? (size_t)atoll(argv[1]) : 1000000;
+    size_t runs = argc > 2 ? (size_t)atoll(argv[2]) : 5;
+    size_t threads = argc > 3 ? (size_t)atoll(argv[3]) : 0;
+    String_View source = generate_source(lines);
+    runs = runs > 0 ? runs : 1;
+
+    Assembly serial, parallel;
+    vm_asm_threads = 1;
+    double best = time_assembly(source, runs, &serial);
+    printf("assembled %zu lines: %.0f lines/s (best of %zu runs, %.3f s)\n", lines, (double)lines / best, runs, best);
+
+    vm_asm_threads = threads;
+    best = time_assembly(source, runs, &parallel);
+    printf("on %s threads: %.0f lines/s (best of %zu runs, %.3f s)\n", threads > 0 ? argv[3] : "all", (double)lines / best, runs, best);
+    if (!same_assembly(&serial, &parallel))
+    {
+        fprintf(stderr, "ERROR: the parallel assembly differs from the serial one\n");
+        return EXIT_FAILURE;
+    }
+    assembly_free(&serial);
+    assembly_free(&parallel);
+
+    // every mnemonic plus names that aren't one, so misses are timed too
+    String_View names[INST_COUNT + 3];
+    size_t names_size = 0;
+    for (size_t i = 1; i < INST_COUNT; i++)
+    {
+        names[names_size++] = cstr_as_sv(get_inst_name(i));
+    }
+    names[names_size++] = cstr_as_sv("block");
+    names[names_size++] = cstr_as_sv("upushx");
+    names[names_size++] = cstr_as_sv("start:");
+
+    size_t rounds = 200000;
+    size_t found[2] = {0};
+    Inst_Type (*const lookups[])(String_View) = {linear_lookup, vm_inst_lookup};
+    const char *const labels[] = {"linear search", "perfect hash"};
+    for (size_t l = 0; l < ARRAY_SIZE(lookups); l++)
+    {
+        struct timespec begin;
+        timespec_get(&begin, TIME_UTC);
+        for (size_t r = 0; r < rounds; r++)
+        {
+            for (size_t n = 0; n < names_size; n++)
+            {
+                found[l] += lookups[l](names[n]);
+            }
+        }
+        double seconds = seconds_since(begin);
+        printf("%s: %.1f ns per mnemonic\n", labels[l], seconds * 1e9 / (double)(rounds * names_size));
+    }
+    if (found[0] != found[1])
+    {
+        fprintf(stderr, "ERROR: the two lookups disagree\n");
+        return EXIT_FAILURE;
+    }
+
+    free((void *)source.data);
+    return EXIT_SUCCESS;
+}
@@ -48,6 +48,7 @@ bool target_is_num = false;
 
 #define TYPE_INVALID ((uint8_t)10)
 #define ERROR_BUFFER_SIZE 256
+#define MAX_HASHTABLE_SIZE 256
 
 #define PROG_TEXT(inst) fprintf(ctx->program_file, "    "##inst "\n")
 #define PROG_DATA(inst) fprintf(ctx->data_file, "   "##inst "\n")
@@ -839,185 +840,183 @@ bool handle_code_line(CompilerContext *ctx, String_View *line)
     sv_trim_left(line);
     bool has_operand_value = line->count > 0;
 
-    for (size_t i = 1; i < (size_t)INST_COUNT; i++)
+    Inst_Type i = vm_inst_lookup(inst_name);
+    if (i == 0)
     {
-        if (sv_eq(inst_name, cstr_as_sv(get_inst_name(i))))
+        snprintf(ctx->error_buffer, ERROR_BUFFER_SIZE,
+                 "Line Number %zu -> ERROR: Invalid instruction %.*s",
+                 ctx->line_no, (int)inst_name.count, inst_name.data);
+        return false;
+    }
+
+    if (has_operand_function(i) != has_operand_value)
+    {
+        snprintf(ctx->error_buffer, ERROR_BUFFER_SIZE,
+                 "Line Number %zu -> ERROR: %s %s an operand",
+                 ctx->line_no, get_inst_name(i),
+                 has_operand_function(i) ? "requires" : "doesn't require");
+        return false;
+    }
+
+    if (!has_operand_function(i))
+    {
+        return handle_instruction(ctx, i, &(String_View){0});
+    }
+
+    uint8_t operand_type = check_operand_type(line);
+
+    switch (get_operand_type(i))
+    {
+    case TYPE_SIGNED_64INT:
+    {
+        if (operand_type == TYPE_UNSIGNED_64INT || operand_type == TYPE_SIGNED_64INT)
+        {
+            if (!handle_instruction(ctx, i, line))
+                return false;
+        }
+        else if (operand_type == TYPE_DOUBLE)
+        {
+            snprintf(ctx->error_buffer, ERROR_BUFFER_SIZE,
+                     "Line Number %zu -> ERROR: illegal operand value for %s instruction: %.*s\n"
+                     "Must be a signed integral value",
+                     ctx->line_no, get_inst_name(i), (int)line->count, line->data);
+            return false;
+        }
+        else if (operand_type == TYPE_INVALID)
         {
-            if (has_operand_function(i) != has_operand_value)
+            if (ctx->unresolved_labels_counter >= label_capacity)
             {
                 snprintf(ctx->error_buffer, ERROR_BUFFER_SIZE,
-                         "Line Number %zu -> ERROR: %s %s an operand",
-                         ctx->line_no, get_inst_name(i),
-                         has_operand_function(i) ? "requires" : "doesn't require");
+                         "Line Number %zu -> ERROR: Too many unresolved labels",
+                         ctx->line_no);
                 return false;
             }
+            ctx->unresolved_labels[ctx->unresolved_labels_counter].label = *line;
+            ctx->unresolved_labels[ctx->unresolved_labels_counter].line_no = ctx->line_no;
+            ctx->unresolved_labels[ctx->unresolved_labels_counter].target_is_num_ = false;
 
-            if (!has_operand_function(i))
+            ctx->unresolved_labels_counter++;
+        }
+        return true;
+    }
+    case TYPE_UNSIGNED_64INT:
+    {
+        if (i == INST_CALL || i == INST_JMP || i == INST_FJMP_IF || i == INST_UJMP_IF)
+        {
+            if (operand_type == TYPE_SIGNED_64INT)
             {
-                return handle_instruction(ctx, i, &(String_View){0});
+                snprintf(ctx->error_buffer, ERROR_BUFFER_SIZE,
+                         "Line Number %zu -> ERROR: illegal operand value for %s instruction: %.*s\n"
+                         "Must be a label/unsigned 64 bit integer",
+                         ctx->line_no, get_inst_name(i), (int)line->count, line->data);
+                return false;
             }
-
-            uint8_t operand_type = check_operand_type(line);
-
-            switch (get_operand_type(i))
-            {
-            case TYPE_SIGNED_64INT:
+            else if (operand_type == TYPE_UNSIGNED_64INT)
             {
-                if (operand_type == TYPE_UNSIGNED_64INT || operand_type == TYPE_SIGNED_64INT)
-                {
-                    if (!handle_instruction(ctx, i, line))
-                        return false;
-                }
-                else if (operand_type == TYPE_DOUBLE)
+                if (ctx->unresolved_labels_counter >= label_capacity)
                 {
                     snprintf(ctx->error_buffer, ERROR_BUFFER_SIZE,
-                             "Line Number %zu -> ERROR: illegal operand value for %s instruction: %.*s\n"
-                             "Must be a signed integral value",
-                             ctx->line_no, get_inst_name(i), (int)line->count, line->data);
+                             "Line Number %zu -> ERROR: Too many unresolved bindings",
+                             ctx->line_no);
                     return false;
                 }
-                else if (operand_type == TYPE_INVALID)
-                {
-                    if (ctx->unresolved_labels_counter >= label_capacity)
-                    {
-                        snprintf(ctx->error_buffer, ERROR_BUFFER_SIZE,
-                                 "Line Number %zu -> ERROR: Too many unresolved labels",
-                                 ctx->line_no);
-                        return false;
-                    }
-                    ctx->unresolved_labels[ctx->unresolved_labels_counter].label = *line;
-                    ctx->unresolved_labels[ctx->unresolved_labels_counter].line_no = ctx->line_no;
-                    ctx->unresolved_labels[ctx->unresolved_labels_counter].target_is_num_ = false;
-
-                    ctx->unresolved_labels_counter++;
-                }
-                return true;
+
+                char str[128];
+                snprintf(str, 128, "L%.*s", (int)line->count, line->data);
+
+                ctx->unresolved_labels[ctx->unresolved_labels_counter].label = cstr_as_sv(str);
+                ctx->unresolved_labels[ctx->unresolved_labels_counter].line_no = ctx->line_no;
+                ctx->unresolved_labels[ctx->unresolved_labels_counter].target_is_num_ = true;
+                ctx->unresolved_labels_counter++;
+
+                target_is_num = true;
+                if (!handle_instruction(ctx, i, line))
+                    return false;
             }
-            case TYPE_UNSIGNED_64INT:
+            else
             {
-                if (i == INST_CALL || i == INST_JMP || i == INST_FJMP_IF || i == INST_UJMP_IF)
+                if (ctx->unresolved_labels_counter >= label_capacity)
                 {
-                    if (operand_type == TYPE_SIGNED_64INT)
-                    {
-                        snprintf(ctx->error_buffer, ERROR_BUFFER_SIZE,
-                                 "Line Number %zu -> ERROR: illegal operand value for %s instruction: %.*s\n"
-                                 "Must be a label/unsigned 64 bit integer",
-                                 ctx->line_no, get_inst_name(i), (int)line->count, line->data);
-                        return false;
-                    }
-                    else if (operand_type == TYPE_UNSIGNED_64INT)
-                    {
-                        if (ctx->unresolved_labels_counter >= label_capacity)
-                        {
-                            snprintf(ctx->error_buffer, ERROR_BUFFER_SIZE,
-                                     "Line Number %zu -> ERROR: Too many unresolved bindings",
-                                     ctx->line_no);
-                            return false;
-                        }
-
-                        char str[128];
-                        snprintf(str, 128, "L%.*s", (int)line->count, line->data);
-
-                        ctx->unresolved_labels[ctx->unresolved_labels_counter].label = cstr_as_sv(str);
-                        ctx->unresolved_labels[ctx->unresolved_labels_counter].line_no = ctx->line_no;
-                        ctx->unresolved_labels[ctx->unresolved_labels_counter].target_is_num_ = true;
-                        ctx->unresolved_labels_counter++;
-
-                        target_is_num = true;
-                        if (!handle_instruction(ctx, i, line))
-                            return false;
-                    }
-                    else
-                    {
-                        if (ctx->unresolved_labels_counter >= label_capacity)
-                        {
-                            snprintf(ctx->error_buffer, ERROR_BUFFER_SIZE,
-                                     "Line Number %zu -> ERROR: Too many unresolved labels",
-                                     ctx->line_no);
-                            return false;
-                        }
-                        ctx->unresolved_labels[ctx->unresolved_labels_counter].label = *line;
-                        ctx->unresolved_labels[ctx->unresolved_labels_counter].line_no = ctx->line_no;
-                        ctx->unresolved_labels[ctx->unresolved_labels_counter].target_is_num_ = false;
-
-                        ctx->unresolved_labels_counter++;
-
-                        if (!handle_instruction(ctx, i, line))
-                            return false;
-                    }
-                }
-                else
-                {
-                    if (operand_type == TYPE_UNSIGNED_64INT)
-                    {
-                        if (!handle_instruction(ctx, i, line))
-                            return false;
-                    }
-                    else if (operand_type == TYPE_DOUBLE || operand_type == TYPE_SIGNED_64INT)
-                    {
-                        snprintf(ctx->error_buffer, ERROR_BUFFER_SIZE,
-                                 "Line Number %zu -> ERROR: illegal operand value for %s instruction: %.*s\n"
-                                 "Must be an unsigned integral value",
-                                 ctx->line_no, get_inst_name(i), (int)line->count, line->data);
-                        return false;
-                    }
-                    else if (operand_type == TYPE_INVALID)
-                    {
-                        if (ctx->unresolved_labels_counter >= label_capacity)
-                        {
-                            snprintf(ctx->error_buffer, ERROR_BUFFER_SIZE,
-                                     "Line Number %zu -> ERROR: Too many unresolved labels",
-                                     ctx->line_no);
-                            return false;
-                        }
-                        ctx->unresolved_labels[ctx->unresolved_labels_counter].label = *line;
-                        ctx->unresolved_labels[ctx->unresolved_labels_counter].line_no = ctx->line_no;
-                        ctx->unresolved_labels[ctx->unresolved_labels_counter].target_is_num_ = false;
-
-                        ctx->unresolved_labels_counter++;
-                    }
+                    snprintf(ctx->error_buffer, ERROR_BUFFER_SIZE,
+                             "Line Number %zu -> ERROR: Too many unresolved labels",
+                             ctx->line_no);
+                    return false;
                 }
-                return true;
+                ctx->unresolved_labels[ctx->unresolved_labels_counter].label = *line;
+                ctx->unresolved_labels[ctx->unresolved_labels_counter].line_no = ctx->line_no;
+                ctx->unresolved_labels[ctx->unresolved_labels_counter].target_is_num_ = false;
+
+                ctx->unresolved_labels_counter++;
+
+                if (!handle_instruction(ctx, i, line))
+                    return false;
             }
-            case TYPE_DOUBLE:
+        }
+        else
+        {
+            if (operand_type == TYPE_UNSIGNED_64INT)
             {
-                if (operand_type == TYPE_INVALID)
-                {
-                    if (ctx->unresolved_labels_counter >= label_capacity)
-                    {
-                        snprintf(ctx->error_buffer, ERROR_BUFFER_SIZE,
-                                 "Line Number %zu -> ERROR: Too many unresolved labels",
-                                 ctx->line_no);
-                        return false;
-                    }
-                    ctx->unresolved_labels[ctx->unresolved_labels_counter].label = *line;
-                    ctx->unresolved_labels[ctx->unresolved_labels_counter].line_no = ctx->line_no;
-                    ctx->unresolved_labels[ctx->unresolved_labels_counter].target_is_num_ = false;
-
-                    ctx->unresolved_labels_counter++;
-                }
-                else
+                if (!handle_instruction(ctx, i, line))
+                    return false;
+            }
+            else if (operand_type == TYPE_DOUBLE || operand_type == TYPE_SIGNED_64INT)
+            {
+                snprintf(ctx->error_buffer, ERROR_BUFFER_SIZE,
+                         "Line Number %zu -> ERROR: illegal operand value for %s instruction: %.*s\n"
+                         "Must be an unsigned integral value",
+                         ctx->line_no, get_inst_name(i), (int)line->count, line->data);
+                return false;
+            }
+            else if (operand_type == TYPE_INVALID)
+            {
+                if (ctx->unresolved_labels_counter >= label_capacity)
                 {
-                    if (!handle_instruction(ctx, i, line))
-                        return false;
+                    snprintf(ctx->error_buffer, ERROR_BUFFER_SIZE,
+                             "Line Number %zu -> ERROR: Too many unresolved labels",
+                             ctx->line_no);
+                    return false;
                 }
-                return true;
+                ctx->unresolved_labels[ctx->unresolved_labels_counter].label = *line;
+                ctx->unresolved_labels[ctx->unresolved_labels_counter].line_no = ctx->line_no;
+                ctx->unresolved_labels[ctx->unresolved_labels_counter].target_is_num_ = false;
+
+                ctx->unresolved_labels_counter++;
             }
-            default:
+        }
+        return true;
+    }
+    case TYPE_DOUBLE:
+    {
+        if (operand_type == TYPE_INVALID)
+        {
+            if (ctx->unresolved_labels_counter >= label_capacity)
+            {
                 snprintf(ctx->error_buffer, ERROR_BUFFER_SIZE,
-                         "Line Number %zu -> ERROR: Unknown operand type for instruction %s",
-                         ctx->line_no, get_inst_name(i));
+                         "Line Number %zu -> ERROR: Too many unresolved labels",
+                         ctx->line_no);
                 return false;
             }
+            ctx->unresolved_labels[ctx->unresolved_labels_counter].label = *line;
+            ctx->unresolved_labels[ctx->unresolved_labels_counter].line_no = ctx->line_no;
+            ctx->unresolved_labels[ctx->unresolved_labels_counter].target_is_num_ = false;
 
-            return handle_instruction(ctx, i, line);
+            ctx->unresolved_labels_counter++;
         }
+        else
+        {
+            if (!handle_instruction(ctx, i, line))
+                return false;
+        }
+        return true;
+    }
+    default:
+        snprintf(ctx->error_buffer, ERROR_BUFFER_SIZE,
+                 "Line Number %zu -> ERROR: Unknown operand type for instruction %s",
+                 ctx->line_no, get_inst_name(i));
+        return false;
     }
 
-    snprintf(ctx->error_buffer, ERROR_BUFFER_SIZE,
-             "Line Number %zu -> ERROR: Invalid instruction %.*s",
-             ctx->line_no, (int)inst_name.count, inst_name.data);
-    return false;
+    return handle_instruction(ctx, i, line);
 }
 
 bool process_source_file(CompilerContext *ctx, const char *input_file)
@@ -1037,8 +1036,8 @@ bool process_source_file(CompilerContext *ctx, const char *input_file)
         sv_trim_left(&line);
         sv_trim_right(&line);
 
-        if (line.count == 0)
-            continue;
+        if (line.count == 0 || line.data[0] == '#')
+            continue; // blank, or a preprocessor line marker
 
         String_View section = line;
         String_View directive = sv_chop_by_delim(&section, ' ');
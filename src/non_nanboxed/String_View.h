@@ -7,6 +7,16 @@
 #include <string.h>
 #include <stdint.h>
 #include <ctype.h>
+#include <float.h>
+
+// x86 gets SSE2 and AVX2 versions of the byte search every chop goes through, picked by what the processor running it
+// has; everything else, and any view too short for a vector, is searched a byte at a time
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define SV_HAS_SIMD 1
+#include <immintrin.h>
+#else
+#define SV_HAS_SIMD 0
+#endif
 
 typedef struct
 {
@@ -20,15 +30,33 @@ typedef int64_t word;
 #define FAILURE 0
 #define OPERAND_OVERFLOW -1
 
+typedef enum
+{
+    SV_UNSIGNED, // digits, '+' in front or not
+    SV_SIGNED,   // '-' and digits
+    SV_DOUBLE,   // anything with a '.'
+} Sv_Number_Type;
+
+typedef struct // a literal as sv_to_number() read it: what kind it is, and its value in the member for that kind
+{
+    Sv_Number_Type type;
+    union
+    {
+        uint64_t u64;
+        int64_t s64;
+        double f64;
+    };
+} Sv_Number;
+
 // printf macros for String_View
 #define SV_fmt "%.*s"
 #define SV_arg(sv) (int)sv.count, sv.data
 #define SV_argp(sv) (int)sv->count, sv->data
 
-int str_errno = SUCCESS;
+_Thread_local int str_errno = SUCCESS; // per thread, so assemblers on different threads don't see each other's
 
 String_View cstr_as_sv(const char *cstr);
-String_View sv_chop_by_delim(String_View *sv, const char delim);
+static inline String_View sv_chop_by_delim(String_View *sv, const char delim);
 void sv_trim_left(String_View *line);
 void sv_trim_right(String_View *line);
 void sv_trim_side_comments(String_View *line);
@@ -36,6 +64,7 @@ bool sv_eq(String_View a, String_View b);
 /* double sv_to_value(String_View *op); */
 bool is_negative(String_View value);
 bool is_fraction(String_View value);
+Sv_Number sv_to_number(String_View *value);
 double sv_to_double(String_View *value);
 uint64_t sv_to_unsigned64(String_View *value);
 int64_t sv_to_signed64(String_View *value);
@@ -50,32 +79,101 @@ String_View cstr_as_sv(const char *cstr)
     };
 }
 
-String_View sv_chop_by_delim(String_View *sv, const char delim)
+static inline size_t sv_index_of_scalar(const char *data, size_t count, char c)
 {
-    String_View chopped = {0}; // Initialize chopped.count to 0
-    chopped.data = sv->data;
+    size_t i = 0;
+    while (i < count && data[i] != c)
+    {
+        i++;
+    }
+    return i;
+}
 
-    // Loop through until the delimiter or end of string is found
-    while (sv->count > 0 && *(sv->data) != delim) // if there's no delim at the end; sv.count will be zero and will point to a null byte
+#if SV_HAS_SIMD
+// count is at least 16; the bytes past the last whole vector are compared in one more, overlapping the one before
+__attribute__((target("sse2"))) static size_t sv_index_of_sse2(const char *data, size_t count, char c)
+{
+    __m128i needle = _mm_set1_epi8(c);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + i)), needle));
+        if (mask != 0)
+        {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+    if (i < count)
     {
-        sv->count--;
-        chopped.count++;
-        sv->data++;
+        size_t last = count - 16;
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + last)), needle)) >> (i - last);
+        if (mask != 0)
+        {
+            return i + (size_t)__builtin_ctz(mask);
+        }
     }
+    return count;
+}
 
-    // If delimiter found and not at the end of the string
-    if (sv->count > 0 && *(sv->data) == delim)
+// count is at least 32, as above
+__attribute__((target("avx2"))) static size_t sv_index_of_avx2(const char *data, size_t count, char c)
+{
+    __m256i needle = _mm256_set1_epi8(c);
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32)
+    {
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(data + i)), needle));
+        if (mask != 0)
+        {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+    if (i < count)
     {
-        sv->count--; // Skip the delimiter
-        sv->data++;  // Move past the delimiter
+        size_t last = count - 32;
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(data + last)), needle)) >> (i - last);
+        if (mask != 0)
+        {
+            return i + (size_t)__builtin_ctz(mask);
+        }
     }
+    return count;
+}
+#endif
+
+// the index of the first c in sv, or sv.count if there's none; inline, as most views chopped are a few bytes long
+static inline size_t sv_index_of(String_View sv, char c)
+{
+#if SV_HAS_SIMD
+    if (sv.count >= 32 && __builtin_cpu_supports("avx2"))
+    {
+        return sv_index_of_avx2(sv.data, sv.count, c);
+    }
+    if (sv.count >= 16 && __builtin_cpu_supports("sse2"))
+    {
+        return sv_index_of_sse2(sv.data, sv.count, c);
+    }
+#endif
+    return sv_index_of_scalar(sv.data, sv.count, c);
+}
+
+static inline String_View sv_chop_by_delim(String_View *sv, const char delim)
+{
+    size_t i = sv_index_of(*sv, delim);
+    String_View chopped = {.count = i, .data = sv->data};
+
+    // past the delimiter too, if there is one
+    size_t skip = i < sv->count ? i + 1 : i;
+    sv->data += skip;
+    sv->count -= skip;
 
     return chopped;
 }
 
+// blanks run a few bytes at most, too short for vectors to pay for themselves
 void sv_trim_left(String_View *line)
 {
-    while (isspace((int)*(line->data)) && line->count > 0)
+    while (line->count > 0 && isspace((unsigned char)*(line->data)))
     {
         line->data++;
         line->count--;
@@ -84,7 +182,7 @@ void sv_trim_left(String_View *line)
 
 void sv_trim_right(String_View *line)
 {
-    while (isspace((int)(line->data[line->count - 1])) && line->count > 0)
+    while (line->count > 0 && isspace((unsigned char)(line->data[line->count - 1])))
     {
         line->count--;
     }
@@ -138,167 +236,296 @@ bool is_fraction(String_View value)
     return false;
 }
 
-double sv_to_double(String_View *value)
+// whether the 8 bytes x was loaded from are all digits
+static inline bool sv_is_eight_digits(uint64_t x)
 {
-    double num = 0;
-    double fraction_part = 0;
-    bool is_neg = false;
-    bool in_fraction = false;
-    double divisor = 1;
-    str_errno = SUCCESS; // Reset the error flag before processing
-
-    for (size_t i = 0; i < value->count; i++)
-    {
-        char ch = value->data[i];
-
-        // Check for negative sign
-        if (ch == '-')
-        {
-            if (i > 0) // Negative sign should only be at the beginning
-            {
-                str_errno = FAILURE;
-                return -1;
-            }
-            is_neg = true;
-            continue;
-        }
-
-        // Check for positive sign (optional)
-        if (ch == '+')
-        {
-            if (i > 0) // Positive sign should only be at the beginning
-            {
-                str_errno = FAILURE;
-                return -1;
-            }
-            continue;
-        }
+    return ((x & 0xF0F0F0F0F0F0F0F0ULL) | (((x + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) == 0x3333333333333333ULL;
+}
 
-        // Check for decimal point
-        if (ch == '.')
-        {
-            if (in_fraction) // Multiple decimal points are not allowed
-            {
-                str_errno = FAILURE;
-                return -1;
-            }
-            in_fraction = true;
-            continue;
-        }
+// the number 8 digits loaded by sv_load8() make, first digit most significant, in three multiplies instead of 8
+static inline uint32_t sv_eight_digits(uint64_t x)
+{
+    x = (x & 0x0F0F0F0F0F0F0F0FULL) * 2561 >> 8;
+    x = (x & 0x00FF00FF00FF00FFULL) * 6553601 >> 16;
+    return (uint32_t)((x & 0x0000FFFF0000FFFFULL) * 42949672960001ULL >> 32);
+}
 
-        int dig = ch - '0';
-        if (dig < 0 || dig > 9)
-        {
-            str_errno = FAILURE; // Set error if non-digit is encountered
-            return -1;
-        }
+// p[0] in the lowest byte on any host; little endian ones make it a single load
+static inline uint64_t sv_load8(const char *p)
+{
+    const uint8_t *b = (const uint8_t *)p;
+    return (uint64_t)b[0] | (uint64_t)b[1] << 8 | (uint64_t)b[2] << 16 | (uint64_t)b[3] << 24 | (uint64_t)b[4] << 32 |
+           (uint64_t)b[5] << 40 | (uint64_t)b[6] << 48 | (uint64_t)b[7] << 56;
+}
 
-        if (in_fraction)
-        {
-            divisor *= 10;
-            fraction_part += dig / divisor;
-        }
-        else
+// reads the digits from *p on into *w, 8 at a time while there are 8; past 19 of them *w has wrapped around
+static inline void sv_read_digits(const char **p, const char *end, uint64_t *w)
+{
+    while (end - *p >= 8)
+    {
+        uint64_t x = sv_load8(*p);
+        if (!sv_is_eight_digits(x))
         {
-            num = num * 10 + dig; // Accumulate integer part
+            break;
         }
+        *w = *w * 100000000 + sv_eight_digits(x);
+        *p += 8;
+    }
+    while (*p < end && (unsigned)(**p - '0') < 10)
+    {
+        *w = *w * 10 + (uint64_t)(**p - '0');
+        (*p)++;
     }
-
-    double result = num + fraction_part;
-    return is_neg ? -result : result; // Apply the negative sign if needed
 }
 
-uint64_t sv_to_unsigned64(String_View *value)
+#define SV_POWER_MIN -19
+#define SV_POWER_MAX 0
+
+// 5^q for q from SV_POWER_MIN to SV_POWER_MAX, shifted to fill 128 bits (high word first) and rounded up, as the
+// Eisel-Lemire algorithm takes them; literals have no exponent and anything past 19 digits goes to strtod(), so a
+// mantissa is only ever scaled by a power from 10^-19 to 1
+static const uint64_t sv_powers_of_five[SV_POWER_MAX - SV_POWER_MIN + 1][2] = {
+    {0xec1e4a7db69561a5ULL, 0x2b31e9e3d06c32e6ULL},
+    {0x9392ee8e921d5d07ULL, 0x3aff322e62439fd0ULL},
+    {0xb877aa3236a4b449ULL, 0x09befeb9fad487c3ULL},
+    {0xe69594bec44de15bULL, 0x4c2ebe687989a9b4ULL},
+    {0x901d7cf73ab0acd9ULL, 0x0f9d37014bf60a11ULL},
+    {0xb424dc35095cd80fULL, 0x538484c19ef38c95ULL},
+    {0xe12e13424bb40e13ULL, 0x2865a5f206b06fbaULL},
+    {0x8cbccc096f5088cbULL, 0xf93f87b7442e45d4ULL},
+    {0xafebff0bcb24aafeULL, 0xf78f69a51539d749ULL},
+    {0xdbe6fecebdedd5beULL, 0xb573440e5a884d1cULL},
+    {0x89705f4136b4a597ULL, 0x31680a88f8953031ULL},
+    {0xabcc77118461cefcULL, 0xfdc20d2b36ba7c3eULL},
+    {0xd6bf94d5e57a42bcULL, 0x3d32907604691b4dULL},
+    {0x8637bd05af6c69b5ULL, 0xa63f9a49c2c1b110ULL},
+    {0xa7c5ac471b478423ULL, 0x0fcf80dc33721d54ULL},
+    {0xd1b71758e219652bULL, 0xd3c36113404ea4a9ULL},
+    {0x83126e978d4fdf3bULL, 0x645a1cac083126eaULL},
+    {0xa3d70a3d70a3d70aULL, 0x3d70a3d70a3d70a4ULL},
+    {0xccccccccccccccccULL, 0xcccccccccccccccdULL},
+    {0x8000000000000000ULL, 0x0000000000000000ULL},
+};
+
+// the high and the low 64 bits of a * b
+static inline uint64_t sv_mul128(uint64_t a, uint64_t b, uint64_t *low)
 {
-    str_errno = SUCCESS;
-    uint64_t num = 0;
+#ifdef __SIZEOF_INT128__
+    __extension__ unsigned __int128 product = (unsigned __int128)a * b;
+    *low = (uint64_t)product;
+    return (uint64_t)(product >> 64);
+#else
+    uint64_t a_low = (uint32_t)a, a_high = a >> 32, b_low = (uint32_t)b, b_high = b >> 32;
+    uint64_t low_low = a_low * b_low, high_low = a_high * b_low, low_high = a_low * b_high;
+    uint64_t middle = (low_low >> 32) + (uint32_t)high_low + (uint32_t)low_high;
+    *low = (middle << 32) | (uint32_t)low_low;
+    return a_high * b_high + (high_low >> 32) + (low_high >> 32) + (middle >> 32);
+#endif
+}
 
-    for (size_t i = 0; i < value->count; i++)
+// w * 10^q correctly rounded, for w != 0, into *bits as a double's exponent and mantissa; false for a q off the
+// table, for the caller to ask strtod(); in its range the 128 bits of 5^q always settle the rounding, and the result
+// is never subnormal or infinite
+static bool sv_eisel_lemire(uint64_t w, int q, uint64_t *bits)
+{
+    if (q < SV_POWER_MIN || q > SV_POWER_MAX)
     {
-        char ch = value->data[i];
+        return false;
+    }
 
-        // Check for positive sign (optional)
-        if (ch == '+')
-        {
-            if (i > 0) // Positive sign should only be at the beginning
-            {
-                str_errno = FAILURE;
-                return 0; // Return 0 in case of failure for unsigned
-            }
-            continue;
-        }
+#if defined(__GNUC__) || defined(__clang__)
+    int lz = __builtin_clzll(w);
+#else
+    int lz = 0;
+    while (!(w & (1ULL << (63 - lz))))
+    {
+        lz++;
+    }
+#endif
+    w <<= lz;
 
-        int dig = ch - '0';
-        if (dig < 0 || dig > 9)
-        {
-            str_errno = FAILURE; // Set error if non-digit is encountered
-            return 0;            // Return 0 in case of failure for unsigned
-        }
+    // the product's top 55 bits, with the low word of 5^q only where they might carry into them
+    const uint64_t *power = sv_powers_of_five[q - SV_POWER_MIN];
+    uint64_t low, high = sv_mul128(w, power[0], &low);
+    if ((high & 0x1FF) == 0x1FF)
+    {
+        uint64_t second_low, second_high = sv_mul128(w, power[1], &second_low);
+        low += second_high;
+        high += second_high > low;
+    }
 
-        // Check for overflow before performing the multiplication
-        if (num > (UINT64_MAX - dig) / 10)
-        {
-            str_errno = FAILURE; // Overflow occurred
-            return 0;
-        }
+    int upper_bit = (int)(high >> 63);
+    int shift = upper_bit + 64 - 52 - 3;
+    uint64_t mantissa = high >> shift;
+    int power2 = (((152170 + 65536) * q) >> 16) + 63 + upper_bit - lz + 1023;
 
-        num = num * 10 + dig;
+    // halfway between two doubles, where only an exact product rounds to even
+    if (low <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1 && (mantissa << shift) == high)
+    {
+        mantissa &= ~1ULL;
     }
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    if (mantissa >= (2ULL << 52))
+    {
+        mantissa = 1ULL << 52;
+        power2++;
+    }
+    mantissa &= ~(1ULL << 52);
+    *bits = (uint64_t)power2 << 52 | mantissa;
+    return true;
+}
 
-    return num;
+// the value of the literal text[0, count) when Eisel-Lemire can't tell
+static double sv_strtod(const char *text, size_t count)
+{
+    char small[128];
+    char *copy = count < sizeof(small) ? small : malloc(count + 1);
+    if (!copy)
+    {
+        fprintf(stderr, "ERROR: number allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(copy, text, count);
+    copy[count] = '\0';
+    double value = strtod(copy, NULL);
+    if (copy != small)
+    {
+        free(copy);
+    }
+    return value;
 }
 
-int64_t sv_to_signed64(String_View *value)
+// the powers of ten a double holds exactly, by which an exactly held mantissa scales in one correctly rounded step
+static const double sv_exact_powers_of_ten[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                                1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+// the literal *value in one pass: [+-]digits[.digits], either run of digits possibly empty; a double where there's a
+// '.' or as_double says so, else an integer, signed where there's a '-'; str_errno is FAILURE for what isn't a literal
+// and OPERAND_OVERFLOW for an integer past 64 bits
+static Sv_Number sv_parse_number(String_View *value, bool as_double)
 {
+    const char *p = value->data, *end = value->data + value->count;
+    Sv_Number number = {.type = SV_UNSIGNED};
     str_errno = SUCCESS;
-    bool is_neg = false;
-    int64_t num = 0;
 
-    for (size_t i = 0; i < value->count; i++)
+    bool negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        p++;
+    }
+    uint64_t w = 0;
+    const char *digits = p;
+    sv_read_digits(&p, end, &w);
+    size_t significant = (size_t)(p - digits); // leading zeros too, till there are too many for w to be sure of
+    int exponent = 0; // of ten, to scale w by
+
+    bool point = p < end && *p == '.';
+    if (point)
+    {
+        p++;
+        const char *fraction = p;
+        sv_read_digits(&p, end, &w);
+        significant += (size_t)(p - fraction);
+        exponent = -(int)(p - fraction);
+    }
+    if (p != end || p - digits == (point ? 1 : 0)) // a sign or a point alone has no digits to be a number
     {
-        char ch = value->data[i];
+        str_errno = FAILURE;
+        return number;
+    }
 
-        // Check for positive sign (optional)
-        if (ch == '+')
+    if (point || as_double)
+    {
+        number.type = SV_DOUBLE;
+        uint64_t bits = 0;
+#if FLT_EVAL_METHOD == 0
+        if (w != 0 && significant <= 19 && w <= 1ULL << 53 && exponent >= -22 && exponent <= 22)
         {
-            if (i > 0) // Positive sign should only be at the beginning
-            {
-                str_errno = FAILURE;
-                return 0; // Return 0 in case of failure
-            }
-            continue;
+            double scaled = (double)w;
+            scaled = exponent < 0 ? scaled / sv_exact_powers_of_ten[-exponent] : scaled * sv_exact_powers_of_ten[exponent];
+            number.f64 = negative ? -scaled : scaled;
+            return number;
         }
-
-        // Check for negative sign
-        if (ch == '-')
+#endif
+        // past 19 digits w may have wrapped, to zero even
+        if (significant > 19 || (w != 0 && !sv_eisel_lemire(w, exponent, &bits)))
         {
-            if (i > 0) // Negative sign should only be at the beginning
-            {
-                str_errno = FAILURE;
-                return 0; // Return 0 in case of failure
-            }
-            is_neg = true;
-            continue;
+            number.f64 = sv_strtod(value->data, value->count);
+            return number;
         }
+        bits |= negative ? 1ULL << 63 : 0;
+        memcpy(&number.f64, &bits, sizeof(bits));
+        return number;
+    }
 
-        int dig = ch - '0';
-        if (dig < 0 || dig > 9)
+    while (significant > 19 && *digits == '0')
+    {
+        digits++;
+        significant--;
+    }
+    // 20 digits still fit where they don't go past UINT64_MAX, 18446744073709551615
+    if (significant > 19)
+    {
+        uint64_t high = 0;
+        const char *twentieth = digits + 19;
+        sv_read_digits(&digits, twentieth, &high);
+        if (significant > 20 || high > 1844674407370955161ULL || (high == 1844674407370955161ULL && *twentieth > '5'))
         {
-            str_errno = FAILURE; // Set error if non-digit is encountered
-            return 0;            // Return 0 in case of failure
+            str_errno = OPERAND_OVERFLOW;
+            return number;
         }
+        w = high * 10 + (uint64_t)(*twentieth - '0');
+    }
+    if (!negative)
+    {
+        number.u64 = w;
+        return number;
+    }
 
-        // Check for overflow before performing the multiplication
-        if (num > (INT64_MAX - dig) / 10)
-        {
-            str_errno = FAILURE; // Overflow occurred
-            return 0;
-        }
+    number.type = SV_SIGNED;
+    if (w > 1ULL << 63)
+    {
+        str_errno = OPERAND_OVERFLOW;
+        return number;
+    }
+    number.s64 = w == 1ULL << 63 ? INT64_MIN : -(int64_t)w;
+    return number;
+}
 
-        num = num * 10 + dig;
+Sv_Number sv_to_number(String_View *value)
+{
+    return sv_parse_number(value, false);
+}
+
+double sv_to_double(String_View *value)
+{
+    Sv_Number number = sv_parse_number(value, true);
+    return str_errno == SUCCESS ? number.f64 : -1;
+}
+
+uint64_t sv_to_unsigned64(String_View *value)
+{
+    Sv_Number number = sv_parse_number(value, false);
+    if (str_errno == SUCCESS && number.type != SV_UNSIGNED)
+    {
+        str_errno = FAILURE;
     }
+    return str_errno == SUCCESS ? number.u64 : 0;
+}
 
-    return is_neg ? -num : num;
+int64_t sv_to_signed64(String_View *value)
+{
+    Sv_Number number = sv_parse_number(value, false);
+    if (str_errno == SUCCESS && number.type == SV_DOUBLE)
+    {
+        str_errno = FAILURE;
+    }
+    else if (str_errno == SUCCESS && number.type == SV_UNSIGNED && number.u64 > INT64_MAX)
+    {
+        str_errno = OPERAND_OVERFLOW;
+    }
+    return str_errno == SUCCESS ? number.s64 : 0;
 }
 
 #endif // _SV_IMPLEMENTATION
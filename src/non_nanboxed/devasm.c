@@ -12,23 +12,68 @@ int main(int argc, char **argv)
 
     const char *input = argv[1];
 
-#ifdef _WIN32
-    Inst program[VM_PROGRAM_CAPACITY];
-    uint8_t data_section[VM_DEFAULT_MEMORY_SIZE];
-#else
-    Inst program[vm_program_capacity];
-    uint8_t data_section[vm_default_memory_size];
-#endif
-    vm_header_ header = vm_load_program_from_file(program, data_section, input);
+    Inst *program;
+    uint8_t *data_section;
+    vm_header_ header = vm_load_program_from_file(&program, &data_section, input);
     size_t program_size = header.code_section_size;
 
+    printf("; executable format version %u%s\n", header.format_version, header.checksummed ? ", checksums verified" : "");
+    printf("; code section: %zu instructions, %s encoding, %zu bytes at offset %zu\n", program_size,
+           header.vm_executable_identifier == VM_EXECUTABLE_IDENTIFIER_COMPACT ? "compact" : "fixed",
+           header.code_section_bytes_in_executable, header.code_section_offset_in_executable);
+    printf("; data section: %zu bytes at offset %zu\n", header.data_section_size, header.data_section_offset_in_executable);
+    if (header.stack_size > 0)
+    {
+        printf("; stack: %zu entries\n", header.stack_size);
+    }
+    if (header.snapshot)
+    {
+        printf("; snapshot: resumes at instruction %lld with %zu stack entries, static break %llu of %zu bytes\n", (long long)header.start_location,
+               (header.state_size - VM_STATE_HEADER_SIZE) / sizeof(uint64_t), (unsigned long long)header.static_break, header.memory_capacity);
+    }
+
+    // labels and source lines, if the executable wasn't stripped of them
+    Vm_Debug_Info *debug = vm_debug_read(input, header);
+    if (debug)
+    {
+        printf("; debug info: %zu symbols, lines from %zu files\n", debug->symbols_size, debug->files_size);
+    }
+
      for (size_t i = 0; i < header.data_section_size; i++)
     {
+        for (size_t s = 0; debug && s < debug->symbols_size; s++)
+        {
+            if (debug->symbols[s].section == VM_SECTION_DATA && debug->symbols[s].value == i)
+            {
+                printf("; %.*s:\n", (int)debug->symbols[s].name.count, debug->symbols[s].name.data);
+            }
+        }
         printf("%d\n", data_section[i]);
     } 
 
+    size_t file = SIZE_MAX;
     for (size_t i = 0; i < program_size; i++)
     {
+        for (size_t s = 0; debug && s < debug->symbols_size; s++)
+        {
+            if (debug->symbols[s].section == VM_SECTION_CODE && debug->symbols[s].value == i)
+            {
+                printf("%.*s:\n", (int)debug->symbols[s].name.count, debug->symbols[s].name.data);
+            }
+        }
+        if (debug && i < debug->lines_size && debug->lines[i].line > 0 && debug->lines[i].file != file)
+        {
+            file = debug->lines[i].file;
+            const Vm_Source_File *source = &debug->files[file];
+            printf("; %.*s", (int)source->name.count, source->name.data);
+            for (; source->parent > 0; source = &debug->files[source->parent - 1])
+            {
+                const Vm_Source_File *parent = &debug->files[source->parent - 1];
+                printf(", included from %.*s:%zu", (int)parent->name.count, parent->name.data, source->parent_line);
+            }
+            printf("\n");
+        }
+
         printf("%s ", get_inst_name(program[i].type));
         if (has_operand_function(program[i].type))
         {
@@ -46,7 +91,15 @@ int main(int argc, char **argv)
                 printf("%llu", program[i].operand._as_u64);
             }
         }
+        if (debug && i < debug->lines_size && debug->lines[i].line > 0)
+        {
+            printf(" ; line %u", debug->lines[i].line);
+        }
         printf("\n");
     }
+
+    vm_debug_free(debug);
+    free((void *)program);
+    free((void *)data_section);
     return EXIT_SUCCESS;
 }
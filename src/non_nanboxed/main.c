@@ -1,3 +1,4 @@
+#define _DEFAULT_SOURCE // before any system header, see virt_mach.h
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -208,6 +209,50 @@ static Trap vm_dump_static(VirtualMachine *vm)
     return TRAP_OK;
 }
 
+static const char *snapshot_path = NULL; // --snapshot
+
+// writes the machine to the --snapshot file, so that --restore resumes it right after this native; without --snapshot
+// the program just runs on
+static Trap vm_snapshot(VirtualMachine *vm)
+{
+    if (snapshot_path)
+    {
+        vm_save_snapshot_to_file(vm, snapshot_path);
+    }
+    return TRAP_OK;
+}
+
+// the native table, in the order the native instruction indexes it
+static void push_natives(VirtualMachine *vm)
+{
+    vm_native_push_with_effect(vm, vm_alloc, 1, -1);
+    vm_native_push_with_effect(vm, vm_free, 1, -1);
+    vm_native_push_with_effect(vm, vm_print_f64, 1, 0);
+    vm_native_push_with_effect(vm, vm_print_s64, 1, 0);
+    vm_native_push_with_effect(vm, vm_print_u64, 1, 0);
+    vm_native_push_with_effect(vm, vm_dump_static, 2, 0);
+    vm_native_push_with_effect(vm, vm_print_string, 1, 0);
+    vm_native_push_with_effect(vm, vm_read, 2, -2);
+    vm_native_push_with_effect(vm, vm_write, 2, 0);
+    vm_native_push_with_effect(vm, vm_snapshot, 0, 0);
+}
+
+// proves the stack the program needs against the natives a run registers, so vm_init() can allocate exactly that
+static void record_stack_size(Inst *program, vm_header_ *header)
+{
+    native natives[VM_NATIVE_CAPACITY];
+    Native_Effect native_effects[VM_NATIVE_CAPACITY];
+    VirtualMachine probe = {.program = program, .program_size = header->code_section_size, .natives = natives, .native_effects = native_effects};
+    probe.instruction_pointer = header->has_start ? header->start_location : 0;
+    push_natives(&probe);
+
+    Verify_Report report;
+    vm_verify_program(&probe, &report);
+    header->stack_size = report.bounded && report.max_stack_depth > 0 ? report.max_stack_depth : 0;
+    free((void *)probe.frame_depths);
+    free((void *)probe.return_shadow);
+}
+
 #ifdef _WIN32
 #define SYSTEM_COMMAND(command) system(command)
 #define PATH_SEPARATOR ";"
@@ -230,7 +275,10 @@ typedef struct
 
 void print_usage_and_exit()
 {
-    fprintf(stderr, "Usage: ./virtmach --action <asm|run|pp> [--lib <library-path>]... [--vlib-ignore] [--stack-size <size>] [--program-capacity <size>] [--static-size <size>] [--limit <n>] [--save-vpp [filename]] [--debug] [--vpp] <input> [output]\n");
+    fprintf(stderr, "Usage: ./virtmach --action <asm|obj|run|jit|pp> [--lib <library-path>]... [--vlib-ignore] [--stack-size <size|auto>] [--program-capacity <size>] [--static-size <size>] [--limit <n>] [--dispatch <switch|threaded|register>] [--verify] [--fusion-stats] [--ir-stats] [--trace-threshold <n>] [--trace-stats] [--save-vpp [filename]] [--compact] [--checksum] [--strip] [--no-cache] [--cache-dir <dir>] [--cache-size <bytes>] [--asm-threads <n>] [--snapshot <file>] [--debug] [--vpp] <input> [output]\n"
+                    "       ./virtmach --action <run|jit> --restore <snapshot> [options]\n"
+                    "       ./virtmach --action link [--compact] [--checksum] [--strip] <object>... <output>\n"
+                    "       ./virtmach --action <cache-stats|cache-clean> [--cache-dir <dir>]\n");
     exit(EXIT_FAILURE);
 }
 
@@ -292,7 +340,15 @@ int main(int argc, char **argv)
     int save_vpp = 0;
     int use_vpp = 0;
     int vlib_ignore = 0;
+    int verify_report = 0;
+    int stack_size_auto = 0;
+    int fusion_stats = 0;
+    int trace_stats = 0;
+    int ir_stats = 0;
+    int compact = 0;
+    int checksum = 0;
     const char *vpp_filename = NULL;
+    const char *restore_path = NULL;
     LibPaths lib_paths = {0};
 
     if (argc < 3)
@@ -303,6 +359,13 @@ int main(int argc, char **argv)
     const char *action = NULL;
     const char *input = NULL;
     const char *output = NULL;
+    const char **positional = calloc(argc + 2, sizeof(const char *)); // every file named, for link
+    int positional_size = 0;
+    if (!positional)
+    {
+        fprintf(stderr, "ERROR: argument allocation failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
 
     for (int i = 1; i < argc; i++)
     {
@@ -342,7 +405,15 @@ int main(int argc, char **argv)
                 fprintf(stderr, "ERROR: Missing value for --stack-size.\n");
                 print_usage_and_exit();
             }
-            vm_stack_capacity = parse_non_negative_int(argv[++i]);
+            if (strcmp(argv[++i], "auto") == 0)
+            {
+                stack_size_auto = 1;
+            }
+            else
+            {
+                vm_stack_capacity = parse_non_negative_int(argv[i]);
+                vm_stack_capacity_set = true;
+            }
         }
         else if (strcmp(argv[i], "--program-capacity") == 0)
         {
@@ -362,6 +433,37 @@ int main(int argc, char **argv)
             }
             limit = atoll(argv[++i]);
         }
+        else if (strcmp(argv[i], "--dispatch") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "ERROR: Missing value for --dispatch.\n");
+                print_usage_and_exit();
+            }
+            i++;
+            if (strcmp(argv[i], "switch") == 0)
+            {
+                vm_dispatch_mode = DISPATCH_SWITCH;
+            }
+            else if (strcmp(argv[i], "threaded") == 0)
+            {
+                if (!VM_HAS_COMPUTED_GOTO)
+                {
+                    fprintf(stderr, "ERROR: threaded dispatch needs a compiler with computed goto support.\n");
+                    exit(EXIT_FAILURE);
+                }
+                vm_dispatch_mode = DISPATCH_THREADED;
+            }
+            else if (strcmp(argv[i], "register") == 0)
+            {
+                vm_dispatch_mode = DISPATCH_REGISTER;
+            }
+            else
+            {
+                fprintf(stderr, "ERROR: Unknown dispatch mode '%s'. Expected 'switch', 'threaded' or 'register'.\n", argv[i]);
+                print_usage_and_exit();
+            }
+        }
         else if (strcmp(argv[i], "--static-size") == 0)
         {
             if (i + 1 >= argc)
@@ -379,6 +481,92 @@ int main(int argc, char **argv)
                 vpp_filename = argv[++i];
             }
         }
+        else if (strcmp(argv[i], "--verify") == 0)
+        {
+            verify_report = 1;
+        }
+        else if (strcmp(argv[i], "--fusion-stats") == 0)
+        {
+            fusion_stats = 1;
+        }
+        else if (strcmp(argv[i], "--trace-threshold") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "ERROR: Missing value for --trace-threshold.\n");
+                print_usage_and_exit();
+            }
+            vm_trace_threshold = parse_non_negative_int(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--trace-stats") == 0)
+        {
+            trace_stats = 1;
+        }
+        else if (strcmp(argv[i], "--ir-stats") == 0)
+        {
+            ir_stats = 1;
+        }
+        else if (strcmp(argv[i], "--compact") == 0)
+        {
+            compact = 1;
+        }
+        else if (strcmp(argv[i], "--checksum") == 0)
+        {
+            checksum = 1;
+        }
+        else if (strcmp(argv[i], "--strip") == 0)
+        {
+            vm_emit_debug_info = false;
+        }
+        else if (strcmp(argv[i], "--no-cache") == 0)
+        {
+            vm_cache_enabled = false;
+        }
+        else if (strcmp(argv[i], "--cache-dir") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "ERROR: Missing value for --cache-dir.\n");
+                print_usage_and_exit();
+            }
+            vm_cache_dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--cache-size") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "ERROR: Missing value for --cache-size.\n");
+                print_usage_and_exit();
+            }
+            vm_cache_limit = parse_non_negative_int(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--asm-threads") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "ERROR: Missing value for --asm-threads.\n");
+                print_usage_and_exit();
+            }
+            vm_asm_threads = parse_non_negative_int(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--snapshot") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "ERROR: Missing value for --snapshot.\n");
+                print_usage_and_exit();
+            }
+            snapshot_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--restore") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "ERROR: Missing value for --restore.\n");
+                print_usage_and_exit();
+            }
+            restore_path = argv[++i];
+        }
         else if (strcmp(argv[i], "--debug") == 0)
         {
             debug = 1;
@@ -387,26 +575,83 @@ int main(int argc, char **argv)
         {
             use_vpp = 1;
         }
-        else if (!input)
+        else
         {
-            input = argv[i];
+            positional[positional_size++] = argv[i];
         }
-        else if (!output)
+    }
+
+    if (!action)
+    {
+        fprintf(stderr, "ERROR: Missing --action option.\n");
+        print_usage_and_exit();
+    }
+
+    if (strcmp(action, "link") == 0)
+    {
+        if (positional_size < 2)
+        {
+            fprintf(stderr, "ERROR: Expected at least one object and an output file for the 'link' action.\n");
+            print_usage_and_exit();
+        }
+
+        Vm_Assembler as;
+        vm_assembler_init(&as, NULL, false);
+        Inst *program;
+        uint8_t *data_section;
+        vm_header_ header = vm_link_objects(&as, positional, positional_size - 1, &program, &data_section);
+        record_stack_size(program, &header);
+        if (compact)
+        {
+            header.vm_executable_identifier = VM_EXECUTABLE_IDENTIFIER_COMPACT;
+        }
+        header.checksummed = checksum;
+        vm_save_program_to_file(&as, program, data_section, header, positional[positional_size - 1]);
+        vm_assembler_free(&as);
+
+        free((void *)program);
+        free((void *)data_section);
+        free((void *)positional);
+        return EXIT_SUCCESS;
+    }
+
+    if (strcmp(action, "cache-stats") == 0 || strcmp(action, "cache-clean") == 0)
+    {
+        free((void *)positional);
+#if VM_HAS_BUILD_CACHE
+        if (strcmp(action, "cache-stats") == 0)
         {
-            output = argv[i];
+            vm_cache_print_stats(stdout);
         }
         else
         {
-            fprintf(stderr, "ERROR: Too many arguments.\n");
-            print_usage_and_exit();
+            vm_cache_clean(stdout);
         }
+        return EXIT_SUCCESS;
+#else
+        fprintf(stderr, "ERROR: the build cache needs a POSIX system.\n");
+        return EXIT_FAILURE;
+#endif
     }
 
-    if (!action)
+    if (positional_size > 2)
     {
-        fprintf(stderr, "ERROR: Missing --action option.\n");
+        fprintf(stderr, "ERROR: Too many arguments.\n");
         print_usage_and_exit();
     }
+    input = positional[0];
+    output = positional[1];
+    if (restore_path)
+    {
+        if ((strcmp(action, "run") != 0 && strcmp(action, "jit") != 0) || positional_size > 0)
+        {
+            fprintf(stderr, "ERROR: --restore takes the place of the input of a 'run' or 'jit' action.\n");
+            print_usage_and_exit();
+        }
+        vm_restoring = true;
+        input = restore_path;
+    }
+    free((void *)positional); // the names themselves are argv's
 
     // Handle VLIB environment variable if not ignored
     if (!vlib_ignore)
@@ -461,13 +706,18 @@ int main(int argc, char **argv)
         vpp_filename = default_vpp_file;
     }
 
-    if (strcmp(action, "asm") == 0 || strcmp(action, "pp") == 0)
+    if (strcmp(action, "asm") == 0 || strcmp(action, "obj") == 0 || strcmp(action, "pp") == 0)
     {
         if (!input)
         {
             fprintf(stderr, "ERROR: Expected input file for the '%s' action.\n", action);
             print_usage_and_exit();
         }
+        if (!output && strcmp(action, "pp") != 0)
+        {
+            fprintf(stderr, "ERROR: Expected output file for the '%s' action.\n", action);
+            print_usage_and_exit();
+        }
 
         // Preprocess the input file
         char pre_process[MAX_COMMAND_LENGTH];
@@ -488,9 +738,9 @@ int main(int argc, char **argv)
         else
         {
 #ifdef _WIN32
-            snprintf(pre_process, sizeof(pre_process), "cl /EP %s > %s", input, vpp_filename);
+            snprintf(pre_process, sizeof(pre_process), "cl /E %s > %s", input, vpp_filename); // with #line markers for the line table
 #else
-            snprintf(pre_process, sizeof(pre_process), "cpp -P %s %s", input, vpp_filename);
+            snprintf(pre_process, sizeof(pre_process), "cpp %s %s", input, vpp_filename); // with line markers for the line table
 #endif
         }
 
@@ -507,27 +757,59 @@ int main(int argc, char **argv)
         }
 
         // Continue with assembly if action is "asm"
-        String_View source = slurp_file(vpp_filename);
-
         assert(vm_program_capacity <= UINT64_MAX);
         assert(vm_memory_capacity <= UINT64_MAX);
         assert(vm_stack_capacity <= UINT64_MAX);
         assert(vm_default_memory_size < vm_memory_capacity);
 
-        label_init();
+        Vm_Assembler as;
+        vm_assembler_init(&as, vpp_filename, strcmp(action, "obj") == 0);
 
-#ifdef _WIN32
-        Inst program[VM_PROGRAM_CAPACITY * sizeof(Inst)];
-        uint8_t data_section[VM_DEFAULT_MEMORY_SIZE];
+#if VM_HAS_BUILD_CACHE
+        // an unchanged program assembled with the same flags before is copied out of the cache
+        char cache_key[VM_CACHE_KEY_LENGTH + 1];
+        if (vm_cache_enabled)
+        {
+            vm_cache_key(&as, vpp_filename, compact, checksum, cache_key);
+        }
+        bool cached = vm_cache_enabled && vm_cache_fetch(cache_key, output);
 #else
-        Inst program[vm_program_capacity * sizeof(Inst)];
-        uint8_t data_section[vm_default_memory_size];
+        bool cached = false;
 #endif
 
-        vm_header_ header = vm_translate_source(source, program, data_section);
-        label_free();
-        free((void *)source.data);
-        vm_save_program_to_file(program, data_section, header, output);
+        if (!cached)
+        {
+            Inst *program;
+            uint8_t *data_section;
+            vm_header_ header = vm_translate_file(&as, vpp_filename, &program, &data_section);
+            if (compact)
+            {
+                header.vm_executable_identifier = VM_EXECUTABLE_IDENTIFIER_COMPACT;
+            }
+            header.checksummed = checksum;
+
+            if (as.object)
+            {
+                vm_save_object_to_file(&as, program, data_section, header, output);
+                label_free(&as);
+            }
+            else
+            {
+                label_free(&as);
+                record_stack_size(program, &header);
+                vm_save_program_to_file(&as, program, data_section, header, output);
+            }
+            free((void *)program);
+            free((void *)data_section);
+
+#if VM_HAS_BUILD_CACHE
+            if (vm_cache_enabled && as.compilation_successful)
+            {
+                vm_cache_store(cache_key, output);
+            }
+#endif
+        }
+        vm_assembler_free(&as);
 
         if (!save_vpp)
         {
@@ -542,33 +824,73 @@ int main(int argc, char **argv)
 
         return EXIT_SUCCESS;
     }
-    else if (strcmp(action, "run") == 0)
+    else if (strcmp(action, "run") == 0 || strcmp(action, "jit") == 0)
     {
         if (!input)
         {
-            fprintf(stderr, "ERROR: Expected a .vm file for the 'run' action.\n");
+            fprintf(stderr, "ERROR: Expected a .vm file for the '%s' action.\n", action);
             print_usage_and_exit();
         }
 
         VirtualMachine vm;
         vm_init(&vm, input);
-        vm_native_push(&vm, vm_alloc);
-        vm_native_push(&vm, vm_free);
-        vm_native_push(&vm, vm_print_f64);
-        vm_native_push(&vm, vm_print_s64);
-        vm_native_push(&vm, vm_print_u64);
-        vm_native_push(&vm, vm_dump_static);
-        vm_native_push(&vm, vm_print_string);
-        vm_native_push(&vm, vm_read);
-        vm_native_push(&vm, vm_write);
-        vm_exec_program(&vm, limit, debug);
+        push_natives(&vm);
+
+        Verify_Report report;
+        vm_verify_program(&vm, &report);
+        if (stack_size_auto && vm.stack_size > 0)
+        {
+            fprintf(stderr, "WARNING: --stack-size auto: the restored machine has %zu entries on its stack; keeping the stack it was snapshotted with\n", vm.stack_size);
+        }
+        else if (stack_size_auto)
+        {
+            if (report.bounded)
+            {
+                // the proof gives the exact depth the program can reach, so the stack is sized to it
+                vm_resize_stack(&vm, report.max_stack_depth > 0 ? report.max_stack_depth : 1);
+                vm_verify_program(&vm, &report);
+            }
+            else
+            {
+                fprintf(stderr, "WARNING: --stack-size auto: %s at instruction %zu; keeping the default stack size of %zu\n", report.reason, report.failed_at, vm_stack_capacity);
+            }
+        }
+        if (verify_report)
+        {
+            vm_print_verify_report(stdout, &vm, &report);
+        }
+
+        if (strcmp(action, "jit") == 0 && !debug && limit < 0)
+        {
+            vm_exec_jit(&vm);
+        }
+        else
+        {
+            if (strcmp(action, "jit") == 0)
+            {
+                fprintf(stderr, "WARNING: --debug and --limit need the interpreter; running '%s' interpreted\n", input);
+            }
+            vm_exec_program(&vm, limit, debug);
+        }
+        if (fusion_stats)
+        {
+            vm_print_fusion_stats(stdout, &vm);
+        }
+        if (trace_stats)
+        {
+            vm_print_trace_stats(stdout, &vm);
+        }
+        if (ir_stats)
+        {
+            vm_print_reg_stats(stdout, &vm);
+        }
         vm_internal_free(&vm);
 
         return EXIT_SUCCESS;
     }
     else
     {
-        fprintf(stderr, "ERROR: Unknown action '%s'. Expected 'asm', 'run', or 'pp'.\n", action);
+        fprintf(stderr, "ERROR: Unknown action '%s'. Expected 'asm', 'run', 'jit', or 'pp'.\n", action);
         print_usage_and_exit();
     }
 
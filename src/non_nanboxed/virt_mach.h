@@ -1,5 +1,10 @@
 #ifndef _VM
 #define _VM
+// mmap()'s MAP_ANONYMOUS is an extension to POSIX that -std=c11 hides; this only takes effect ahead of the first system
+// header, so files that include one before this header define it themselves
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
 #define _SV_IMPLEMENTATION
 #define _NAN_IMPLEMENTATION
 
@@ -7,8 +12,10 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdbool.h>
+#include <time.h>
 
 // long is 32 bit on Windows and 64 bit on Linux; long long is 64 bit on both; so we use that to make it cross platform
 
@@ -17,14 +24,95 @@
 #define TYPE_DOUBLE 2
 
 #define EPSILON 1e-9
+
+// labels as values (computed goto) are a GNU extension; every other compiler gets the switch based interpreter only
+#if defined(__GNUC__) || defined(__clang__)
+#define VM_HAS_COMPUTED_GOTO 1
+#else
+#define VM_HAS_COMPUTED_GOTO 0
+#endif
+
+// vm_init() maps .vm executables instead of reading them where there is mmap(); everywhere else it reads them in
+#if defined(__unix__) || defined(__APPLE__)
+#define VM_HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#ifndef MAP_ANONYMOUS
+#error "MAP_ANONYMOUS is hidden: define _DEFAULT_SOURCE before the first system header"
+#endif
+#else
+#define VM_HAS_MMAP 0
+#endif
+
+// the asm build cache keeps its entries in a directory, which takes POSIX's directory functions; elsewhere it's off
+#if VM_HAS_MMAP
+#define VM_HAS_BUILD_CACHE 1
+#include <dirent.h>
+#include <utime.h>
+#else
+#define VM_HAS_BUILD_CACHE 0
+#endif
+
+// vm_translate_source() spreads big sources over POSIX threads; everywhere else it assembles on the calling thread
+#if VM_HAS_MMAP
+#define VM_HAS_THREADS 1
+#include <pthread.h>
+#else
+#define VM_HAS_THREADS 0
+#endif
+
+// the template JIT emits x86-64 System V code into pages it gets from mmap(); everywhere else --action jit interprets
+#if defined(__x86_64__) && defined(__linux__)
+#define VM_HAS_JIT 1
+#else
+#define VM_HAS_JIT 0
+#endif
 #define VM_STACK_CAPACITY 1024
 #define VM_MEMORY_CAPACITY 640 * 1024
 #define VM_DEFAULT_MEMORY_SIZE 1024
-#define VM_PROGRAM_CAPACITY 1024
-#define VM_LABEL_CAPACITY 128
+#define VM_PROGRAM_CAPACITY 1024 // instructions the assembler's code buffer starts out with; it grows from there
+#define VM_ASM_CHUNK_MIN (256 * 1024) // bytes of source below which another assembler thread isn't worth starting
+#define VM_LINE_READER_SIZE (1024 * 1024) // bytes of source vm_translate_file() reads at a time
+#define VM_LABEL_CAPACITY 128 // label references the assembler's fixup list starts out with; it grows from there
 #define VM_EQU_CAPACITY 128
 #define VM_NATIVE_CAPACITY 128
-#define VM_EXECUTABLE_IDENTIFIER ((int16_t)(42069))
+#define VM_TRACE_THRESHOLD 1000
+#define VM_TRACE_MAX_LENGTH 512
+#define VM_DEPTH_UNREACHED INT64_MIN // frame_depths entry of an instruction the proof never reached
+#define VM_DEPTH_AMBIGUOUS INT64_MAX // frame_depths entry of an instruction two functions reach at different depths
+#define VM_EXECUTABLE_IDENTIFIER ((int16_t)(42069))         // fixed size code section; also the magic of pre-container files
+#define VM_EXECUTABLE_IDENTIFIER_COMPACT ((int16_t)(42070)) // code section in the compact encoding
+#define VM_FORMAT_MAGIC "VASMEXE"                           // with its terminating zero, the first eight bytes of a .vm file
+#define VM_FORMAT_VERSION 1
+#define VM_ASSEMBLER_VERSION 1 // bump whenever the same source and flags would assemble to different bytes
+#define VM_FORMAT_HEADER_SIZE 64
+#define VM_FORMAT_SECTION_SIZE 40
+#define VM_FORMAT_HAS_START 0x1
+#define VM_FORMAT_CHECKSUMS 0x2
+#define VM_FORMAT_OBJECT 0x4 // a relocatable object from --action obj, to be linked rather than run
+#define VM_FORMAT_SNAPSHOT 0x8 // a machine paused by vm_save_snapshot_to_file(), to be resumed with --restore
+#define VM_SECTION_ALIGNMENT 4096 // sections of fixed size images start on pages
+#define VM_SECTION_CODE 1
+#define VM_SECTION_DATA 2
+#define VM_SECTION_SYMBOLS 3     // objects: the labels they define
+#define VM_SECTION_RELOCATIONS 4 // objects: the operands the linker has to patch
+#define VM_SECTION_LINES 5       // debug info: the source line every instruction came from
+#define VM_SECTION_STATE 6       // snapshots: the static break, the static memory layout and the stack
+#define VM_STATE_HEADER_SIZE 24  // bytes of the state section before the stack entries
+#define VM_CODE_FIXED 0
+#define VM_CODE_COMPACT 1
+#define VM_RELOC_CODE 0   // the operand is an address in the object's own code; the linker adds where that code lands
+#define VM_RELOC_DATA 1   // the operand is an offset into the object's own data
+#define VM_RELOC_IMPORT 2 // the operand is the address of a label some other object defines
+#define VM_CACHE_LIMIT (64 * 1024 * 1024) // bytes of images the build cache keeps before it evicts
+#define VM_CACHE_KEY_LENGTH 32              // hex digits of a build cache key
+#define VM_CACHE_PATH_LENGTH 1024
+#define VM_COMPACT_INST_MAX 11 // longest compact instruction: the opcode byte and a ten byte varint
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
 #define MAKE_INST_PUSH(value) {.type = INST_PUSH, .operand = (value)}
 #define MAKE_INST_DUP(rel_addr) {.type = INST_DUP, .operand = (rel_addr)}
@@ -50,6 +138,9 @@
         vm->stack[vm->stack_size - 2]._as_##out = vm->stack[vm->stack_size - 2]._as_##in op vm->stack[vm->stack_size - 1]._as_##in; \
     } while (false)
 
+// signed division that wraps INT64_MIN / -1 to INT64_MIN like the other signed operations do; the divisor is nonzero
+#define VM_SDIV(a, b) ((b) == -1 ? (int64_t)(0 - (uint64_t)(a)) : (a) / (b))
+
 #define CONV_OP(in, out)                                                                  \
     do                                                                                    \
     {                                                                                     \
@@ -64,24 +155,58 @@
  */
 
 size_t vm_stack_capacity = VM_STACK_CAPACITY;
-size_t vm_program_capacity = VM_PROGRAM_CAPACITY;
+bool vm_stack_capacity_set = false; // --stack-size gave vm_stack_capacity; vm_init() doesn't size the stack from the header
+size_t vm_program_capacity = SIZE_MAX; // largest program assembled or loaded; only limited by --program-capacity
 size_t vm_memory_capacity = VM_MEMORY_CAPACITY;
 size_t natives_capacity = VM_NATIVE_CAPACITY;
-size_t line_no = 0;
 size_t label_capacity = VM_LABEL_CAPACITY;
 size_t vm_default_memory_size = VM_DEFAULT_MEMORY_SIZE;
-bool compilation_successful = true;
 
-#define MAX_HASHTABLE_SIZE 256
+typedef enum
+{
+    DISPATCH_SWITCH = 0, // vm_execute_at_inst_pointer() per instruction; portable and the reference for every other mode
+    DISPATCH_THREADED,   // computed goto, one label per Inst_Type
+    DISPATCH_REGISTER,   // register form of a verified program, see vm_reg_translate(); others run threaded
+} Dispatch_Mode;
+
+Dispatch_Mode vm_dispatch_mode = VM_HAS_COMPUTED_GOTO ? DISPATCH_THREADED : DISPATCH_SWITCH;
+bool vm_emit_debug_info = true;    // write the line table and the symbol table; --strip leaves them out of executables
+bool vm_restoring = false;         // --restore: vm_init() is given a snapshot to resume instead of an executable to start
+bool vm_fusion_enabled = true; // let vm_decode_program() fuse common instruction pairs into superinstructions
+size_t vm_trace_threshold = VM_TRACE_THRESHOLD; // back edges into a loop header before its loop is traced; 0 turns tracing off
+bool vm_cache_enabled = VM_HAS_BUILD_CACHE; // --no-cache turns it off
+const char *vm_cache_dir = NULL;            // --cache-dir; NULL is $VCACHE, then $XDG_CACHE_HOME/virtmach, then ~/.cache/virtmach
+size_t vm_cache_limit = VM_CACHE_LIMIT;     // --cache-size
+size_t vm_asm_threads = 1;                  // --asm-threads: threads vm_translate_source() may split a source over
+
+// a bump allocator over a list of blocks; what the assembler allocates from one lives until the whole arena is freed
+#define VM_ARENA_BLOCK_SIZE (64 * 1024)
+
+typedef struct Vm_Arena_Block
+{
+    struct Vm_Arena_Block *next;
+    size_t size;
+    size_t capacity;
+    max_align_t data[];
+} Vm_Arena_Block;
+
+typedef struct
+{
+    Vm_Arena_Block *head; // the block being allocated from, the full ones behind it
+} Vm_Arena;
 
-typedef struct Hashnode
+typedef struct
 {
     String_View label;
     size_t value;
-    struct Hashnode *next;
+    uint32_t section; // VM_SECTION_CODE or VM_SECTION_DATA, the section value is an address in
 } Hashnode;
 
-Hashnode *bucket[MAX_HASHTABLE_SIZE];
+typedef struct
+{
+    uint32_t hash; // hash_sv() of the label, so probing only compares names whose hashes match
+    uint32_t node; // index + 1 into label_nodes; 0 for an empty slot
+} Label_Slot;
 
 typedef union
 {
@@ -98,9 +223,93 @@ typedef struct
     size_t label_line_no;
 } label_inst_location;
 
-size_t not_resolved_yet_counter = 0;
+typedef struct
+{
+    String_View name;
+    size_t parent;      // index + 1 of the file whose %include brought this one in; 0 for the file assembled
+    size_t parent_line; // line of that %include
+} Vm_Source_File;
+
+typedef struct
+{
+    uint32_t file; // index of its Vm_Source_File
+    uint32_t line; // 0 where it isn't known
+} Vm_Source_Line;
+
+typedef struct
+{
+    String_View name;
+    uint64_t value;   // instruction or data address
+    uint32_t section; // VM_SECTION_CODE or VM_SECTION_DATA
+} Vm_Debug_Symbol;
 
-label_inst_location *not_resolved_yet;
+typedef struct // the VM_SECTION_LINES and VM_SECTION_SYMBOLS sections of an executable, read by vm_debug_read()
+{
+    Vm_Source_File *files;
+    size_t files_size;
+    Vm_Source_Line *lines;     // one per instruction
+    size_t lines_size;
+    Vm_Debug_Symbol *symbols;  // every label
+    size_t symbols_size;
+    uint8_t *mapping;          // the sections, which the names point into
+    size_t mapping_size;
+    size_t mapping_lead;       // bytes mapped in front of them to start on a page
+} Vm_Debug_Info;
+
+typedef struct // a file vm_translate_source() is reading lines of, as the line markers in its source say
+{
+    String_View name;
+    size_t line;        // line number of the next line read from it
+    size_t parent_line; // line of the %include that entered it
+    size_t file;        // index + 1 into the assembler's source_files once an instruction came from it; 0 before
+    size_t id;          // the frames made before it, counted over the whole source, so chunks can tell them apart
+} Vm_Source_Frame;
+
+// everything one assembly or one link works on, so that any number of them can run at once, on as many threads;
+// vm_assembler_init() sets one up and vm_assembler_free() releases it
+typedef struct
+{
+    const char *source_name; // what to call the source in the line table where no line marker names it
+    bool object;             // --action obj: labels a module doesn't define are left for the linker
+    FILE *errors; // where the diagnostics go; stderr but for the chunks of a parallel assembly
+    size_t line_no;
+    bool compilation_successful;
+
+    // the labels, the fixups and the table over them all come from arena, which label_free() releases at once
+    Vm_Arena arena;
+    Hashnode *label_nodes; // in the order they were defined
+    size_t label_nodes_size;
+    size_t label_nodes_capacity;
+    Label_Slot *label_slots; // open addressing with linear probing; a power of two, never more than half full
+    size_t label_slots_capacity;
+    bool interning;           // names are copied into arena, each once, as vm_translate_file() doesn't keep its source
+    String_View *interned;    // the copies, probed like label_slots
+    size_t interned_size;
+    size_t interned_capacity;
+    label_inst_location *not_resolved_yet;
+    size_t not_resolved_yet_counter;
+    size_t not_resolved_yet_capacity;
+
+    Vm_Source_Frame *source_frames; // the file being read and the files that %included it, outermost first
+    size_t source_frames_size;
+    size_t source_frames_capacity;
+    size_t source_frames_made;
+    Vm_Source_File *source_files;   // files instructions came from
+    size_t *source_file_frames;     // the id of the frame each came from, to merge the files of a parallel assembly
+    size_t source_files_size;
+    size_t source_files_capacity;
+    Vm_Source_Line *source_lines;   // where each instruction came from
+    size_t source_lines_capacity;
+
+    uint8_t *debug_lines;     // the line table and symbol table vm_translate_source() or vm_link_objects() encoded,
+    size_t debug_lines_size;  // for the save functions to write
+    uint8_t *debug_symbols;
+    size_t debug_symbols_size;
+    size_t debug_symbols_count;
+
+    void *source_mapping; // the source vm_translate_file() mapped to split over threads, unmapped by vm_assembler_free()
+    size_t source_mapping_size;
+} Vm_Assembler;
 
 typedef enum
 {
@@ -117,77 +326,88 @@ typedef enum
     TRAP_ILLEGAL_OPERATION, // doing arithmetic on floating points and ints together
 } Trap;                     // exceptions that stop the execution on the virtual machine
 
+#define VM_NO_OPERAND 0xFF // operand type of an instruction that takes none
+#define VM_MNEMONIC_TABLE_BITS 8 // the mnemonic hash table has 2^8 slots, room to spare for the instruction set
+#define VM_MNEMONIC_MULTIPLIER 0xBA96F82F829563C3ULL // the first one vm_mnemonic_table_build()'s search finds for this opcode list
+
+// the instruction set, the one list the opcodes, the mnemonics the assemblers, vtx and devasm use and the operand
+// types are all generated from: X(type, opcode, mnemonic, operand type or VM_NO_OPERAND); opcodes are what .vm files
+// store, so an instruction keeps its number for good and new ones go at the end
+#define VM_INSTRUCTIONS(X) \
+    X(INST_NOP, 1, "nop", VM_NO_OPERAND)                /* does nothing but increment the instruction pointer; if the program array is just zero, it will all be no-ops; */ \
+    X(INST_SPUSH, 2, "spush", TYPE_SIGNED_64INT)        /* push a word to the stack top; we assume that our stack grows downwards */ \
+    X(INST_FPUSH, 3, "fpush", TYPE_DOUBLE)                                                                              \
+    X(INST_UPUSH, 4, "upush", TYPE_UNSIGNED_64INT)                                                                      \
+    X(INST_RDUP, 5, "rdup", TYPE_UNSIGNED_64INT)        /* duplicates the element at the position stack_top - addr at the top of the stack; stack_top = stack_size - 1 */ \
+    X(INST_ADUP, 6, "adup", TYPE_UNSIGNED_64INT)                                                                        \
+    X(INST_SPLUS, 7, "splus", VM_NO_OPERAND)            /* add the last element on stack onto the second last element, and remove the last element from the stack */ \
+    X(INST_UPLUS, 8, "uplus", VM_NO_OPERAND)                                                                            \
+    X(INST_FPLUS, 9, "fplus", VM_NO_OPERAND)                                                                            \
+    X(INST_SMINUS, 10, "sminus", VM_NO_OPERAND)         /* subtract the last element on the stack from the second last element, and remove the last element from the stack */ \
+    X(INST_UMINUS, 11, "uminus", VM_NO_OPERAND)                                                                         \
+    X(INST_FMINUS, 12, "fminus", VM_NO_OPERAND)                                                                         \
+    X(INST_SMULT, 13, "smult", VM_NO_OPERAND)           /* multiply the last element on the stack to the second last element, and remove the last element from the stack */ \
+    X(INST_UMULT, 14, "umult", VM_NO_OPERAND)                                                                           \
+    X(INST_FMULT, 15, "fmult", VM_NO_OPERAND)                                                                           \
+    X(INST_SDIV, 16, "sdiv", VM_NO_OPERAND)             /* integer divide the second last element on the stack by the last element and store the result in the second last element, and then remove the last element from the stack */ \
+    X(INST_UDIV, 17, "udiv", VM_NO_OPERAND)                                                                             \
+    X(INST_FDIV, 18, "fdiv", VM_NO_OPERAND)                                                                             \
+    X(INST_JMP, 19, "jmp", TYPE_UNSIGNED_64INT)         /* unconditional jump */                                        \
+    X(INST_HALT, 20, "halt", VM_NO_OPERAND)             /* halt the machine */                                          \
+    X(INST_UJMP_IF, 21, "ujmp_if", TYPE_UNSIGNED_64INT) /* jump to an address if the last element on the stack is non-zero; do not jump otherwise */ \
+    X(INST_FJMP_IF, 22, "fjmp_if", TYPE_UNSIGNED_64INT)                                                                 \
+    X(INST_EQ, 23, "eq", VM_NO_OPERAND)                 /* checks if the second last stack element is equal to the last stack element; sets the second last element to one if true, and 0 otherwise; removes the last element from the stack */ \
+    X(INST_LSR, 24, "lsr", TYPE_UNSIGNED_64INT)         /* logical shift right; for unsigned */                         \
+    X(INST_ASR, 25, "asr", TYPE_UNSIGNED_64INT)         /* arithmetic shift right;  for signed */                       \
+    X(INST_SL, 26, "sl", TYPE_UNSIGNED_64INT)           /* shift left; for both signed and unsigned */                  \
+    X(INST_ANDB, 27, "and", VM_NO_OPERAND)                                                                              \
+    X(INST_ORB, 28, "or", VM_NO_OPERAND)                                                                                \
+    X(INST_NOTB, 29, "not", VM_NO_OPERAND)                                                                              \
+    X(INST_EMPTY, 30, "empty", VM_NO_OPERAND)                                                                           \
+    X(INST_POP_AT, 31, "pop_at", TYPE_UNSIGNED_64INT)                                                                   \
+    X(INST_POP, 32, "pop", VM_NO_OPERAND)                                                                               \
+    X(INST_RSWAP, 33, "rswap", TYPE_UNSIGNED_64INT)                                                                     \
+    X(INST_ASWAP, 34, "aswap", TYPE_UNSIGNED_64INT)                                                                     \
+    X(INST_RET, 35, "ret", VM_NO_OPERAND)               /* jumps to the VM instruction address on the top of the stack and removes that address from the stack top */ \
+    X(INST_CALL, 36, "call", TYPE_UNSIGNED_64INT)       /* pushes the address of the next VM instruction on the VM stack and jumps to the specified instruction */ \
+    X(INST_NATIVE, 37, "native", TYPE_UNSIGNED_64INT)                                                                   \
+    X(INST_STORE8, 38, "store8", VM_NO_OPERAND)         /* write the raw bytes on the stack onto the memory locations */ \
+    X(INST_STORE16, 39, "store16", VM_NO_OPERAND)                                                                       \
+    X(INST_STORE32, 40, "store32", VM_NO_OPERAND)                                                                       \
+    X(INST_STORE64, 41, "store64", VM_NO_OPERAND)                                                                       \
+    X(INST_ZELOAD8, 42, "zeload8", VM_NO_OPERAND)       /* zero extend the memory value into the 64-bit stack */        \
+    X(INST_ZELOAD16, 43, "zeload16", VM_NO_OPERAND)                                                                     \
+    X(INST_ZELOAD32, 44, "zeload32", VM_NO_OPERAND)                                                                     \
+    X(INST_LOAD64, 45, "load64", VM_NO_OPERAND)                                                                         \
+    X(INST_SELOAD8, 46, "seload8", VM_NO_OPERAND)       /* sign extend the memory value into the 64-bit stack */        \
+    X(INST_SELOAD16, 47, "seload16", VM_NO_OPERAND)                                                                     \
+    X(INST_SELOAD32, 48, "seload32", VM_NO_OPERAND)                                                                     \
+    X(INST_EQU, 49, "equ", VM_NO_OPERAND)                                                                               \
+    X(INST_EQS, 50, "eqs", VM_NO_OPERAND)                                                                               \
+    X(INST_EQF, 51, "eqf", VM_NO_OPERAND)                                                                               \
+    X(INST_GEU, 52, "geu", VM_NO_OPERAND)                                                                               \
+    X(INST_GES, 53, "ges", VM_NO_OPERAND)                                                                               \
+    X(INST_GEF, 54, "gef", VM_NO_OPERAND)                                                                               \
+    X(INST_LEU, 55, "leu", VM_NO_OPERAND)                                                                               \
+    X(INST_LES, 56, "les", VM_NO_OPERAND)                                                                               \
+    X(INST_LEF, 57, "lef", VM_NO_OPERAND)                                                                               \
+    X(INST_GU, 58, "gu", VM_NO_OPERAND)                                                                                 \
+    X(INST_GS, 59, "gs", VM_NO_OPERAND)                                                                                 \
+    X(INST_GF, 60, "gf", VM_NO_OPERAND)                                                                                 \
+    X(INST_LU, 61, "lu", VM_NO_OPERAND)                                                                                 \
+    X(INST_LS, 62, "ls", VM_NO_OPERAND)                                                                                 \
+    X(INST_LF, 63, "lf", VM_NO_OPERAND)                                                                                 \
+    X(INST_FTU, 64, "ftu", VM_NO_OPERAND)                                                                               \
+    X(INST_FTS, 65, "fts", VM_NO_OPERAND)                                                                               \
+    X(INST_STF, 66, "stf", VM_NO_OPERAND)                                                                               \
+    X(INST_UTF, 67, "utf", VM_NO_OPERAND)                                                                               \
+    X(INST_STU, 68, "stu", VM_NO_OPERAND)                                                                               \
+    X(INST_UTS, 69, "uts", VM_NO_OPERAND)
+
+#define VM_INST_ENUM(type, opcode, mnemonic, operand) type = opcode,
 typedef enum
 {
-    INST_NOP = 1, // does nothing but increment the instruction pointer; if the program array is just zero, it will all be no-ops;
-    INST_SPUSH,   // push a word to the stack top; we assume that our stack grows downwards
-    INST_FPUSH,
-    INST_UPUSH,
-    INST_RDUP, // duplicates the element at the position stack_top - addr at the top of the stack; stack_top = stack_size - 1
-    INST_ADUP,
-    INST_SPLUS, // add the last element on stack onto the second last element, and remove the last element from the stack
-    INST_UPLUS,
-    INST_FPLUS,
-    INST_SMINUS, // subtract the last element on the stack from the second last element, and remove the last element from the stack
-    INST_UMINUS,
-    INST_FMINUS,
-    INST_SMULT, // multiply the last element on the stack to the second last element, and remove the last element from the stack
-    INST_UMULT,
-    INST_FMULT,
-    INST_SDIV, // integer divide the second last element on the stack by the last element and store the result in the second last element, and then remove the last element from the stack
-    INST_UDIV,
-    INST_FDIV,
-    INST_JMP,     // unconditional jump
-    INST_HALT,    // halt the machine
-    INST_UJMP_IF, // jump to an address if the last element on the stack is non-zero; do not jump otherwise
-    INST_FJMP_IF,
-    INST_EQ,  // checks if the second last stack element is equal to the last stack element; sets the second last element to one if true, and 0 otherwise; removes the last element from the stack
-    INST_LSR, // logical shift right; for unsigned
-    INST_ASR, // arithmetic shift right;  for signed
-    INST_SL,  // shift left; for both signed and unsigned
-    INST_ANDB,
-    INST_ORB,
-    INST_NOTB,
-    INST_EMPTY,
-    INST_POP_AT,
-    INST_POP,
-    INST_RSWAP,
-    INST_ASWAP,
-    INST_RET,  // jumps to the VM instruction address on the top of the stack and removes that address from the stack top
-    INST_CALL, // pushes the address of the next VM instruction on the VM stack and jumps to the specified instruction
-    INST_NATIVE,
-    INST_STORE8, // write the raw bytes on the stack onto the memory locations
-    INST_STORE16,
-    INST_STORE32,
-    INST_STORE64,
-    INST_ZELOAD8, // zero extend the memory value into the 64-bit stack
-    INST_ZELOAD16,
-    INST_ZELOAD32,
-    INST_LOAD64,
-    INST_SELOAD8, // sign extend the memory value into the 64-bit stack
-    INST_SELOAD16,
-    INST_SELOAD32,
-    INST_EQU,
-    INST_EQS,
-    INST_EQF,
-    INST_GEU,
-    INST_GES,
-    INST_GEF,
-    INST_LEU,
-    INST_LES,
-    INST_LEF,
-    INST_GU,
-    INST_GS,
-    INST_GF,
-    INST_LU,
-    INST_LS,
-    INST_LF,
-    INST_FTU,
-    INST_FTS,
-    INST_STF,
-    INST_UTF,
-    INST_STU,
-    INST_UTS,
+    VM_INSTRUCTIONS(VM_INST_ENUM)
     INST_COUNT,
 } Inst_Type; // enum for the instruction types
 
@@ -197,58 +417,333 @@ typedef struct
     Value operand;  // operand of the instruction
 } Inst;             // structure for the actual instruction
 
+// internal handler ids of the threaded interpreter; the first INST_COUNT of them are the Inst_Type values themselves
+typedef enum
+{
+    HANDLER_ILLEGAL_JMP = INST_COUNT, // jmp/ujmp_if/fjmp_if whose target failed the decode time check
+    HANDLER_ILLEGAL_CALL,             // call whose target failed the decode time check
+    HANDLER_JMP_BACK,                 // jmp to an earlier instruction, counted for the tracing JIT
+    HANDLER_UJMP_IF_BACK,             // ujmp_if to an earlier instruction, counted for the tracing JIT
+
+    // superinstructions vm_decode_program() fuses a pair of adjacent instructions into; the handler sits on the first
+    // instruction of the pair and continues after the second, while the second keeps its own handler for anything
+    // that jumps straight to it
+    HANDLER_FUSED_FIRST,
+    HANDLER_PUSH_UPLUS = HANDLER_FUSED_FIRST, // upush/spush N; uplus
+    HANDLER_PUSH_SPLUS,                       // upush/spush N; splus
+    HANDLER_PUSH_UMINUS,                      // upush/spush N; uminus
+    HANDLER_PUSH_SMINUS,                      // upush/spush N; sminus
+    HANDLER_PUSH_LOAD64,                      // upush addr; load64
+    HANDLER_PUSH_STORE64,                     // upush addr; store64
+    HANDLER_RDUP_LOAD64,                      // rdup K; load64
+    HANDLER_EQU_UJMP_IF,                      // <cmp>; ujmp_if L, for each comparison
+    HANDLER_EQS_UJMP_IF,
+    HANDLER_EQF_UJMP_IF,
+    HANDLER_GEU_UJMP_IF,
+    HANDLER_GES_UJMP_IF,
+    HANDLER_GEF_UJMP_IF,
+    HANDLER_LEU_UJMP_IF,
+    HANDLER_LES_UJMP_IF,
+    HANDLER_LEF_UJMP_IF,
+    HANDLER_GU_UJMP_IF,
+    HANDLER_GS_UJMP_IF,
+    HANDLER_GF_UJMP_IF,
+    HANDLER_LU_UJMP_IF,
+    HANDLER_LS_UJMP_IF,
+    HANDLER_LF_UJMP_IF,
+    HANDLER_COUNT,
+} Handler_Id;
+
+typedef struct Decoded_Inst
+{
+    const void *handler; // label address inside vm_exec_threaded()
+    union
+    {
+        Value value;                       // immediate operand, already in the type the handler consumes
+        const struct Decoded_Inst *target; // jmp/ujmp_if/fjmp_if/call destination, checked against program_size once
+    } operand;
+} Decoded_Inst; // load time form of Inst that the threaded interpreter runs on
+
+// operations of the register IR that vm_reg_translate() builds from a verified program; stack slots whose depth the
+// proof fixed become registers addressed relative to the frame of the function they are in
+// two operand operations: name, result field, expression over the operand Values a and b, whether a and b commute
+#define REG_BINARY_OPS(X)                            \
+    X(SPLUS, u64, a._as_u64 + b._as_u64, true)       \
+    X(UPLUS, u64, a._as_u64 + b._as_u64, true)       \
+    X(FPLUS, f64, a._as_f64 + b._as_f64, true)       \
+    X(SMINUS, u64, a._as_u64 - b._as_u64, false)     \
+    X(UMINUS, u64, a._as_u64 - b._as_u64, false)     \
+    X(FMINUS, f64, a._as_f64 - b._as_f64, false)     \
+    X(SMULT, u64, a._as_u64 * b._as_u64, true)       \
+    X(UMULT, u64, a._as_u64 * b._as_u64, true)       \
+    X(FMULT, f64, a._as_f64 * b._as_f64, true)       \
+    X(ANDB, u64, a._as_u64 & b._as_u64, true)        \
+    X(ORB, u64, a._as_u64 | b._as_u64, true)
+
+// comparisons, same columns; each also has a form fused with the ujmp_if after it
+#define REG_COMPARE_OPS(X)                           \
+    X(EQU, u64, a._as_u64 == b._as_u64, true)        \
+    X(EQS, u64, a._as_s64 == b._as_s64, true)        \
+    X(EQF, u64, a._as_f64 == b._as_f64, true)        \
+    X(GEU, u64, a._as_u64 >= b._as_u64, false)       \
+    X(GES, u64, a._as_s64 >= b._as_s64, false)       \
+    X(GEF, u64, a._as_f64 >= b._as_f64, false)       \
+    X(LEU, u64, a._as_u64 <= b._as_u64, false)       \
+    X(LES, u64, a._as_s64 <= b._as_s64, false)       \
+    X(LEF, u64, a._as_f64 <= b._as_f64, false)       \
+    X(GU, u64, a._as_u64 > b._as_u64, false)         \
+    X(GS, u64, a._as_s64 > b._as_s64, false)         \
+    X(GF, u64, a._as_f64 > b._as_f64, false)         \
+    X(LU, u64, a._as_u64 < b._as_u64, false)         \
+    X(LS, u64, a._as_s64 < b._as_s64, false)         \
+    X(LF, u64, a._as_f64 < b._as_f64, false)
+
+// divisions: name, field of the result and of the divisor tested for zero, expression; the register form checks the
+// divisor, the immediate form is only made for a nonzero constant one and doesn't
+#define REG_DIVISION_OPS(X)                          \
+    X(SDIV, s64, VM_SDIV(a._as_s64, b._as_s64))      \
+    X(UDIV, u64, a._as_u64 / b._as_u64)              \
+    X(FDIV, f64, a._as_f64 / b._as_f64)
+
+// one operand operations: name, result field, expression over the operand Value a and the immediate shift count
+#define REG_UNARY_OPS(X)                             \
+    X(LSR, u64, a._as_u64 >> shift)                  \
+    X(ASR, s64, a._as_s64 >> shift)                  \
+    X(SL, u64, a._as_u64 << shift)                   \
+    X(NOTB, u64, ~a._as_u64)                         \
+    X(FTU, u64, (uint64_t)(int64_t)a._as_f64)        \
+    X(FTS, s64, (int64_t)a._as_f64)                  \
+    X(STF, f64, (double)a._as_s64)                   \
+    X(UTF, f64, (double)a._as_u64)                   \
+    X(STU, u64, (uint64_t)a._as_s64)                 \
+    X(UTS, s64, (int64_t)a._as_u64)
+
+// memory accesses: name, bytes accessed, result field (loads), C type in memory
+#define REG_LOAD_OPS(X)                              \
+    X(ZELOAD8, 1, u64, uint8_t)                      \
+    X(ZELOAD16, 2, u64, uint16_t)                    \
+    X(ZELOAD32, 4, u64, uint32_t)                    \
+    X(LOAD64, 8, u64, uint64_t)                      \
+    X(SELOAD8, 1, s64, int8_t)                       \
+    X(SELOAD16, 2, s64, int16_t)                     \
+    X(SELOAD32, 4, s64, int32_t)
+
+#define REG_STORE_OPS(X)                             \
+    X(STORE8, 1, uint8_t)                            \
+    X(STORE16, 2, uint16_t)                          \
+    X(STORE32, 4, uint32_t)                          \
+    X(STORE64, 8, uint64_t)
+
+typedef enum
+{
+    REG_MOV,  // dst = a
+    REG_MOVI, // dst = imm
+    REG_SWAP, // dst <-> a, for cycles among the moves that bring the registers back in line with the stack
+#define X(name, ...) REG_##name##_RR, REG_##name##_RI, // dst = a op b / dst = a op imm
+    REG_BINARY_OPS(X)
+    REG_COMPARE_OPS(X)
+    REG_DIVISION_OPS(X)
+#undef X
+#define X(name, ...) REG_BR_##name##_RR, REG_BR_##name##_RI, // comparison into dst, then ujmp_if on it
+    REG_COMPARE_OPS(X)
+#undef X
+#define X(name, ...) REG_##name,
+    REG_UNARY_OPS(X)  // dst = op a
+    REG_LOAD_OPS(X)   // dst = memory[a]
+    REG_STORE_OPS(X)  // memory[a] = b
+#undef X
+    REG_JMP,
+    REG_JNZ,      // ujmp_if on a
+    REG_FJMP,     // fjmp_if on a
+    REG_CALL,     // return address into depth, frame moves up past it
+    REG_RET,      // through the return address in a, back to the frame of the matching call
+    REG_NATIVE,   // natives[imm] on the stack synced to depth
+    REG_FALLBACK, // the source instruction through vm_execute_at_inst_pointer(); adup, aswap, pop_at and empty
+    REG_HALT,
+    REG_OP_COUNT,
+} Reg_Op;
+
+typedef struct Reg_Inst
+{
+    const void *handler;           // label of op inside vm_exec_register(), with computed goto
+    uint32_t op;                   // Reg_Op
+    int32_t dst, a, b;             // registers: stack slots relative to the frame
+    int32_t depth;                 // stack depth relative to the frame before the source instruction runs
+    size_t ip;                     // source instruction, for traps and for jump and call targets
+    Value imm;                     // constant operand
+    const struct Reg_Inst *target; // jump or call destination
+} Reg_Inst;
+
+typedef struct
+{
+    Value *fp;           // caller's frame
+    uint64_t ret_ip;     // return address the call pushed
+    const Reg_Inst *to;  // where the caller continues
+} Reg_Frame;
+
+typedef struct
+{
+    const char *missing;  // why there is no register form of the program; NULL once it was built
+    size_t instructions;  // reachable instructions translated
+    size_t operations;    // register operations they became
+    size_t moves;         // of those, moves and swaps left over from the stack shuffling
+    size_t fused;         // of those, comparisons fused with a ujmp_if
+    size_t deopts;        // runs that left the register form at a ret that didn't match its call
+} Reg_Stats;
+
+typedef struct
+{
+    uint8_t *code;    // executable mapping, entered at entry
+    size_t size;      // bytes mapped at code
+    const uint8_t *entry; // first instruction of the loop
+} Vm_Trace; // native code for one loop, recorded from its header around to its header again
+
+typedef struct
+{
+    size_t compiled;        // traces compiled
+    size_t aborted;         // loops that got hot but couldn't be traced
+    size_t entered;         // times the interpreter handed over to a trace
+    double native_seconds;  // wall time spent inside traces
+} Trace_Stats;
+
 struct VirtualMachine;
 
 typedef Trap (*native)(struct VirtualMachine *); // you can define functions that match this signature and assign their addresses to variables of type native
 
+typedef struct
+{
+    bool known;     // false for natives registered through plain vm_native_push(); programs calling them can't be verified
+    size_t needs;   // stack entries the native reads
+    int64_t delta;  // net change of the stack size once it returns TRAP_OK
+} Native_Effect; // what a native does to the stack, for vm_verify_program()
+
+typedef struct
+{
+    bool verified;           // every reachable instruction has one proved stack depth and none of them can under or overflow
+    const char *reason;      // why the proof failed; NULL when verified
+    size_t failed_at;        // instruction the proof failed at
+    bool bounded;            // max_stack_depth is exact; only the check against vm_stack_capacity may have failed
+    size_t max_stack_depth;  // deepest the stack can get on any path from the entry
+    size_t max_call_depth;   // deepest nesting of calls on any path from the entry
+    size_t proved;           // reachable instructions the proof covered
+} Verify_Report;
+
+typedef struct // what the section table of an executable says; vm_save_program_to_file() lays the file out itself
+{
+    size_t code_section_offset_in_executable;
+    int64_t start_location;
+    size_t code_section_size; // in instructions
+    size_t data_section_offset_in_executable;
+    size_t data_section_size;
+    int16_t vm_executable_identifier; // encoding of the code section: VM_EXECUTABLE_IDENTIFIER or _COMPACT
+    bool has_start;
+    bool checksummed;                  // the sections carry checksums, checked on load
+    uint16_t format_version;           // 0 for files from before the container format
+    size_t code_section_bytes_in_executable;
+    size_t stack_size;                 // entries the verifier proved the program needs; 0 if it couldn't
+    bool object;                       // VM_FORMAT_OBJECT; the symbols and relocations are only in objects
+    size_t symbols_offset_in_executable;
+    size_t symbols_size;
+    size_t relocations_offset_in_executable;
+    size_t relocations_size;
+    size_t lines_offset_in_executable;  // the debug info; 0 bytes if it was stripped
+    size_t lines_size;
+    bool snapshot;                     // VM_FORMAT_SNAPSHOT; start_location is where it resumes, stack_size the stack it had
+    size_t state_offset_in_executable;
+    size_t state_size;
+    uint64_t static_break;             // snapshots: from the state section
+    size_t memory_capacity;
+    size_t default_memory_size;
+} vm_header_;
+
 typedef struct VirtualMachine // structure defining the actual virtual machine
 {
     Value *stack;      // the stack of the virtual machine; the stack top is the end of the array
     size_t stack_size; // current stack size
 
     Inst *program;            // the actual instruction array
+    size_t program_capacity;  // instructions allocated at program; 0 while it points into a mapped image
     size_t program_size;      // number of instructions in the program
     word instruction_pointer; // the address of the next instruction to be executed
 
+    Decoded_Inst *decoded;         // program pre-decoded for the threaded interpreter; NULL until vm_decode_program()
+    size_t fused[HANDLER_COUNT];   // superinstructions the last vm_decode_program() made, by Handler_Id
+    size_t *block_lengths;         // instructions left in the basic block from each instruction on; NULL until a budgeted run
+
+    uint8_t *jit_code;             // program compiled to x86-64 by vm_jit_compile(); NULL until then
+    size_t jit_code_size;          // bytes mapped at jit_code
+    const uint8_t **jit_entries;   // where each instruction starts in jit_code; ret jumps through it
+
+    int64_t *hot_counters;         // back edges taken into each instruction; NULL unless tracing
+    Vm_Trace *traces;              // trace compiled for the loop headed at each instruction; NULL unless tracing
+    Trace_Stats trace_stats;
+
     native *natives;
+    Native_Effect *native_effects; // parallel to natives
     size_t natives_size;
 
+    bool verified;            // vm_verify_program() proved the program, so it may be decoded to skip the stack checks
+    word verified_entry;      // instruction the proof started from, with an empty stack
+    uint64_t *return_shadow;  // return addresses of the calls in flight on the unchecked path; max_call_depth entries
+    size_t shadow_top;        // live entries of return_shadow, kept across vm_exec_threaded() calls
+    size_t max_call_depth;    // from the proof
+    int64_t *frame_depths;    // proved stack depth of each instruction relative to its function's entry, VM_DEPTH_*
+
+    Reg_Inst *reg_program;         // register form of the program; NULL until vm_reg_translate()
+    size_t reg_program_size;
+    const Reg_Inst *reg_entry;     // where the register form of verified_entry starts
+    Reg_Frame *reg_frames;         // calls in flight in vm_exec_register(); max_call_depth entries
+    Reg_Stats reg_stats;
+
     bool has_start;
     size_t start_label_index;
 
+    const uint8_t *image;          // the executable mapped by vm_map_program_file() while program points into it, else NULL
+    size_t image_size;
+
+    char *path;                    // the executable vm_init() loaded, whose debug info vm_debug_info() reads when asked
+    vm_header_ header;
+    Vm_Debug_Info *debug;          // NULL until vm_debug_info() read it, and if the executable has none
+    bool debug_read;
+
     uint8_t *static_memory;
     uint64_t static_break;
+    uint8_t *static_mapping;       // mapping static_memory lies in; NULL when it was calloc()ed
+    size_t static_mapping_size;
 
     int halt;
 } VirtualMachine;
 
-typedef struct
-{
-    size_t code_section_offset_in_executable;
-    int64_t start_location;
-    size_t code_section_size;
-    size_t data_section_offset_in_executable;
-    size_t data_section_size;
-    int16_t vm_executable_identifier;
-    bool has_start;
-} vm_header_;
 
 uint32_t hash_sv(String_View sv);
-void push_to_hashtable(String_View label, size_t value);
-Hashnode *search_for_node(String_View label);
-void push_to_not_resolved_yet(String_View label, size_t inst_location, size_t label_line_no);
+void push_to_hashtable(Vm_Assembler *as, String_View label, size_t value, uint32_t section);
+Hashnode *search_for_node(const Vm_Assembler *as, String_View label);
+void push_to_not_resolved_yet(Vm_Assembler *as, String_View label, size_t inst_location, size_t label_line_no);
+static String_View vm_intern(Vm_Assembler *as, String_View name);
 // void push_to_label_array(String_View label, size_t pointing_location);
 const char *trap_as_cstr(Trap trap);
 const char *inst_type_as_asm_str(Inst_Type type);
 const char *inst_type_as_cstr(Inst_Type type);
 void vm_native_push(VirtualMachine *vm, native native_func);
+void vm_native_push_with_effect(VirtualMachine *vm, native native_func, size_t needs, int64_t delta);
 void vm_dump_stack(FILE *stream, const VirtualMachine *vm);
 static int handle_static(VirtualMachine *vm, Inst inst);
 static int handle_swap(VirtualMachine *vm, Inst inst);
 static int handle_native(VirtualMachine *vm, Inst inst);
 static int handle_shift(VirtualMachine *vm, Inst inst, bool is_arithmetic);
 static int handle_push(VirtualMachine *vm, Inst inst);
-static int handle_arithmetic(VirtualMachine *vm, Inst inst);
+static int handle_splus(VirtualMachine *vm);
+static int handle_uplus(VirtualMachine *vm);
+static int handle_fplus(VirtualMachine *vm);
+static int handle_sminus(VirtualMachine *vm);
+static int handle_uminus(VirtualMachine *vm);
+static int handle_fminus(VirtualMachine *vm);
+static int handle_smult(VirtualMachine *vm);
+static int handle_umult(VirtualMachine *vm);
+static int handle_fmult(VirtualMachine *vm);
+static int handle_sdiv(VirtualMachine *vm);
+static int handle_udiv(VirtualMachine *vm);
+static int handle_fdiv(VirtualMachine *vm);
 static int handle_functions(VirtualMachine *vm, Inst inst);
 static int handle_jump(VirtualMachine *vm, Inst inst);
 static int handle_comparisons(VirtualMachine *vm, Inst inst);
@@ -261,267 +756,209 @@ static int handle_pop(VirtualMachine *vm, Inst inst);
 const char *get_inst_name(Inst_Type inst);
 bool has_operand_function(Inst_Type inst);
 uint8_t get_operand_type(Inst_Type inst);
+void vm_mnemonic_table_init(void);
+Inst_Type vm_inst_lookup(String_View name);
 int vm_execute_at_inst_pointer(VirtualMachine *vm); // executes the instruction inst on vm
+void vm_compute_block_lengths(VirtualMachine *vm);
+static int vm_exec_fast(VirtualMachine *vm);
+static int vm_exec_budgeted(VirtualMachine *vm, int64_t limit);
+static int vm_exec_debug(VirtualMachine *vm, int64_t limit);
+bool vm_jit_compile(VirtualMachine *vm);
+void vm_jit_free(VirtualMachine *vm);
+int vm_exec_jit(VirtualMachine *vm);
+void vm_trace_free(VirtualMachine *vm);
+static int vm_trace_enter(VirtualMachine *vm);
+void vm_print_trace_stats(FILE *stream, const VirtualMachine *vm);
+#define VM_DEOPT (-2) // vm_exec_register() handed the machine back to the stack interpreter; not a Trap
+bool vm_reg_translate(VirtualMachine *vm);
+static int vm_exec_register(VirtualMachine *vm);
+void vm_reg_free(VirtualMachine *vm);
+void vm_print_reg_stats(FILE *stream, const VirtualMachine *vm);
+#if VM_HAS_COMPUTED_GOTO
+#define VM_HOT_LOOP (-1)      // vm_exec_threaded() stopped at the header of a loop that got hot; not a Trap
+#define VM_OUT_OF_BUDGET (-3) // vm_exec_threaded() stopped where the next block doesn't fit in the budget; not a Trap
+static int vm_exec_threaded(VirtualMachine *vm, int64_t *budget);
+void vm_decode_program(VirtualMachine *vm);
+static Handler_Id vm_fusion_for(Inst first, Inst second);
+#endif
+const char *fused_handler_as_cstr(Handler_Id id);
+void vm_print_fusion_stats(FILE *stream, const VirtualMachine *vm);
 int vm_load_program_from_memory(VirtualMachine *vm, Inst *program, size_t program_size);
-void label_init();
-void label_free();
+bool vm_verify_program(VirtualMachine *vm, Verify_Report *report);
+void vm_print_verify_report(FILE *stream, const VirtualMachine *vm, const Verify_Report *report);
+void vm_assembler_init(Vm_Assembler *as, const char *source_name, bool object);
+void vm_assembler_free(Vm_Assembler *as);
+void label_free(Vm_Assembler *as);
+void *vm_grow_array(void *array, size_t *capacity, size_t needed, size_t element_size);
+void *vm_arena_alloc(Vm_Arena *arena, size_t size);
+void *vm_arena_grow(Vm_Arena *arena, void *array, size_t *capacity, size_t needed, size_t element_size);
+void vm_arena_free(Vm_Arena *arena);
+void vm_resize_stack(VirtualMachine *vm, size_t capacity);
 void vm_init(VirtualMachine *vm, char *source_code);
 void vm_internal_free(VirtualMachine *vm);
 int vm_exec_program(VirtualMachine *vm, int64_t limit, bool debug);
 void vm_push_inst(VirtualMachine *vm, Inst *inst);
-void vm_save_program_to_file(Inst *program, uint8_t *data_section, vm_header_ header, const char *file_path);
-vm_header_ vm_load_program_from_file(Inst *program, uint8_t *data_section, const char *file_path);
-Inst vm_translate_line(String_View line, size_t current_program_counter);
-static void process_label(String_View label, size_t program_size);
-static void resolve_labels(Inst *program);
+size_t vm_encode_inst(Inst inst, uint8_t *out);
+bool vm_decode_inst(const uint8_t **cursor, const uint8_t *end, Inst *inst);
+void vm_save_program_to_file(const Vm_Assembler *as, Inst *program, uint8_t *data_section, vm_header_ header, const char *file_path);
+void vm_save_object_to_file(const Vm_Assembler *as, Inst *program, uint8_t *data_section, vm_header_ header, const char *file_path);
+void vm_save_snapshot_to_file(VirtualMachine *vm, const char *file_path);
+static void vm_restore_state(VirtualMachine *vm, const char *file_path);
+vm_header_ vm_link_objects(Vm_Assembler *as, const char **object_paths, size_t objects_size, Inst **program, uint8_t **data_section);
+static void vm_debug_encode_lines(Vm_Assembler *as, const Vm_Source_File *files, size_t files_size, const Vm_Source_Line *lines, size_t lines_size);
+static void vm_debug_encode_symbols(Vm_Assembler *as);
+static bool vm_debug_decode(Vm_Debug_Info *debug, vm_header_ header, size_t begin);
+Vm_Debug_Info *vm_debug_read(const char *file_path, vm_header_ header);
+void vm_debug_free(Vm_Debug_Info *debug);
+const Vm_Debug_Info *vm_debug_info(VirtualMachine *vm);
+const Vm_Debug_Symbol *vm_debug_symbol_at(const Vm_Debug_Info *debug, size_t ip);
+void vm_print_location(FILE *stream, VirtualMachine *vm, size_t ip);
+vm_header_ vm_load_program_from_file(Inst **program, uint8_t **data_section, const char *file_path);
+static void vm_size_static_memory(vm_header_ header);
+#if VM_HAS_MMAP
+vm_header_ vm_map_program_file(VirtualMachine *vm, const char *file_path);
+#endif
+#if VM_HAS_BUILD_CACHE
+void vm_cache_key(const Vm_Assembler *as, const char *source_path, bool compact, bool checksum, char *key);
+bool vm_cache_fetch(const char *key, const char *output_path);
+void vm_cache_store(const char *key, const char *output_path);
+void vm_cache_print_stats(FILE *stream);
+void vm_cache_clean(FILE *stream);
+#endif
+void vm_own_program(VirtualMachine *vm);
+Inst vm_translate_line(Vm_Assembler *as, String_View line, size_t current_program_counter);
+static void process_label(Vm_Assembler *as, String_View label, size_t program_size, uint32_t section);
+static void resolve_labels(Vm_Assembler *as, Inst *program);
 static void check_unresolved_labels();
-static void process_code_line(String_View line, Inst *program, size_t *code_section_offset);
-static void process_data_line(String_View line, uint8_t *data_section, size_t *data_section_offset);
-static bool check_compilation_status(Inst *program, size_t code_section_offset);
-static vm_header_ create_vm_header(size_t code_section_offset, size_t data_section_offset);
-vm_header_ vm_translate_source(String_View source, Inst *program, uint8_t *data_section);
+static void process_code_line(Vm_Assembler *as, String_View line, Inst *program, size_t *code_section_offset);
+static void process_data_line(Vm_Assembler *as, String_View line, uint8_t *data_section, size_t *data_section_offset);
+static bool check_compilation_status(const Vm_Assembler *as, Inst *program, size_t code_section_offset);
+static vm_header_ create_vm_header(const Vm_Assembler *as, size_t code_section_offset, size_t data_section_offset);
+static vm_header_ vm_translate_finish(Vm_Assembler *as, Inst *program, size_t code_section_offset, size_t data_section_offset);
+vm_header_ vm_translate_source(Vm_Assembler *as, String_View source, Inst **program, uint8_t **data_section);
+vm_header_ vm_translate_file(Vm_Assembler *as, const char *source_path, Inst **program, uint8_t **data_section);
 String_View slurp_file(const char *file_path);
 
 #ifdef _VM_IMPLEMENTATION
 
-const char *get_inst_name(Inst_Type inst)
+typedef struct
 {
-    switch (inst)
-    {
-    case INST_NOP:
-        return "nop";
-    case INST_SPUSH:
-        return "spush";
-    case INST_FPUSH:
-        return "fpush";
-    case INST_UPUSH:
-        return "upush";
-    case INST_RDUP:
-        return "rdup";
-    case INST_ADUP:
-        return "adup";
-    case INST_SPLUS:
-        return "splus";
-    case INST_UPLUS:
-        return "uplus";
-    case INST_FPLUS:
-        return "fplus";
-    case INST_SMINUS:
-        return "sminus";
-    case INST_UMINUS:
-        return "uminus";
-    case INST_FMINUS:
-        return "fminus";
-    case INST_SMULT:
-        return "smult";
-    case INST_UMULT:
-        return "umult";
-    case INST_FMULT:
-        return "fmult";
-    case INST_SDIV:
-        return "sdiv";
-    case INST_UDIV:
-        return "udiv";
-    case INST_FDIV:
-        return "fdiv";
-    case INST_JMP:
-        return "jmp";
-    case INST_HALT:
-        return "halt";
-    case INST_UJMP_IF:
-        return "ujmp_if";
-    case INST_FJMP_IF:
-        return "fjmp_if";
-    case INST_EQ:
-        return "eq";
-    case INST_LSR:
-        return "lsr";
-    case INST_ASR:
-        return "asr";
-    case INST_SL:
-        return "sl";
-    case INST_ANDB:
-        return "and";
-    case INST_ORB:
-        return "or";
-    case INST_NOTB:
-        return "not";
-    case INST_EMPTY:
-        return "empty";
-    case INST_POP_AT:
-        return "pop_at";
-    case INST_POP:
-        return "pop";
-    case INST_RSWAP:
-        return "rswap";
-    case INST_ASWAP:
-        return "aswap";
-    case INST_RET:
-        return "ret";
-    case INST_CALL:
-        return "call";
-    case INST_NATIVE:
-        return "native";
-    case INST_ZELOAD8:
-        return "zeload8";
-    case INST_ZELOAD16:
-        return "zeload16";
-    case INST_ZELOAD32:
-        return "zeload32";
-    case INST_LOAD64:
-        return "load64";
-    case INST_SELOAD8:
-        return "seload8";
-    case INST_SELOAD16:
-        return "seload16";
-    case INST_SELOAD32:
-        return "seload32";
-    case INST_STORE8:
-        return "store8";
-    case INST_STORE16:
-        return "store16";
-    case INST_STORE32:
-        return "store32";
-    case INST_STORE64:
-        return "store64";
-    case INST_EQU:
-        return "equ";
-    case INST_EQS:
-        return "eqs";
-    case INST_EQF:
-        return "eqf";
-    case INST_GEU:
-        return "geu";
-    case INST_GES:
-        return "ges";
-    case INST_GEF:
-        return "gef";
-    case INST_LEU:
-        return "leu";
-    case INST_LES:
-        return "les";
-    case INST_LEF:
-        return "lef";
-    case INST_GU:
-        return "gu";
-    case INST_GS:
-        return "gs";
-    case INST_GF:
-        return "gf";
-    case INST_LU:
-        return "lu";
-    case INST_LS:
-        return "ls";
-    case INST_LF:
-        return "lf";
-    case INST_UTF:
-        return "utf";
-    case INST_STF:
-        return "stf";
-    case INST_FTU:
-        return "ftu";
-    case INST_FTS:
-        return "fts";
-    case INST_STU:
-        return "stu";
-    case INST_UTS:
-        return "uts";
+    const char *name;
+    uint8_t operand_type; // TYPE_* or VM_NO_OPERAND
+} Inst_Info;
 
-    default:
-        return NULL; // Invalid instruction
-    }
+#define VM_INST_INFO(type, opcode, mnemonic, operand) [type] = {mnemonic, operand},
+static const Inst_Info vm_inst_info[INST_COUNT] = {VM_INSTRUCTIONS(VM_INST_INFO)};
+
+const char *get_inst_name(Inst_Type inst)
+{
+    return (uint32_t)inst < INST_COUNT ? vm_inst_info[inst].name : NULL; // NULL for 0 and anything past the last
 }
 
 bool has_operand_function(Inst_Type inst)
 {
-    switch (inst)
-    {
-    case INST_SPUSH:
-        return 1;
-    case INST_UPUSH:
-        return 1;
-    case INST_FPUSH:
-        return 1;
-    case INST_ADUP:
-        return 1;
-    case INST_RDUP:
-        return 1;
-    case INST_JMP:
-        return 1;
-    case INST_FJMP_IF:
-        return 1;
-    case INST_UJMP_IF:
-        return 1;
-    case INST_LSR:
-        return 1;
-    case INST_ASR:
-        return 1;
-    case INST_SL:
-        return 1;
-    case INST_POP_AT:
-        return 1;
-    case INST_CALL:
-        return 1;
-    case INST_RSWAP:
-        return 1;
-    case INST_ASWAP:
-        return 1;
-    case INST_NATIVE:
-        return 1;
-    }
-
-    return 0;
+    return (uint32_t)inst < INST_COUNT && vm_inst_info[inst].name && vm_inst_info[inst].operand_type != VM_NO_OPERAND;
 }
 
 uint8_t get_operand_type(Inst_Type inst)
 {
-    switch (inst)
-    {
-    // Signed arithmetic instructions
-    case INST_SPUSH:
-        return TYPE_SIGNED_64INT;
-
-    // Unsigned arithmetic instructions
-    case INST_UPUSH:
-        return TYPE_UNSIGNED_64INT;
-
-    // Floating-point arithmetic instructions
-    case INST_FPUSH:
-        return TYPE_DOUBLE;
-
-    // Shift operations, which often use unsigned integers
-    case INST_LSR: // Logical Shift Right
-    case INST_ASR: // Arithmetic Shift Right
-    case INST_SL:  // Shift Left
-        return TYPE_UNSIGNED_64INT;
-
-    // Control flow instructions
-    case INST_JMP:
-    case INST_UJMP_IF:
-    case INST_FJMP_IF:
-        return TYPE_UNSIGNED_64INT;
-
-    // Stack manipulation
-    case INST_POP_AT:
-        return TYPE_UNSIGNED_64INT;
+    return has_operand_function(inst) ? vm_inst_info[inst].operand_type : 0; // No specific operand type or invalid instruction
+}
 
-    case INST_ADUP:
-    case INST_RDUP:
-        return TYPE_UNSIGNED_64INT;
+// mnemonic lookup for the assemblers: a perfect hash of the mnemonics packed into integers, built from vm_inst_info once
+// per process the first time it is asked, so a line costs one multiply and one compare instead of a string compare per
+// instruction
+typedef struct
+{
+    uint64_t key;     // the mnemonic's bytes, see vm_mnemonic_key()
+    Inst_Type type;   // 0 for an empty slot
+} Mnemonic_Slot;
+
+static Mnemonic_Slot vm_mnemonic_table[1 << VM_MNEMONIC_TABLE_BITS];
+static uint64_t vm_mnemonic_multiplier = VM_MNEMONIC_MULTIPLIER;
+#if VM_HAS_THREADS
+static pthread_once_t vm_mnemonic_once = PTHREAD_ONCE_INIT;
+#else
+static bool vm_mnemonic_built = false;
+#endif
+
+// name's bytes as a little endian integer, zero padded; 0 for names no mnemonic can be, longer than eight bytes or
+// holding a zero byte
+static uint64_t vm_mnemonic_key(String_View name)
+{
+    uint64_t key = 0;
+    if (name.count == 0 || name.count > sizeof(key))
+    {
+        return 0;
+    }
+    for (size_t i = 0; i < name.count; i++)
+    {
+        if (name.data[i] == '\0')
+        {
+            return 0;
+        }
+        key |= (uint64_t)(uint8_t)name.data[i] << (8 * i);
+    }
+    return key;
+}
 
-    case INST_ASWAP:
-    case INST_RSWAP:
-        return TYPE_UNSIGNED_64INT;
+static size_t vm_mnemonic_slot(uint64_t key, uint64_t multiplier)
+{
+    return (size_t)((key * multiplier) >> (64 - VM_MNEMONIC_TABLE_BITS));
+}
 
-    case INST_CALL:
-        return TYPE_UNSIGNED_64INT;
+// false if two mnemonics share a slot under multiplier
+static bool vm_mnemonic_table_fill(uint64_t multiplier)
+{
+    memset(vm_mnemonic_table, 0, sizeof(vm_mnemonic_table));
+    for (size_t i = 1; i < INST_COUNT; i++)
+    {
+        uint64_t key = vm_mnemonic_key(cstr_as_sv(vm_inst_info[i].name));
+        assert(key != 0 && "mnemonics are at most eight bytes");
+        Mnemonic_Slot *slot = &vm_mnemonic_table[vm_mnemonic_slot(key, multiplier)];
+        if (slot->type != 0)
+        {
+            return false;
+        }
+        *slot = (Mnemonic_Slot){.key = key, .type = (Inst_Type)i};
+    }
+    return true;
+}
 
-    case INST_NATIVE:
-        return TYPE_UNSIGNED_64INT;
+// VM_MNEMONIC_MULTIPLIER, or where the opcode list has changed under it, the first multiplier from a fixed sequence
+// under which every mnemonic lands in a slot of its own; the same one every run
+static void vm_mnemonic_table_build(void)
+{
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    uint64_t multiplier = VM_MNEMONIC_MULTIPLIER;
+    while (!vm_mnemonic_table_fill(multiplier))
+    {
+        multiplier = (state = state * 6364136223846793005ULL + 1442695040888963407ULL) | 1;
+    }
+    vm_mnemonic_multiplier = multiplier;
+}
 
-    default:
-        return 0; // No specific operand type or invalid instruction
+// builds the table exactly once, whichever thread asks first; the others wait for it
+void vm_mnemonic_table_init(void)
+{
+#if VM_HAS_THREADS
+    pthread_once(&vm_mnemonic_once, vm_mnemonic_table_build);
+#else
+    if (!vm_mnemonic_built)
+    {
+        vm_mnemonic_table_build();
+        vm_mnemonic_built = true;
     }
+#endif
+}
+
+// the instruction name is the mnemonic of; 0 if it isn't one
+Inst_Type vm_inst_lookup(String_View name)
+{
+    vm_mnemonic_table_init();
+    uint64_t key = vm_mnemonic_key(name);
+    const Mnemonic_Slot *slot = &vm_mnemonic_table[vm_mnemonic_slot(key, vm_mnemonic_multiplier)];
+    return key != 0 && slot->key == key ? slot->type : 0;
 }
 
 const char *trap_as_cstr(Trap trap)
@@ -548,6 +985,8 @@ const char *trap_as_cstr(Trap trap)
         return "TRAP_ILLEGAL_OPERAND";
     case TRAP_ILLEGAL_OPERATION:
         return "TRAP_ILLEGAL_OPERATION";
+    case TRAP_ILLEGAL_MEMORY_ACCESS:
+        return "TRAP_ILLEGAL_MEMORY_ACCESS";
     default:
         assert(00 && "trap_as_cstr: Unreachnable");
     }
@@ -564,73 +1003,137 @@ uint32_t hash_sv(String_View sv)
     return hash;
 }
 
-void push_to_hashtable(String_View label, size_t value)
+// the slot holding 'label', or the empty slot probing for it stopped at
+static size_t label_slot_find(const Vm_Assembler *as, String_View label, uint32_t hash)
 {
-    if (search_for_node(label))
+    size_t mask = as->label_slots_capacity - 1;
+    size_t i = hash & mask;
+    while (as->label_slots[i].node != 0 &&
+           (as->label_slots[i].hash != hash || !sv_eq(as->label_nodes[as->label_slots[i].node - 1].label, label)))
     {
-        fprintf(stderr, "Line Number %zu -> ERROR: Label '%.*s' redefinition\n", line_no, (int)label.count, label.data);
-        compilation_successful = false;
-        return;
+        i = (i + 1) & mask;
     }
+    return i;
+}
 
-    uint32_t key = hash_sv(label) % MAX_HASHTABLE_SIZE;
+static void label_slots_grow(Vm_Assembler *as)
+{
+    size_t capacity = as->label_slots_capacity > 0 ? as->label_slots_capacity * 2 : 256;
+    as->label_slots = vm_arena_alloc(&as->arena, sizeof(Label_Slot) * capacity);
+    memset(as->label_slots, 0, sizeof(Label_Slot) * capacity);
+    as->label_slots_capacity = capacity;
 
-    Hashnode *node = (Hashnode *)malloc(sizeof(Hashnode));
-    if (!node)
+    for (size_t n = 0; n < as->label_nodes_size; n++)
     {
-        fprintf(stderr, "ERROR: memory allocation for the hash node of the label %.*s failed\n", (int)label.count, label.data);
-        exit(EXIT_FAILURE);
+        uint32_t hash = hash_sv(as->label_nodes[n].label);
+        size_t i = hash & (capacity - 1);
+        while (as->label_slots[i].node != 0)
+        {
+            i = (i + 1) & (capacity - 1);
+        }
+        as->label_slots[i] = (Label_Slot){.hash = hash, .node = (uint32_t)(n + 1)};
     }
-    node->label = label;
-    node->value = value;
+}
 
-    if (!bucket[key]) // its null
+void push_to_hashtable(Vm_Assembler *as, String_View label, size_t value, uint32_t section)
+{
+    if (search_for_node(as, label))
     {
-        bucket[key] = node;
-        node->next = NULL;
+        fprintf(as->errors, "Line Number %zu -> ERROR: Label '%.*s' redefinition\n", as->line_no, (int)label.count, label.data);
+        as->compilation_successful = false;
+        return;
     }
-    else
+    if (as->label_nodes_size >= UINT32_MAX)
     {
-        node->next = bucket[key];
-        bucket[key] = node;
+        fprintf(stderr, "ERROR: too many labels\n");
+        exit(EXIT_FAILURE);
     }
-}
 
-Hashnode *search_for_node(String_View label)
-{
-    uint32_t key = hash_sv(label) % MAX_HASHTABLE_SIZE;
+    if ((as->label_nodes_size + 1) * 2 > as->label_slots_capacity)
+    {
+        label_slots_grow(as);
+    }
+    as->label_nodes = vm_arena_grow(&as->arena, as->label_nodes, &as->label_nodes_capacity, as->label_nodes_size + 1, sizeof(Hashnode));
+    as->label_nodes[as->label_nodes_size++] = (Hashnode){.label = label, .value = value, .section = section};
 
-    Hashnode *current_node = bucket[key];
+    uint32_t hash = hash_sv(label);
+    as->label_slots[label_slot_find(as, label, hash)] = (Label_Slot){.hash = hash, .node = (uint32_t)as->label_nodes_size};
+}
 
-    while (current_node != NULL)
+// the node stays where it is until the next push_to_hashtable() may move the nodes
+Hashnode *search_for_node(const Vm_Assembler *as, String_View label)
+{
+    if (as->label_slots_capacity == 0)
     {
-        if (sv_eq(current_node->label, label))
-        {
-            return current_node;
-        }
-
-        current_node = current_node->next;
+        return NULL;
     }
 
-    return NULL;
+    Label_Slot slot = as->label_slots[label_slot_find(as, label, hash_sv(label))];
+    return slot.node != 0 ? &as->label_nodes[slot.node - 1] : NULL;
 }
 
-void push_to_not_resolved_yet(String_View label, size_t inst_location, size_t label_line_no)
+void push_to_not_resolved_yet(Vm_Assembler *as, String_View label, size_t inst_location, size_t label_line_no)
 {
-    not_resolved_yet[not_resolved_yet_counter].inst_location = inst_location;
-    not_resolved_yet[not_resolved_yet_counter].label = label;
-    not_resolved_yet[not_resolved_yet_counter].resolved = false;
-    not_resolved_yet[not_resolved_yet_counter].label_line_no = label_line_no;
-    not_resolved_yet_counter++;
+    as->not_resolved_yet = vm_arena_grow(&as->arena, as->not_resolved_yet, &as->not_resolved_yet_capacity, as->not_resolved_yet_counter + 1, sizeof(label_inst_location));
+    as->not_resolved_yet[as->not_resolved_yet_counter].inst_location = inst_location;
+    as->not_resolved_yet[as->not_resolved_yet_counter].label = label;
+    as->not_resolved_yet[as->not_resolved_yet_counter].resolved = false;
+    as->not_resolved_yet[as->not_resolved_yet_counter].label_line_no = label_line_no;
+    as->not_resolved_yet_counter++;
 }
 
-/* void push_to_label_array(String_View label, size_t pointing_location)
+// the copy of name in the arena, made the first time the name comes up; name itself where the assembler isn't
+// interning, its source outliving the labels
+static String_View vm_intern(Vm_Assembler *as, String_View name)
+{
+    if (!as->interning)
+    {
+        return name;
+    }
+
+    if ((as->interned_size + 1) * 2 > as->interned_capacity)
+    {
+        size_t capacity = as->interned_capacity > 0 ? as->interned_capacity * 2 : 256;
+        String_View *interned = vm_arena_alloc(&as->arena, sizeof(String_View) * capacity);
+        memset(interned, 0, sizeof(String_View) * capacity);
+        for (size_t n = 0; n < as->interned_capacity; n++)
+        {
+            if (as->interned[n].data)
+            {
+                size_t i = hash_sv(as->interned[n]) & (capacity - 1);
+                while (interned[i].data)
+                {
+                    i = (i + 1) & (capacity - 1);
+                }
+                interned[i] = as->interned[n];
+            }
+        }
+        as->interned = interned;
+        as->interned_capacity = capacity;
+    }
+
+    size_t i = hash_sv(name) & (as->interned_capacity - 1);
+    while (as->interned[i].data && !sv_eq(as->interned[i], name))
+    {
+        i = (i + 1) & (as->interned_capacity - 1);
+    }
+    if (!as->interned[i].data)
+    {
+        char *copy = vm_arena_alloc(&as->arena, name.count);
+        memcpy(copy, name.data, name.count);
+        as->interned[i] = (String_View){.data = copy, .count = name.count};
+        as->interned_size++;
+    }
+    return as->interned[i];
+}
+
+/* void push_to_label_array(String_View label, size_t pointing_location)
 {
     for (size_t i = 0; i < label_array_counter; i++)
     {
         if (sv_eq(label_array[i].label, label))
         {
-            fprintf(stderr, "Line Number %zu -> ERROR: Label '%.*s' redefinition\n", line_no, (int)label.count, label.data);
+            fprintf(as->errors, "Line Number %zu -> ERROR: Label '%.*s' redefinition\n", line_no, (int)label.count, label.data);
             compilation_successful = false;
             return;
         }
@@ -643,9 +1146,18 @@ void push_to_not_resolved_yet(String_View label, size_t inst_location, size_t la
 void vm_native_push(VirtualMachine *vm, native native_func)
 {
     assert(vm->natives_size < natives_capacity);
+    vm->native_effects[vm->natives_size] = (Native_Effect){.known = false};
     vm->natives[vm->natives_size++] = native_func;
 }
 
+// same as vm_native_push(), but lets vm_verify_program() account for the native: it reads the top 'needs' entries and
+// leaves the stack 'delta' entries larger (negative when it pops); a native that breaks its declaration voids the proof
+void vm_native_push_with_effect(VirtualMachine *vm, native native_func, size_t needs, int64_t delta)
+{
+    vm_native_push(vm, native_func);
+    vm->native_effects[vm->natives_size - 1] = (Native_Effect){.known = true, .needs = needs, .delta = delta};
+}
+
 void vm_dump_stack(FILE *stream, const VirtualMachine *vm)
 {
     fprintf(stream, "Stack:\n");
@@ -982,7 +1494,7 @@ static int handle_swap(VirtualMachine *vm, Inst inst)
     }
     else
     {
-        if (vm->stack_size - operand < 0)
+        if (operand >= vm->stack_size)
         {
             return TRAP_STACK_UNDERFLOW;
         }
@@ -999,15 +1511,19 @@ static int handle_swap(VirtualMachine *vm, Inst inst)
 static int handle_native(VirtualMachine *vm, Inst inst)
 {
     uint64_t index = inst.operand._as_u64;
-    if (index > vm->natives_size)
+    if (index >= vm->natives_size)
     {
         return TRAP_ILLEGAL_OPERAND;
     }
 
     Trap ret_val = (vm->natives[index])(vm);
+    if (ret_val != TRAP_OK)
+    {
+        return ret_val; // left at the native, so the trap is reported where it happened
+    }
 
     vm->instruction_pointer++;
-    return ret_val;
+    return TRAP_OK;
 }
 
 static int handle_shift(VirtualMachine *vm, Inst inst, bool is_arithmetic)
@@ -1048,118 +1564,58 @@ static int handle_push(VirtualMachine *vm, Inst inst)
     return TRAP_OK;
 }
 
-static int handle_arithmetic(VirtualMachine *vm, Inst inst)
-{
-    if (vm->stack_size < 2)
-    {
-        return TRAP_STACK_UNDERFLOW;
-    }
-
-    // Second operand is the top of the stack
-    double result = 0.0;
-    int64_t a_signed = 0, b_signed = 0;
-    uint64_t a_unsigned = 0, b_unsigned = 0;
-    double a_float = 0.0, b_float = 0.0;
-
-    // Retrieve the operands based on the instruction type
-    switch (inst.type)
-    {
-    case INST_FPLUS:
-    case INST_FMINUS:
-    case INST_FMULT:
-    case INST_FDIV:
-        a_float = vm->stack[vm->stack_size - 2]._as_f64; // First operand from the given index
-        b_float = vm->stack[vm->stack_size - 1]._as_f64; // Second operand is the top of the stack
-        break;
-    case INST_SPLUS:
-    case INST_SMINUS:
-    case INST_SMULT:
-    case INST_SDIV:
-        a_signed = vm->stack[vm->stack_size - 2]._as_s64;
-        b_signed = vm->stack[vm->stack_size - 1]._as_s64;
-        break;
-    case INST_UPLUS:
-    case INST_UMINUS:
-    case INST_UMULT:
-    case INST_UDIV:
-        a_unsigned = vm->stack[vm->stack_size - 2]._as_u64;
-        b_unsigned = vm->stack[vm->stack_size - 1]._as_u64;
-        break;
-    default:
-        return TRAP_ILLEGAL_INSTRUCTION;
-    }
-
-    // Perform the arithmetic operation
-    switch (inst.type)
-    {
-    case INST_FPLUS:
-        result = a_float + b_float;
-        break;
-    case INST_SPLUS:
-        result = (a_signed + b_signed);
-        break;
-    case INST_UPLUS:
-        result = (double)(a_unsigned + b_unsigned);
-        break;
-    case INST_FMINUS:
-        result = a_float - b_float;
-        break;
-    case INST_SMINUS:
-        result = (double)(a_signed - b_signed);
-        break;
-    case INST_UMINUS:
-        result = (double)(a_unsigned - b_unsigned);
-        break;
-    case INST_FMULT:
-        result = a_float * b_float;
-        break;
-    case INST_SMULT:
-        result = (double)(a_signed * b_signed);
-        break;
-    case INST_UMULT:
-        result = (double)(a_unsigned * b_unsigned);
-        break;
-    case INST_FDIV:
-        if (b_float == 0.0)
-            return TRAP_DIV_BY_ZERO;
-        result = a_float / b_float;
-        break;
-    case INST_SDIV:
-        if (b_signed == 0)
-            return TRAP_DIV_BY_ZERO;
-        result = (a_signed / b_signed);
-        break;
-    case INST_UDIV:
-        if (b_unsigned == 0)
-            return TRAP_DIV_BY_ZERO;
-        result = (a_unsigned / b_unsigned);
-        break;
-    default:
-        return TRAP_ILLEGAL_INSTRUCTION;
+// one handler per arithmetic instruction, each computing in the instruction's own type
+// signed plus/minus/mult are done on the unsigned bit patterns, which is the same two's complement result without
+// the undefined behaviour of signed overflow, and INT64_MIN / -1 wraps to INT64_MIN instead of faulting
+#define ARITHMETIC_HANDLER(name, field, expression)                                     \
+    static int handle_##name(VirtualMachine *vm)                                        \
+    {                                                                                   \
+        if (vm->stack_size < 2)                                                         \
+        {                                                                               \
+            return TRAP_STACK_UNDERFLOW;                                                \
+        }                                                                               \
+        Value a = vm->stack[vm->stack_size - 2];                                        \
+        Value b = vm->stack[vm->stack_size - 1];                                        \
+        vm->stack[vm->stack_size - 2]._as_##field = (expression);                       \
+        vm->stack_size--;                                                               \
+        vm->instruction_pointer++;                                                      \
+        return TRAP_OK;                                                                 \
     }
 
-    // Store the result in the location of the first operand
-    if (inst.type == INST_SPLUS || inst.type == INST_SMINUS || inst.type == INST_SMULT || inst.type == INST_SDIV)
-    {
-        vm->stack[vm->stack_size - 2]._as_s64 = (int64_t)result;
-    }
-    else if (inst.type == INST_UPLUS || inst.type == INST_UMINUS || inst.type == INST_UMULT || inst.type == INST_UDIV)
-    {
-        vm->stack[vm->stack_size - 2]._as_u64 = (uint64_t)result;
-    }
-    else
-    {
-        vm->stack[vm->stack_size - 2]._as_f64 = result;
+#define DIVISION_HANDLER(name, field, expression)                                       \
+    static int handle_##name(VirtualMachine *vm)                                        \
+    {                                                                                   \
+        if (vm->stack_size < 2)                                                         \
+        {                                                                               \
+            return TRAP_STACK_UNDERFLOW;                                                \
+        }                                                                               \
+        Value a = vm->stack[vm->stack_size - 2];                                        \
+        Value b = vm->stack[vm->stack_size - 1];                                        \
+        if (b._as_##field == 0)                                                         \
+        {                                                                               \
+            return TRAP_DIV_BY_ZERO;                                                    \
+        }                                                                               \
+        vm->stack[vm->stack_size - 2]._as_##field = (expression);                       \
+        vm->stack_size--;                                                               \
+        vm->instruction_pointer++;                                                      \
+        return TRAP_OK;                                                                 \
     }
 
-    // Reduce the stack size by one, popping the top operand
-    vm->stack_size--;
-
-    // Move the instruction pointer to the next instruction
-    vm->instruction_pointer++;
-
-    return TRAP_OK;
-}
+ARITHMETIC_HANDLER(splus, u64, a._as_u64 + b._as_u64)
+ARITHMETIC_HANDLER(uplus, u64, a._as_u64 + b._as_u64)
+ARITHMETIC_HANDLER(fplus, f64, a._as_f64 + b._as_f64)
+ARITHMETIC_HANDLER(sminus, u64, a._as_u64 - b._as_u64)
+ARITHMETIC_HANDLER(uminus, u64, a._as_u64 - b._as_u64)
+ARITHMETIC_HANDLER(fminus, f64, a._as_f64 - b._as_f64)
+ARITHMETIC_HANDLER(smult, u64, a._as_u64 * b._as_u64)
+ARITHMETIC_HANDLER(umult, u64, a._as_u64 * b._as_u64)
+ARITHMETIC_HANDLER(fmult, f64, a._as_f64 * b._as_f64)
+DIVISION_HANDLER(sdiv, s64, VM_SDIV(a._as_s64, b._as_s64))
+DIVISION_HANDLER(udiv, u64, a._as_u64 / b._as_u64)
+DIVISION_HANDLER(fdiv, f64, a._as_f64 / b._as_f64)
+
+#undef ARITHMETIC_HANDLER
+#undef DIVISION_HANDLER
 
 static int handle_functions(VirtualMachine *vm, Inst inst)
 {
@@ -1171,12 +1627,28 @@ static int handle_functions(VirtualMachine *vm, Inst inst)
             return TRAP_STACK_OVERFLOW;
         }
 
+        if (addr >= vm->program_size)
+        {
+            return TRAP_ILLEGAL_JMP;
+        }
+
         vm->stack[vm->stack_size++]._as_u64 = (vm->instruction_pointer + 1);
         vm->instruction_pointer = addr;
     }
     else if (inst.type == INST_RET)
     {
-        vm->instruction_pointer = vm->stack[vm->stack_size - 1]._as_u64;
+        if (vm->stack_size < 1)
+        {
+            return TRAP_STACK_UNDERFLOW;
+        }
+
+        uint64_t addr = vm->stack[vm->stack_size - 1]._as_u64;
+        if (addr >= vm->program_size)
+        {
+            return TRAP_ILLEGAL_JMP;
+        }
+
+        vm->instruction_pointer = addr;
         vm->stack_size--;
     }
 
@@ -1243,7 +1715,7 @@ static int handle_adup(VirtualMachine *vm, Inst inst)
 {
     uint64_t index = inst.operand._as_u64;
 
-    if (vm->stack_size >= vm_stack_capacity || index > vm->stack_size)
+    if (vm->stack_size >= vm_stack_capacity || index >= vm->stack_size)
         return TRAP_STACK_OVERFLOW;
 
     vm->stack[vm->stack_size] = vm->stack[index];
@@ -1324,6 +1796,11 @@ static int handle_bitwise(VirtualMachine *vm, Inst inst)
 }
 static int handle_empty(VirtualMachine *vm)
 {
+    if (vm->stack_size >= vm_stack_capacity)
+    {
+        return TRAP_STACK_OVERFLOW;
+    }
+
     if (vm->stack_size >= 1)
     {
         vm->stack_size++;
@@ -1355,6 +1832,10 @@ static int handle_pop(VirtualMachine *vm, Inst inst)
             vm->stack[i] = vm->stack[i + 1];
         }
     }
+    else if (vm->stack_size < 1)
+    {
+        return TRAP_STACK_UNDERFLOW;
+    }
 
     vm->stack_size--;
     vm->instruction_pointer++;
@@ -1383,19 +1864,30 @@ int vm_execute_at_inst_pointer(VirtualMachine *vm)
 
         return handle_push(vm, inst);
 
-    case INST_FPLUS:
     case INST_SPLUS:
+        return handle_splus(vm);
     case INST_UPLUS:
-    case INST_FMINUS:
+        return handle_uplus(vm);
+    case INST_FPLUS:
+        return handle_fplus(vm);
     case INST_SMINUS:
+        return handle_sminus(vm);
     case INST_UMINUS:
-    case INST_FMULT:
+        return handle_uminus(vm);
+    case INST_FMINUS:
+        return handle_fminus(vm);
     case INST_SMULT:
+        return handle_smult(vm);
     case INST_UMULT:
+        return handle_umult(vm);
+    case INST_FMULT:
+        return handle_fmult(vm);
     case INST_SDIV:
+        return handle_sdiv(vm);
     case INST_UDIV:
+        return handle_udiv(vm);
     case INST_FDIV:
-        return handle_arithmetic(vm, inst);
+        return handle_fdiv(vm);
 
     case INST_HALT:
         vm->halt = 1;
@@ -1482,496 +1974,6566 @@ int vm_execute_at_inst_pointer(VirtualMachine *vm)
     }
 }
 
-int vm_load_program_from_memory(VirtualMachine *vm, Inst *program, size_t program_size)
+#if VM_HAS_COMPUTED_GOTO
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic" // labels as values and computed goto are GNU extensions
+
+static const void *const *threaded_handlers = NULL;           // vm_exec_threaded()'s label table, indexed by Handler_Id
+static const void *const *threaded_unchecked_handlers = NULL; // same, but entering each handler past its stack checks
+
+// direct-threaded counterpart of vm_execute_at_inst_pointer(); every Inst_Type gets its own label and each handler jumps
+// straight into the next one through the handler address vm_decode_program() stored in the instruction, so there is no
+// call, no switch and no operand or jump target validation left per instruction
+// the handle_* functions stay the reference semantics; every handler here must trap exactly where they do
+// each handler that checks the stack has a second unchecked_* entry right after those checks; programs that
+// vm_verify_program() proved are decoded to enter there, and ret falls back to the checked entries if a return ever
+// fails to land where the matching call left off (the proof assumes calls and returns nest)
+// a budgeted run (budget not NULL) pays at every transfer of control for the instructions from where it lands up to and
+// including the next transfer (block_lengths), and stops before a stretch that doesn't fit with what is left in *budget
+// called with a NULL vm it only publishes its label tables
+static int vm_exec_threaded(VirtualMachine *vm, int64_t *budget)
 {
-    if (!program)
+#define HANDLERS(prefix)                              \
+    [0] = &&op_illegal,                               \
+    [INST_NOP] = &&op_nop,                            \
+    [INST_SPUSH] = &&prefix##_push,                   \
+    [INST_FPUSH] = &&prefix##_push,                   \
+    [INST_UPUSH] = &&prefix##_push,                   \
+    [INST_RDUP] = &&prefix##_rdup,                    \
+    [INST_ADUP] = &&op_adup,                          \
+    [INST_SPLUS] = &&prefix##_splus,                  \
+    [INST_UPLUS] = &&prefix##_uplus,                  \
+    [INST_FPLUS] = &&prefix##_fplus,                  \
+    [INST_SMINUS] = &&prefix##_sminus,                \
+    [INST_UMINUS] = &&prefix##_uminus,                \
+    [INST_FMINUS] = &&prefix##_fminus,                \
+    [INST_SMULT] = &&prefix##_smult,                  \
+    [INST_UMULT] = &&prefix##_umult,                  \
+    [INST_FMULT] = &&prefix##_fmult,                  \
+    [INST_SDIV] = &&prefix##_sdiv,                    \
+    [INST_UDIV] = &&prefix##_udiv,                    \
+    [INST_FDIV] = &&prefix##_fdiv,                    \
+    [INST_JMP] = &&op_jmp,                            \
+    [INST_HALT] = &&op_halt,                          \
+    [INST_UJMP_IF] = &&prefix##_ujmp_if,              \
+    [INST_FJMP_IF] = &&prefix##_fjmp_if,              \
+    [INST_EQ] = &&op_illegal,                         \
+    [INST_LSR] = &&prefix##_lsr,                      \
+    [INST_ASR] = &&prefix##_asr,                      \
+    [INST_SL] = &&prefix##_sl,                        \
+    [INST_ANDB] = &&prefix##_andb,                    \
+    [INST_ORB] = &&prefix##_orb,                      \
+    [INST_NOTB] = &&prefix##_notb,                    \
+    [INST_EMPTY] = &&prefix##_empty,                  \
+    [INST_POP_AT] = &&op_pop_at,                      \
+    [INST_POP] = &&prefix##_pop,                      \
+    [INST_RSWAP] = &&prefix##_rswap,                  \
+    [INST_ASWAP] = &&op_aswap,                        \
+    [INST_RET] = &&prefix##_ret,                      \
+    [INST_CALL] = &&prefix##_call,                    \
+    [INST_NATIVE] = &&op_native,                      \
+    [INST_STORE8] = &&prefix##_store8,                \
+    [INST_STORE16] = &&prefix##_store16,              \
+    [INST_STORE32] = &&prefix##_store32,              \
+    [INST_STORE64] = &&prefix##_store64,              \
+    [INST_ZELOAD8] = &&prefix##_zeload8,              \
+    [INST_ZELOAD16] = &&prefix##_zeload16,            \
+    [INST_ZELOAD32] = &&prefix##_zeload32,            \
+    [INST_LOAD64] = &&prefix##_load64,                \
+    [INST_SELOAD8] = &&prefix##_seload8,              \
+    [INST_SELOAD16] = &&prefix##_seload16,            \
+    [INST_SELOAD32] = &&prefix##_seload32,            \
+    [INST_EQU] = &&prefix##_equ,                      \
+    [INST_EQS] = &&prefix##_eqs,                      \
+    [INST_EQF] = &&prefix##_eqf,                      \
+    [INST_GEU] = &&prefix##_geu,                      \
+    [INST_GES] = &&prefix##_ges,                      \
+    [INST_GEF] = &&prefix##_gef,                      \
+    [INST_LEU] = &&prefix##_leu,                      \
+    [INST_LES] = &&prefix##_les,                      \
+    [INST_LEF] = &&prefix##_lef,                      \
+    [INST_GU] = &&prefix##_gu,                        \
+    [INST_GS] = &&prefix##_gs,                        \
+    [INST_GF] = &&prefix##_gf,                        \
+    [INST_LU] = &&prefix##_lu,                        \
+    [INST_LS] = &&prefix##_ls,                        \
+    [INST_LF] = &&prefix##_lf,                        \
+    [INST_FTU] = &&prefix##_ftu,                      \
+    [INST_FTS] = &&prefix##_fts,                      \
+    [INST_STF] = &&prefix##_stf,                      \
+    [INST_UTF] = &&prefix##_utf,                      \
+    [INST_STU] = &&prefix##_stu,                      \
+    [INST_UTS] = &&prefix##_uts,                      \
+    [HANDLER_ILLEGAL_JMP] = &&op_illegal_jmp,         \
+    [HANDLER_ILLEGAL_CALL] = &&op_illegal_call,       \
+    [HANDLER_JMP_BACK] = &&op_jmp_back,               \
+    [HANDLER_UJMP_IF_BACK] = &&prefix##_ujmp_if_back, \
+    [HANDLER_PUSH_UPLUS] = &&prefix##_push_uplus,     \
+    [HANDLER_PUSH_SPLUS] = &&prefix##_push_splus,     \
+    [HANDLER_PUSH_UMINUS] = &&prefix##_push_uminus,   \
+    [HANDLER_PUSH_SMINUS] = &&prefix##_push_sminus,   \
+    [HANDLER_PUSH_LOAD64] = &&prefix##_push_load64,   \
+    [HANDLER_PUSH_STORE64] = &&prefix##_push_store64, \
+    [HANDLER_RDUP_LOAD64] = &&prefix##_rdup_load64,   \
+    [HANDLER_EQU_UJMP_IF] = &&prefix##_equ_ujmp_if,   \
+    [HANDLER_EQS_UJMP_IF] = &&prefix##_eqs_ujmp_if,   \
+    [HANDLER_EQF_UJMP_IF] = &&prefix##_eqf_ujmp_if,   \
+    [HANDLER_GEU_UJMP_IF] = &&prefix##_geu_ujmp_if,   \
+    [HANDLER_GES_UJMP_IF] = &&prefix##_ges_ujmp_if,   \
+    [HANDLER_GEF_UJMP_IF] = &&prefix##_gef_ujmp_if,   \
+    [HANDLER_LEU_UJMP_IF] = &&prefix##_leu_ujmp_if,   \
+    [HANDLER_LES_UJMP_IF] = &&prefix##_les_ujmp_if,   \
+    [HANDLER_LEF_UJMP_IF] = &&prefix##_lef_ujmp_if,   \
+    [HANDLER_GU_UJMP_IF] = &&prefix##_gu_ujmp_if,     \
+    [HANDLER_GS_UJMP_IF] = &&prefix##_gs_ujmp_if,     \
+    [HANDLER_GF_UJMP_IF] = &&prefix##_gf_ujmp_if,     \
+    [HANDLER_LU_UJMP_IF] = &&prefix##_lu_ujmp_if,     \
+    [HANDLER_LS_UJMP_IF] = &&prefix##_ls_ujmp_if,     \
+    [HANDLER_LF_UJMP_IF] = &&prefix##_lf_ujmp_if
+
+    static const void *dispatch_table[HANDLER_COUNT] = {HANDLERS(op)};
+    static const void *unchecked_table[HANDLER_COUNT] = {HANDLERS(unchecked)};
+#undef HANDLERS
+
+    if (!vm)
     {
-        fprintf(stderr, "Invalid Pointer to the Instruction Array\n");
-        return FAILURE;
+        threaded_handlers = dispatch_table;
+        threaded_unchecked_handlers = unchecked_table;
+        return TRAP_OK;
     }
-    memcpy(vm->program, program, program_size * sizeof(program[0]));
-    vm->program_size = program_size;
 
-    return SUCCESS;
-}
+    Trap ret = TRAP_OK;
+    const Decoded_Inst *ip = &vm->decoded[vm->instruction_pointer];
+    size_t shadow_top = vm->shadow_top; // live entries of vm->return_shadow
+    int64_t left = budget ? *budget : 0;
+
+    // the stack top lives in 'tos' and the stack pointer in 'sp' (one past the top) for as long as the loop runs;
+    // sp[-1] is stale while tos is live and sp[-2] is the entry below it
+    // vm->stack is only brought up to date around natives and on the way out, which is also why adup, aswap and
+    // pop_at, that index the stack from its bottom, write tos back first
+    // pushing spills tos to sp[-1] and popping reloads it without looking at the depth, which lands on the guard slot
+    // vm_init() keeps below vm->stack when the stack is empty
+    Value *const base = vm->stack;
+    Value *const limit = base + vm_stack_capacity;
+    Value *sp = base + vm->stack_size;
+    Value tos = sp[-1];
+
+#define DISPATCH() goto *ip->handler
+
+#define NEXT()      \
+    do              \
+    {               \
+        ip++;       \
+        DISPATCH(); \
+    } while (false)
 
-void label_init()
-{
-    /* label_array = malloc(sizeof(label_point_location) * label_capacity);
-    if (!label_array)
-    {
-        fprintf(stderr, "ERROR: label array allocation failed: %s\n", strerror(errno));
-        exit(EXIT_FAILURE);
-    } */
+#define SYNC_IP() (vm->instruction_pointer = ip - vm->decoded)
+
+#define SPILL()                     \
+    do                              \
+    {                               \
+        sp[-1] = tos;               \
+        vm->stack_size = sp - base; \
+    } while (false)
+
+#define FILL()                      \
+    do                              \
+    {                               \
+        sp = base + vm->stack_size; \
+        tos = sp[-1];               \
+    } while (false)
+
+#define TRAP(trap)     \
+    do                 \
+    {                  \
+        ret = (trap);  \
+        goto trap_out; \
+    } while (false)
+
+#define CHARGE()                                                                  \
+    do                                                                            \
+    {                                                                             \
+        if (budget && (left -= (int64_t)vm->block_lengths[ip - vm->decoded]) < 0) \
+        {                                                                         \
+            goto out_of_budget;                                                   \
+        }                                                                         \
+    } while (false)
 
-    not_resolved_yet = malloc(sizeof(label_inst_location) * label_capacity);
-    if (!not_resolved_yet)
+// every jump, call, return and branch, taken or not, goes on through here
+#define TRANSFER(to) \
+    do               \
+    {                \
+        ip = (to);   \
+        CHARGE();    \
+        DISPATCH();  \
+    } while (false)
+
+#define OPERAND (ip->operand.value)
+#define DEPTH ((size_t)(sp - base))
+#define PUSH(value)           \
+    do                        \
+    {                         \
+        Value next = (value); \
+        sp[-1] = tos;         \
+        tos = next;           \
+        sp++;                 \
+    } while (false)
+#define POP()         \
+    do                \
+    {                 \
+        sp--;         \
+        tos = sp[-1]; \
+    } while (false)
+#define REQUIRE(n)                  \
+    if (DEPTH < (n))                \
+    {                               \
+        TRAP(TRAP_STACK_UNDERFLOW); \
+    }
+#define ROOM()                     \
+    if (sp >= limit)               \
+    {                              \
+        TRAP(TRAP_STACK_OVERFLOW); \
+    }
+
+// same results as the handle_* arithmetic handlers: each in its own type, signed ones on their two's complement bits
+#define ARITH_OP(field, op)                                  \
+    tos._as_##field = sp[-2]._as_##field op tos._as_##field; \
+    sp--;                                                    \
+    NEXT()
+
+#define DIV_OP(field, expression)   \
+    if (tos._as_##field == 0)       \
+    {                               \
+        TRAP(TRAP_DIV_BY_ZERO);     \
+    }                               \
+    tos._as_##field = (expression); \
+    sp--;                           \
+    NEXT()
+
+#define BITWISE_OP(op)                           \
+    tos._as_u64 = sp[-2]._as_u64 op tos._as_u64; \
+    sp--;                                        \
+    NEXT()
+
+#define CMP_OP(in, op)                             \
+    tos._as_u64 = sp[-2]._as_##in op tos._as_##in; \
+    sp--;                                          \
+    NEXT()
+
+#define CONVERT_OP(in, out)       \
+    tos._as_##out = tos._as_##in; \
+    NEXT()
+
+#define LOAD_OP(out, type)                                    \
+    if (tos._as_u64 >= vm_memory_capacity - sizeof(type))     \
+    {                                                         \
+        TRAP(TRAP_ILLEGAL_MEMORY_ACCESS);                     \
+    }                                                         \
+    tos._as_##out = *(type *)&vm->static_memory[tos._as_u64]; \
+    NEXT()
+
+#define STORE_OP(type)                                               \
+    if (tos._as_u64 >= vm_memory_capacity - sizeof(type))            \
+    {                                                                \
+        TRAP(TRAP_ILLEGAL_MEMORY_ACCESS);                            \
+    }                                                                \
+    *(type *)&vm->static_memory[tos._as_u64] = (type)sp[-2]._as_u64; \
+    sp -= 2;                                                         \
+    tos = sp[-1];                                                    \
+    NEXT()
+
+    DISPATCH();
+
+op_nop:
+    NEXT();
+
+op_push:
+    ROOM();
+unchecked_push:
+    PUSH(OPERAND);
+    NEXT();
+
+op_rdup:
+    ROOM();
+    if (OPERAND._as_u64 >= DEPTH)
     {
-        fprintf(stderr, "ERROR: label resolution array allocation failed: %s\n", strerror(errno));
-        exit(EXIT_FAILURE);
+        TRAP(TRAP_STACK_UNDERFLOW);
     }
-}
+unchecked_rdup:
+    sp[-1] = tos;
+    PUSH(sp[-1 - (int64_t)OPERAND._as_u64]);
+    NEXT();
 
-void label_free()
+op_adup:
 {
-    free((void *)not_resolved_yet);
-    for (size_t i = 0; i < MAX_HASHTABLE_SIZE; i++)
+    uint64_t index = OPERAND._as_u64;
+    if (sp >= limit || index >= DEPTH)
     {
-        Hashnode *current_node = bucket[i];
-        while (current_node)
-        {
-            Hashnode *temp = current_node->next;
-            free(current_node);
-            current_node = temp;
-        }
+        TRAP(TRAP_STACK_OVERFLOW);
     }
-    /* free((void *)label_array); */
+    sp[-1] = tos;
+    PUSH(base[index]);
+    NEXT();
 }
 
-void vm_init(VirtualMachine *vm, char *source_code)
-{
-    vm->stack = malloc(sizeof(Value) * vm_stack_capacity);
-    if (!vm->stack)
+op_splus:
+    REQUIRE(2);
+unchecked_splus:
+    ARITH_OP(u64, +);
+op_uplus:
+    REQUIRE(2);
+unchecked_uplus:
+    ARITH_OP(u64, +);
+op_fplus:
+    REQUIRE(2);
+unchecked_fplus:
+    ARITH_OP(f64, +);
+op_sminus:
+    REQUIRE(2);
+unchecked_sminus:
+    ARITH_OP(u64, -);
+op_uminus:
+    REQUIRE(2);
+unchecked_uminus:
+    ARITH_OP(u64, -);
+op_fminus:
+    REQUIRE(2);
+unchecked_fminus:
+    ARITH_OP(f64, -);
+op_smult:
+    REQUIRE(2);
+unchecked_smult:
+    ARITH_OP(u64, *);
+op_umult:
+    REQUIRE(2);
+unchecked_umult:
+    ARITH_OP(u64, *);
+op_fmult:
+    REQUIRE(2);
+unchecked_fmult:
+    ARITH_OP(f64, *);
+op_sdiv:
+    REQUIRE(2);
+unchecked_sdiv:
+    DIV_OP(s64, VM_SDIV(sp[-2]._as_s64, tos._as_s64));
+op_udiv:
+    REQUIRE(2);
+unchecked_udiv:
+    DIV_OP(u64, sp[-2]._as_u64 / tos._as_u64);
+op_fdiv:
+    REQUIRE(2);
+unchecked_fdiv:
+    DIV_OP(f64, sp[-2]._as_f64 / tos._as_f64);
+
+op_jmp:
+    TRANSFER(ip->operand.target);
+
+op_ujmp_if:
+    REQUIRE(1);
+unchecked_ujmp_if:
+    if (tos._as_u64)
     {
-        fprintf(stderr, "ERROR: stack allocation failed: %s\n", strerror(errno));
-        exit(EXIT_FAILURE);
+        POP();
+        TRANSFER(ip->operand.target);
     }
+    TRANSFER(ip + 1);
 
-    vm->program = malloc(sizeof(Inst) * vm_program_capacity);
-    if (!vm->program)
+op_fjmp_if:
+    REQUIRE(1);
+unchecked_fjmp_if:
+    if (!(tos._as_f64 < EPSILON))
     {
-        fprintf(stderr, "ERROR: code section allocation failed: %s\n", strerror(errno));
-        exit(EXIT_FAILURE);
+        POP();
+        TRANSFER(ip->operand.target);
     }
+    TRANSFER(ip + 1);
 
-    vm->natives = malloc(sizeof(native) * natives_capacity);
-    if (!vm->natives)
+op_illegal_jmp:
+    TRAP(TRAP_ILLEGAL_JMP);
+
+// back edges count how often their loop header is reached; past vm_trace_threshold the loop is handed to
+// vm_trace_enter(), from then on every time, as a traced loop's counter never drops below the threshold again
+// budgeted runs don't trace, a trace wouldn't stop for the budget
+op_jmp_back:
+    ip = ip->operand.target;
+    if (budget)
     {
-        fprintf(stderr, "ERROR: native function pointer array allocation failed: %s\n", strerror(errno));
-        exit(EXIT_FAILURE);
+        TRANSFER(ip);
     }
-    vm->natives_size = 0;
-
-    vm->static_memory = calloc(sizeof(uint8_t) * vm_memory_capacity, 1);
-    if (!vm->static_memory)
+    if (++vm->hot_counters[ip - vm->decoded] >= (int64_t)vm_trace_threshold)
     {
-        fprintf(stderr, "ERROR: static memory allocation failed: %s\n", strerror(errno));
-        exit(EXIT_FAILURE);
+        goto hot_loop;
     }
+    DISPATCH();
 
-    vm->static_break = vm_default_memory_size;
-
-    vm_header_ header = vm_load_program_from_file(vm->program, vm->static_memory, source_code);
+op_ujmp_if_back:
+    REQUIRE(1);
+unchecked_ujmp_if_back:
+    if (tos._as_u64)
+    {
+        POP();
+        ip = ip->operand.target;
+        if (budget)
+        {
+            TRANSFER(ip);
+        }
+        if (++vm->hot_counters[ip - vm->decoded] >= (int64_t)vm_trace_threshold)
+        {
+            goto hot_loop;
+        }
+        DISPATCH();
+    }
+    TRANSFER(ip + 1);
+
+hot_loop:
+    SPILL();
+    SYNC_IP();
+    vm->shadow_top = shadow_top;
+    return VM_HOT_LOOP;
+
+out_of_budget:
+    left += (int64_t)vm->block_lengths[ip - vm->decoded];
+    *budget = left;
+    SPILL();
+    SYNC_IP();
+    vm->shadow_top = shadow_top;
+    return VM_OUT_OF_BUDGET;
+
+op_halt:
+    SPILL();
+    SYNC_IP();
+    vm->shadow_top = shadow_top;
+    vm->halt = 1;
+    return TRAP_OK;
 
-    vm->program_size = header.code_section_size;
-    vm->has_start = header.has_start;
-    if (vm->has_start)
+op_lsr:
+    REQUIRE(1);
+unchecked_lsr:
+    tos._as_u64 >>= OPERAND._as_u64;
+    NEXT();
+
+op_asr:
+    REQUIRE(1);
+unchecked_asr:
+    tos._as_s64 >>= OPERAND._as_u64;
+    NEXT();
+
+op_sl:
+    REQUIRE(1);
+unchecked_sl:
+    tos._as_u64 <<= OPERAND._as_u64;
+    NEXT();
+
+op_andb:
+    REQUIRE(2);
+unchecked_andb:
+    BITWISE_OP(&);
+
+op_orb:
+    REQUIRE(2);
+unchecked_orb:
+    BITWISE_OP(|);
+
+op_notb:
+    REQUIRE(1);
+unchecked_notb:
+    tos._as_u64 = ~tos._as_u64;
+    NEXT();
+
+op_empty:
+    ROOM();
+unchecked_empty:
+    if (sp > base)
     {
-        vm->instruction_pointer = header.start_location;
+        PUSH((Value){._as_u64 = 0});
     }
     else
     {
-        fprintf(stderr, "ERROR: 'start' not found in %s; Defaulting to the first VASM instruction\n", source_code);
-        vm->instruction_pointer = 0;
+        PUSH((Value){._as_s64 = 1});
     }
-    vm->stack_size = 0;
-    vm->halt = 0;
-}
-
-void vm_internal_free(VirtualMachine *vm)
-{
-    free((void *)vm->program);
-    free((void *)vm->natives);
-    free((void *)vm->stack);
-    free((void *)vm->static_memory);
-}
+    NEXT();
 
-int vm_exec_program(VirtualMachine *vm, int64_t limit, bool debug)
+op_pop_at:
 {
-    int ret;
-    if (vm->program[vm->program_size - 1].type != INST_HALT)
+    size_t index_to_pop = OPERAND._as_u64;
+    if (index_to_pop >= DEPTH)
     {
-        return TRAP_NO_HALT_FOUND;
+        TRAP(TRAP_STACK_OVERFLOW);
     }
-    while (!vm->halt && limit != 0)
+    sp[-1] = tos;
+    memmove(&base[index_to_pop], &base[index_to_pop + 1], (DEPTH - 1 - index_to_pop) * sizeof(Value));
+    POP();
+    NEXT();
+}
+
+op_pop:
+    REQUIRE(1);
+unchecked_pop:
+    POP();
+    NEXT();
+
+op_rswap:
+    if (OPERAND._as_u64 >= DEPTH)
     {
-        if (debug)
-        {
-            getchar();
-            fprintf(stdout, "%s\n", get_inst_name(vm->program[vm->instruction_pointer].type));
-        }
-        ret = vm_execute_at_inst_pointer(vm);
-        if (debug)
-        {
-            vm_dump_stack(stdout, vm);
-        }
-        if (ret != TRAP_OK)
-        {
-            fprintf(stderr, "Trap activated: %s\n", trap_as_cstr(ret));
-            return ret;
-            // vm_dump_stack(stderr, &vm);
-        }
-        // vm_dump_stack(stdout, &vm);
-        if (limit > 0)
-        {
-            limit--;
-        }
+        TRAP(TRAP_STACK_UNDERFLOW);
     }
-    // vm_dump_stack(stdout, vm);
-    return SUCCESS;
+unchecked_rswap:
+{
+    // tos goes to memory first so that rswap 0 swaps it with itself
+    Value *other = &sp[-1 - (int64_t)OPERAND._as_u64];
+    sp[-1] = tos;
+    tos = *other;
+    *other = sp[-1];
+    NEXT();
 }
 
-void vm_push_inst(VirtualMachine *vm, Inst *inst)
+op_aswap:
 {
-    if (vm->program_size == vm_program_capacity)
+    uint64_t operand = OPERAND._as_u64;
+    if (operand >= DEPTH)
     {
-        fprintf(stderr, "Program Size Limit Exceeded");
-        exit(EXIT_FAILURE);
+        TRAP(TRAP_STACK_OVERFLOW);
     }
-
-    vm->program[vm->program_size++ - 1] = *inst;
+    sp[-1] = tos;
+    tos = base[operand];
+    base[operand] = sp[-1];
+    NEXT();
 }
 
-void vm_save_program_to_file(Inst *program, uint8_t *data_section, vm_header_ header, const char *file_path)
-{
-    FILE *f = fopen(file_path, "wb");
-    if (!f)
+op_ret:
+    REQUIRE(1);
+    if (tos._as_u64 >= vm->program_size)
     {
-        fprintf(stderr, "ERROR: Could not open file '%s': %s\n", file_path, strerror(errno));
-        exit(EXIT_FAILURE);
+        TRAP(TRAP_ILLEGAL_JMP);
     }
+    ip = &vm->decoded[tos._as_u64];
+    POP();
+    TRANSFER(ip);
 
-    fwrite(&header, sizeof(header), 1, f);
-    if (ferror(f)) // did some error occur due to the last stdio function call on f?
+unchecked_ret:
+    if (shadow_top > 0 && tos._as_u64 == vm->return_shadow[shadow_top - 1])
     {
-        fprintf(stderr, "ERROR: Could not write to file '%s': %s\n", file_path, strerror(errno));
-        fclose(f);
-        exit(EXIT_FAILURE);
+        shadow_top--;
+        ip = &vm->decoded[tos._as_u64];
+        POP();
+        TRANSFER(ip);
     }
 
-    fwrite(data_section, sizeof(uint8_t), header.data_section_size, f);
-    if (ferror(f)) // did some error occur due to the last stdio function call on f?
+    // the return address was replaced; the depths proved past this point no longer hold
+    vm->verified = false;
+    SYNC_IP();
+    vm_decode_program(vm);
+    ip = &vm->decoded[vm->instruction_pointer];
+    goto op_ret;
+
+op_call:
+    ROOM();
+    PUSH((Value){._as_u64 = (ip - vm->decoded) + 1}); // return addresses stay plain instruction indices
+    TRANSFER(ip->operand.target);
+
+unchecked_call:
+    vm->return_shadow[shadow_top++] = (ip - vm->decoded) + 1;
+    PUSH((Value){._as_u64 = (ip - vm->decoded) + 1});
+    TRANSFER(ip->operand.target);
+
+op_illegal_call:
+    ROOM();
+    TRAP(TRAP_ILLEGAL_JMP);
+
+op_native:
+    if (OPERAND._as_u64 >= vm->natives_size)
     {
-        fprintf(stderr, "ERROR: Could not write to file '%s': %s\n", file_path, strerror(errno));
-        fclose(f);
-        exit(EXIT_FAILURE);
+        TRAP(TRAP_ILLEGAL_OPERAND);
+    }
+    SPILL();
+    SYNC_IP();
+    ret = vm->natives[OPERAND._as_u64](vm);
+    FILL();
+    if (ret != TRAP_OK)
+    {
+        goto trap_out;
+    }
+    ip++;
+    DISPATCH();
+
+op_store8:
+    REQUIRE(2);
+unchecked_store8:
+    STORE_OP(uint8_t);
+op_store16:
+    REQUIRE(2);
+unchecked_store16:
+    STORE_OP(uint16_t);
+op_store32:
+    REQUIRE(2);
+unchecked_store32:
+    STORE_OP(uint32_t);
+op_store64:
+    REQUIRE(2);
+unchecked_store64:
+    STORE_OP(uint64_t);
+
+op_zeload8:
+    REQUIRE(1);
+unchecked_zeload8:
+    LOAD_OP(u64, uint8_t);
+op_zeload16:
+    REQUIRE(1);
+unchecked_zeload16:
+    LOAD_OP(u64, uint16_t);
+op_zeload32:
+    REQUIRE(1);
+unchecked_zeload32:
+    LOAD_OP(u64, uint32_t);
+op_load64:
+    REQUIRE(1);
+unchecked_load64:
+    LOAD_OP(u64, uint64_t);
+op_seload8:
+    REQUIRE(1);
+unchecked_seload8:
+    LOAD_OP(s64, int8_t);
+op_seload16:
+    REQUIRE(1);
+unchecked_seload16:
+    LOAD_OP(s64, int16_t);
+op_seload32:
+    REQUIRE(1);
+unchecked_seload32:
+    LOAD_OP(s64, int32_t);
+
+op_equ:
+    REQUIRE(2);
+unchecked_equ:
+    CMP_OP(u64, ==);
+op_eqs:
+    REQUIRE(2);
+unchecked_eqs:
+    CMP_OP(s64, ==);
+op_eqf:
+    REQUIRE(2);
+unchecked_eqf:
+    CMP_OP(f64, ==);
+op_geu:
+    REQUIRE(2);
+unchecked_geu:
+    CMP_OP(u64, >=);
+op_ges:
+    REQUIRE(2);
+unchecked_ges:
+    CMP_OP(s64, >=);
+op_gef:
+    REQUIRE(2);
+unchecked_gef:
+    CMP_OP(f64, >=);
+op_leu:
+    REQUIRE(2);
+unchecked_leu:
+    CMP_OP(u64, <=);
+op_les:
+    REQUIRE(2);
+unchecked_les:
+    CMP_OP(s64, <=);
+op_lef:
+    REQUIRE(2);
+unchecked_lef:
+    CMP_OP(f64, <=);
+op_gu:
+    REQUIRE(2);
+unchecked_gu:
+    CMP_OP(u64, >);
+op_gs:
+    REQUIRE(2);
+unchecked_gs:
+    CMP_OP(s64, >);
+op_gf:
+    REQUIRE(2);
+unchecked_gf:
+    CMP_OP(f64, >);
+op_lu:
+    REQUIRE(2);
+unchecked_lu:
+    CMP_OP(u64, <);
+op_ls:
+    REQUIRE(2);
+unchecked_ls:
+    CMP_OP(s64, <);
+op_lf:
+    REQUIRE(2);
+unchecked_lf:
+    CMP_OP(f64, <);
+
+op_ftu:
+    REQUIRE(1);
+unchecked_ftu:
+    tos._as_u64 = (uint64_t)(int64_t)tos._as_f64; // see handle_conversions()
+    NEXT();
+op_fts:
+    REQUIRE(1);
+unchecked_fts:
+    CONVERT_OP(f64, s64);
+op_stf:
+    REQUIRE(1);
+unchecked_stf:
+    CONVERT_OP(s64, f64);
+op_utf:
+    REQUIRE(1);
+unchecked_utf:
+    CONVERT_OP(u64, f64);
+op_stu:
+    REQUIRE(1);
+unchecked_stu:
+    CONVERT_OP(s64, u64);
+op_uts:
+    REQUIRE(1);
+unchecked_uts:
+    CONVERT_OP(u64, s64);
+
+// superinstructions: the op_* entry checks everything both halves would, and if any of it fails it hands over to
+// the first half's own handler so the pair runs, and traps, exactly as it would unfused
+// the memory checks stay on the unchecked entries as well, the verifier doesn't prove addresses
+#define PUSH_ARITH_OP(name, field, op)                        \
+    op_push_##name:                                           \
+    if (sp <= base || sp >= limit)                            \
+    {                                                         \
+        goto op_push;                                         \
+    }                                                         \
+    unchecked_push_##name:                                    \
+    tos._as_##field = tos._as_##field op OPERAND._as_##field; \
+    ip += 2;                                                  \
+    DISPATCH()
+
+// the comparison's result is only left on the stack when ujmp_if falls through, as that is when it doesn't pop
+#define CMP_UJMP_IF_OP(name, in, op)     \
+    op_##name##_ujmp_if:                 \
+    if (DEPTH < 2)                       \
+    {                                    \
+        goto op_##name;                  \
+    }                                    \
+    unchecked_##name##_ujmp_if:          \
+    if (sp[-2]._as_##in op tos._as_##in) \
+    {                                    \
+        sp -= 2;                         \
+        tos = sp[-1];                    \
+        TRANSFER(ip->operand.target);    \
+    }                                    \
+    tos._as_u64 = 0;                     \
+    sp--;                                \
+    TRANSFER(ip + 2)
+
+    PUSH_ARITH_OP(uplus, u64, +);
+    PUSH_ARITH_OP(splus, u64, +);
+    PUSH_ARITH_OP(uminus, u64, -);
+    PUSH_ARITH_OP(sminus, u64, -);
+
+op_push_load64:
+    ROOM();
+unchecked_push_load64:
+    if (OPERAND._as_u64 >= vm_memory_capacity - sizeof(uint64_t))
+    {
+        goto op_push;
     }
+    PUSH((Value){._as_u64 = *(uint64_t *)&vm->static_memory[OPERAND._as_u64]});
+    ip += 2;
+    DISPATCH();
 
-    fwrite(program, sizeof(Inst), header.code_section_size, f);
-    if (ferror(f)) // did some error occur due to the last stdio function call on f?
+op_push_store64:
+    if (sp <= base || sp >= limit)
     {
-        fprintf(stderr, "ERROR: Could not write to file '%s': %s\n", file_path, strerror(errno));
-        fclose(f);
-        exit(EXIT_FAILURE);
+        goto op_push;
     }
+unchecked_push_store64:
+    if (OPERAND._as_u64 >= vm_memory_capacity - sizeof(uint64_t))
+    {
+        goto op_push;
+    }
+    *(uint64_t *)&vm->static_memory[OPERAND._as_u64] = tos._as_u64;
+    POP();
+    ip += 2;
+    DISPATCH();
 
-    fclose(f);
+op_rdup_load64:
+    if (sp >= limit || OPERAND._as_u64 >= DEPTH)
+    {
+        goto op_rdup;
+    }
+unchecked_rdup_load64:
+{
+    uint64_t address = OPERAND._as_u64 == 0 ? tos._as_u64 : sp[-1 - (int64_t)OPERAND._as_u64]._as_u64;
+    if (address >= vm_memory_capacity - sizeof(uint64_t))
+    {
+        goto op_rdup;
+    }
+    PUSH((Value){._as_u64 = *(uint64_t *)&vm->static_memory[address]});
+    ip += 2;
+    DISPATCH();
+}
+
+    CMP_UJMP_IF_OP(equ, u64, ==);
+    CMP_UJMP_IF_OP(eqs, s64, ==);
+    CMP_UJMP_IF_OP(eqf, f64, ==);
+    CMP_UJMP_IF_OP(geu, u64, >=);
+    CMP_UJMP_IF_OP(ges, s64, >=);
+    CMP_UJMP_IF_OP(gef, f64, >=);
+    CMP_UJMP_IF_OP(leu, u64, <=);
+    CMP_UJMP_IF_OP(les, s64, <=);
+    CMP_UJMP_IF_OP(lef, f64, <=);
+    CMP_UJMP_IF_OP(gu, u64, >);
+    CMP_UJMP_IF_OP(gs, s64, >);
+    CMP_UJMP_IF_OP(gf, f64, >);
+    CMP_UJMP_IF_OP(lu, u64, <);
+    CMP_UJMP_IF_OP(ls, s64, <);
+    CMP_UJMP_IF_OP(lf, f64, <);
+
+op_illegal:
+    ret = TRAP_ILLEGAL_INSTRUCTION;
+
+trap_out:
+    SPILL();
+    SYNC_IP();
+    vm->shadow_top = shadow_top;
+    return ret;
+
+#undef DISPATCH
+#undef NEXT
+#undef SYNC_IP
+#undef SPILL
+#undef FILL
+#undef TRAP
+#undef CHARGE
+#undef TRANSFER
+#undef OPERAND
+#undef DEPTH
+#undef PUSH
+#undef POP
+#undef REQUIRE
+#undef ROOM
+#undef ARITH_OP
+#undef DIV_OP
+#undef BITWISE_OP
+#undef CMP_OP
+#undef CONVERT_OP
+#undef LOAD_OP
+#undef STORE_OP
+#undef PUSH_ARITH_OP
+#undef CMP_UJMP_IF_OP
+}
+
+#pragma GCC diagnostic pop
+
+// one time pass over the loaded program that resolves everything the switch interpreter re-derives on every step:
+// the handler for the Inst_Type (illegal types included) and the jump/call destinations, which are bounds checked here
+// once so the handlers can follow them blindly; a bad target still only traps if the instruction is ever executed
+// a verified program is decoded onto the unchecked entry points
+void vm_decode_program(VirtualMachine *vm)
+{
+    if (!threaded_handlers)
+    {
+        vm_exec_threaded(NULL, NULL);
+    }
+    const void *const *handlers = vm->verified ? threaded_unchecked_handlers : threaded_handlers;
+
+    // counters and traces belong to the program, not to one decoding of it, so a deopt keeps them
+    bool tracing = VM_HAS_JIT && vm_trace_threshold > 0;
+    if (tracing && !vm->hot_counters)
+    {
+        vm->hot_counters = calloc(vm->program_size > 0 ? vm->program_size : 1, sizeof(int64_t));
+        vm->traces = calloc(vm->program_size > 0 ? vm->program_size : 1, sizeof(Vm_Trace));
+        if (!vm->hot_counters || !vm->traces)
+        {
+            fprintf(stderr, "ERROR: trace table allocation failed: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    free((void *)vm->decoded);
+    vm->decoded = malloc(sizeof(Decoded_Inst) * (vm->program_size > 0 ? vm->program_size : 1));
+    if (!vm->decoded)
+    {
+        fprintf(stderr, "ERROR: decoded program allocation failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < vm->program_size; i++)
+    {
+        Inst inst = vm->program[i];
+        Decoded_Inst *decoded = &vm->decoded[i];
+
+        if ((uint32_t)inst.type >= INST_COUNT)
+        {
+            decoded->handler = handlers[0];
+            continue;
+        }
+
+        decoded->handler = handlers[inst.type];
+        decoded->operand.value = inst.operand;
+
+        switch (inst.type)
+        {
+        case INST_JMP:
+        case INST_UJMP_IF:
+        case INST_FJMP_IF:
+            if (inst.operand._as_u64 >= vm->program_size)
+            {
+                decoded->handler = handlers[HANDLER_ILLEGAL_JMP];
+            }
+            else
+            {
+                decoded->operand.target = &vm->decoded[inst.operand._as_u64];
+                if (tracing && inst.type != INST_FJMP_IF && inst.operand._as_u64 <= i)
+                {
+                    // counted, and so never fused into a compare-and-branch superinstruction below
+                    decoded->handler = handlers[inst.type == INST_JMP ? HANDLER_JMP_BACK : HANDLER_UJMP_IF_BACK];
+                }
+            }
+            break;
+
+        case INST_CALL:
+            if (inst.operand._as_u64 >= vm->program_size)
+            {
+                decoded->handler = handlers[HANDLER_ILLEGAL_CALL];
+            }
+            else
+            {
+                decoded->operand.target = &vm->decoded[inst.operand._as_u64];
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    memset(vm->fused, 0, sizeof(vm->fused));
+    if (!vm_fusion_enabled)
+    {
+        return;
+    }
+
+    // pairs don't overlap; the second instruction of a pair keeps its handler, so a jump into the middle of one, or a
+    // superinstruction handing over to the first half, still runs it on its own
+    for (size_t i = 0; i + 1 < vm->program_size; i++)
+    {
+        Handler_Id fused = vm_fusion_for(vm->program[i], vm->program[i + 1]);
+        if (fused == 0)
+        {
+            continue;
+        }
+        if (fused >= HANDLER_EQU_UJMP_IF)
+        {
+            if (vm->decoded[i + 1].handler != handlers[INST_UJMP_IF]) // the jump target failed its check
+            {
+                continue;
+            }
+            vm->decoded[i].operand.target = vm->decoded[i + 1].operand.target;
+        }
+        vm->decoded[i].handler = handlers[fused];
+        vm->fused[fused]++;
+        i++;
+    }
+}
+
+// the superinstruction a pair of adjacent instructions fuses into, 0 if none
+static Handler_Id vm_fusion_for(Inst first, Inst second)
+{
+    bool push = first.type == INST_UPUSH || first.type == INST_SPUSH;
+
+    switch (second.type)
+    {
+    case INST_UPLUS:
+        return push ? HANDLER_PUSH_UPLUS : 0;
+    case INST_SPLUS:
+        return push ? HANDLER_PUSH_SPLUS : 0;
+    case INST_UMINUS:
+        return push ? HANDLER_PUSH_UMINUS : 0;
+    case INST_SMINUS:
+        return push ? HANDLER_PUSH_SMINUS : 0;
+    case INST_STORE64:
+        return first.type == INST_UPUSH ? HANDLER_PUSH_STORE64 : 0;
+    case INST_LOAD64:
+        if (first.type == INST_UPUSH)
+        {
+            return HANDLER_PUSH_LOAD64;
+        }
+        return first.type == INST_RDUP ? HANDLER_RDUP_LOAD64 : 0;
+    case INST_UJMP_IF:
+        break;
+    default:
+        return 0;
+    }
+
+    switch (first.type)
+    {
+    case INST_EQU:
+        return HANDLER_EQU_UJMP_IF;
+    case INST_EQS:
+        return HANDLER_EQS_UJMP_IF;
+    case INST_EQF:
+        return HANDLER_EQF_UJMP_IF;
+    case INST_GEU:
+        return HANDLER_GEU_UJMP_IF;
+    case INST_GES:
+        return HANDLER_GES_UJMP_IF;
+    case INST_GEF:
+        return HANDLER_GEF_UJMP_IF;
+    case INST_LEU:
+        return HANDLER_LEU_UJMP_IF;
+    case INST_LES:
+        return HANDLER_LES_UJMP_IF;
+    case INST_LEF:
+        return HANDLER_LEF_UJMP_IF;
+    case INST_GU:
+        return HANDLER_GU_UJMP_IF;
+    case INST_GS:
+        return HANDLER_GS_UJMP_IF;
+    case INST_GF:
+        return HANDLER_GF_UJMP_IF;
+    case INST_LU:
+        return HANDLER_LU_UJMP_IF;
+    case INST_LS:
+        return HANDLER_LS_UJMP_IF;
+    case INST_LF:
+        return HANDLER_LF_UJMP_IF;
+    default:
+        return 0;
+    }
+}
+
+#endif // VM_HAS_COMPUTED_GOTO
+
+const char *fused_handler_as_cstr(Handler_Id id)
+{
+    switch (id)
+    {
+    case HANDLER_PUSH_UPLUS:
+        return "push; uplus";
+    case HANDLER_PUSH_SPLUS:
+        return "push; splus";
+    case HANDLER_PUSH_UMINUS:
+        return "push; uminus";
+    case HANDLER_PUSH_SMINUS:
+        return "push; sminus";
+    case HANDLER_PUSH_LOAD64:
+        return "upush; load64";
+    case HANDLER_PUSH_STORE64:
+        return "upush; store64";
+    case HANDLER_RDUP_LOAD64:
+        return "rdup; load64";
+    case HANDLER_EQU_UJMP_IF:
+        return "equ; ujmp_if";
+    case HANDLER_EQS_UJMP_IF:
+        return "eqs; ujmp_if";
+    case HANDLER_EQF_UJMP_IF:
+        return "eqf; ujmp_if";
+    case HANDLER_GEU_UJMP_IF:
+        return "geu; ujmp_if";
+    case HANDLER_GES_UJMP_IF:
+        return "ges; ujmp_if";
+    case HANDLER_GEF_UJMP_IF:
+        return "gef; ujmp_if";
+    case HANDLER_LEU_UJMP_IF:
+        return "leu; ujmp_if";
+    case HANDLER_LES_UJMP_IF:
+        return "les; ujmp_if";
+    case HANDLER_LEF_UJMP_IF:
+        return "lef; ujmp_if";
+    case HANDLER_GU_UJMP_IF:
+        return "gu; ujmp_if";
+    case HANDLER_GS_UJMP_IF:
+        return "gs; ujmp_if";
+    case HANDLER_GF_UJMP_IF:
+        return "gf; ujmp_if";
+    case HANDLER_LU_UJMP_IF:
+        return "lu; ujmp_if";
+    case HANDLER_LS_UJMP_IF:
+        return "ls; ujmp_if";
+    case HANDLER_LF_UJMP_IF:
+        return "lf; ujmp_if";
+    default:
+        return NULL;
+    }
+}
+
+// how often each superinstruction was fused into the decoded program; sites, not executions
+void vm_print_fusion_stats(FILE *stream, const VirtualMachine *vm)
+{
+    if (!vm->decoded)
+    {
+        fprintf(stream, "Fusion: not done; only the threaded interpreter fuses, and it didn't run\n");
+        return;
+    }
+
+    size_t total = 0;
+    fprintf(stream, "Fusion:\n");
+    for (size_t id = HANDLER_FUSED_FIRST; id < HANDLER_COUNT; id++)
+    {
+        if (vm->fused[id] > 0)
+        {
+            fprintf(stream, "  %-16s %zu\n", fused_handler_as_cstr((Handler_Id)id), vm->fused[id]);
+            total += vm->fused[id];
+        }
+    }
+    fprintf(stream, "  %-16s %zu of %zu instructions\n", "total pairs", total, vm->program_size);
+}
+
+int vm_load_program_from_memory(VirtualMachine *vm, Inst *program, size_t program_size)
+{
+    if (!program)
+    {
+        fprintf(stderr, "Invalid Pointer to the Instruction Array\n");
+        return FAILURE;
+    }
+    vm_trace_free(vm); // while program_size is still the size the trace tables were made for
+    vm_own_program(vm);
+    if (program_size > vm->program_capacity)
+    {
+        vm->program = vm_grow_array(vm->program, &vm->program_capacity, program_size, sizeof(Inst));
+    }
+    memcpy(vm->program, program, program_size * sizeof(program[0]));
+    vm->program_size = program_size;
+
+    // any earlier proof and decoding was for the old program; vm_exec_program() decodes again on demand
+    vm->verified = false;
+    free((void *)vm->decoded);
+    vm->decoded = NULL;
+    free((void *)vm->block_lengths);
+    vm->block_lengths = NULL;
+    vm_jit_free(vm);
+    vm_reg_free(vm);
+    free((void *)vm->frame_depths);
+    vm->frame_depths = NULL;
+
+    return SUCCESS;
+}
+
+// what one instruction does to the stack as far as vm_verify_program() is concerned: it needs 'needs' entries, takes the
+// stack at most 'peak' above where it started and leaves it 'delta' entries larger on the path it falls through
+// adup, aswap and pop_at index from the stack bottom and keep checking that at run time; jumps, calls and natives are
+// resolved by the caller
+typedef struct
+{
+    int64_t needs;
+    int64_t delta;
+} Inst_Stack_Effect;
+
+static bool verifier_inst_effect(Inst inst, Inst_Stack_Effect *effect)
+{
+    // an rdup/rswap reaching deeper than any stack could be can never be proved; clamp it before it wraps
+    int64_t reach = inst.operand._as_u64 < vm_stack_capacity ? (int64_t)inst.operand._as_u64 + 1 : (int64_t)vm_stack_capacity + 1;
+
+    switch (inst.type)
+    {
+    case INST_NOP:
+    case INST_JMP:
+    case INST_HALT:
+        *effect = (Inst_Stack_Effect){0, 0};
+        return true;
+
+    case INST_SPUSH:
+    case INST_FPUSH:
+    case INST_UPUSH:
+    case INST_ADUP:
+    case INST_EMPTY:
+    case INST_CALL: // the return address
+        *effect = (Inst_Stack_Effect){0, 1};
+        return true;
+
+    case INST_RDUP:
+        *effect = (Inst_Stack_Effect){reach, 1};
+        return true;
+
+    case INST_RSWAP:
+        *effect = (Inst_Stack_Effect){reach, 0};
+        return true;
+
+    case INST_SPLUS:
+    case INST_UPLUS:
+    case INST_FPLUS:
+    case INST_SMINUS:
+    case INST_UMINUS:
+    case INST_FMINUS:
+    case INST_SMULT:
+    case INST_UMULT:
+    case INST_FMULT:
+    case INST_SDIV:
+    case INST_UDIV:
+    case INST_FDIV:
+    case INST_ANDB:
+    case INST_ORB:
+    case INST_EQU:
+    case INST_EQS:
+    case INST_EQF:
+    case INST_GEU:
+    case INST_GES:
+    case INST_GEF:
+    case INST_LEU:
+    case INST_LES:
+    case INST_LEF:
+    case INST_GU:
+    case INST_GS:
+    case INST_GF:
+    case INST_LU:
+    case INST_LS:
+    case INST_LF:
+        *effect = (Inst_Stack_Effect){2, -1};
+        return true;
+
+    case INST_UJMP_IF: // falling through leaves the condition on the stack; the taken branch pops it
+    case INST_FJMP_IF:
+    case INST_LSR:
+    case INST_ASR:
+    case INST_SL:
+    case INST_NOTB:
+    case INST_ASWAP:
+    case INST_ZELOAD8:
+    case INST_ZELOAD16:
+    case INST_ZELOAD32:
+    case INST_LOAD64:
+    case INST_SELOAD8:
+    case INST_SELOAD16:
+    case INST_SELOAD32:
+    case INST_FTU:
+    case INST_FTS:
+    case INST_STF:
+    case INST_UTF:
+    case INST_STU:
+    case INST_UTS:
+        *effect = (Inst_Stack_Effect){1, 0};
+        return true;
+
+    case INST_POP:
+    case INST_POP_AT:
+    case INST_RET:
+        *effect = (Inst_Stack_Effect){1, -1};
+        return true;
+
+    case INST_STORE8:
+    case INST_STORE16:
+    case INST_STORE32:
+    case INST_STORE64:
+        *effect = (Inst_Stack_Effect){2, -2};
+        return true;
+
+    default: // INST_EQ, INST_NATIVE and anything that isn't an instruction
+        return false;
+    }
+}
+
+typedef struct
+{
+    size_t entry;       // first instruction; the program entry or a call target
+    size_t calls_begin; // its call sites in the verifier's call list
+    size_t calls_end;
+    int64_t need;       // stack depth it needs on entry, its own return address included
+    size_t need_at;     // instruction that set need
+    int64_t grow;       // deepest it takes the stack above its entry depth, callees included
+    size_t grow_at;     // instruction that set grow
+    bool returns;       // has a reachable ret
+    int64_t ret_delta;  // depth at its rets relative to the entry; a call leaves the caller this much deeper
+    size_t chain;       // calls in flight at its deepest, its own included
+} Verifier_Function;
+
+typedef struct
+{
+    size_t site;   // the call instruction
+    size_t callee; // index into the function list
+} Verifier_Call;
+
+// abstract interpretation over the control flow graph of every function reachable from the current instruction pointer,
+// a function being the entry or anything that is the target of a call: each reachable instruction gets one stack
+// depth relative to its function's entry, paths that merge have to agree on it and all rets of a function have to
+// leave the same depth; callees are summarised before their callers (recursion is refused, its depth has no bound)
+// so a call is just another instruction with a known effect, as is a native, through the effect it was registered with
+// (vm_native_push_with_effect())
+// the program is verified when the entry needs nothing from an empty stack and never takes it past vm_stack_capacity,
+// in which case the threaded loop can skip every stack check the proof covers
+bool vm_verify_program(VirtualMachine *vm, Verify_Report *report)
+{
+    size_t n = vm->program_size;
+    Inst *program = vm->program;
+
+    *report = (Verify_Report){0};
+    vm->verified = false;
+    free((void *)vm->decoded);
+    vm->decoded = NULL;
+    vm_reg_free(vm);
+
+    if ((size_t)vm->instruction_pointer >= n)
+    {
+        report->reason = "entry point outside of the program";
+        report->failed_at = vm->instruction_pointer;
+        return false;
+    }
+
+    // every function starts at a distinct instruction, so n bounds the per function arrays as well
+    size_t *owner = malloc(sizeof(size_t) * n); // last function that reached the instruction, plus one
+    int64_t *depth = malloc(sizeof(int64_t) * n);
+    int64_t *frame_depth = malloc(sizeof(int64_t) * n); // depth over all functions, becomes vm->frame_depths
+    bool *covered = calloc(n, sizeof(bool));
+    size_t *function_of = malloc(sizeof(size_t) * n); // function starting at the instruction, SIZE_MAX if none
+    size_t *worklist = malloc(sizeof(size_t) * n);
+    Verifier_Function *functions = malloc(sizeof(Verifier_Function) * n);
+    size_t *order = malloc(sizeof(size_t) * n);
+    uint8_t *state = calloc(n, 1); // 0 unseen, 1 on the current call path, 2 ordered
+    size_t *path = malloc(sizeof(size_t) * n);
+    size_t *next_call = malloc(sizeof(size_t) * n);
+    size_t calls_capacity = 64;
+    Verifier_Call *calls = malloc(sizeof(Verifier_Call) * calls_capacity);
+    if (!owner || !depth || !frame_depth || !covered || !function_of || !worklist || !functions || !order || !state || !path || !next_call || !calls)
+    {
+        fprintf(stderr, "ERROR: verifier allocation failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        owner[i] = 0;
+        frame_depth[i] = VM_DEPTH_UNREACHED;
+        function_of[i] = SIZE_MAX;
+    }
+
+    size_t functions_size = 0;
+    size_t calls_size = 0;
+    size_t worklist_size;
+
+#define REJECT(why, at)              \
+    do                               \
+    {                                \
+        report->reason = (why);      \
+        report->failed_at = (at);    \
+        goto done;                   \
+    } while (false)
+
+#define ADD_FUNCTION(at)                                                                   \
+    do                                                                                     \
+    {                                                                                      \
+        function_of[(at)] = functions_size;                                                \
+        functions[functions_size++] = (Verifier_Function){.entry = (at), .need_at = (at)}; \
+    } while (false)
+
+    // pass 1: discover the functions and who calls whom; a call is assumed to return here, the summaries tell later
+    ADD_FUNCTION((size_t)vm->instruction_pointer);
+    for (size_t f = 0; f < functions_size; f++)
+    {
+        functions[f].calls_begin = calls_size;
+        worklist_size = 0;
+        owner[functions[f].entry] = f + 1;
+        worklist[worklist_size++] = functions[f].entry;
+
+        while (worklist_size > 0)
+        {
+            size_t i = worklist[--worklist_size];
+            Inst inst = program[i];
+            size_t successors[2];
+            size_t successors_size = 0;
+
+            switch (inst.type)
+            {
+            case INST_HALT:
+            case INST_RET:
+            case INST_EQ:
+                break;
+
+            case INST_JMP:
+            case INST_UJMP_IF:
+            case INST_FJMP_IF:
+                if (inst.operand._as_u64 >= n)
+                {
+                    REJECT("jump target outside of the program", i);
+                }
+                successors[successors_size++] = inst.operand._as_u64;
+                if (inst.type != INST_JMP)
+                {
+                    successors[successors_size++] = i + 1;
+                }
+                break;
+
+            case INST_CALL:
+                if (inst.operand._as_u64 >= n)
+                {
+                    REJECT("call target outside of the program", i);
+                }
+                if (function_of[inst.operand._as_u64] == SIZE_MAX)
+                {
+                    ADD_FUNCTION(inst.operand._as_u64);
+                }
+                if (calls_size == calls_capacity)
+                {
+                    calls_capacity *= 2;
+                    calls = realloc(calls, sizeof(Verifier_Call) * calls_capacity);
+                    if (!calls)
+                    {
+                        fprintf(stderr, "ERROR: verifier allocation failed: %s\n", strerror(errno));
+                        exit(EXIT_FAILURE);
+                    }
+                }
+                calls[calls_size++] = (Verifier_Call){.site = i, .callee = function_of[inst.operand._as_u64]};
+                successors[successors_size++] = i + 1;
+                break;
+
+            default:
+                if ((uint32_t)inst.type < INST_COUNT)
+                {
+                    successors[successors_size++] = i + 1;
+                }
+                break;
+            }
+
+            for (size_t k = 0; k < successors_size; k++)
+            {
+                size_t next = successors[k];
+                if (next < n && owner[next] != f + 1) // running off the end is reported by pass 3, if it's reachable
+                {
+                    owner[next] = f + 1;
+                    worklist[worklist_size++] = next;
+                }
+            }
+        }
+
+        functions[f].calls_end = calls_size;
+    }
+
+    // pass 2: order the functions callees first; reaching a function that is still on the path is recursion
+    size_t order_size = 0;
+    size_t path_size = 0;
+    path[path_size++] = 0;
+    state[0] = 1;
+    next_call[0] = functions[0].calls_begin;
+    while (path_size > 0)
+    {
+        size_t f = path[path_size - 1];
+        if (next_call[f] == functions[f].calls_end)
+        {
+            state[f] = 2;
+            order[order_size++] = f;
+            path_size--;
+            continue;
+        }
+
+        Verifier_Call call = calls[next_call[f]++];
+        if (state[call.callee] == 1)
+        {
+            REJECT("recursive call", call.site);
+        }
+        if (state[call.callee] == 0)
+        {
+            state[call.callee] = 1;
+            next_call[call.callee] = functions[call.callee].calls_begin;
+            path[path_size++] = call.callee;
+        }
+    }
+
+    // pass 3: the depths themselves, one function at a time, callees first
+    for (size_t i = 0; i < n; i++)
+    {
+        owner[i] = 0;
+    }
+
+    for (size_t o = 0; o < order_size; o++)
+    {
+        size_t f = order[o];
+        Verifier_Function *function = &functions[f];
+        worklist_size = 0;
+
+        owner[function->entry] = f + 1;
+        depth[function->entry] = 0;
+        worklist[worklist_size++] = function->entry;
+
+        while (worklist_size > 0)
+        {
+            size_t i = worklist[--worklist_size];
+            Inst inst = program[i];
+            int64_t rel = depth[i];
+            Inst_Stack_Effect effect;
+            int64_t peak;
+
+            if (frame_depth[i] == VM_DEPTH_UNREACHED)
+            {
+                frame_depth[i] = rel;
+            }
+            else if (frame_depth[i] != rel)
+            {
+                frame_depth[i] = VM_DEPTH_AMBIGUOUS; // code shared by functions that reach it at different depths
+            }
+
+            if (!covered[i])
+            {
+                covered[i] = true;
+                report->proved++;
+            }
+
+            if (inst.type == INST_NATIVE)
+            {
+                if (inst.operand._as_u64 >= vm->natives_size)
+                {
+                    REJECT("native index outside of the native table", i);
+                }
+                Native_Effect native_effect = vm->native_effects[inst.operand._as_u64];
+                if (!native_effect.known)
+                {
+                    REJECT("native without a declared stack effect", i);
+                }
+                effect = (Inst_Stack_Effect){(int64_t)native_effect.needs, native_effect.delta};
+            }
+            else if (!verifier_inst_effect(inst, &effect))
+            {
+                REJECT("illegal instruction", i);
+            }
+
+            peak = effect.delta > 0 ? effect.delta : 0;
+
+            Verifier_Function *callee = NULL;
+            if (inst.type == INST_CALL)
+            {
+                callee = &functions[function_of[inst.operand._as_u64]];
+                effect.needs = callee->need - 1; // the callee's own return address is pushed by the call
+                peak = 1 + callee->grow;
+            }
+
+            if (inst.type == INST_RET && f == 0) // the entry starts on an empty stack, there is nothing to return to
+            {
+                REJECT("ret outside of a called function", i);
+            }
+
+            if (effect.needs - rel > function->need)
+            {
+                function->need = effect.needs - rel;
+                function->need_at = i;
+            }
+            if (rel + peak > function->grow)
+            {
+                function->grow = rel + peak;
+                function->grow_at = i;
+            }
+            if (callee && callee->chain + 1 > function->chain)
+            {
+                function->chain = callee->chain + 1;
+            }
+
+            size_t successors[2];
+            int64_t successor_depths[2];
+            size_t successors_size = 0;
+
+            switch (inst.type)
+            {
+            case INST_HALT:
+                break;
+
+            case INST_RET:
+                if (function->returns && function->ret_delta != rel)
+                {
+                    REJECT("function returns with different stack depths", i);
+                }
+                function->returns = true;
+                function->ret_delta = rel;
+                break;
+
+            case INST_JMP:
+                successors[successors_size] = inst.operand._as_u64;
+                successor_depths[successors_size++] = rel;
+                break;
+
+            case INST_UJMP_IF:
+            case INST_FJMP_IF:
+                successors[successors_size] = inst.operand._as_u64;
+                successor_depths[successors_size++] = rel - 1;
+                successors[successors_size] = i + 1;
+                successor_depths[successors_size++] = rel;
+                break;
+
+            case INST_CALL:
+                if (callee->returns)
+                {
+                    successors[successors_size] = i + 1;
+                    successor_depths[successors_size++] = rel + callee->ret_delta;
+                }
+                break;
+
+            default:
+                successors[successors_size] = i + 1;
+                successor_depths[successors_size++] = rel + effect.delta;
+                break;
+            }
+
+            for (size_t k = 0; k < successors_size; k++)
+            {
+                size_t next = successors[k];
+                if (next >= n)
+                {
+                    REJECT("execution runs off the end of the program", i);
+                }
+                if (owner[next] != f + 1)
+                {
+                    owner[next] = f + 1;
+                    depth[next] = successor_depths[k];
+                    worklist[worklist_size++] = next;
+                }
+                else if (depth[next] != successor_depths[k])
+                {
+                    REJECT("stack depth differs where paths merge", next);
+                }
+            }
+        }
+    }
+
+    Verifier_Function *entry = &functions[0];
+    if (entry->need > 0)
+    {
+        REJECT("stack underflow", entry->need_at);
+    }
+
+    report->bounded = true;
+    report->max_stack_depth = (size_t)entry->grow;
+    report->max_call_depth = entry->chain;
+    if (report->max_stack_depth > vm_stack_capacity)
+    {
+        REJECT("stack overflow", entry->grow_at);
+    }
+
+    free((void *)vm->return_shadow);
+    vm->return_shadow = malloc(sizeof(uint64_t) * (entry->chain > 0 ? entry->chain : 1));
+    if (!vm->return_shadow)
+    {
+        fprintf(stderr, "ERROR: return shadow stack allocation failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    report->verified = true;
+    vm->verified = true;
+    vm->verified_entry = vm->instruction_pointer;
+    vm->max_call_depth = entry->chain;
+    free((void *)vm->frame_depths);
+    vm->frame_depths = frame_depth;
+    frame_depth = NULL;
+
+done:
+    free(owner);
+    free(depth);
+    free(frame_depth);
+    free(covered);
+    free(function_of);
+    free(worklist);
+    free(functions);
+    free(order);
+    free(state);
+    free(path);
+    free(next_call);
+    free(calls);
+    return report->verified;
+
+#undef REJECT
+#undef ADD_FUNCTION
+}
+
+void vm_print_verify_report(FILE *stream, const VirtualMachine *vm, const Verify_Report *report)
+{
+    if (report->verified)
+    {
+        fprintf(stream, "Verification: passed\n");
+    }
+    else
+    {
+        const char *name = report->failed_at < vm->program_size ? get_inst_name(vm->program[report->failed_at].type) : NULL;
+        fprintf(stream, "Verification: failed: %s at instruction %zu (%s)\n", report->reason, report->failed_at, name ? name : "?");
+    }
+
+    if (report->bounded)
+    {
+        fprintf(stream, "Max stack depth: %zu\n", report->max_stack_depth);
+        fprintf(stream, "Max call depth: %zu\n", report->max_call_depth);
+    }
+    fprintf(stream, "Instructions proved: %zu\n", report->proved);
+}
+
+void vm_assembler_init(Vm_Assembler *as, const char *source_name, bool object)
+{
+    *as = (Vm_Assembler){.source_name = source_name, .object = object, .errors = stderr, .compilation_successful = true};
+    as->not_resolved_yet = vm_arena_grow(&as->arena, NULL, &as->not_resolved_yet_capacity, label_capacity, sizeof(label_inst_location));
+}
+
+// the labels and the line tracking; the debug sections encoded from them stay for the save functions
+void label_free(Vm_Assembler *as)
+{
+    vm_arena_free(&as->arena);
+    as->label_nodes = NULL;
+    as->label_slots = NULL;
+    as->label_nodes_size = as->label_nodes_capacity = as->label_slots_capacity = 0;
+    as->not_resolved_yet = NULL;
+    as->not_resolved_yet_counter = as->not_resolved_yet_capacity = 0;
+    as->interned = NULL;
+    as->interned_size = as->interned_capacity = 0;
+    free((void *)as->source_frames);
+    free((void *)as->source_files);
+    free((void *)as->source_file_frames);
+    free((void *)as->source_lines);
+    as->source_frames = NULL;
+    as->source_files = NULL;
+    as->source_file_frames = NULL;
+    as->source_lines = NULL;
+    as->source_frames_size = as->source_frames_capacity = as->source_frames_made = 0;
+    as->source_files_size = as->source_files_capacity = 0;
+    as->source_lines_capacity = 0;
+}
+
+void vm_assembler_free(Vm_Assembler *as)
+{
+    label_free(as);
+    free((void *)as->debug_lines);
+    free((void *)as->debug_symbols);
+    as->debug_lines = NULL;
+    as->debug_symbols = NULL;
+    as->debug_lines_size = as->debug_symbols_size = as->debug_symbols_count = 0;
+#if VM_HAS_MMAP
+    if (as->source_mapping)
+    {
+        munmap(as->source_mapping, as->source_mapping_size);
+    }
+#endif
+    as->source_mapping = NULL;
+    as->source_mapping_size = 0;
+}
+
+// reallocates 'array' of *capacity elements to hold at least 'needed', doubling so that growing one at a time is cheap
+void *vm_grow_array(void *array, size_t *capacity, size_t needed, size_t element_size)
+{
+    size_t grown = *capacity > 0 ? *capacity : 1;
+    while (grown < needed)
+    {
+        grown *= 2;
+    }
+
+    void *allocation = realloc(array, grown * element_size);
+    if (!allocation)
+    {
+        fprintf(stderr, "ERROR: buffer allocation failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    *capacity = grown;
+    return allocation;
+}
+
+void *vm_arena_alloc(Vm_Arena *arena, size_t size)
+{
+    size = (size + sizeof(max_align_t) - 1) / sizeof(max_align_t) * sizeof(max_align_t);
+    Vm_Arena_Block *block = arena->head;
+    if (!block || block->capacity - block->size < size)
+    {
+        size_t capacity = size > VM_ARENA_BLOCK_SIZE ? size : VM_ARENA_BLOCK_SIZE;
+        block = malloc(sizeof(Vm_Arena_Block) + capacity);
+        if (!block)
+        {
+            fprintf(stderr, "ERROR: arena allocation failed: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        block->next = arena->head;
+        block->size = 0;
+        block->capacity = capacity;
+        arena->head = block;
+    }
+
+    void *allocation = (uint8_t *)block->data + block->size;
+    block->size += size;
+    return allocation;
+}
+
+// vm_grow_array() for arrays in an arena: the elements are copied to a doubled allocation and the old one is left for
+// vm_arena_free(), which at most doubles what the arena holds
+void *vm_arena_grow(Vm_Arena *arena, void *array, size_t *capacity, size_t needed, size_t element_size)
+{
+    if (array && needed <= *capacity)
+    {
+        return array;
+    }
+
+    size_t grown = *capacity > 0 ? *capacity : 1;
+    while (grown < needed)
+    {
+        grown *= 2;
+    }
+
+    void *allocation = vm_arena_alloc(arena, grown * element_size);
+    if (array)
+    {
+        memcpy(allocation, array, *capacity * element_size);
+    }
+    *capacity = grown;
+    return allocation;
+}
+
+void vm_arena_free(Vm_Arena *arena)
+{
+    while (arena->head)
+    {
+        Vm_Arena_Block *next = arena->head->next;
+        free((void *)arena->head);
+        arena->head = next;
+    }
+}
+
+// (re)allocates the stack for 'capacity' entries and makes that the new vm_stack_capacity; what is on it is kept
+// one more entry is allocated below vm->stack as a guard the threaded loop's cached stack top can spill into and be
+// reloaded from when the stack is empty, so it never has to test for that
+void vm_resize_stack(VirtualMachine *vm, size_t capacity)
+{
+    Value *allocation = realloc(vm->stack ? vm->stack - 1 : NULL, sizeof(Value) * (capacity + 1));
+    if (!allocation)
+    {
+        fprintf(stderr, "ERROR: stack allocation failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    allocation[0]._as_u64 = 0;
+    vm->stack = allocation + 1;
+    vm_stack_capacity = capacity;
+}
+
+// loads the executable at source_code; code, static memory and, unless --stack-size said otherwise, the stack are
+// allocated to the sizes its header records
+void vm_init(VirtualMachine *vm, char *source_code)
+{
+    vm->natives = malloc(sizeof(native) * natives_capacity);
+    if (!vm->natives)
+    {
+        fprintf(stderr, "ERROR: native function pointer array allocation failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    vm->native_effects = malloc(sizeof(Native_Effect) * natives_capacity);
+    if (!vm->native_effects)
+    {
+        fprintf(stderr, "ERROR: native effect array allocation failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    vm->natives_size = 0;
+
+#if VM_HAS_MMAP
+    vm_header_ header = vm_map_program_file(vm, source_code);
+#else
+    uint8_t *data_section;
+    vm_header_ header = vm_load_program_from_file(&vm->program, &data_section, source_code);
+    vm->program_capacity = header.code_section_size > 0 ? header.code_section_size : 1;
+    vm->image = NULL;
+    vm->static_mapping = NULL;
+
+    vm_size_static_memory(header);
+    vm->static_memory = calloc(sizeof(uint8_t) * vm_memory_capacity, 1);
+    if (!vm->static_memory)
+    {
+        fprintf(stderr, "ERROR: static memory allocation failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    memcpy(vm->static_memory, data_section, header.data_section_size);
+    free((void *)data_section);
+#endif
+    vm->static_break = vm_default_memory_size;
+
+    // the debug info stays in the file until a trap report or a profile asks vm_debug_info() for it
+    vm->path = malloc(strlen(source_code) + 1);
+    if (!vm->path)
+    {
+        fprintf(stderr, "ERROR: path allocation failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    memcpy(vm->path, source_code, strlen(source_code) + 1);
+    vm->header = header;
+    vm->debug = NULL;
+    vm->debug_read = false;
+
+    vm->stack = NULL;
+    vm_resize_stack(vm, header.stack_size > 0 && !vm_stack_capacity_set ? header.stack_size : vm_stack_capacity);
+
+    vm->program_size = header.code_section_size;
+    vm->has_start = header.has_start;
+    if (vm->has_start)
+    {
+        vm->instruction_pointer = header.start_location;
+    }
+    else
+    {
+        fprintf(stderr, "ERROR: 'start' not found in %s; Defaulting to the first VASM instruction\n", source_code);
+        vm->instruction_pointer = 0;
+    }
+    vm->stack_size = 0;
+    vm->halt = 0;
+
+    memset(vm->fused, 0, sizeof(vm->fused));
+    vm->decoded = NULL; // decoded by vm_exec_program(), once the natives are registered and the program had a chance to be verified
+    vm->block_lengths = NULL;
+    vm->jit_code = NULL;
+    vm->jit_code_size = 0;
+    vm->jit_entries = NULL;
+    vm->hot_counters = NULL;
+    vm->traces = NULL;
+    vm->trace_stats = (Trace_Stats){0};
+    vm->shadow_top = 0;
+    vm->verified = false;
+    vm->verified_entry = 0;
+    vm->return_shadow = NULL;
+    vm->max_call_depth = 0;
+    vm->frame_depths = NULL;
+    vm->reg_program = NULL;
+    vm->reg_program_size = 0;
+    vm->reg_entry = NULL;
+    vm->reg_frames = NULL;
+    vm->reg_stats = (Reg_Stats){.missing = "not requested"};
+
+    if (header.snapshot != vm_restoring)
+    {
+        fprintf(stderr, header.snapshot ? "ERROR: '%s' is a snapshot; resume it with --restore\n"
+                                        : "ERROR: '%s' is an executable, not a snapshot written by the snapshot native\n",
+                source_code);
+        exit(EXIT_FAILURE);
+    }
+    if (header.snapshot)
+    {
+        vm_restore_state(vm, source_code);
+    }
+}
+
+void vm_internal_free(VirtualMachine *vm)
+{
+#if VM_HAS_MMAP
+    if (vm->image)
+    {
+        munmap((void *)vm->image, vm->image_size);
+    }
+    else
+    {
+        free((void *)vm->program);
+    }
+    if (vm->static_mapping)
+    {
+        munmap(vm->static_mapping, vm->static_mapping_size);
+    }
+    else
+    {
+        free((void *)vm->static_memory);
+    }
+#else
+    free((void *)vm->program);
+    free((void *)vm->static_memory);
+#endif
+    free((void *)vm->decoded);
+    free((void *)vm->block_lengths);
+    vm_jit_free(vm);
+    vm_trace_free(vm);
+    free((void *)vm->return_shadow);
+    free((void *)vm->frame_depths);
+    vm_reg_free(vm);
+    free((void *)vm->natives);
+    free((void *)vm->native_effects);
+    free((void *)(vm->stack - 1));
+    free((void *)vm->path);
+    vm_debug_free(vm->debug);
+}
+
+// register IR: vm_reg_translate() turns a verified program into three address operations on registers, a register
+// being the stack slot at a depth the proof fixed, relative to the frame of the function it is in; the registers live
+// in vm->stack itself, so the machine can be handed back to the stack interpreter at any operation by setting
+// stack_size from the frame and the depth
+// within a basic block pushes, rdup, rswap and pop emit nothing, they only change what each slot is known to hold (a
+// constant or another register) and the operations read their operands from there; the slots are brought back in
+// line with the stack by moves at the end of every block and before anything that can trap or look at the stack
+// constant operands become immediates and a comparison followed by ujmp_if one compare-and-branch; a program the
+// verifier rejects has no register form and runs on the threaded loop
+
+typedef struct
+{
+    bool konst;   // holds imm; otherwise holds whatever register 'slot' holds
+    int32_t slot;
+    Value imm;
+} Reg_Operand;
+
+typedef struct
+{
+    Reg_Inst *ops;
+    size_t size;
+    size_t capacity;
+    size_t block_start;     // first operation of the current block; nothing before it may be fused
+    Reg_Operand *slots;     // what each stack slot holds, from 'lowest' up
+    int32_t lowest;
+    bool *dirty;            // slot may hold something other than itself
+    int32_t *dirty_list;
+    size_t dirty_size;
+    int32_t *move_dst;      // scratch for reg_flush()
+    Reg_Operand *move_src;
+    Reg_Stats *stats;
+} Reg_Builder;
+
+static Reg_Operand *reg_slot(Reg_Builder *t, int32_t x)
+{
+    return &t->slots[x - t->lowest];
+}
+
+static void reg_set(Reg_Builder *t, int32_t x, Reg_Operand value)
+{
+    if (!t->dirty[x - t->lowest])
+    {
+        t->dirty[x - t->lowest] = true;
+        t->dirty_list[t->dirty_size++] = x;
+    }
+    *reg_slot(t, x) = value;
+}
+
+static Reg_Inst *reg_emit(Reg_Builder *t, Reg_Op op, size_t ip, int32_t depth)
+{
+    if (t->size == t->capacity)
+    {
+        t->capacity = t->capacity ? t->capacity * 2 : 64;
+        t->ops = realloc(t->ops, sizeof(Reg_Inst) * t->capacity);
+        if (!t->ops)
+        {
+            fprintf(stderr, "ERROR: register IR allocation failed: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+    t->stats->operations++;
+    if (op == REG_MOV || op == REG_MOVI || op == REG_SWAP)
+    {
+        t->stats->moves++;
+    }
+    t->ops[t->size] = (Reg_Inst){.op = op, .ip = ip, .depth = depth};
+    return &t->ops[t->size++];
+}
+
+// writes every live slot that holds something other than itself back to itself, except for constants from slot
+// 'keep' up, which the operation about to be emitted takes as its immediate; the moves among registers are a parallel
+// assignment, so one whose destination nothing else still reads goes first, and when only cycles are left one of them
+// is broken with a swap
+static void reg_flush_keeping(Reg_Builder *t, size_t ip, int32_t depth, int32_t keep)
+{
+    size_t moves = 0;
+    size_t constants = t->dirty_size;
+    size_t kept = 0;
+    for (size_t k = 0; k < t->dirty_size; k++)
+    {
+        int32_t x = t->dirty_list[k];
+        Reg_Operand *value = reg_slot(t, x);
+        if (x >= keep && x < depth && value->konst)
+        {
+            t->dirty_list[kept++] = x; // stays dirty; kept <= k so the list can be compacted in place
+            continue;
+        }
+        if (x < depth && value->konst)
+        {
+            t->move_dst[--constants] = x; // constants fill the scratch from the end, nothing reads them
+            t->move_src[constants] = *value;
+        }
+        else if (x < depth && value->slot != x)
+        {
+            t->move_dst[moves] = x;
+            t->move_src[moves++] = *value;
+        }
+        t->dirty[x - t->lowest] = false;
+        *value = (Reg_Operand){.slot = x};
+    }
+
+    while (moves > 0)
+    {
+        bool progress = false;
+        for (size_t k = 0; k < moves;)
+        {
+            bool read = false;
+            for (size_t j = 0; j < moves && !read; j++)
+            {
+                read = j != k && t->move_src[j].slot == t->move_dst[k];
+            }
+            if (read)
+            {
+                k++;
+                continue;
+            }
+            Reg_Inst *move = reg_emit(t, REG_MOV, ip, depth);
+            move->dst = t->move_dst[k];
+            move->a = t->move_src[k].slot;
+            moves--;
+            t->move_dst[k] = t->move_dst[moves];
+            t->move_src[k] = t->move_src[moves];
+            progress = true;
+        }
+
+        if (!progress)
+        {
+            int32_t dst = t->move_dst[0];
+            int32_t src = t->move_src[0].slot;
+            Reg_Inst *swap = reg_emit(t, REG_SWAP, ip, depth);
+            swap->dst = dst;
+            swap->a = src;
+
+            // dst is done; its old value now sits in src and src's in dst
+            moves--;
+            t->move_dst[0] = t->move_dst[moves];
+            t->move_src[0] = t->move_src[moves];
+            for (size_t j = 0; j < moves;)
+            {
+                if (t->move_src[j].slot == dst)
+                {
+                    t->move_src[j].slot = src;
+                }
+                else if (t->move_src[j].slot == src)
+                {
+                    t->move_src[j].slot = dst;
+                }
+
+                if (t->move_src[j].slot == t->move_dst[j])
+                {
+                    moves--;
+                    t->move_dst[j] = t->move_dst[moves];
+                    t->move_src[j] = t->move_src[moves];
+                }
+                else
+                {
+                    j++;
+                }
+            }
+        }
+    }
+
+    for (size_t k = constants; k < t->dirty_size; k++)
+    {
+        Reg_Inst *move = reg_emit(t, REG_MOVI, ip, depth);
+        move->dst = t->move_dst[k];
+        move->imm = t->move_src[k].imm;
+    }
+    t->dirty_size = kept;
+}
+
+static void reg_flush(Reg_Builder *t, size_t ip, int32_t depth)
+{
+    reg_flush_keeping(t, ip, depth, depth);
+}
+
+// about to overwrite register w: if a slot below 'top' other than w still holds what w holds now, everything is flushed
+// but the constant operands from 'top' up
+static void reg_prepare_write(Reg_Builder *t, int32_t w, int32_t top, size_t ip, int32_t depth)
+{
+    for (size_t k = 0; k < t->dirty_size; k++)
+    {
+        int32_t x = t->dirty_list[k];
+        Reg_Operand *value = reg_slot(t, x);
+        if (x < top && x != w && !value->konst && value->slot == w)
+        {
+            reg_flush_keeping(t, ip, depth, top);
+            return;
+        }
+    }
+}
+
+// makes slot x hold itself
+static void reg_materialize(Reg_Builder *t, int32_t x, size_t ip, int32_t depth)
+{
+    reg_prepare_write(t, x, depth, ip, depth);
+
+    Reg_Operand value = *reg_slot(t, x);
+    if (value.konst || value.slot != x)
+    {
+        Reg_Inst *move = reg_emit(t, value.konst ? REG_MOVI : REG_MOV, ip, depth);
+        move->dst = x;
+        move->a = value.slot;
+        move->imm = value.imm;
+        reg_set(t, x, (Reg_Operand){.slot = x});
+    }
+}
+
+// the two slots on top into the lower one; rr + 1 is the form with a constant b
+static void reg_binary(Reg_Builder *t, Reg_Op rr, bool commutative, size_t ip, int32_t depth)
+{
+    int32_t w = depth - 2;
+    Reg_Operand a = *reg_slot(t, w);
+    Reg_Operand b = *reg_slot(t, depth - 1);
+
+    if (a.konst && !(commutative && !b.konst))
+    {
+        reg_materialize(t, w, ip, depth);
+    }
+    reg_prepare_write(t, w, w, ip, depth);
+
+    a = *reg_slot(t, w);
+    b = *reg_slot(t, depth - 1);
+    if (a.konst)
+    {
+        Reg_Operand swap = a;
+        a = b;
+        b = swap;
+    }
+
+    Reg_Inst *inst = reg_emit(t, b.konst ? rr + 1 : rr, ip, depth);
+    inst->dst = w;
+    inst->a = a.slot;
+    inst->b = b.slot;
+    inst->imm = b.imm;
+    reg_set(t, w, (Reg_Operand){.slot = w});
+    reg_set(t, depth - 1, (Reg_Operand){.slot = depth - 1});
+}
+
+static void reg_unary(Reg_Builder *t, Reg_Op op, uint64_t shift, size_t ip, int32_t depth)
+{
+    int32_t w = depth - 1;
+    if (reg_slot(t, w)->konst)
+    {
+        reg_materialize(t, w, ip, depth);
+    }
+    reg_prepare_write(t, w, w, ip, depth);
+
+    Reg_Inst *inst = reg_emit(t, op, ip, depth);
+    inst->dst = w;
+    inst->a = reg_slot(t, w)->slot;
+    inst->imm._as_u64 = shift;
+    reg_set(t, w, (Reg_Operand){.slot = w});
+}
+
+// builds vm->reg_program from the proof vm_verify_program() left in vm->frame_depths; false, with the reason in
+// vm->reg_stats.missing, if there is no proof or some code is shared by functions at different depths
+bool vm_reg_translate(VirtualMachine *vm)
+{
+    size_t n = vm->program_size;
+    Inst *program = vm->program;
+    const int64_t *depths = vm->frame_depths;
+
+    vm_reg_free(vm);
+    vm->reg_stats = (Reg_Stats){0};
+    if (!vm->verified || !depths)
+    {
+        vm->reg_stats.missing = "program not verified";
+        return false;
+    }
+    if (vm_stack_capacity >= INT32_MAX / 2)
+    {
+        vm->reg_stats.missing = "stack too large for the register numbering";
+        return false;
+    }
+
+    // the slots any instruction can reach, relative to its frame; a function may reach below its entry into its caller
+    int64_t lowest = 0;
+    int64_t highest = 1;
+    for (size_t i = 0; i < n; i++)
+    {
+        Inst_Stack_Effect effect;
+        if (depths[i] == VM_DEPTH_UNREACHED)
+        {
+            continue;
+        }
+        if (depths[i] == VM_DEPTH_AMBIGUOUS)
+        {
+            vm->reg_stats.missing = "code shared by functions at different stack depths";
+            return false;
+        }
+        if (verifier_inst_effect(program[i], &effect) && depths[i] - effect.needs < lowest)
+        {
+            lowest = depths[i] - effect.needs;
+        }
+        if (depths[i] + 2 > highest)
+        {
+            highest = depths[i] + 2;
+        }
+        vm->reg_stats.instructions++;
+    }
+
+    size_t slots = (size_t)(highest - lowest);
+    bool *leader = calloc(n + 1, sizeof(bool));
+    size_t *entries = malloc(sizeof(size_t) * n);
+    Reg_Builder t = {
+        .slots = malloc(sizeof(Reg_Operand) * slots),
+        .lowest = (int32_t)lowest,
+        .dirty = calloc(slots, sizeof(bool)),
+        .dirty_list = malloc(sizeof(int32_t) * slots),
+        .move_dst = malloc(sizeof(int32_t) * slots),
+        .move_src = malloc(sizeof(Reg_Operand) * slots),
+        .stats = &vm->reg_stats,
+    };
+    if (!leader || !entries || !t.slots || !t.dirty || !t.dirty_list || !t.move_dst || !t.move_src)
+    {
+        fprintf(stderr, "ERROR: register IR allocation failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    for (int32_t x = t.lowest; x < (int32_t)highest; x++)
+    {
+        *reg_slot(&t, x) = (Reg_Operand){.slot = x};
+    }
+
+    leader[vm->verified_entry] = true;
+    for (size_t i = 0; i < n; i++)
+    {
+        switch (program[i].type)
+        {
+        case INST_JMP:
+        case INST_UJMP_IF:
+        case INST_FJMP_IF:
+        case INST_CALL:
+            leader[program[i].operand._as_u64 < n ? program[i].operand._as_u64 : n] = true;
+            leader[i + 1] = true;
+            break;
+        case INST_RET:
+        case INST_HALT:
+            leader[i + 1] = true;
+            break;
+        default:
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        Inst inst = program[i];
+        if (depths[i] == VM_DEPTH_UNREACHED)
+        {
+            continue;
+        }
+
+        int32_t d = (int32_t)depths[i];
+        if (leader[i])
+        {
+            reg_flush(&t, i, d);
+            t.block_start = t.size;
+        }
+        entries[i] = t.size;
+
+        switch (inst.type)
+        {
+        case INST_NOP:
+            break;
+
+        case INST_SPUSH:
+        case INST_UPUSH:
+        case INST_FPUSH:
+            reg_set(&t, d, (Reg_Operand){.konst = true, .imm = inst.operand});
+            break;
+
+        case INST_RDUP:
+            reg_set(&t, d, *reg_slot(&t, d - 1 - (int32_t)inst.operand._as_u64));
+            break;
+
+        case INST_RSWAP:
+        {
+            int32_t other = d - 1 - (int32_t)inst.operand._as_u64;
+            Reg_Operand top = *reg_slot(&t, d - 1);
+            reg_set(&t, d - 1, *reg_slot(&t, other));
+            reg_set(&t, other, top);
+            break;
+        }
+
+        case INST_POP:
+            reg_set(&t, d - 1, (Reg_Operand){.slot = d - 1});
+            break;
+
+#define X(name, field, expression, commutative)                          \
+    case INST_##name:                                                    \
+        reg_binary(&t, REG_##name##_RR, (commutative), i, d);            \
+        break;
+            REG_BINARY_OPS(X)
+#undef X
+
+        // a comparison the next instruction branches on flushes first, so the branch finds nothing left to flush
+        // and can be fused into it
+#define X(name, field, expression, commutative)                          \
+    case INST_##name:                                                    \
+        if (i + 1 < n && program[i + 1].type == INST_UJMP_IF && !leader[i + 1]) \
+        {                                                                \
+            reg_flush_keeping(&t, i, d, d - 2);                          \
+        }                                                                \
+        reg_binary(&t, REG_##name##_RR, (commutative), i, d);            \
+        break;
+            REG_COMPARE_OPS(X)
+#undef X
+
+#define X(name, field, expression)                                       \
+    case INST_##name:                                                    \
+    {                                                                    \
+        Reg_Operand divisor = *reg_slot(&t, d - 1);                      \
+        if (!divisor.konst || divisor.imm._as_##field == 0)              \
+        {                                                                \
+            reg_flush(&t, i, d); /* the divisor is checked at run time */ \
+        }                                                                \
+        reg_binary(&t, REG_##name##_RR, false, i, d);                    \
+        break;                                                           \
+    }
+            REG_DIVISION_OPS(X)
+#undef X
+
+#define X(name, field, expression)                                       \
+    case INST_##name:                                                    \
+        reg_unary(&t, REG_##name, inst.operand._as_u64, i, d);           \
+        break;
+            REG_UNARY_OPS(X)
+#undef X
+
+#define X(name, size, ...)                                               \
+    case INST_##name:                                                    \
+    {                                                                    \
+        reg_flush(&t, i, d);                                             \
+        Reg_Inst *access = reg_emit(&t, REG_##name, i, d);               \
+        access->dst = d - 1;                                             \
+        access->a = d - 1; /* the address */                             \
+        access->b = d - 2; /* the value, for stores */                   \
+        break;                                                           \
+    }
+            REG_LOAD_OPS(X)
+            REG_STORE_OPS(X)
+#undef X
+
+        case INST_JMP:
+            reg_flush(&t, i, d);
+            reg_emit(&t, REG_JMP, i, d);
+            break;
+
+        case INST_UJMP_IF:
+        {
+            reg_flush(&t, i, d);
+            Reg_Inst *last = t.size > t.block_start ? &t.ops[t.size - 1] : NULL;
+            if (last && last->op >= REG_EQU_RR && last->op <= REG_LF_RI && last->dst == d - 1)
+            {
+                last->op = REG_BR_EQU_RR + (last->op - REG_EQU_RR); // the branch forms are laid out like the comparisons
+                last->ip = i;
+                last->depth = d;
+                vm->reg_stats.fused++;
+            }
+            else
+            {
+                reg_emit(&t, REG_JNZ, i, d)->a = d - 1;
+            }
+            break;
+        }
+
+        case INST_FJMP_IF:
+            reg_flush(&t, i, d);
+            reg_emit(&t, REG_FJMP, i, d)->a = d - 1;
+            break;
+
+        case INST_CALL:
+            reg_flush(&t, i, d);
+            reg_emit(&t, REG_CALL, i, d);
+            break;
+
+        case INST_RET:
+            reg_flush(&t, i, d);
+            reg_emit(&t, REG_RET, i, d)->a = d - 1;
+            break;
+
+        case INST_HALT:
+            reg_flush(&t, i, d);
+            reg_emit(&t, REG_HALT, i, d);
+            break;
+
+        case INST_NATIVE:
+            reg_flush(&t, i, d);
+            reg_emit(&t, REG_NATIVE, i, d)->imm = inst.operand;
+            break;
+
+        default: // adup, aswap, pop_at and empty look at the stack from its bottom
+            reg_flush(&t, i, d);
+            reg_emit(&t, REG_FALLBACK, i, d);
+            break;
+        }
+    }
+
+    for (size_t k = 0; k < t.size; k++)
+    {
+        Reg_Inst *op = &t.ops[k];
+        if (op->op == REG_JMP || op->op == REG_JNZ || op->op == REG_FJMP || op->op == REG_CALL || (op->op >= REG_BR_EQU_RR && op->op <= REG_BR_LF_RI))
+        {
+            op->target = &t.ops[entries[program[op->ip].operand._as_u64]];
+        }
+    }
+
+    vm->reg_program = t.ops;
+    vm->reg_program_size = t.size;
+    vm->reg_entry = &t.ops[entries[vm->verified_entry]];
+    vm->reg_frames = malloc(sizeof(Reg_Frame) * (vm->max_call_depth > 0 ? vm->max_call_depth : 1));
+    if (!vm->reg_frames)
+    {
+        fprintf(stderr, "ERROR: register IR allocation failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    free((void *)leader);
+    free((void *)entries);
+    free((void *)t.slots);
+    free((void *)t.dirty);
+    free((void *)t.dirty_list);
+    free((void *)t.move_dst);
+    free((void *)t.move_src);
+    return true;
+}
+
+#if VM_HAS_COMPUTED_GOTO
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+// runs the register form from verified_entry on an empty stack; stops on halt or a trap with the machine exactly where
+// the stack interpreter would have left it, or returns VM_DEOPT at a ret that doesn't go back to its call, with the
+// machine at that ret for the stack interpreter to carry on from
+static int vm_exec_register(VirtualMachine *vm)
+{
+    Value *fp = vm->stack; // frame of the function running; the entry's starts at the bottom of the stack
+    const Reg_Inst *op = vm->reg_entry;
+    size_t frames = 0;
+
+#if VM_HAS_COMPUTED_GOTO
+#define X(name, ...) [REG_##name##_RR] = &&reg_##name##_RR, [REG_##name##_RI] = &&reg_##name##_RI,
+#define Y(name, ...) [REG_BR_##name##_RR] = &&reg_BR_##name##_RR, [REG_BR_##name##_RI] = &&reg_BR_##name##_RI,
+#define Z(name, ...) [REG_##name] = &&reg_##name,
+    static const void *const labels[REG_OP_COUNT] = {
+        [REG_MOV] = &&reg_MOV,
+        [REG_MOVI] = &&reg_MOVI,
+        [REG_SWAP] = &&reg_SWAP,
+        REG_BINARY_OPS(X) REG_COMPARE_OPS(X) REG_DIVISION_OPS(X)
+        REG_COMPARE_OPS(Y)
+        REG_UNARY_OPS(Z) REG_LOAD_OPS(Z) REG_STORE_OPS(Z)
+        [REG_JMP] = &&reg_JMP,
+        [REG_JNZ] = &&reg_JNZ,
+        [REG_FJMP] = &&reg_FJMP,
+        [REG_CALL] = &&reg_CALL,
+        [REG_RET] = &&reg_RET,
+        [REG_NATIVE] = &&reg_NATIVE,
+        [REG_FALLBACK] = &&reg_FALLBACK,
+        [REG_HALT] = &&reg_HALT,
+    };
+#undef X
+#undef Y
+#undef Z
+    for (size_t k = 0; k < vm->reg_program_size; k++)
+    {
+        vm->reg_program[k].handler = labels[vm->reg_program[k].op];
+    }
+#define CASE(name) reg_##name
+#define DISPATCH() goto *op->handler
+#else
+#define CASE(name) case REG_##name
+#define DISPATCH() goto dispatch
+#endif
+#define NEXT()     \
+    do             \
+    {              \
+        op++;      \
+        DISPATCH(); \
+    } while (false)
+#define JUMP(to)       \
+    do                 \
+    {                  \
+        op = (to);     \
+        DISPATCH();    \
+    } while (false)
+#define SYNC(at)                                                                    \
+    do                                                                              \
+    {                                                                               \
+        vm->stack_size = (size_t)(fp - vm->stack) + (size_t)op->depth;              \
+        vm->instruction_pointer = (at);                                             \
+    } while (false)
+
+    DISPATCH();
+#if !VM_HAS_COMPUTED_GOTO
+dispatch:
+    switch (op->op)
+#endif
+    {
+    CASE(MOV):
+        fp[op->dst] = fp[op->a];
+        NEXT();
+    CASE(MOVI):
+        fp[op->dst] = op->imm;
+        NEXT();
+    CASE(SWAP):
+    {
+        Value swap = fp[op->dst];
+        fp[op->dst] = fp[op->a];
+        fp[op->a] = swap;
+        NEXT();
+    }
+
+#define X(name, field, expression, commutative)   \
+    CASE(name##_RR):                              \
+    {                                             \
+        Value a = fp[op->a];                      \
+        Value b = fp[op->b];                      \
+        fp[op->dst]._as_##field = (expression);   \
+        NEXT();                                   \
+    }                                             \
+    CASE(name##_RI):                              \
+    {                                             \
+        Value a = fp[op->a];                      \
+        Value b = op->imm;                        \
+        fp[op->dst]._as_##field = (expression);   \
+        NEXT();                                   \
+    }
+        REG_BINARY_OPS(X)
+        REG_COMPARE_OPS(X)
+#undef X
+
+#define X(name, field, expression, commutative)   \
+    CASE(BR_##name##_RR):                         \
+    {                                             \
+        Value a = fp[op->a];                      \
+        Value b = fp[op->b];                      \
+        if ((fp[op->dst]._as_u64 = (expression))) \
+        {                                         \
+            JUMP(op->target);                     \
+        }                                         \
+        NEXT();                                   \
+    }                                             \
+    CASE(BR_##name##_RI):                         \
+    {                                             \
+        Value a = fp[op->a];                      \
+        Value b = op->imm;                        \
+        if ((fp[op->dst]._as_u64 = (expression))) \
+        {                                         \
+            JUMP(op->target);                     \
+        }                                         \
+        NEXT();                                   \
+    }
+        REG_COMPARE_OPS(X)
+#undef X
+
+#define X(name, field, expression)                \
+    CASE(name##_RR):                              \
+    {                                             \
+        Value a = fp[op->a];                      \
+        Value b = fp[op->b];                      \
+        if (b._as_##field == 0)                   \
+        {                                         \
+            SYNC(op->ip);                         \
+            return TRAP_DIV_BY_ZERO;              \
+        }                                         \
+        fp[op->dst]._as_##field = (expression);   \
+        NEXT();                                   \
+    }                                             \
+    CASE(name##_RI):                              \
+    {                                             \
+        Value a = fp[op->a];                      \
+        Value b = op->imm;                        \
+        fp[op->dst]._as_##field = (expression);   \
+        NEXT();                                   \
+    }
+        REG_DIVISION_OPS(X)
+#undef X
+
+#define X(name, field, expression)                \
+    CASE(name):                                   \
+    {                                             \
+        Value a = fp[op->a];                      \
+        uint64_t shift = op->imm._as_u64;         \
+        (void)shift;                              \
+        fp[op->dst]._as_##field = (expression);   \
+        NEXT();                                   \
+    }
+        REG_UNARY_OPS(X)
+#undef X
+
+#define X(name, size, field, type)                                              \
+    CASE(name):                                                                 \
+    {                                                                           \
+        uint64_t addr = fp[op->a]._as_u64;                                      \
+        if (addr >= vm_memory_capacity - (size))                                \
+        {                                                                       \
+            SYNC(op->ip);                                                       \
+            return TRAP_ILLEGAL_MEMORY_ACCESS;                                  \
+        }                                                                       \
+        fp[op->dst]._as_##field = *(type *)&vm->static_memory[addr];            \
+        NEXT();                                                                 \
+    }
+        REG_LOAD_OPS(X)
+#undef X
+
+#define X(name, size, type)                                                     \
+    CASE(name):                                                                 \
+    {                                                                           \
+        uint64_t addr = fp[op->a]._as_u64;                                      \
+        if (addr >= vm_memory_capacity - (size))                                \
+        {                                                                       \
+            SYNC(op->ip);                                                       \
+            return TRAP_ILLEGAL_MEMORY_ACCESS;                                  \
+        }                                                                       \
+        *(type *)&vm->static_memory[addr] = (type)fp[op->b]._as_u64;            \
+        NEXT();                                                                 \
+    }
+        REG_STORE_OPS(X)
+#undef X
+
+    CASE(JMP):
+        JUMP(op->target);
+    CASE(JNZ):
+        if (fp[op->a]._as_u64)
+        {
+            JUMP(op->target);
+        }
+        NEXT();
+    CASE(FJMP):
+        if (!(fp[op->a]._as_f64 < EPSILON))
+        {
+            JUMP(op->target);
+        }
+        NEXT();
+
+    CASE(CALL):
+        fp[op->depth]._as_u64 = op->ip + 1;
+        vm->reg_frames[frames++] = (Reg_Frame){.fp = fp, .ret_ip = op->ip + 1, .to = op + 1};
+        fp += op->depth + 1;
+        JUMP(op->target);
+    CASE(RET):
+        if (frames == 0 || fp[op->a]._as_u64 != vm->reg_frames[frames - 1].ret_ip)
+        {
+            // a return address the program computed itself; the proof assumed calls and returns nest
+            SYNC(op->ip);
+            vm->reg_stats.deopts++;
+            return VM_DEOPT;
+        }
+        frames--;
+        fp = vm->reg_frames[frames].fp;
+        JUMP(vm->reg_frames[frames].to);
+
+    CASE(NATIVE):
+    {
+        SYNC(op->ip);
+        Trap trap = vm->natives[op->imm._as_u64](vm);
+        if (trap != TRAP_OK)
+        {
+            vm->instruction_pointer = op->ip;
+            return trap;
+        }
+        NEXT();
+    }
+    CASE(FALLBACK):
+    {
+        SYNC(op->ip);
+        int trap = vm_execute_at_inst_pointer(vm);
+        if (trap != TRAP_OK)
+        {
+            return trap;
+        }
+        NEXT();
+    }
+
+    CASE(HALT):
+        SYNC(op->ip);
+        vm->halt = 1;
+        return TRAP_OK;
+    }
+
+#if !VM_HAS_COMPUTED_GOTO
+    return TRAP_ILLEGAL_INSTRUCTION; // not reached, every Reg_Op is handled
+#endif
+#undef CASE
+#undef DISPATCH
+#undef NEXT
+#undef JUMP
+#undef SYNC
+}
+
+#if VM_HAS_COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#endif
+
+void vm_reg_free(VirtualMachine *vm)
+{
+    free((void *)vm->reg_program);
+    free((void *)vm->reg_frames);
+    vm->reg_program = NULL;
+    vm->reg_program_size = 0;
+    vm->reg_entry = NULL;
+    vm->reg_frames = NULL;
+}
+
+void vm_print_reg_stats(FILE *stream, const VirtualMachine *vm)
+{
+    const Reg_Stats *stats = &vm->reg_stats;
+    if (stats->missing)
+    {
+        fprintf(stream, "Register IR: not built (%s)\n", stats->missing);
+        return;
+    }
+
+    fprintf(stream, "Register IR: %zu instructions in %zu operations (%.1f%% fewer)\n", stats->instructions, stats->operations,
+            stats->instructions ? 100.0 * ((double)stats->instructions - (double)stats->operations) / (double)stats->instructions : 0.0);
+    fprintf(stream, "  %-16s %zu\n", "moves", stats->moves);
+    fprintf(stream, "  %-16s %zu\n", "fused branches", stats->fused);
+    fprintf(stream, "  %-16s %zu\n", "deopts", stats->deopts);
+}
+
+// a block here runs from wherever execution lands up to and including the next jump, call, ret or halt, falling
+// through into any jump target on the way, as nothing but those transfers can take execution anywhere else;
+// block_lengths[i] is how many instructions run from i to the end of its block, so a budgeted run can pay for a whole
+// block up front no matter where inside it execution entered
+void vm_compute_block_lengths(VirtualMachine *vm)
+{
+    size_t n = vm->program_size;
+    Inst *program = vm->program;
+
+    free((void *)vm->block_lengths);
+    vm->block_lengths = malloc(sizeof(size_t) * (n > 0 ? n : 1));
+    bool *leader = calloc(n + 1, sizeof(bool));
+    if (!vm->block_lengths || !leader)
+    {
+        fprintf(stderr, "ERROR: block length table allocation failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        switch (program[i].type)
+        {
+        case INST_JMP:
+        case INST_UJMP_IF:
+        case INST_FJMP_IF:
+        case INST_CALL:
+        case INST_RET:
+        case INST_HALT:
+            leader[i + 1] = true;
+            break;
+        default:
+            break;
+        }
+    }
+
+    for (size_t i = n; i-- > 0;)
+    {
+        vm->block_lengths[i] = leader[i + 1] ? 1 : vm->block_lengths[i + 1] + 1;
+    }
+
+    free((void *)leader);
+}
+
+#if VM_HAS_COMPUTED_GOTO
+// decodes the program for the threaded loop where it isn't yet, or where it was decoded for a proof that no longer holds
+static void vm_prepare_threaded(VirtualMachine *vm)
+{
+    // the proof holds from the entry it was made for with an empty stack, and nowhere else
+    if (vm->verified && (vm->stack_size != 0 || vm->instruction_pointer != vm->verified_entry))
+    {
+        vm->verified = false;
+        free((void *)vm->decoded);
+        vm->decoded = NULL;
+    }
+
+    if (!vm->decoded)
+    {
+        vm_decode_program(vm);
+    }
+
+    if (vm->stack_size == 0)
+    {
+        vm->shadow_top = 0;
+    }
+}
+#endif
+
+// no limit and no stepping: nothing but the instruction
+static int vm_exec_fast(VirtualMachine *vm)
+{
+    while (!vm->halt)
+    {
+        int ret = vm_execute_at_inst_pointer(vm);
+        if (ret != TRAP_OK)
+        {
+            return ret;
+        }
+    }
+    return TRAP_OK;
+}
+
+// runs at most 'limit' instructions, charging the budget once per block instead of once per instruction: on the
+// threaded loop where there is one, and only the block the budget runs out in is stepped through one at a time
+static int vm_exec_budgeted(VirtualMachine *vm, int64_t limit)
+{
+    if (!vm->block_lengths)
+    {
+        vm_compute_block_lengths(vm);
+    }
+
+#if VM_HAS_COMPUTED_GOTO
+    int64_t first = (int64_t)vm->block_lengths[vm->instruction_pointer];
+    if (vm_dispatch_mode != DISPATCH_SWITCH && first <= limit)
+    {
+        limit -= first;
+        vm_prepare_threaded(vm);
+        int ret = vm_exec_threaded(vm, &limit);
+        if (ret != VM_OUT_OF_BUDGET)
+        {
+            return ret;
+        }
+    }
+#endif
+
+    while (!vm->halt && limit > 0)
+    {
+        int64_t run = (int64_t)vm->block_lengths[vm->instruction_pointer];
+        if (run > limit)
+        {
+            run = limit;
+        }
+        limit -= run;
+
+        while (run-- > 0)
+        {
+            int ret = vm_execute_at_inst_pointer(vm);
+            if (ret != TRAP_OK)
+            {
+                return ret;
+            }
+        }
+    }
+    return TRAP_OK;
+}
+
+// waits for a key before every instruction and dumps the stack after it; a negative limit means no limit
+static int vm_exec_debug(VirtualMachine *vm, int64_t limit)
+{
+    while (!vm->halt && limit != 0)
+    {
+        getchar();
+        fprintf(stdout, "%s\n", get_inst_name(vm->program[vm->instruction_pointer].type));
+        int ret = vm_execute_at_inst_pointer(vm);
+        vm_dump_stack(stdout, vm);
+        if (ret != TRAP_OK)
+        {
+            return ret;
+        }
+        if (limit > 0)
+        {
+            limit--;
+        }
+    }
+    return TRAP_OK;
+}
+
+// picks the loop once, so the one that runs never asks about debug or limit again
+int vm_exec_program(VirtualMachine *vm, int64_t limit, bool debug)
+{
+    int ret;
+    if (vm->program_size == 0 || vm->program[vm->program_size - 1].type != INST_HALT)
+    {
+        return TRAP_NO_HALT_FOUND;
+    }
+
+    if ((size_t)vm->instruction_pointer >= vm->program_size)
+    {
+        fprintf(stderr, "Trap activated: %s\n", trap_as_cstr(TRAP_ILLEGAL_INST_ACCESS));
+        return TRAP_ILLEGAL_INST_ACCESS;
+    }
+
+    if (debug)
+    {
+        ret = vm_exec_debug(vm, limit);
+    }
+    else if (limit >= 0)
+    {
+        ret = vm_exec_budgeted(vm, limit); // on the threaded loop, or the switch loop with --dispatch switch
+    }
+    else if (vm_dispatch_mode == DISPATCH_REGISTER && (vm->reg_program || vm_reg_translate(vm)) &&
+             vm->stack_size == 0 && vm->instruction_pointer == vm->verified_entry)
+    {
+        ret = vm_exec_register(vm);
+        if (ret == VM_DEOPT)
+        {
+            ret = vm_exec_fast(vm);
+        }
+    }
+#if VM_HAS_COMPUTED_GOTO
+    else if (vm_dispatch_mode != DISPATCH_SWITCH)
+    {
+        vm_prepare_threaded(vm);
+        ret = vm_exec_threaded(vm, NULL);
+        while (ret == VM_HOT_LOOP)
+        {
+            ret = vm_trace_enter(vm);
+            if (ret == TRAP_OK && !vm->halt)
+            {
+                ret = vm_exec_threaded(vm, NULL);
+            }
+        }
+    }
+#endif
+    else
+    {
+        ret = vm_exec_fast(vm);
+    }
+
+    if (ret != TRAP_OK)
+    {
+        fprintf(stderr, "Trap activated: %s\n", trap_as_cstr(ret));
+        vm_print_location(stderr, vm, vm->instruction_pointer);
+        return ret;
+    }
+    return SUCCESS;
+}
+
+#if VM_HAS_JIT
+
+// template JIT: every instruction becomes a fixed x86-64 sequence that does what its vm_exec_threaded() handler does,
+// traps included, so a jitted run is observably the same as an interpreted one
+// while the code runs rbx holds the vm, r12 vm->stack, r13 the stack pointer (one past the top, like 'sp' in the
+// threaded loop), r14 the end of the stack and r15 vm->jit_entries; vm->stack_size and vm->instruction_pointer are
+// only written around natives, around the instructions handed back to vm_execute_at_inst_pointer() and on the way out
+
+typedef enum
+{
+    JIT_RAX = 0,
+    JIT_RCX,
+    JIT_RDX,
+    JIT_RBX,
+    JIT_RSP,
+    JIT_RBP,
+    JIT_RSI,
+    JIT_RDI,
+    JIT_R12 = 12,
+    JIT_R13,
+    JIT_R14,
+    JIT_R15,
+} Jit_Register;
+
+typedef enum
+{
+    JIT_CC_B = 0x2,
+    JIT_CC_AE = 0x3,
+    JIT_CC_E = 0x4,
+    JIT_CC_NE = 0x5,
+    JIT_CC_BE = 0x6,
+    JIT_CC_A = 0x7,
+    JIT_CC_P = 0xA,
+    JIT_CC_NP = 0xB,
+    JIT_CC_L = 0xC,
+    JIT_CC_GE = 0xD,
+    JIT_CC_LE = 0xE,
+    JIT_CC_G = 0xF,
+    JIT_ALWAYS = 0x10, // plain jmp
+} Jit_Condition;       // low nibble of jcc/setcc
+
+typedef struct
+{
+    size_t at;     // offset of the rel32 to patch
+    size_t target; // instruction it jumps to
+} Jit_Jump;
+
+typedef struct
+{
+    size_t at; // offset of the rel32 to patch
+    size_t ip; // instruction the trap is reported at
+    Trap trap; // what to report, unless in_eax
+    bool in_eax; // the trap came back from a call out and is already in eax
+} Jit_Trap;
+
+typedef struct
+{
+    uint8_t *code;
+    size_t size;
+    size_t capacity;
+
+    Jit_Jump *jumps;
+    size_t jumps_size;
+    size_t jumps_capacity;
+
+    Jit_Trap *traps;
+    size_t traps_size;
+    size_t traps_capacity;
+} Jit_Buffer;
+
+typedef Trap (*Jit_Entry)(VirtualMachine *vm, const uint8_t *start);
+
+static void *jit_grow(void *items, size_t *capacity, size_t needed, size_t item_size)
+{
+    if (needed <= *capacity)
+    {
+        return items;
+    }
+
+    size_t new_capacity = *capacity ? *capacity * 2 : 256;
+    while (new_capacity < needed)
+    {
+        new_capacity *= 2;
+    }
+
+    items = realloc(items, new_capacity * item_size);
+    if (!items)
+    {
+        fprintf(stderr, "ERROR: JIT buffer allocation failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    *capacity = new_capacity;
+    return items;
+}
+
+static void jit_byte(Jit_Buffer *b, uint8_t byte)
+{
+    b->code = jit_grow(b->code, &b->capacity, b->size + 1, 1);
+    b->code[b->size++] = byte;
+}
+
+static void jit_u32(Jit_Buffer *b, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        jit_byte(b, (uint8_t)(value >> (8 * i)));
+    }
+}
+
+static void jit_u64(Jit_Buffer *b, uint64_t value)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        jit_byte(b, (uint8_t)(value >> (8 * i)));
+    }
+}
+
+static void jit_patch_rel32(Jit_Buffer *b, size_t at, size_t to)
+{
+    uint32_t rel = (uint32_t)(to - (at + 4));
+    for (int i = 0; i < 4; i++)
+    {
+        b->code[at + i] = (uint8_t)(rel >> (8 * i));
+    }
+}
+
+// [prefix] [REX] opcode, the opcode given most significant byte first in the low 'length' bytes
+static void jit_opcode(Jit_Buffer *b, uint8_t prefix, bool wide, uint32_t opcode, int length, int reg, int rm)
+{
+    if (prefix)
+    {
+        jit_byte(b, prefix);
+    }
+    uint8_t rex = 0x40 | (wide ? 0x8 : 0) | ((reg & 8) ? 0x4 : 0) | ((rm & 8) ? 0x1 : 0);
+    if (rex != 0x40)
+    {
+        jit_byte(b, rex);
+    }
+    for (int i = length - 1; i >= 0; i--)
+    {
+        jit_byte(b, (uint8_t)(opcode >> (8 * i)));
+    }
+}
+
+// op reg, [base + disp] (or the other way round, as the opcode says); reg is an opcode extension for the one operand forms
+static void jit_mem(Jit_Buffer *b, uint8_t prefix, bool wide, uint32_t opcode, int length, int reg, int base, int32_t disp)
+{
+    jit_opcode(b, prefix, wide, opcode, length, reg, base);
+    bool short_disp = disp >= -128 && disp <= 127;
+    jit_byte(b, (short_disp ? 0x40 : 0x80) | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == JIT_RSP)
+    {
+        jit_byte(b, 0x24); // rsp and r12 as a base need a SIB byte
+    }
+    if (short_disp)
+    {
+        jit_byte(b, (uint8_t)disp);
+    }
+    else
+    {
+        jit_u32(b, (uint32_t)disp);
+    }
+}
+
+// op reg, rm with both operands registers
+static void jit_reg(Jit_Buffer *b, uint8_t prefix, bool wide, uint32_t opcode, int length, int reg, int rm)
+{
+    jit_opcode(b, prefix, wide, opcode, length, reg, rm);
+    jit_byte(b, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+static void jit_mov_imm(Jit_Buffer *b, int reg, uint64_t value)
+{
+    if (value <= UINT32_MAX)
+    {
+        jit_opcode(b, 0, false, 0xB8 + (reg & 7), 1, 0, reg); // writing the low half zeroes the rest
+        jit_u32(b, (uint32_t)value);
+        return;
+    }
+    jit_opcode(b, 0, true, 0xB8 + (reg & 7), 1, 0, reg);
+    jit_u64(b, value);
+}
+
+// add/sub/cmp (extension 0, 5, 7) of a sign extended byte to a 64 bit register
+static void jit_alu_imm8(Jit_Buffer *b, int extension, int reg, int8_t value)
+{
+    jit_reg(b, 0, true, 0x83, 1, extension, reg);
+    jit_byte(b, (uint8_t)value);
+}
+
+static void jit_jump(Jit_Buffer *b, Jit_Condition condition)
+{
+    if (condition == JIT_ALWAYS)
+    {
+        jit_byte(b, 0xE9);
+    }
+    else
+    {
+        jit_byte(b, 0x0F);
+        jit_byte(b, 0x80 | condition);
+    }
+}
+
+static void jit_jump_to_inst(Jit_Buffer *b, Jit_Condition condition, size_t target)
+{
+    jit_jump(b, condition);
+    b->jumps = jit_grow(b->jumps, &b->jumps_capacity, b->jumps_size + 1, sizeof(Jit_Jump));
+    b->jumps[b->jumps_size++] = (Jit_Jump){.at = b->size, .target = target};
+    jit_u32(b, 0);
+}
+
+// the stubs these jump to are emitted after the program, out of the straight line path
+static void jit_exit_if(Jit_Buffer *b, Jit_Condition condition, size_t ip, Trap trap, bool in_eax)
+{
+    jit_jump(b, condition);
+    b->traps = jit_grow(b->traps, &b->traps_capacity, b->traps_size + 1, sizeof(Jit_Trap));
+    b->traps[b->traps_size++] = (Jit_Trap){.at = b->size, .ip = ip, .trap = trap, .in_eax = in_eax};
+    jit_u32(b, 0);
+}
+
+static void jit_trap_if(Jit_Buffer *b, Jit_Condition condition, size_t ip, Trap trap)
+{
+    jit_exit_if(b, condition, ip, trap, false);
+}
+
+// the REQUIRE() and ROOM() of the threaded loop
+static void jit_require(Jit_Buffer *b, size_t n, size_t ip)
+{
+    jit_mem(b, 0, true, 0x8D, 1, JIT_RAX, JIT_R12, (int32_t)(n * sizeof(Value))); // lea rax, [r12 + n * 8]
+    jit_reg(b, 0, true, 0x39, 1, JIT_RAX, JIT_R13);                             // cmp r13, rax
+    jit_trap_if(b, JIT_CC_B, ip, TRAP_STACK_UNDERFLOW);
+}
+
+static void jit_room(Jit_Buffer *b, size_t ip)
+{
+    jit_reg(b, 0, true, 0x39, 1, JIT_R14, JIT_R13); // cmp r13, r14
+    jit_trap_if(b, JIT_CC_AE, ip, TRAP_STACK_OVERFLOW);
+}
+
+static void jit_load_top(Jit_Buffer *b, int reg, int from_top)
+{
+    jit_mem(b, 0, true, 0x8B, 1, reg, JIT_R13, -8 * from_top); // mov reg, [r13 - 8 * from_top]
+}
+
+static void jit_store_top(Jit_Buffer *b, int reg, int from_top)
+{
+    jit_mem(b, 0, true, 0x89, 1, reg, JIT_R13, -8 * from_top); // mov [r13 - 8 * from_top], reg
+}
+
+static void jit_drop(Jit_Buffer *b, int8_t entries)
+{
+    jit_alu_imm8(b, 5, JIT_R13, (int8_t)(8 * entries)); // sub r13, 8 * entries
+}
+
+static void jit_spill(Jit_Buffer *b, int scratch)
+{
+    jit_reg(b, 0, true, 0x89, 1, JIT_R13, scratch); // mov scratch, r13
+    jit_reg(b, 0, true, 0x29, 1, JIT_R12, scratch); // sub scratch, r12
+    jit_reg(b, 0, true, 0xC1, 1, 5, scratch);       // shr scratch, 3
+    jit_byte(b, 3);
+    jit_mem(b, 0, true, 0x89, 1, scratch, JIT_RBX, offsetof(VirtualMachine, stack_size));
+}
+
+static void jit_fill(Jit_Buffer *b)
+{
+    jit_mem(b, 0, true, 0x8B, 1, JIT_R12, JIT_RBX, offsetof(VirtualMachine, stack));
+    jit_mem(b, 0, true, 0x8B, 1, JIT_R13, JIT_RBX, offsetof(VirtualMachine, stack_size));
+    jit_reg(b, 0, true, 0xC1, 1, 4, JIT_R13); // shl r13, 3
+    jit_byte(b, 3);
+    jit_reg(b, 0, true, 0x01, 1, JIT_R12, JIT_R13); // add r13, r12
+}
+
+// calls fn(vm) with the machine state written back and reloads it afterwards; the Trap it returns is left in eax
+static void jit_call_out(Jit_Buffer *b, size_t ip, uint64_t fn, int32_t table_disp, bool through_natives)
+{
+    jit_spill(b, JIT_RAX);
+    jit_mem(b, 0, true, 0xC7, 1, 0, JIT_RBX, offsetof(VirtualMachine, instruction_pointer)); // mov qword [rbx + ip], imm32
+    jit_u32(b, (uint32_t)ip);
+    jit_reg(b, 0, true, 0x89, 1, JIT_RBX, JIT_RDI); // mov rdi, rbx
+    if (through_natives)
+    {
+        jit_mem(b, 0, true, 0x8B, 1, JIT_RAX, JIT_RBX, offsetof(VirtualMachine, natives));
+        jit_mem(b, 0, false, 0xFF, 1, 2, JIT_RAX, table_disp); // call [rax + index * 8]
+    }
+    else
+    {
+        jit_mov_imm(b, JIT_RAX, fn);
+        jit_reg(b, 0, false, 0xFF, 1, 2, JIT_RAX); // call rax
+    }
+    jit_fill(b);
+    jit_reg(b, 0, false, 0x85, 1, JIT_RAX, JIT_RAX); // test eax, eax
+}
+
+// anything without a template of its own runs through the switch interpreter's handler for that one instruction
+static void jit_fallback(Jit_Buffer *b, size_t ip)
+{
+    jit_call_out(b, ip, (uint64_t)(uintptr_t)vm_execute_at_inst_pointer, 0, false);
+    jit_exit_if(b, JIT_CC_NE, ip, TRAP_OK, true);
+}
+
+static void jit_compare(Jit_Buffer *b, Jit_Condition condition)
+{
+    jit_load_top(b, JIT_RAX, 2);
+    jit_mem(b, 0, true, 0x3B, 1, JIT_RAX, JIT_R13, -8); // cmp rax, [r13 - 8]
+    jit_reg(b, 0, false, 0x0F90 | condition, 2, 0, JIT_RAX);
+}
+
+// a > b and a >= b straight from ucomisd; a < b and a <= b as b > a and b >= a, so unordered comes out false in all four
+static void jit_compare_f64(Jit_Buffer *b, Jit_Condition condition, bool swapped)
+{
+    jit_mem(b, 0xF2, false, 0x0F10, 2, 0, JIT_R13, swapped ? -8 : -16);  // movsd xmm0, a
+    jit_mem(b, 0x66, false, 0x0F2E, 2, 0, JIT_R13, swapped ? -16 : -8);  // ucomisd xmm0, b
+    jit_reg(b, 0, false, 0x0F90 | condition, 2, 0, JIT_RAX);
+    if (condition == JIT_CC_E)
+    {
+        jit_reg(b, 0, false, 0x0F90 | JIT_CC_NP, 2, 0, JIT_RCX);
+        jit_reg(b, 0, false, 0x20, 1, JIT_RCX, JIT_RAX); // and al, cl
+    }
+}
+
+static void jit_finish_compare(Jit_Buffer *b)
+{
+    jit_reg(b, 0, false, 0x0FB6, 2, JIT_RAX, JIT_RAX); // movzx eax, al
+    jit_store_top(b, JIT_RAX, 2);
+    jit_drop(b, 1);
+}
+
+static void jit_arith_f64(Jit_Buffer *b, uint32_t opcode)
+{
+    jit_mem(b, 0xF2, false, 0x0F10, 2, 0, JIT_R13, -16); // movsd xmm0, [r13 - 16]
+    jit_mem(b, 0xF2, false, opcode, 2, 0, JIT_R13, -8);  // op xmm0, [r13 - 8]
+    jit_mem(b, 0xF2, false, 0x0F11, 2, 0, JIT_R13, -16); // movsd [r13 - 16], xmm0
+    jit_drop(b, 1);
+}
+
+// ucomisd of the stack top against EPSILON, for fjmp_if: it jumps unless the flags say below and ordered
+static void jit_compare_epsilon(Jit_Buffer *b)
+{
+    double epsilon = EPSILON;
+    uint64_t epsilon_bits;
+    memcpy(&epsilon_bits, &epsilon, sizeof(epsilon_bits));
+
+    jit_mem(b, 0xF2, false, 0x0F10, 2, 0, JIT_R13, -8); // movsd xmm0, [r13 - 8]
+    jit_mov_imm(b, JIT_RAX, epsilon_bits);
+    jit_reg(b, 0x66, true, 0x0F6E, 2, 1, JIT_RAX); // movq xmm1, rax
+    jit_reg(b, 0x66, false, 0x0F2E, 2, 0, 1);     // ucomisd xmm0, xmm1
+}
+
+// the push itself; the ROOM() check is the caller's
+static void jit_push_imm(Jit_Buffer *b, uint64_t value)
+{
+    jit_mov_imm(b, JIT_RAX, value);
+    jit_store_top(b, JIT_RAX, 0);
+    jit_alu_imm8(b, 0, JIT_R13, 8);
+}
+
+// leaves rax pointing at static_memory[address] once the LOAD_OP()/STORE_OP() bounds check passed
+static void jit_static_address(Jit_Buffer *b, size_t ip, size_t access_size)
+{
+    jit_load_top(b, JIT_RAX, 1);
+    jit_mov_imm(b, JIT_RCX, vm_memory_capacity - access_size);
+    jit_reg(b, 0, true, 0x39, 1, JIT_RCX, JIT_RAX); // cmp rax, rcx
+    jit_trap_if(b, JIT_CC_AE, ip, TRAP_ILLEGAL_MEMORY_ACCESS);
+    jit_mem(b, 0, true, 0x03, 1, JIT_RAX, JIT_RBX, offsetof(VirtualMachine, static_memory)); // add rax, [rbx + static_memory]
+}
+
+// deepest slot rdup and rswap can address with a 32 bit displacement; deeper ones go through the fallback
+#define JIT_MAX_REACH ((uint64_t)1 << 24)
+
+static void jit_emit_inst(Jit_Buffer *b, const VirtualMachine *vm, size_t ip)
+{
+    Inst inst = vm->program[ip];
+    uint64_t operand = inst.operand._as_u64;
+
+    switch (inst.type)
+    {
+    case INST_NOP:
+        break;
+
+    case INST_SPUSH:
+    case INST_UPUSH:
+    case INST_FPUSH:
+        jit_room(b, ip);
+        jit_push_imm(b, operand);
+        break;
+
+    case INST_RDUP:
+        if (operand >= JIT_MAX_REACH)
+        {
+            jit_fallback(b, ip);
+            break;
+        }
+        jit_room(b, ip);
+        jit_require(b, operand + 1, ip);
+        jit_load_top(b, JIT_RAX, (int)operand + 1);
+        jit_store_top(b, JIT_RAX, 0);
+        jit_alu_imm8(b, 0, JIT_R13, 8);
+        break;
+
+    case INST_RSWAP:
+        if (operand >= JIT_MAX_REACH)
+        {
+            jit_fallback(b, ip);
+            break;
+        }
+        jit_require(b, operand + 1, ip);
+        jit_load_top(b, JIT_RAX, 1);
+        jit_load_top(b, JIT_RCX, (int)operand + 1);
+        jit_store_top(b, JIT_RCX, 1);
+        jit_store_top(b, JIT_RAX, (int)operand + 1);
+        break;
+
+    case INST_POP:
+        jit_require(b, 1, ip);
+        jit_drop(b, 1);
+        break;
+
+    case INST_SPLUS:
+    case INST_UPLUS:
+    case INST_SMINUS:
+    case INST_UMINUS:
+    case INST_ANDB:
+    case INST_ORB:
+    {
+        uint8_t opcode = inst.type == INST_ANDB ? 0x21 : inst.type == INST_ORB ? 0x09
+                                                   : (inst.type == INST_SPLUS || inst.type == INST_UPLUS) ? 0x01
+                                                                                                           : 0x29;
+        jit_require(b, 2, ip);
+        jit_load_top(b, JIT_RAX, 1);
+        jit_mem(b, 0, true, opcode, 1, JIT_RAX, JIT_R13, -16); // op [r13 - 16], rax
+        jit_drop(b, 1);
+        break;
+    }
+
+    case INST_SMULT:
+    case INST_UMULT:
+        jit_require(b, 2, ip);
+        jit_load_top(b, JIT_RAX, 2);
+        jit_mem(b, 0, true, 0x0FAF, 2, JIT_RAX, JIT_R13, -8); // imul rax, [r13 - 8]
+        jit_store_top(b, JIT_RAX, 2);
+        jit_drop(b, 1);
+        break;
+
+    case INST_SDIV:
+    case INST_UDIV:
+        jit_require(b, 2, ip);
+        jit_load_top(b, JIT_RCX, 1);
+        jit_reg(b, 0, true, 0x85, 1, JIT_RCX, JIT_RCX); // test rcx, rcx
+        jit_trap_if(b, JIT_CC_E, ip, TRAP_DIV_BY_ZERO);
+        jit_load_top(b, JIT_RAX, 2);
+        if (inst.type == INST_UDIV)
+        {
+            jit_reg(b, 0, false, 0x31, 1, JIT_RDX, JIT_RDX); // xor edx, edx
+            jit_reg(b, 0, true, 0xF7, 1, 6, JIT_RCX);        // div rcx
+        }
+        else
+        {
+            // VM_SDIV(): dividing by -1 negates, which wraps INT64_MIN where idiv would fault
+            jit_alu_imm8(b, 7, JIT_RCX, -1); // cmp rcx, -1
+            jit_byte(b, 0x75);               // jne idiv
+            jit_byte(b, 5);
+            jit_reg(b, 0, true, 0xF7, 1, 3, JIT_RAX); // neg rax
+            jit_byte(b, 0xEB);                        // jmp done
+            jit_byte(b, 5);
+            jit_opcode(b, 0, true, 0x99, 1, 0, 0);    // cqo
+            jit_reg(b, 0, true, 0xF7, 1, 7, JIT_RCX); // idiv rcx
+        }
+        jit_store_top(b, JIT_RAX, 2);
+        jit_drop(b, 1);
+        break;
+
+    case INST_FPLUS:
+        jit_require(b, 2, ip);
+        jit_arith_f64(b, 0x0F58);
+        break;
+    case INST_FMINUS:
+        jit_require(b, 2, ip);
+        jit_arith_f64(b, 0x0F5C);
+        break;
+    case INST_FMULT:
+        jit_require(b, 2, ip);
+        jit_arith_f64(b, 0x0F59);
+        break;
+    case INST_FDIV:
+        jit_require(b, 2, ip);
+        jit_reg(b, 0x66, false, 0x0F57, 2, 1, 1);            // xorpd xmm1, xmm1
+        jit_mem(b, 0x66, false, 0x0F2E, 2, 1, JIT_R13, -8); // ucomisd xmm1, [r13 - 8]
+        jit_byte(b, 0x7A);                                   // jp over the trap, NaN isn't zero
+        jit_byte(b, 6);
+        jit_trap_if(b, JIT_CC_E, ip, TRAP_DIV_BY_ZERO);
+        jit_arith_f64(b, 0x0F5E);
+        break;
+
+    case INST_LSR:
+    case INST_ASR:
+    case INST_SL:
+        jit_require(b, 1, ip);
+        jit_mov_imm(b, JIT_RCX, operand & 0xFF); // shifts by cl, which the hardware masks the same way the interpreters' shifts do
+        jit_mem(b, 0, true, 0xD3, 1, inst.type == INST_LSR ? 5 : inst.type == INST_ASR ? 7
+                                                                                         : 4,
+                JIT_R13, -8);
+        break;
+
+    case INST_NOTB:
+        jit_require(b, 1, ip);
+        jit_mem(b, 0, true, 0xF7, 1, 2, JIT_R13, -8); // not qword [r13 - 8]
+        break;
+
+    case INST_JMP:
+        if (operand >= vm->program_size)
+        {
+            jit_trap_if(b, JIT_ALWAYS, ip, TRAP_ILLEGAL_JMP);
+            break;
+        }
+        jit_jump_to_inst(b, JIT_ALWAYS, operand);
+        break;
+
+    case INST_UJMP_IF:
+        if (operand >= vm->program_size)
+        {
+            jit_trap_if(b, JIT_ALWAYS, ip, TRAP_ILLEGAL_JMP);
+            break;
+        }
+        jit_require(b, 1, ip);
+        jit_load_top(b, JIT_RAX, 1);
+        jit_reg(b, 0, true, 0x85, 1, JIT_RAX, JIT_RAX); // test rax, rax
+        jit_byte(b, 0x74);                              // je past the pop and the jump
+        jit_byte(b, 9);
+        jit_drop(b, 1);
+        jit_jump_to_inst(b, JIT_ALWAYS, operand);
+        break;
+
+    case INST_FJMP_IF:
+        if (operand >= vm->program_size)
+        {
+            jit_trap_if(b, JIT_ALWAYS, ip, TRAP_ILLEGAL_JMP);
+            break;
+        }
+        jit_require(b, 1, ip);
+        jit_compare_epsilon(b);
+        jit_byte(b, 0x7A);                             // jp taken: NaN is not below EPSILON
+        jit_byte(b, 2);
+        jit_byte(b, 0x72); // jb past the pop and the jump
+        jit_byte(b, 9);
+        jit_drop(b, 1);
+        jit_jump_to_inst(b, JIT_ALWAYS, operand);
+        break;
+
+    case INST_CALL:
+        jit_room(b, ip);
+        if (operand >= vm->program_size)
+        {
+            jit_trap_if(b, JIT_ALWAYS, ip, TRAP_ILLEGAL_JMP);
+            break;
+        }
+        jit_push_imm(b, ip + 1); // return addresses stay plain instruction indices
+        jit_jump_to_inst(b, JIT_ALWAYS, operand);
+        break;
+
+    case INST_RET:
+        jit_require(b, 1, ip);
+        jit_load_top(b, JIT_RAX, 1);
+        jit_mov_imm(b, JIT_RCX, vm->program_size);
+        jit_reg(b, 0, true, 0x39, 1, JIT_RCX, JIT_RAX); // cmp rax, rcx
+        jit_trap_if(b, JIT_CC_AE, ip, TRAP_ILLEGAL_JMP);
+        jit_drop(b, 1);
+        jit_byte(b, 0x41); // jmp [r15 + rax * 8]
+        jit_byte(b, 0xFF);
+        jit_byte(b, 0x24);
+        jit_byte(b, 0xC7);
+        break;
+
+    case INST_HALT:
+        jit_mem(b, 0, false, 0xC7, 1, 0, JIT_RBX, offsetof(VirtualMachine, halt)); // mov dword [rbx + halt], 1
+        jit_u32(b, 1);
+        jit_trap_if(b, JIT_ALWAYS, ip, TRAP_OK); // leaves like a trap, with nothing to report
+        break;
+
+    case INST_NATIVE:
+        if (operand >= vm->natives_size)
+        {
+            jit_trap_if(b, JIT_ALWAYS, ip, TRAP_ILLEGAL_OPERAND);
+            break;
+        }
+        jit_call_out(b, ip, 0, (int32_t)(operand * sizeof(native)), true);
+        jit_exit_if(b, JIT_CC_NE, ip, TRAP_OK, true);
+        break;
+
+    case INST_STORE8:
+    case INST_STORE16:
+    case INST_STORE32:
+    case INST_STORE64:
+    {
+        size_t size = inst.type == INST_STORE8 ? 1 : inst.type == INST_STORE16 ? 2
+                                                 : inst.type == INST_STORE32   ? 4
+                                                                               : 8;
+        jit_require(b, 2, ip);
+        jit_static_address(b, ip, size);
+        jit_load_top(b, JIT_RCX, 2);
+        jit_mem(b, size == 2 ? 0x66 : 0, size == 8, size == 1 ? 0x88 : 0x89, 1, JIT_RCX, JIT_RAX, 0); // mov [rax], cl/cx/ecx/rcx
+        jit_drop(b, 2);
+        break;
+    }
+
+    case INST_ZELOAD8:
+    case INST_ZELOAD16:
+    case INST_ZELOAD32:
+    case INST_LOAD64:
+    case INST_SELOAD8:
+    case INST_SELOAD16:
+    case INST_SELOAD32:
+    {
+        size_t size = (inst.type == INST_ZELOAD8 || inst.type == INST_SELOAD8)     ? 1
+                      : (inst.type == INST_ZELOAD16 || inst.type == INST_SELOAD16) ? 2
+                      : (inst.type == INST_ZELOAD32 || inst.type == INST_SELOAD32) ? 4
+                                                                                   : 8;
+        jit_require(b, 1, ip);
+        jit_static_address(b, ip, size);
+        switch (inst.type)
+        {
+        case INST_ZELOAD8:
+            jit_mem(b, 0, false, 0x0FB6, 2, JIT_RAX, JIT_RAX, 0); // movzx eax, byte [rax]
+            break;
+        case INST_ZELOAD16:
+            jit_mem(b, 0, false, 0x0FB7, 2, JIT_RAX, JIT_RAX, 0); // movzx eax, word [rax]
+            break;
+        case INST_ZELOAD32:
+            jit_mem(b, 0, false, 0x8B, 1, JIT_RAX, JIT_RAX, 0); // mov eax, [rax]
+            break;
+        case INST_SELOAD8:
+            jit_mem(b, 0, true, 0x0FBE, 2, JIT_RAX, JIT_RAX, 0); // movsx rax, byte [rax]
+            break;
+        case INST_SELOAD16:
+            jit_mem(b, 0, true, 0x0FBF, 2, JIT_RAX, JIT_RAX, 0); // movsx rax, word [rax]
+            break;
+        case INST_SELOAD32:
+            jit_mem(b, 0, true, 0x63, 1, JIT_RAX, JIT_RAX, 0); // movsxd rax, [rax]
+            break;
+        default:
+            jit_mem(b, 0, true, 0x8B, 1, JIT_RAX, JIT_RAX, 0); // mov rax, [rax]
+            break;
+        }
+        jit_store_top(b, JIT_RAX, 1);
+        break;
+    }
+
+    case INST_EQU:
+    case INST_EQS:
+    case INST_GEU:
+    case INST_GES:
+    case INST_LEU:
+    case INST_LES:
+    case INST_GU:
+    case INST_GS:
+    case INST_LU:
+    case INST_LS:
+    {
+        static const Jit_Condition conditions[] = {
+            [INST_EQU] = JIT_CC_E,
+            [INST_EQS] = JIT_CC_E,
+            [INST_GEU] = JIT_CC_AE,
+            [INST_GES] = JIT_CC_GE,
+            [INST_LEU] = JIT_CC_BE,
+            [INST_LES] = JIT_CC_LE,
+            [INST_GU] = JIT_CC_A,
+            [INST_GS] = JIT_CC_G,
+            [INST_LU] = JIT_CC_B,
+            [INST_LS] = JIT_CC_L,
+        };
+        jit_require(b, 2, ip);
+        jit_compare(b, conditions[inst.type]);
+        jit_finish_compare(b);
+        break;
+    }
+
+    case INST_EQF:
+    case INST_GEF:
+    case INST_GF:
+    case INST_LEF:
+    case INST_LF:
+        jit_require(b, 2, ip);
+        jit_compare_f64(b, inst.type == INST_EQF                           ? JIT_CC_E
+                           : (inst.type == INST_GEF || inst.type == INST_LEF) ? JIT_CC_AE
+                                                                              : JIT_CC_A,
+                        inst.type == INST_LEF || inst.type == INST_LF);
+        jit_finish_compare(b);
+        break;
+
+    case INST_FTU:
+    case INST_FTS:
+        jit_require(b, 1, ip);
+        jit_mem(b, 0xF2, true, 0x0F2C, 2, JIT_RAX, JIT_R13, -8); // cvttsd2si rax, [r13 - 8]
+        jit_store_top(b, JIT_RAX, 1);
+        break;
+
+    case INST_STF:
+        jit_require(b, 1, ip);
+        jit_mem(b, 0xF2, true, 0x0F2A, 2, 0, JIT_R13, -8);  // cvtsi2sd xmm0, qword [r13 - 8]
+        jit_mem(b, 0xF2, false, 0x0F11, 2, 0, JIT_R13, -8); // movsd [r13 - 8], xmm0
+        break;
+
+    case INST_STU:
+    case INST_UTS:
+        jit_require(b, 1, ip); // same bits either way
+        break;
+
+    default: // adup, aswap, pop_at, empty, utf and illegal instructions
+        jit_fallback(b, ip);
+        break;
+    }
+}
+
+// Trap entry(VirtualMachine *vm, const uint8_t *start): saves the callee saved registers, keeping rsp 16 byte aligned for
+// the calls out, loads the machine into registers and jumps to start; after it comes the one exit every way out
+// lands on, with the trap in eax and the instruction to report it at in ecx, whose offset is returned
+static size_t jit_emit_entry(Jit_Buffer *b, const uint8_t **entries)
+{
+    static const uint8_t prologue[] = {
+        0x53,                   // push rbx
+        0x55,                   // push rbp
+        0x41, 0x54,             // push r12
+        0x41, 0x55,             // push r13
+        0x41, 0x56,             // push r14
+        0x41, 0x57,             // push r15
+        0x48, 0x83, 0xEC, 0x08, // sub rsp, 8
+        0x48, 0x89, 0xFB,       // mov rbx, rdi
+    };
+    for (size_t i = 0; i < ARRAY_SIZE(prologue); i++)
+    {
+        jit_byte(b, prologue[i]);
+    }
+    jit_fill(b);
+    jit_mov_imm(b, JIT_R14, vm_stack_capacity * sizeof(Value));
+    jit_reg(b, 0, true, 0x01, 1, JIT_R12, JIT_R14); // add r14, r12
+    jit_mov_imm(b, JIT_R15, (uint64_t)(uintptr_t)entries);
+    jit_reg(b, 0, false, 0xFF, 1, 4, JIT_RSI); // jmp rsi
+
+    size_t exit_at = b->size;
+    jit_spill(b, JIT_RDX);
+    jit_mem(b, 0, true, 0x89, 1, JIT_RCX, JIT_RBX, offsetof(VirtualMachine, instruction_pointer));
+    static const uint8_t epilogue[] = {
+        0x48, 0x83, 0xC4, 0x08, // add rsp, 8
+        0x41, 0x5F,             // pop r15
+        0x41, 0x5E,             // pop r14
+        0x41, 0x5D,             // pop r13
+        0x41, 0x5C,             // pop r12
+        0x5D,                   // pop rbp
+        0x5B,                   // pop rbx
+        0xC3,                   // ret
+    };
+    for (size_t i = 0; i < ARRAY_SIZE(epilogue); i++)
+    {
+        jit_byte(b, epilogue[i]);
+    }
+    return exit_at;
+}
+
+// the stubs jit_exit_if() promised, each loading its trap and instruction and going to the exit
+static void jit_emit_exits(Jit_Buffer *b, size_t exit_at)
+{
+    for (size_t i = 0; i < b->traps_size; i++)
+    {
+        Jit_Trap trap = b->traps[i];
+        jit_patch_rel32(b, trap.at, b->size);
+        jit_mov_imm(b, JIT_RCX, trap.ip);
+        if (!trap.in_eax)
+        {
+            jit_mov_imm(b, JIT_RAX, trap.trap);
+        }
+        jit_jump(b, JIT_ALWAYS);
+        jit_u32(b, 0);
+        jit_patch_rel32(b, b->size - 4, exit_at);
+    }
+}
+
+// copies the finished code into a mapping that is written while still writable, then flipped to read and execute so
+// it is never both; NULL if either step fails
+static uint8_t *jit_map(const Jit_Buffer *b)
+{
+    uint8_t *code = mmap(NULL, b->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED)
+    {
+        fprintf(stderr, "WARNING: JIT mapping failed: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    memcpy(code, b->code, b->size);
+    if (mprotect(code, b->size, PROT_READ | PROT_EXEC) != 0)
+    {
+        fprintf(stderr, "WARNING: JIT mapping could not be made executable: %s\n", strerror(errno));
+        munmap(code, b->size);
+        return NULL;
+    }
+    return code;
+}
+
+static void jit_buffer_free(Jit_Buffer *b)
+{
+    free((void *)b->code);
+    free((void *)b->jumps);
+    free((void *)b->traps);
+}
+
+static Trap jit_enter(const uint8_t *code, VirtualMachine *vm, const uint8_t *start)
+{
+    Jit_Entry entry;
+    memcpy(&entry, &code, sizeof(entry));
+    return entry(vm, start);
+}
+
+// compiles the whole loaded program at once into an executable mapping; false if it can't, in which case the program
+// is left to the interpreter
+bool vm_jit_compile(VirtualMachine *vm)
+{
+    size_t n = vm->program_size;
+    vm_jit_free(vm);
+
+    if (n == 0 || n > INT32_MAX)
+    {
+        return false;
+    }
+
+    Jit_Buffer b = {0};
+    size_t *offsets = malloc(sizeof(size_t) * n);
+    vm->jit_entries = malloc(sizeof(*vm->jit_entries) * n);
+    if (!offsets || !vm->jit_entries)
+    {
+        fprintf(stderr, "ERROR: JIT allocation failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    size_t exit_at = jit_emit_entry(&b, vm->jit_entries);
+    for (size_t ip = 0; ip < n; ip++)
+    {
+        offsets[ip] = b.size;
+        jit_emit_inst(&b, vm, ip);
+    }
+    jit_emit_exits(&b, exit_at);
+
+    for (size_t i = 0; i < b.jumps_size; i++)
+    {
+        jit_patch_rel32(&b, b.jumps[i].at, offsets[b.jumps[i].target]);
+    }
+
+    uint8_t *code = jit_map(&b);
+    if (code)
+    {
+        vm->jit_code = code;
+        vm->jit_code_size = b.size;
+        for (size_t ip = 0; ip < n; ip++)
+        {
+            vm->jit_entries[ip] = code + offsets[ip];
+        }
+    }
+
+    free((void *)offsets);
+    jit_buffer_free(&b);
+
+    if (!code)
+    {
+        vm_jit_free(vm);
+        return false;
+    }
+    return true;
+}
+
+void vm_jit_free(VirtualMachine *vm)
+{
+    if (vm->jit_code)
+    {
+        munmap(vm->jit_code, vm->jit_code_size);
+    }
+    free((void *)vm->jit_entries);
+    vm->jit_code = NULL;
+    vm->jit_code_size = 0;
+    vm->jit_entries = NULL;
+}
+
+#undef JIT_MAX_REACH
+
+// tracing JIT: vm_exec_threaded() counts the back edges into every loop header and stops at one once it gets hot;
+// the loop is then run once around on the switch interpreter while the path it takes is written down, and that one
+// path is compiled with the same templates as above, every branch and ret turned into a guard that leaves the trace,
+// at the instruction it guards, whenever the run would go another way than the recording did
+
+typedef struct
+{
+    size_t ip;
+    uint64_t expect; // ujmp_if/fjmp_if: whether it jumped; ret: the address it returned to
+} Trace_Step;
+
+// runs the loop headed at vm->instruction_pointer once around, noting every instruction and which way it went; false
+// if the path can't be a trace, in which case *trap says whether it stopped on a trap, and the machine is left
+// wherever the recording stopped either way
+// paths reaching halt, longer than VM_TRACE_MAX_LENGTH, or returning from a function they didn't call aren't traced
+static bool vm_trace_record(VirtualMachine *vm, Trace_Step *steps, size_t *length, Trap *trap)
+{
+    size_t head = vm->instruction_pointer;
+    size_t depth = 0; // calls in flight that the trace made itself
+    *length = 0;
+    *trap = TRAP_OK;
+
+    do
+    {
+        size_t ip = vm->instruction_pointer;
+        Inst inst = vm->program[ip];
+        Trace_Step step = {.ip = ip};
+        size_t stack_size = vm->stack_size;
+
+        if (*length == VM_TRACE_MAX_LENGTH || inst.type == INST_HALT)
+        {
+            return false;
+        }
+        if (inst.type == INST_CALL)
+        {
+            depth++;
+        }
+        else if (inst.type == INST_RET)
+        {
+            if (depth == 0)
+            {
+                return false;
+            }
+            depth--;
+            step.expect = stack_size > 0 ? vm->stack[stack_size - 1]._as_u64 : 0;
+        }
+
+        *trap = vm_execute_at_inst_pointer(vm);
+        if (*trap != TRAP_OK)
+        {
+            return false;
+        }
+        if (inst.type == INST_UJMP_IF || inst.type == INST_FJMP_IF)
+        {
+            step.expect = vm->stack_size < stack_size; // they pop exactly when they jump
+        }
+        steps[(*length)++] = step;
+    } while ((size_t)vm->instruction_pointer != head);
+
+    return depth == 0;
+}
+
+static bool vm_trace_compile(VirtualMachine *vm, const Trace_Step *steps, size_t length, Vm_Trace *trace)
+{
+    Jit_Buffer b = {0};
+    size_t exit_at = jit_emit_entry(&b, NULL);
+    size_t loop_at = b.size;
+
+    for (size_t k = 0; k < length; k++)
+    {
+        size_t ip = steps[k].ip;
+        bool expect = steps[k].expect != 0;
+
+        switch (vm->program[ip].type)
+        {
+        case INST_JMP:
+            break;
+
+        case INST_UJMP_IF:
+            jit_require(&b, 1, ip);
+            jit_load_top(&b, JIT_RAX, 1);
+            jit_reg(&b, 0, true, 0x85, 1, JIT_RAX, JIT_RAX); // test rax, rax
+            jit_trap_if(&b, expect ? JIT_CC_E : JIT_CC_NE, ip, TRAP_OK);
+            if (expect)
+            {
+                jit_drop(&b, 1);
+            }
+            break;
+
+        case INST_FJMP_IF:
+            jit_require(&b, 1, ip);
+            jit_compare_epsilon(&b);
+            if (expect)
+            {
+                jit_byte(&b, 0x7A); // jp past the exit, NaN jumps
+                jit_byte(&b, 6);
+                jit_trap_if(&b, JIT_CC_B, ip, TRAP_OK);
+                jit_drop(&b, 1);
+            }
+            else
+            {
+                jit_trap_if(&b, JIT_CC_P, ip, TRAP_OK);
+                jit_trap_if(&b, JIT_CC_AE, ip, TRAP_OK);
+            }
+            break;
+
+        case INST_CALL:
+            jit_room(&b, ip);
+            jit_push_imm(&b, ip + 1);
+            break;
+
+        case INST_RET:
+            jit_require(&b, 1, ip);
+            jit_load_top(&b, JIT_RAX, 1);
+            jit_mov_imm(&b, JIT_RCX, steps[k].expect);
+            jit_reg(&b, 0, true, 0x39, 1, JIT_RCX, JIT_RAX); // cmp rax, rcx
+            jit_trap_if(&b, JIT_CC_NE, ip, TRAP_OK);
+            jit_drop(&b, 1);
+            break;
+
+        default:
+            jit_emit_inst(&b, vm, ip);
+            break;
+        }
+    }
+    jit_jump(&b, JIT_ALWAYS); // around again
+    jit_u32(&b, 0);
+    jit_patch_rel32(&b, b.size - 4, loop_at);
+    jit_emit_exits(&b, exit_at);
+
+    uint8_t *code = jit_map(&b);
+    if (code)
+    {
+        *trace = (Vm_Trace){.code = code, .size = b.size, .entry = code + loop_at};
+    }
+    jit_buffer_free(&b);
+    return code != NULL;
+}
+
+// called with the machine stopped at a hot loop header: traces the loop the first time, then runs the trace until a
+// guard fails or it traps, and returns with the machine wherever the interpreter has to pick up
+static int vm_trace_enter(VirtualMachine *vm)
+{
+    size_t head = vm->instruction_pointer;
+    Vm_Trace *trace = &vm->traces[head];
+
+    if (!trace->code)
+    {
+        Trace_Step *steps = malloc(sizeof(Trace_Step) * VM_TRACE_MAX_LENGTH);
+        if (!steps)
+        {
+            fprintf(stderr, "ERROR: trace recording allocation failed: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        size_t length;
+        Trap trap;
+        if (vm_trace_record(vm, steps, &length, &trap) && vm_trace_compile(vm, steps, length, trace))
+        {
+            vm->trace_stats.compiled++;
+        }
+        else if (trap == TRAP_OK)
+        {
+            vm->hot_counters[head] = INT64_MIN; // never hot again
+            vm->trace_stats.aborted++;
+        }
+        free((void *)steps);
+
+        if (trap != TRAP_OK || !trace->code)
+        {
+            return trap;
+        }
+    }
+
+    struct timespec begin, end;
+    timespec_get(&begin, TIME_UTC);
+    Trap ret = jit_enter(trace->code, vm, trace->entry);
+    timespec_get(&end, TIME_UTC);
+
+    vm->trace_stats.entered++;
+    vm->trace_stats.native_seconds += (double)(end.tv_sec - begin.tv_sec) + (double)(end.tv_nsec - begin.tv_nsec) / 1e9;
+    return ret;
+}
+
+void vm_trace_free(VirtualMachine *vm)
+{
+    for (size_t i = 0; vm->traces && i < vm->program_size; i++)
+    {
+        if (vm->traces[i].code)
+        {
+            munmap(vm->traces[i].code, vm->traces[i].size);
+        }
+    }
+    free((void *)vm->hot_counters);
+    free((void *)vm->traces);
+    vm->hot_counters = NULL;
+    vm->traces = NULL;
+}
+
+#else
+
+bool vm_jit_compile(VirtualMachine *vm)
+{
+    (void)vm;
+    return false;
+}
+
+void vm_jit_free(VirtualMachine *vm)
+{
+    (void)vm;
+}
+
+static int vm_trace_enter(VirtualMachine *vm)
+{
+    (void)vm;
+    return TRAP_OK; // the decoder never counts back edges without a JIT, so nothing gets here
+}
+
+void vm_trace_free(VirtualMachine *vm)
+{
+    free((void *)vm->hot_counters);
+    free((void *)vm->traces);
+    vm->hot_counters = NULL;
+    vm->traces = NULL;
+}
+
+#endif // VM_HAS_JIT
+
+void vm_print_trace_stats(FILE *stream, const VirtualMachine *vm)
+{
+    const Trace_Stats *stats = &vm->trace_stats;
+    if (!VM_HAS_JIT || vm_trace_threshold == 0)
+    {
+        fprintf(stream, "Tracing: off\n");
+    }
+    else
+    {
+        fprintf(stream, "Trace threshold: %zu back edges\n", vm_trace_threshold);
+    }
+    fprintf(stream, "Traces compiled: %zu (%zu loops could not be traced)\n", stats->compiled, stats->aborted);
+    fprintf(stream, "Trace entries: %zu\n", stats->entered);
+    fprintf(stream, "Time in traces: %.6f s\n", stats->native_seconds);
+}
+
+// runs the program as machine code, compiling it first if it hasn't been; programs that can't be compiled (or builds
+// without a JIT) are interpreted instead
+int vm_exec_jit(VirtualMachine *vm)
+{
+    if (vm->program_size == 0 || vm->program[vm->program_size - 1].type != INST_HALT)
+    {
+        return TRAP_NO_HALT_FOUND;
+    }
+
+    if ((size_t)vm->instruction_pointer >= vm->program_size)
+    {
+        fprintf(stderr, "Trap activated: %s\n", trap_as_cstr(TRAP_ILLEGAL_INST_ACCESS));
+        return TRAP_ILLEGAL_INST_ACCESS;
+    }
+
+    if (!vm->jit_code && !vm_jit_compile(vm))
+    {
+        fprintf(stderr, "WARNING: the program could not be compiled to machine code; interpreting it instead\n");
+        return vm_exec_program(vm, -1, false);
+    }
+
+#if VM_HAS_JIT
+    if (vm->halt)
+    {
+        return SUCCESS;
+    }
+
+    int ret = jit_enter(vm->jit_code, vm, vm->jit_entries[vm->instruction_pointer]);
+    if (ret != TRAP_OK)
+    {
+        fprintf(stderr, "Trap activated: %s\n", trap_as_cstr(ret));
+        vm_print_location(stderr, vm, vm->instruction_pointer);
+        return ret;
+    }
+#endif
+    return SUCCESS;
+}
+
+void vm_push_inst(VirtualMachine *vm, Inst *inst)
+{
+    if (vm->program_size == vm_program_capacity)
+    {
+        fprintf(stderr, "Program Size Limit Exceeded");
+        exit(EXIT_FAILURE);
+    }
+
+    vm_own_program(vm);
+    if (vm->program_size == vm->program_capacity)
+    {
+        vm->program = vm_grow_array(vm->program, &vm->program_capacity, vm->program_size + 1, sizeof(Inst));
+    }
+    vm->program[vm->program_size++] = *inst;
+}
+
+// compact code section (VM_EXECUTABLE_IDENTIFIER_COMPACT): each instruction is its Inst_Type in one byte followed by
+// its operand, if it has one, as a LEB128 varint; unsigned operands go in as they are, signed ones zigzag encoded so
+// small negative numbers stay short, and doubles byte-reversed so the zero low bytes of round values drop out
+static uint64_t vm_compact_operand(Inst inst)
+{
+    uint64_t bits = inst.operand._as_u64;
+    switch (get_operand_type(inst.type))
+    {
+    case TYPE_SIGNED_64INT:
+        return (bits << 1) ^ (uint64_t)(inst.operand._as_s64 >> 63);
+    case TYPE_DOUBLE:
+    {
+        uint64_t reversed = 0;
+        for (int k = 0; k < 8; k++, bits >>= 8)
+        {
+            reversed = (reversed << 8) | (bits & 0xFF);
+        }
+        return reversed;
+    }
+    default:
+        return bits;
+    }
+}
+
+// LEB128: seven bits a byte, low first, the top bit set on every byte but the last; at most ten bytes
+static size_t vm_put_varint(uint8_t *out, uint64_t value)
+{
+    size_t size = 0;
+    do
+    {
+        out[size++] = (uint8_t)((value & 0x7F) | (value > 0x7F ? 0x80 : 0));
+        value >>= 7;
+    } while (value > 0);
+    return size;
+}
+
+// reads a varint from *cursor and moves past it; false if the bytes up to end don't hold a whole one
+static bool vm_get_varint(const uint8_t **cursor, const uint8_t *end, uint64_t *value)
+{
+    const uint8_t *at = *cursor;
+    *value = 0;
+    for (int shift = 0;; shift += 7)
+    {
+        if (at == end || shift > 63)
+        {
+            return false;
+        }
+        *value |= (uint64_t)(*at & 0x7F) << shift;
+        if (!(*at++ & 0x80))
+        {
+            break;
+        }
+    }
+    *cursor = at;
+    return true;
+}
+
+// writes at most VM_COMPACT_INST_MAX bytes to out and returns how many
+size_t vm_encode_inst(Inst inst, uint8_t *out)
+{
+    size_t size = 0;
+    out[size++] = (uint8_t)inst.type;
+    if (has_operand_function(inst.type))
+    {
+        size += vm_put_varint(out + size, vm_compact_operand(inst));
+    }
+    return size;
+}
+
+// reads one instruction from *cursor and moves it past; false if the bytes up to end don't hold a whole one
+bool vm_decode_inst(const uint8_t **cursor, const uint8_t *end, Inst *inst)
+{
+    const uint8_t *at = *cursor;
+    if (at == end)
+    {
+        return false;
+    }
+    *inst = (Inst){.type = (Inst_Type)*at++};
+
+    if (has_operand_function(inst->type))
+    {
+        uint64_t value;
+        if (!vm_get_varint(&at, end, &value))
+        {
+            return false;
+        }
+
+        switch (get_operand_type(inst->type))
+        {
+        case TYPE_SIGNED_64INT:
+            inst->operand._as_u64 = (value >> 1) ^ (0 - (value & 1));
+            break;
+        case TYPE_DOUBLE:
+            inst->operand._as_u64 = vm_compact_operand((Inst){.type = INST_FPUSH, .operand._as_u64 = value}); // reversing is its own inverse
+            break;
+        default:
+            inst->operand._as_u64 = value;
+            break;
+        }
+    }
+
+    *cursor = at;
+    return true;
+}
+
+// container format, all integers little endian:
+//   header, VM_FORMAT_HEADER_SIZE bytes:
+//     0 magic VM_FORMAT_MAGIC | 8 u16 version | 10 u16 flags (VM_FORMAT_*) | 12 u32 section count
+//     16 u64 start location | 24 u64 section table offset | 32 u32 section alignment | 36 u32 reserved
+//     40 u64 FNV-1a of the section table when VM_FORMAT_CHECKSUMS is set | 48 u64 stack entries needed, 0 if unknown
+//     56 reserved up to 64
+//   section table, one VM_FORMAT_SECTION_SIZE entry per section:
+//     0 u32 type (VM_SECTION_*) | 4 u32 encoding (VM_CODE_* for code) | 8 u64 offset | 16 u64 size in bytes
+//     24 u64 entries (instructions or bytes) | 32 u64 FNV-1a of the section when VM_FORMAT_CHECKSUMS is set
+//   state section of a snapshot: 0 u64 static break | 8 u64 static memory capacity | 16 u64 size of its data region
+//     | 24 the stack, bottom first, a u64 per entry
+// sections start at multiples of the alignment; readers skip section types they don't know; a fixed size instruction is
+// a u32 type, four zero bytes and a u64 operand, which is exactly Inst on little endian hosts
+static void vm_put_le(uint8_t *at, uint64_t value, size_t bytes)
+{
+    for (size_t k = 0; k < bytes; k++, value >>= 8)
+    {
+        at[k] = (uint8_t)value;
+    }
+}
+
+static uint64_t vm_get_le(const uint8_t *at, size_t bytes)
+{
+    uint64_t value = 0;
+    for (size_t k = bytes; k-- > 0;)
+    {
+        value = (value << 8) | at[k];
+    }
+    return value;
+}
+
+// FNV-1a of bytes, carried on from hash; the hash of data in several pieces is the hash of the pieces one after another
+static uint64_t vm_fnv1a_extend(uint64_t hash, const uint8_t *bytes, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint64_t vm_fnv1a(const uint8_t *bytes, size_t size)
+{
+    return vm_fnv1a_extend(0xcbf29ce484222325ULL, bytes, size);
+}
+
+// whether a fixed size code section can be used in place as an Inst array on this host
+static bool vm_fixed_code_is_native(void)
+{
+    const uint16_t probe = 1;
+    return sizeof(Inst) == 16 && sizeof(Inst_Type) == 4 && offsetof(Inst, operand) == 8 && *(const uint8_t *)&probe == 1;
+}
+
+typedef struct
+{
+    uint32_t type; // VM_SECTION_*
+    uint32_t encoding;
+    const uint8_t *bytes;
+    size_t size;
+    size_t entries;
+} Vm_Section;
+
+// lays header and sections out as the container format and writes them to file_path
+static void vm_write_image(const char *file_path, vm_header_ header, const Vm_Section *sections, size_t sections_size)
+{
+    size_t alignment = header.vm_executable_identifier == VM_EXECUTABLE_IDENTIFIER_COMPACT ? 8 : VM_SECTION_ALIGNMENT; // compact images are for size, so they aren't padded to pages
+    size_t image_size = VM_FORMAT_HEADER_SIZE + sections_size * VM_FORMAT_SECTION_SIZE;
+    size_t offsets[VM_SECTION_STATE];
+    assert(sections_size <= VM_SECTION_STATE);
+
+    for (size_t s = 0; s < sections_size; s++)
+    {
+        // an empty section takes no room, so an empty data section doesn't pad the file out by another page
+        offsets[s] = sections[s].size > 0 ? (image_size + alignment - 1) / alignment * alignment : 0;
+        image_size = sections[s].size > 0 ? offsets[s] + sections[s].size : image_size;
+    }
+
+    uint8_t *image = calloc(image_size, 1);
+    if (!image)
+    {
+        fprintf(stderr, "ERROR: executable image allocation failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    uint8_t *table = image + VM_FORMAT_HEADER_SIZE;
+    for (size_t s = 0; s < sections_size; s++)
+    {
+        uint8_t *entry = table + s * VM_FORMAT_SECTION_SIZE;
+        if (sections[s].size > 0)
+        {
+            memcpy(image + offsets[s], sections[s].bytes, sections[s].size);
+        }
+        vm_put_le(entry, sections[s].type, 4);
+        vm_put_le(entry + 4, sections[s].encoding, 4);
+        vm_put_le(entry + 8, offsets[s], 8);
+        vm_put_le(entry + 16, sections[s].size, 8);
+        vm_put_le(entry + 24, sections[s].entries, 8);
+        if (header.checksummed)
+        {
+            vm_put_le(entry + 32, vm_fnv1a(sections[s].bytes, sections[s].size), 8);
+        }
+    }
+    if (header.checksummed)
+    {
+        vm_put_le(image + 40, vm_fnv1a(table, sections_size * VM_FORMAT_SECTION_SIZE), 8);
+    }
+
+    memcpy(image, VM_FORMAT_MAGIC, 8);
+    vm_put_le(image + 8, VM_FORMAT_VERSION, 2);
+    vm_put_le(image + 10, (header.has_start ? VM_FORMAT_HAS_START : 0) | (header.checksummed ? VM_FORMAT_CHECKSUMS : 0) | (header.object ? VM_FORMAT_OBJECT : 0) | (header.snapshot ? VM_FORMAT_SNAPSHOT : 0), 2);
+    vm_put_le(image + 12, sections_size, 4);
+    vm_put_le(image + 16, (uint64_t)header.start_location, 8);
+    vm_put_le(image + 24, VM_FORMAT_HEADER_SIZE, 8);
+    vm_put_le(image + 32, alignment, 4);
+    vm_put_le(image + 48, header.stack_size, 8);
+
+    FILE *f = fopen(file_path, "wb");
+    if (!f)
+    {
+        fprintf(stderr, "ERROR: Could not open file '%s': %s\n", file_path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    fwrite(image, sizeof(uint8_t), image_size, f);
+    if (ferror(f)) // did some error occur due to the last stdio function call on f?
+    {
+        fprintf(stderr, "ERROR: Could not write to file '%s': %s\n", file_path, strerror(errno));
+        fclose(f);
+        exit(EXIT_FAILURE);
+    }
+
+    fclose(f);
+    free((void *)image);
+}
+
+// the code section in the encoding header asks for; *size gets its length in bytes, the caller frees it
+static uint8_t *vm_encode_code_section(const Inst *program, vm_header_ header, size_t *size)
+{
+    bool compact = header.vm_executable_identifier == VM_EXECUTABLE_IDENTIFIER_COMPACT;
+    uint8_t *code = malloc((compact ? VM_COMPACT_INST_MAX : sizeof(Inst)) * (header.code_section_size > 0 ? header.code_section_size : 1));
+    if (!code)
+    {
+        fprintf(stderr, "ERROR: code section allocation failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    *size = 0;
+    for (size_t i = 0; i < header.code_section_size; i++)
+    {
+        if (compact)
+        {
+            *size += vm_encode_inst(program[i], code + *size);
+        }
+        else
+        {
+            vm_put_le(code + *size, (uint32_t)program[i].type, 4);
+            vm_put_le(code + *size + 4, 0, 4);
+            vm_put_le(code + *size + 8, program[i].operand._as_u64, 8);
+            *size += sizeof(Inst);
+        }
+    }
+    return code;
+}
+
+// writes the program with the line table and the symbol table the assembler or the linker left in as->debug_lines and
+// as->debug_symbols, unless vm_emit_debug_info is off; they go last, so a run that never reads them never touches them
+void vm_save_program_to_file(const Vm_Assembler *as, Inst *program, uint8_t *data_section, vm_header_ header, const char *file_path)
+{
+    size_t code_size;
+    uint8_t *code = vm_encode_code_section(program, header, &code_size);
+    bool debug_info = vm_emit_debug_info && as->debug_lines_size > 0;
+    Vm_Section sections[] = {
+        {VM_SECTION_CODE, header.vm_executable_identifier == VM_EXECUTABLE_IDENTIFIER_COMPACT ? VM_CODE_COMPACT : VM_CODE_FIXED, code, code_size, header.code_section_size},
+        {VM_SECTION_DATA, 0, data_section, header.data_section_size, header.data_section_size},
+        {VM_SECTION_SYMBOLS, 0, as->debug_symbols, as->debug_symbols_size, as->debug_symbols_count},
+        {VM_SECTION_LINES, 0, as->debug_lines, as->debug_lines_size, header.code_section_size},
+    };
+
+    header.object = false;
+    vm_write_image(file_path, header, sections, debug_info ? ARRAY_SIZE(sections) : 2);
+    free((void *)code);
+}
+
+// appends one symbol or relocation record, a u64, a u32, the length of name as a u32 and name, to *records
+static void vm_put_record(uint8_t **records, size_t *size, size_t *capacity, uint64_t value, uint32_t kind, String_View name)
+{
+    if (*capacity - *size < 16 + name.count)
+    {
+        *records = vm_grow_array(*records, capacity, *size + 16 + name.count, sizeof(uint8_t));
+    }
+    vm_put_le(*records + *size, value, 8);
+    vm_put_le(*records + *size + 8, kind, 4);
+    vm_put_le(*records + *size + 12, name.count, 4);
+    if (name.count > 0) // local relocations have no name
+    {
+        memcpy(*records + *size + 16, name.data, name.count);
+    }
+    *size += 16 + name.count;
+}
+
+// --action obj: writes what vm_translate_source() made of one module, with every label it defines as a symbol and
+// every label operand as a relocation, so vm_link_objects() can put it together with other modules; call it before
+// label_free(), the relocations are read from the assembler's tables
+void vm_save_object_to_file(const Vm_Assembler *as, Inst *program, uint8_t *data_section, vm_header_ header, const char *file_path)
+{
+    uint8_t *relocations = NULL;
+    size_t relocations_size = 0, relocations_capacity = 0;
+
+    for (size_t i = 0; i < as->not_resolved_yet_counter; i++)
+    {
+        Hashnode *node = search_for_node(as, as->not_resolved_yet[i].label);
+        if (node)
+        {
+            vm_put_record(&relocations, &relocations_size, &relocations_capacity, as->not_resolved_yet[i].inst_location,
+                          node->section == VM_SECTION_DATA ? VM_RELOC_DATA : VM_RELOC_CODE, (String_View){0});
+        }
+        else
+        {
+            vm_put_record(&relocations, &relocations_size, &relocations_capacity, as->not_resolved_yet[i].inst_location,
+                          VM_RELOC_IMPORT, as->not_resolved_yet[i].label);
+        }
+    }
+
+    size_t code_size;
+    uint8_t *code = vm_encode_code_section(program, header, &code_size);
+    Vm_Section sections[] = {
+        {VM_SECTION_CODE, header.vm_executable_identifier == VM_EXECUTABLE_IDENTIFIER_COMPACT ? VM_CODE_COMPACT : VM_CODE_FIXED, code, code_size, header.code_section_size},
+        {VM_SECTION_DATA, 0, data_section, header.data_section_size, header.data_section_size},
+        {VM_SECTION_SYMBOLS, 0, as->debug_symbols, as->debug_symbols_size, as->debug_symbols_count},
+        {VM_SECTION_RELOCATIONS, 0, relocations, relocations_size, as->not_resolved_yet_counter},
+        {VM_SECTION_LINES, 0, as->debug_lines, as->debug_lines_size, header.code_section_size},
+    };
+
+    header.object = true;
+    header.has_start = false; // start is just another symbol until the link
+    vm_write_image(file_path, header, sections, vm_emit_debug_info ? ARRAY_SIZE(sections) : ARRAY_SIZE(sections) - 1);
+    free((void *)code);
+    free((void *)relocations);
+}
+
+// size bytes of the file at offset, in an allocation the caller frees; NULL if they can't be read
+static uint8_t *vm_read_range(const char *file_path, size_t offset, size_t size)
+{
+    FILE *f = fopen(file_path, "rb");
+    uint8_t *bytes = f ? malloc(size > 0 ? size : 1) : NULL;
+    if (bytes && (fseek(f, (long)offset, SEEK_SET) || fread(bytes, 1, size, f) != size))
+    {
+        free((void *)bytes);
+        bytes = NULL;
+    }
+    if (f)
+    {
+        fclose(f);
+    }
+    return bytes;
+}
+
+// writes the machine as it stands to file_path as a snapshot: its program, its static memory up to the static break
+// (or past it, to the last byte that isn't zero, if the program wrote above the break), its stack, and the instruction
+// after the one running as where to resume, so --restore picks up right after the native that asked for it; natives
+// see instruction_pointer at themselves in every dispatch mode. The debug info of the executable is copied along
+void vm_save_snapshot_to_file(VirtualMachine *vm, const char *file_path)
+{
+    size_t memory = vm->static_break < vm_memory_capacity ? vm->static_break : vm_memory_capacity;
+    for (size_t i = vm_memory_capacity; i > memory; i--)
+    {
+        if (vm->static_memory[i - 1] != 0)
+        {
+            memory = i;
+            break;
+        }
+    }
+
+    size_t state_size = VM_STATE_HEADER_SIZE + sizeof(uint64_t) * vm->stack_size;
+    uint8_t *state = malloc(state_size);
+    if (!state)
+    {
+        fprintf(stderr, "ERROR: snapshot allocation failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    vm_put_le(state, vm->static_break, 8);
+    vm_put_le(state + 8, vm_memory_capacity, 8);
+    vm_put_le(state + 16, vm_default_memory_size, 8);
+    for (size_t i = 0; i < vm->stack_size; i++)
+    {
+        vm_put_le(state + VM_STATE_HEADER_SIZE + sizeof(uint64_t) * i, vm->stack[i]._as_u64, 8);
+    }
+
+    vm_header_ header = {
+        .code_section_size = vm->program_size,
+        .vm_executable_identifier = VM_EXECUTABLE_IDENTIFIER, // fixed size, so the restored program runs from the mapping
+        .data_section_size = memory,
+        .has_start = true,
+        .start_location = vm->instruction_pointer + 1,
+        .stack_size = vm_stack_capacity,
+        .snapshot = true,
+    };
+    size_t code_size;
+    uint8_t *code = vm_encode_code_section(vm->program, header, &code_size);
+
+    uint8_t *symbols = vm->header.symbols_size > 0 ? vm_read_range(vm->path, vm->header.symbols_offset_in_executable, vm->header.symbols_size) : NULL;
+    uint8_t *lines = vm->header.lines_size > 0 ? vm_read_range(vm->path, vm->header.lines_offset_in_executable, vm->header.lines_size) : NULL;
+    Vm_Section sections[] = {
+        {VM_SECTION_CODE, VM_CODE_FIXED, code, code_size, vm->program_size},
+        {VM_SECTION_DATA, 0, vm->static_memory, memory, memory},
+        {VM_SECTION_STATE, 0, state, state_size, vm->stack_size},
+        {VM_SECTION_SYMBOLS, 0, symbols, symbols ? vm->header.symbols_size : 0, 0},
+        {VM_SECTION_LINES, 0, lines, lines ? vm->header.lines_size : 0, vm->program_size},
+    };
+
+    vm_write_image(file_path, header, sections, symbols || lines ? ARRAY_SIZE(sections) : 3);
+    free((void *)code);
+    free((void *)state);
+    free((void *)symbols);
+    free((void *)lines);
+}
+
+// vm_init() of a snapshot: the code and the static memory were loaded like any executable's (vm_size_static_memory()
+// gave back the layout the machine had); this puts back the static break and the stack
+static void vm_restore_state(VirtualMachine *vm, const char *file_path)
+{
+    size_t entries = (vm->header.state_size - VM_STATE_HEADER_SIZE) / sizeof(uint64_t);
+    if (entries > vm_stack_capacity)
+    {
+        if (vm_stack_capacity_set)
+        {
+            fprintf(stderr, "ERROR: The snapshot '%s' has %zu entries on its stack, more than --stack-size %zu\n", file_path, entries, vm_stack_capacity);
+            exit(EXIT_FAILURE);
+        }
+        vm_resize_stack(vm, entries);
+    }
+
+    uint8_t *stack = vm_read_range(file_path, vm->header.state_offset_in_executable + VM_STATE_HEADER_SIZE, sizeof(uint64_t) * entries);
+    if (!stack)
+    {
+        fprintf(stderr, "ERROR: Could not read the stack of the snapshot '%s': %s\n", file_path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < entries; i++)
+    {
+        vm->stack[i]._as_u64 = vm_get_le(stack + sizeof(uint64_t) * i, 8);
+    }
+    free((void *)stack);
+
+    vm->stack_size = entries;
+    vm->static_break = vm->header.static_break;
+}
+
+static void vm_check_header(vm_header_ header, const char *file_path)
+{
+    if (header.code_section_size > vm_program_capacity)
+    {
+        fprintf(stderr, "ERROR: Text section of the executable %s is of size %zu which exceeds the maximum text section capacity %zu of the virtual machine\n", file_path, header.code_section_size, vm_program_capacity);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// static memory is the data section, never less than vm_default_memory_size of it so programs keep their scratch space
+// below the heap, and then the heap; a larger data section moves the heap up instead of taking from it
+static void vm_size_static_memory(vm_header_ header)
+{
+    if (header.snapshot) // a resumed machine gets back exactly the static memory it was paused with
+    {
+        vm_memory_capacity = header.memory_capacity;
+        vm_default_memory_size = header.default_memory_size;
+        return;
+    }
+    if (header.data_section_size > vm_default_memory_size)
+    {
+        vm_memory_capacity += header.data_section_size - vm_default_memory_size;
+        vm_default_memory_size = header.data_section_size;
+    }
+}
+
+// reads the header and section table of the executable in image[0, size) and checks that the sections it names lie in it
+// files written before the container format (a raw vm_header_ with identifier 42069) come back as format version 0
+// 'object' says whether a relocatable object is wanted (by the linker) or an executable (by everything else)
+static vm_header_ vm_parse_executable(const uint8_t *image, size_t size, const char *file_path, bool object)
+{
+    vm_header_ header = {0};
+
+    if (size >= VM_FORMAT_HEADER_SIZE && memcmp(image, VM_FORMAT_MAGIC, 8) == 0)
+    {
+        header.format_version = (uint16_t)vm_get_le(image + 8, 2);
+        if (header.format_version == 0 || header.format_version > VM_FORMAT_VERSION)
+        {
+            fprintf(stderr, "ERROR: '%s' is in executable format version %u; this virtual machine reads versions 1 to %d\n", file_path, header.format_version, VM_FORMAT_VERSION);
+            exit(EXIT_FAILURE);
+        }
+
+        uint64_t flags = vm_get_le(image + 10, 2);
+        uint64_t section_count = vm_get_le(image + 12, 4);
+        uint64_t table_offset = vm_get_le(image + 24, 8);
+        header.has_start = flags & VM_FORMAT_HAS_START;
+        header.checksummed = flags & VM_FORMAT_CHECKSUMS;
+        header.object = flags & VM_FORMAT_OBJECT;
+        header.snapshot = flags & VM_FORMAT_SNAPSHOT;
+        header.start_location = (int64_t)vm_get_le(image + 16, 8);
+        header.stack_size = vm_get_le(image + 48, 8);
+
+        if (table_offset > size || section_count > (size - table_offset) / VM_FORMAT_SECTION_SIZE)
+        {
+            fprintf(stderr, "ERROR: The section table of '%s' runs past the end of the file\n", file_path);
+            exit(EXIT_FAILURE);
+        }
+        const uint8_t *table = image + table_offset;
+        if (header.checksummed && vm_fnv1a(table, section_count * VM_FORMAT_SECTION_SIZE) != vm_get_le(image + 40, 8))
+        {
+            fprintf(stderr, "ERROR: The section table of '%s' does not match its checksum\n", file_path);
+            exit(EXIT_FAILURE);
+        }
+
+        bool has_code = false, has_data = false;
+        for (const uint8_t *entry = table; entry < table + section_count * VM_FORMAT_SECTION_SIZE; entry += VM_FORMAT_SECTION_SIZE)
+        {
+            uint64_t type = vm_get_le(entry, 4);
+            uint64_t encoding = vm_get_le(entry + 4, 4);
+            uint64_t offset = vm_get_le(entry + 8, 8);
+            uint64_t bytes = vm_get_le(entry + 16, 8);
+            uint64_t entries = vm_get_le(entry + 24, 8);
+
+            static const char *const names[] = {"", "code", "data", "symbol", "relocation", "line table", "state"};
+            if (type < VM_SECTION_CODE || type > VM_SECTION_STATE)
+            {
+                continue;
+            }
+            if ((type == VM_SECTION_CODE && has_code) || (type == VM_SECTION_DATA && has_data))
+            {
+                fprintf(stderr, "ERROR: '%s' has more than one %s section; this virtual machine runs one of each\n", file_path, names[type]);
+                exit(EXIT_FAILURE);
+            }
+            if (offset > size || bytes > size - offset)
+            {
+                fprintf(stderr, "ERROR: A section of '%s' runs past the end of the file\n", file_path);
+                exit(EXIT_FAILURE);
+            }
+            if (header.checksummed && vm_fnv1a(image + offset, bytes) != vm_get_le(entry + 32, 8))
+            {
+                fprintf(stderr, "ERROR: The %s section of '%s' does not match its checksum\n", names[type], file_path);
+                exit(EXIT_FAILURE);
+            }
+
+            if (type == VM_SECTION_SYMBOLS || type == VM_SECTION_RELOCATIONS || type == VM_SECTION_LINES)
+            {
+                size_t *at = type == VM_SECTION_SYMBOLS ? &header.symbols_offset_in_executable : type == VM_SECTION_RELOCATIONS ? &header.relocations_offset_in_executable : &header.lines_offset_in_executable;
+                size_t *length = type == VM_SECTION_SYMBOLS ? &header.symbols_size : type == VM_SECTION_RELOCATIONS ? &header.relocations_size : &header.lines_size;
+                *at = offset;
+                *length = bytes;
+                continue;
+            }
+
+            if (type == VM_SECTION_STATE)
+            {
+                if (bytes < VM_STATE_HEADER_SIZE || (bytes - VM_STATE_HEADER_SIZE) / sizeof(uint64_t) != entries)
+                {
+                    fprintf(stderr, "ERROR: The state section of '%s' is %llu bytes, which is not a stack of %llu entries\n", file_path, (unsigned long long)bytes, (unsigned long long)entries);
+                    exit(EXIT_FAILURE);
+                }
+                header.state_offset_in_executable = offset;
+                header.state_size = bytes;
+                header.static_break = vm_get_le(image + offset, 8);
+                header.memory_capacity = vm_get_le(image + offset + 8, 8);
+                header.default_memory_size = vm_get_le(image + offset + 16, 8);
+                continue;
+            }
+
+            if (type == VM_SECTION_DATA)
+            {
+                has_data = true;
+                header.data_section_offset_in_executable = offset;
+                header.data_section_size = bytes;
+                continue;
+            }
+
+            has_code = true;
+            if (encoding != VM_CODE_FIXED && encoding != VM_CODE_COMPACT)
+            {
+                fprintf(stderr, "ERROR: The code section of '%s' is in an unknown encoding %llu\n", file_path, (unsigned long long)encoding);
+                exit(EXIT_FAILURE);
+            }
+            if (encoding == VM_CODE_FIXED && bytes != entries * sizeof(Inst))
+            {
+                fprintf(stderr, "ERROR: The code section of '%s' is %llu bytes, which is not %llu instructions\n", file_path, (unsigned long long)bytes, (unsigned long long)entries);
+                exit(EXIT_FAILURE);
+            }
+            header.vm_executable_identifier = encoding == VM_CODE_COMPACT ? VM_EXECUTABLE_IDENTIFIER_COMPACT : VM_EXECUTABLE_IDENTIFIER;
+            header.code_section_offset_in_executable = offset;
+            header.code_section_bytes_in_executable = bytes;
+            header.code_section_size = entries;
+        }
+    }
+    else if (size >= 48 && ((int16_t)vm_get_le(image + 40, 2) == VM_EXECUTABLE_IDENTIFIER || (int16_t)vm_get_le(image + 40, 2) == VM_EXECUTABLE_IDENTIFIER_COMPACT))
+    {
+        header.code_section_offset_in_executable = vm_get_le(image, 8);
+        header.start_location = (int64_t)vm_get_le(image + 8, 8);
+        header.code_section_size = vm_get_le(image + 16, 8);
+        header.data_section_offset_in_executable = vm_get_le(image + 24, 8);
+        header.data_section_size = vm_get_le(image + 32, 8);
+        header.vm_executable_identifier = (int16_t)vm_get_le(image + 40, 2);
+        header.has_start = image[42];
+
+        size_t code_offset = header.code_section_offset_in_executable;
+        size_t data_offset = header.data_section_offset_in_executable;
+        if (data_offset > size || header.data_section_size > size - data_offset || code_offset > size ||
+            (header.vm_executable_identifier == VM_EXECUTABLE_IDENTIFIER && header.code_section_size > (size - code_offset) / sizeof(Inst)))
+        {
+            fprintf(stderr, "ERROR: The executable '%s' is shorter than its header says\n", file_path);
+            exit(EXIT_FAILURE);
+        }
+        header.code_section_bytes_in_executable = header.vm_executable_identifier == VM_EXECUTABLE_IDENTIFIER ? header.code_section_size * sizeof(Inst) : size - code_offset;
+    }
+    else
+    {
+        fprintf(stderr, "The provided file '%s' is not a vm executable\n", file_path);
+        exit(EXIT_FAILURE);
+    }
+
+    if (header.snapshot && (header.state_size == 0 || header.static_break > header.memory_capacity ||
+                            header.default_memory_size > header.memory_capacity || header.data_section_size > header.memory_capacity ||
+                            (uint64_t)header.start_location >= header.code_section_size))
+    {
+        fprintf(stderr, "ERROR: The snapshot '%s' doesn't describe a machine it could resume\n", file_path);
+        exit(EXIT_FAILURE);
+    }
+
+    if (header.object != object)
+    {
+        fprintf(stderr, header.object ? "ERROR: '%s' is an object file; link it into an executable with --action link\n"
+                                      : "ERROR: '%s' is an executable, not an object file made by --action obj\n",
+                file_path);
+        exit(EXIT_FAILURE);
+    }
+    if (!header.object && header.code_section_size == 0)
+    {
+        fprintf(stderr, "ERROR: '%s' has no code section to run\n", file_path);
+        exit(EXIT_FAILURE);
+    }
+
+    vm_check_header(header, file_path);
+    return header;
+}
+
+static void vm_decode_code_section(const uint8_t *image, vm_header_ header, Inst *program, const char *file_path)
+{
+    const uint8_t *cursor = image + header.code_section_offset_in_executable;
+    const uint8_t *end = cursor + header.code_section_bytes_in_executable;
+
+    for (size_t i = 0; i < header.code_section_size; i++)
+    {
+        if (header.vm_executable_identifier == VM_EXECUTABLE_IDENTIFIER)
+        {
+            program[i] = (Inst){.type = (Inst_Type)vm_get_le(cursor, 4), .operand._as_u64 = vm_get_le(cursor + 8, 8)};
+            cursor += sizeof(Inst);
+        }
+        else if (!vm_decode_inst(&cursor, end, &program[i]))
+        {
+            fprintf(stderr, "ERROR: The compact code section of '%s' ends in the middle of instruction %zu\n", file_path, i);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// the whole file, in an allocation the caller frees
+static uint8_t *vm_read_image(const char *file_path, size_t *read)
+{
+    FILE *f = fopen(file_path, "rb");
+    if (!f)
+    {
+        fprintf(stderr, "ERROR: Could not open file '%s': %s\n", file_path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    long size = -1;
+    if (fseek(f, 0, SEEK_END) || (size = ftell(f)) < 0 || fseek(f, 0, SEEK_SET))
+    {
+        fclose(f);
+        fprintf(stderr, "ERROR: Could not read file '%s': %s\n", file_path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    uint8_t *image = malloc(size > 0 ? (size_t)size : 1);
+    if (!image)
+    {
+        fclose(f);
+        fprintf(stderr, "ERROR: Couldn't allocate memory for file '%s': %s\n", file_path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    *read = fread(image, sizeof(uint8_t), (size_t)size, f);
+    if (ferror(f))
+    {
+        fclose(f);
+        fprintf(stderr, "ERROR: Could not read file '%s': %s\n", file_path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    fclose(f);
+    return image;
+}
+
+// reads the executable into a program and a data section allocated to its exact sizes, which the caller frees
+vm_header_ vm_load_program_from_file(Inst **program, uint8_t **data_section, const char *file_path)
+{
+    size_t read;
+    uint8_t *image = vm_read_image(file_path, &read);
+    vm_header_ header = vm_parse_executable(image, read, file_path, false);
+    *program = malloc(sizeof(Inst) * (header.code_section_size > 0 ? header.code_section_size : 1));
+    *data_section = malloc(header.data_section_size > 0 ? header.data_section_size : 1);
+    if (!*program || !*data_section)
+    {
+        fprintf(stderr, "ERROR: Couldn't allocate memory for the sections of '%s': %s\n", file_path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    memcpy(*data_section, image + header.data_section_offset_in_executable, header.data_section_size);
+    vm_decode_code_section(image, header, *program, file_path);
+
+    free((void *)image);
+    return header;
+}
+
+// reads one symbol or relocation record written by vm_put_record() at *at, moving past it; false if it doesn't fit
+static bool vm_get_record(const uint8_t **at, const uint8_t *end, uint64_t *value, uint32_t *kind, String_View *name)
+{
+    if (end - *at < 16 || (size_t)(end - *at) - 16 < vm_get_le(*at + 12, 4))
+    {
+        return false;
+    }
+    *value = vm_get_le(*at, 8);
+    *kind = (uint32_t)vm_get_le(*at + 8, 4);
+    *name = (String_View){.count = vm_get_le(*at + 12, 4), .data = (char *)*at + 16}; // String_View data isn't const
+    *at += 16 + name->count;
+    return true;
+}
+
+// links objects from vm_save_object_to_file() into one program: their code and their data are laid end to end in the
+// order given, every label they define becomes a symbol of the whole program, and every relocation is patched with
+// where its target ended up; *program and *data_section are allocated for the caller, and 'start' is the entry point
+vm_header_ vm_link_objects(Vm_Assembler *as, const char **object_paths, size_t objects_size, Inst **program, uint8_t **data_section)
+{
+    uint8_t **images = malloc(sizeof(uint8_t *) * objects_size);
+    vm_header_ *headers = malloc(sizeof(vm_header_) * objects_size);
+    size_t *code_bases = malloc(sizeof(size_t) * objects_size);
+    size_t *data_bases = malloc(sizeof(size_t) * objects_size);
+    if (!images || !headers || !code_bases || !data_bases)
+    {
+        fprintf(stderr, "ERROR: linker allocation failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    size_t code_size = 0, data_size = 0;
+    for (size_t o = 0; o < objects_size; o++)
+    {
+        size_t image_size;
+        images[o] = vm_read_image(object_paths[o], &image_size);
+        headers[o] = vm_parse_executable(images[o], image_size, object_paths[o], true);
+        code_bases[o] = code_size;
+        data_bases[o] = (data_size + 7) / 8 * 8; // every object's data starts as aligned as it was assembled
+        code_size += headers[o].code_section_size;
+        data_size = data_bases[o] + headers[o].data_section_size;
+    }
+
+    *program = malloc(sizeof(Inst) * (code_size + 1)); // room for the closing halt
+    *data_section = calloc(data_size > 0 ? data_size : 1, 1);
+    if (!*program || !*data_section)
+    {
+        fprintf(stderr, "ERROR: linker allocation failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    bool linked = true;
+    uint64_t value;
+    uint32_t kind;
+    String_View name;
+
+    // the symbols of all objects first, so an object may import from any other, before or after it
+    for (size_t o = 0; o < objects_size; o++)
+    {
+        vm_decode_code_section(images[o], headers[o], *program + code_bases[o], object_paths[o]);
+        memcpy(*data_section + data_bases[o], images[o] + headers[o].data_section_offset_in_executable, headers[o].data_section_size);
+
+        const uint8_t *at = images[o] + headers[o].symbols_offset_in_executable;
+        const uint8_t *end = at + headers[o].symbols_size;
+        while (at < end)
+        {
+            if (!vm_get_record(&at, end, &value, &kind, &name))
+            {
+                fprintf(stderr, "ERROR: The symbol table of '%s' is malformed\n", object_paths[o]);
+                exit(EXIT_FAILURE);
+            }
+            if (search_for_node(as, name))
+            {
+                fprintf(stderr, "ERROR: '%.*s' defined in '%s' is already defined by an earlier object\n", (int)name.count, name.data, object_paths[o]);
+                linked = false;
+                continue;
+            }
+            push_to_hashtable(as, name, value + (kind == VM_SECTION_DATA ? data_bases[o] : code_bases[o]), kind == VM_SECTION_DATA ? VM_SECTION_DATA : VM_SECTION_CODE);
+        }
+    }
+
+    for (size_t o = 0; o < objects_size; o++)
+    {
+        const uint8_t *at = images[o] + headers[o].relocations_offset_in_executable;
+        const uint8_t *end = at + headers[o].relocations_size;
+        while (at < end)
+        {
+            if (!vm_get_record(&at, end, &value, &kind, &name) || value >= headers[o].code_section_size)
+            {
+                fprintf(stderr, "ERROR: The relocations of '%s' are malformed\n", object_paths[o]);
+                exit(EXIT_FAILURE);
+            }
+
+            Value *operand = &(*program)[code_bases[o] + value].operand;
+            if (kind == VM_RELOC_CODE)
+            {
+                operand->_as_u64 += code_bases[o];
+            }
+            else if (kind == VM_RELOC_DATA)
+            {
+                operand->_as_u64 += data_bases[o];
+            }
+            else
+            {
+                Hashnode *node = search_for_node(as, name);
+                if (!node)
+                {
+                    fprintf(stderr, "ERROR: '%s' refers to '%.*s', which no object defines\n", object_paths[o], (int)name.count, name.data);
+                    linked = false;
+                    continue;
+                }
+                operand->_as_u64 = node->value;
+            }
+        }
+    }
+
+    Hashnode *start = search_for_node(as, cstr_as_sv("start"));
+    if (start && start->section != VM_SECTION_CODE)
+    {
+        fprintf(stderr, "ERROR: 'start' labels data, not code\n");
+        linked = false;
+    }
+    if (!linked)
+    {
+        fprintf(stderr, "Linking Failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // modules may end in anything, but the program has to end in halt
+    if (code_size == 0 || (*program)[code_size - 1].type != INST_HALT)
+    {
+        (*program)[code_size++] = (Inst){.type = INST_HALT};
+    }
+
+    // the line tables one after another, each file renumbered past the files of the objects before; the code of an
+    // object without one, and the halt, get line 0
+    Vm_Source_File *files = NULL;
+    Vm_Source_Line *lines = calloc(code_size, sizeof(Vm_Source_Line));
+    size_t files_size = 0, files_capacity = 0;
+    if (!lines)
+    {
+        fprintf(stderr, "ERROR: linker allocation failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    for (size_t o = 0; o < objects_size; o++)
+    {
+        Vm_Debug_Info debug = {.mapping = images[o]};
+        vm_header_ lines_only = headers[o];
+        lines_only.symbols_size = 0;
+        if (headers[o].lines_size > 0 && !vm_debug_decode(&debug, lines_only, 0))
+        {
+            fprintf(stderr, "ERROR: The line table of '%s' is malformed\n", object_paths[o]);
+            exit(EXIT_FAILURE);
+        }
+        if (files_capacity - files_size < debug.files_size)
+        {
+            files = vm_grow_array(files, &files_capacity, files_size + debug.files_size, sizeof(Vm_Source_File));
+        }
+        for (size_t f = 0; f < debug.files_size; f++)
+        {
+            files[files_size + f] = debug.files[f];
+            files[files_size + f].parent += debug.files[f].parent > 0 ? files_size : 0;
+        }
+        for (size_t i = 0; i < debug.lines_size; i++)
+        {
+            lines[code_bases[o] + i] = (Vm_Source_Line){.file = (uint32_t)(debug.lines[i].file + files_size), .line = debug.lines[i].line};
+        }
+        files_size += debug.files_size;
+        free((void *)debug.files);
+        free((void *)debug.lines);
+    }
+    if (files_size > 0)
+    {
+        vm_debug_encode_lines(as, files, files_size, lines, code_size);
+    }
+    vm_debug_encode_symbols(as);
+    free((void *)files);
+    free((void *)lines);
+
+    vm_header_ header = {
+        .code_section_size = code_size,
+        .data_section_size = data_size,
+        .has_start = start != NULL,
+        .start_location = start ? (int64_t)start->value : -1,
+        .vm_executable_identifier = VM_EXECUTABLE_IDENTIFIER,
+        .format_version = VM_FORMAT_VERSION};
+
+    label_free(as); // the symbol names point into the images
+    for (size_t o = 0; o < objects_size; o++)
+    {
+        free((void *)images[o]);
+    }
+    free((void *)images);
+    free((void *)headers);
+    free((void *)code_bases);
+    free((void *)data_bases);
+    return header;
+}
+
+void vm_debug_free(Vm_Debug_Info *debug)
+{
+    if (!debug)
+    {
+        return;
+    }
+#if VM_HAS_MMAP
+    if (debug->mapping)
+    {
+        munmap(debug->mapping, debug->mapping_size);
+    }
+#else
+    free((void *)debug->mapping);
+#endif
+    free((void *)debug->files);
+    free((void *)debug->lines);
+    free((void *)debug->symbols);
+    free((void *)debug);
+}
+
+// decodes the sections of debug->mapping, which start at file offset begin; false if they are malformed
+static bool vm_debug_decode(Vm_Debug_Info *debug, vm_header_ header, size_t begin)
+{
+    const uint8_t *base = debug->mapping + debug->mapping_lead - begin; // where offset 0 of the file would be
+    uint64_t value;
+    uint32_t kind;
+    String_View name;
+    size_t capacity = 0;
+
+    const uint8_t *at = base + header.symbols_offset_in_executable;
+    const uint8_t *end = at + header.symbols_size;
+    while (header.symbols_size > 0 && at < end)
+    {
+        if (!vm_get_record(&at, end, &value, &kind, &name))
+        {
+            return false;
+        }
+        if (debug->symbols_size == capacity)
+        {
+            debug->symbols = vm_grow_array(debug->symbols, &capacity, debug->symbols_size + 1, sizeof(Vm_Debug_Symbol));
+        }
+        debug->symbols[debug->symbols_size++] = (Vm_Debug_Symbol){.name = name, .value = value, .section = kind};
+    }
+
+    if (header.lines_size == 0)
+    {
+        return true;
+    }
+    at = base + header.lines_offset_in_executable;
+    end = at + header.lines_size;
+    if (header.lines_size < 8 || vm_get_le(at, 8) > header.lines_size)
+    {
+        return false;
+    }
+    debug->files_size = vm_get_le(at, 8);
+    at += 8;
+    debug->files = malloc(sizeof(Vm_Source_File) * (debug->files_size > 0 ? debug->files_size : 1));
+    debug->lines_size = header.code_section_size;
+    debug->lines = malloc(sizeof(Vm_Source_Line) * (debug->lines_size > 0 ? debug->lines_size : 1));
+    if (!debug->files || !debug->lines)
+    {
+        return false;
+    }
+
+    for (size_t f = 0; f < debug->files_size; f++)
+    {
+        if (!vm_get_record(&at, end, &value, &kind, &name) || kind > f)
+        {
+            return false; // a file is included from one before it
+        }
+        debug->files[f] = (Vm_Source_File){.name = name, .parent = kind, .parent_line = value};
+    }
+
+    uint64_t file = UINT64_MAX, line = 0, delta;
+    for (size_t i = 0; i < debug->lines_size; i++)
+    {
+        if (!vm_get_varint(&at, end, &delta))
+        {
+            return false;
+        }
+        if (delta == 0)
+        {
+            if (!vm_get_varint(&at, end, &file) || file >= debug->files_size || !vm_get_varint(&at, end, &delta) || delta == 0)
+            {
+                return false;
+            }
+        }
+        if (file == UINT64_MAX)
+        {
+            return false;
+        }
+        delta--;
+        line += (delta >> 1) ^ (0 - (delta & 1));
+        debug->lines[i] = (Vm_Source_Line){.file = (uint32_t)file, .line = (uint32_t)line};
+    }
+    return true;
+}
+
+// the line table and the symbol table of the executable at file_path, which header was parsed from; they are mapped
+// (or read) only now, so a program that never traps and isn't profiled never pages them in; NULL if the executable
+// has neither or they don't decode, and whoever asked goes without
+Vm_Debug_Info *vm_debug_read(const char *file_path, vm_header_ header)
+{
+    if (header.lines_size == 0 && header.symbols_size == 0)
+    {
+        return NULL;
+    }
+
+    size_t begin = SIZE_MAX, end = 0;
+    if (header.symbols_size > 0)
+    {
+        begin = header.symbols_offset_in_executable;
+        end = header.symbols_offset_in_executable + header.symbols_size;
+    }
+    if (header.lines_size > 0)
+    {
+        begin = header.lines_offset_in_executable < begin ? header.lines_offset_in_executable : begin;
+        end = header.lines_offset_in_executable + header.lines_size > end ? header.lines_offset_in_executable + header.lines_size : end;
+    }
+
+    Vm_Debug_Info *debug = calloc(1, sizeof(Vm_Debug_Info));
+    if (!debug)
+    {
+        fprintf(stderr, "ERROR: debug info allocation failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+#if VM_HAS_MMAP
+    int fd = open(file_path, O_RDONLY);
+    if (fd >= 0)
+    {
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        debug->mapping_lead = begin % page;
+        debug->mapping_size = debug->mapping_lead + end - begin;
+        debug->mapping = mmap(NULL, debug->mapping_size, PROT_READ, MAP_PRIVATE, fd, (off_t)(begin - debug->mapping_lead));
+        if (debug->mapping == MAP_FAILED)
+        {
+            debug->mapping = NULL;
+        }
+        close(fd);
+    }
+#else
+    FILE *f = fopen(file_path, "rb");
+    debug->mapping_size = end - begin;
+    debug->mapping = f ? malloc(debug->mapping_size) : NULL;
+    if (debug->mapping && (fseek(f, (long)begin, SEEK_SET) || fread(debug->mapping, 1, debug->mapping_size, f) != debug->mapping_size))
+    {
+        free((void *)debug->mapping);
+        debug->mapping = NULL;
+    }
+    if (f)
+    {
+        fclose(f);
+    }
+#endif
+
+    if (!debug->mapping || !vm_debug_decode(debug, header, begin))
+    {
+        fprintf(stderr, "WARNING: the debug info of '%s' can't be read; going without it\n", file_path);
+        vm_debug_free(debug);
+        return NULL;
+    }
+    return debug;
+}
+
+// vm->path's debug info, read the first time anything asks for it; NULL if there is none
+const Vm_Debug_Info *vm_debug_info(VirtualMachine *vm)
+{
+    if (!vm->debug_read)
+    {
+        vm->debug_read = true;
+        vm->debug = vm->path ? vm_debug_read(vm->path, vm->header) : NULL;
+    }
+    return vm->debug;
+}
+
+// the code label ip is at or follows most closely, i.e. the function or block it is in; NULL if none comes before it
+const Vm_Debug_Symbol *vm_debug_symbol_at(const Vm_Debug_Info *debug, size_t ip)
+{
+    const Vm_Debug_Symbol *best = NULL;
+    for (size_t i = 0; i < debug->symbols_size; i++)
+    {
+        const Vm_Debug_Symbol *symbol = &debug->symbols[i];
+        if (symbol->section == VM_SECTION_CODE && symbol->value <= ip && (!best || symbol->value > best->value))
+        {
+            best = symbol;
+        }
+    }
+    return best;
+}
+
+// a line of where instruction ip is, for a trap report: its label and source line when there is debug info, and the
+// chain of %includes the line came in through
+void vm_print_location(FILE *stream, VirtualMachine *vm, size_t ip)
+{
+    const Vm_Debug_Info *debug = vm_debug_info(vm);
+    const Vm_Debug_Symbol *symbol = debug ? vm_debug_symbol_at(debug, ip) : NULL;
+
+    fprintf(stream, "    at instruction %zu", ip);
+    if (symbol)
+    {
+        fprintf(stream, " (%.*s+%llu)", (int)symbol->name.count, symbol->name.data, (unsigned long long)(ip - symbol->value));
+    }
+    if (debug && ip < debug->lines_size && debug->lines[ip].line > 0)
+    {
+        const Vm_Source_File *file = &debug->files[debug->lines[ip].file];
+        fprintf(stream, ", %.*s:%u", (int)file->name.count, file->name.data, debug->lines[ip].line);
+        for (; file->parent > 0; file = &debug->files[file->parent - 1])
+        {
+            const Vm_Source_File *parent = &debug->files[file->parent - 1];
+            fprintf(stream, "\n    included from %.*s:%zu", (int)parent->name.count, parent->name.data, file->parent_line);
+        }
+    }
+    fprintf(stream, "\n");
+}
+
+#if VM_HAS_BUILD_CACHE
+// the build cache of --action asm and obj: every image assembled is kept as <key>.vm in one directory, the key hashing
+// the preprocessed source with everything else that goes into the image, so a program that hasn't changed is copied
+// out of the cache instead of assembled; past vm_cache_limit bytes the entries used longest ago are evicted
+typedef struct
+{
+    char name[VM_CACHE_KEY_LENGTH + 4]; // <key>.vm
+    size_t size;
+    time_t used; // its mtime, which a hit moves to now
+} Vm_Cache_Entry;
+
+typedef struct
+{
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+} Vm_Cache_Stats;
+
+// mkdir -p; false if path can't be made a directory
+static bool vm_cache_make_directory(char *path)
+{
+    for (char *slash = strchr(path + 1, '/'); slash; slash = strchr(slash + 1, '/'))
+    {
+        *slash = '\0';
+        bool made = mkdir(path, 0755) == 0 || errno == EEXIST;
+        *slash = '/';
+        if (!made)
+        {
+            return false;
+        }
+    }
+    return mkdir(path, 0755) == 0 || errno == EEXIST;
+}
+
+// the directory the cache lives in, made if it isn't there yet; NULL, and the cache turned off, if it can't be
+static const char *vm_cache_directory(void)
+{
+    static char directory[VM_CACHE_PATH_LENGTH];
+    if (directory[0])
+    {
+        return directory;
+    }
+
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    int written = -1;
+    if (vm_cache_dir || getenv("VCACHE"))
+    {
+        written = snprintf(directory, sizeof(directory), "%s", vm_cache_dir ? vm_cache_dir : getenv("VCACHE"));
+    }
+    else if (xdg && xdg[0])
+    {
+        written = snprintf(directory, sizeof(directory), "%s/virtmach", xdg);
+    }
+    else if (home && home[0])
+    {
+        written = snprintf(directory, sizeof(directory), "%s/.cache/virtmach", home);
+    }
+
+    if (written <= 0 || (size_t)written >= sizeof(directory))
+    {
+        fprintf(stderr, "WARNING: no build cache directory; set one with --cache-dir or VCACHE\n");
+    }
+    else if (!vm_cache_make_directory(directory))
+    {
+        fprintf(stderr, "WARNING: could not make the build cache directory '%s': %s\n", directory, strerror(errno));
+    }
+    else
+    {
+        return directory;
+    }
+    directory[0] = '\0';
+    vm_cache_enabled = false;
+    return NULL;
+}
+
+static bool vm_cache_path(char *path, const char *directory, const char *name)
+{
+    int written = snprintf(path, VM_CACHE_PATH_LENGTH, "%s/%s", directory, name);
+    return written > 0 && written < VM_CACHE_PATH_LENGTH;
+}
+
+// copies the file at from to to, through a temporary file renamed into place, so that a reader of to never sees half
+// of it; false if any of it fails
+static bool vm_cache_copy(const char *from, const char *to)
+{
+    char temporary[VM_CACHE_PATH_LENGTH];
+    int written = snprintf(temporary, sizeof(temporary), "%s.%ld.tmp", to, (long)getpid());
+    if (written <= 0 || (size_t)written >= sizeof(temporary))
+    {
+        return false;
+    }
+
+    FILE *in = fopen(from, "rb");
+    if (!in)
+    {
+        return false;
+    }
+    FILE *out = fopen(temporary, "wb");
+    if (!out)
+    {
+        fclose(in);
+        return false;
+    }
+
+    uint8_t buffer[64 * 1024];
+    size_t read;
+    bool copied = true;
+    while ((read = fread(buffer, 1, sizeof(buffer), in)) > 0)
+    {
+        copied = copied && fwrite(buffer, 1, read, out) == read;
+    }
+    copied = copied && !ferror(in);
+    fclose(in);
+    copied = fclose(out) == 0 && copied;
+
+    if (!copied || rename(temporary, to) != 0)
+    {
+        remove(temporary);
+        return false;
+    }
+    return true;
+}
+
+// the counters kept across runs in the cache's stats file; zero where there is none
+static Vm_Cache_Stats vm_cache_read_stats(const char *directory)
+{
+    Vm_Cache_Stats stats = {0};
+    char path[VM_CACHE_PATH_LENGTH];
+    FILE *f = vm_cache_path(path, directory, "stats") ? fopen(path, "r") : NULL;
+    if (f)
+    {
+        if (fscanf(f, "hits %llu misses %llu evictions %llu", &stats.hits, &stats.misses, &stats.evictions) != 3)
+        {
+            stats = (Vm_Cache_Stats){0};
+        }
+        fclose(f);
+    }
+    return stats;
+}
+
+// adds to the counters in the stats file; two builds updating it at once may lose a count, which is all they risk
+static void vm_cache_count(const char *directory, unsigned long long hits, unsigned long long misses, unsigned long long evictions)
+{
+    Vm_Cache_Stats stats = vm_cache_read_stats(directory);
+    char path[VM_CACHE_PATH_LENGTH];
+    FILE *f = vm_cache_path(path, directory, "stats") ? fopen(path, "w") : NULL;
+    if (f)
+    {
+        fprintf(f, "hits %llu misses %llu evictions %llu\n", stats.hits + hits, stats.misses + misses, stats.evictions + evictions);
+        fclose(f);
+    }
+}
+
+// the entries in the cache, in an allocation the caller frees; *bytes is what they take up together
+static Vm_Cache_Entry *vm_cache_list(const char *directory, size_t *entries_size, size_t *bytes)
+{
+    Vm_Cache_Entry *entries = NULL;
+    size_t capacity = 0;
+    *entries_size = 0;
+    *bytes = 0;
+
+    DIR *dir = opendir(directory);
+    if (!dir)
+    {
+        return NULL;
+    }
+
+    struct dirent *d;
+    while ((d = readdir(dir)))
+    {
+        size_t length = strlen(d->d_name);
+        char path[VM_CACHE_PATH_LENGTH];
+        struct stat st;
+        if (length != VM_CACHE_KEY_LENGTH + 3 || strcmp(d->d_name + VM_CACHE_KEY_LENGTH, ".vm") != 0 ||
+            !vm_cache_path(path, directory, d->d_name) || stat(path, &st) != 0)
+        {
+            continue;
+        }
+
+        if (*entries_size == capacity)
+        {
+            entries = vm_grow_array(entries, &capacity, *entries_size + 1, sizeof(Vm_Cache_Entry));
+        }
+        Vm_Cache_Entry *entry = &entries[(*entries_size)++];
+        memcpy(entry->name, d->d_name, length + 1);
+        entry->size = (size_t)st.st_size;
+        entry->used = st.st_mtime;
+        *bytes += entry->size;
+    }
+    closedir(dir);
+    return entries;
+}
+
+static int vm_cache_compare_used(const void *a, const void *b)
+{
+    time_t used_a = ((const Vm_Cache_Entry *)a)->used, used_b = ((const Vm_Cache_Entry *)b)->used;
+    return (used_a > used_b) - (used_a < used_b);
+}
+
+// removes the entries used longest ago until the cache fits in vm_cache_limit; returns how many went
+static size_t vm_cache_evict(const char *directory)
+{
+    size_t entries_size, bytes, evicted = 0;
+    Vm_Cache_Entry *entries = vm_cache_list(directory, &entries_size, &bytes);
+    if (bytes > vm_cache_limit)
+    {
+        qsort(entries, entries_size, sizeof(Vm_Cache_Entry), vm_cache_compare_used);
+        for (size_t i = 0; i < entries_size && bytes > vm_cache_limit; i++)
+        {
+            char path[VM_CACHE_PATH_LENGTH];
+            if (vm_cache_path(path, directory, entries[i].name) && remove(path) == 0)
+            {
+                bytes -= entries[i].size;
+                evicted++;
+            }
+        }
+    }
+    free((void *)entries);
+    return evicted;
+}
+
+// the opcode table the assembler encodes with: every mnemonic, in opcode order, with its operand type
+static uint64_t vm_inst_table_hash(void)
+{
+    uint64_t hash = vm_fnv1a(NULL, 0);
+    for (size_t i = 0; i < INST_COUNT; i++)
+    {
+        const char *name = vm_inst_info[i].name ? vm_inst_info[i].name : "";
+        hash = vm_fnv1a_extend(hash, (const uint8_t *)name, strlen(name) + 1);
+        hash = vm_fnv1a_extend(hash, &vm_inst_info[i].operand_type, 1);
+    }
+    return hash;
+}
+
+// the key of the image the source assembles to: two FNV-1a hashes, over the source and over everything else that
+// decides what the assembler writes, i.e. the action, the output flags (--strip included), the capacities, the format
+// and assembler versions, the opcode table and the name of the source; key gets VM_CACHE_KEY_LENGTH hex digits and a
+// terminating zero
+void vm_cache_key(const Vm_Assembler *as, const char *source_path, bool compact, bool checksum, char *key)
+{
+    uint64_t settings[] = {VM_FORMAT_VERSION, VM_ASSEMBLER_VERSION, vm_inst_table_hash(), as->object, compact, checksum,
+                           vm_emit_debug_info, vm_program_capacity, vm_stack_capacity, vm_memory_capacity,
+                           vm_default_memory_size, label_capacity, natives_capacity};
+    uint8_t bytes[sizeof(settings)];
+    for (size_t i = 0; i < ARRAY_SIZE(settings); i++)
+    {
+        vm_put_le(bytes + i * 8, settings[i], 8);
+    }
+    const char *name = as->source_name ? as->source_name : ""; // the line table names lines no marker accounts for by it
+
+    // the second hash takes the pieces in the other order, so the two don't collide together
+    uint64_t first = vm_fnv1a(bytes, sizeof(bytes));
+    first = vm_fnv1a_extend(first, (const uint8_t *)name, strlen(name) + 1);
+    uint64_t second = vm_fnv1a(NULL, 0);
+
+    // the source is hashed as it's read, a buffer at a time, like vm_translate_file() reads it
+    FILE *f = fopen(source_path, "rb");
+    if (!f)
+    {
+        fprintf(stderr, "ERROR: Couldn't open file: '%s': %s\n", source_path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    uint8_t buffer[64 * 1024];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), f)) > 0)
+    {
+        first = vm_fnv1a_extend(first, buffer, read);
+        second = vm_fnv1a_extend(second, buffer, read);
+    }
+    if (ferror(f))
+    {
+        fprintf(stderr, "ERROR: Could not read file '%s': %s\n", source_path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    fclose(f);
+    second = vm_fnv1a_extend(second, (const uint8_t *)name, strlen(name) + 1);
+    second = vm_fnv1a_extend(second, bytes, sizeof(bytes));
+
+    snprintf(key, VM_CACHE_KEY_LENGTH + 1, "%016llx%016llx", (unsigned long long)first, (unsigned long long)second);
+}
+
+// on a hit, writes the cached image to output_path and returns true
+bool vm_cache_fetch(const char *key, const char *output_path)
+{
+    const char *directory = vm_cache_directory();
+    char name[VM_CACHE_KEY_LENGTH + 4], path[VM_CACHE_PATH_LENGTH];
+    snprintf(name, sizeof(name), "%s.vm", key);
+    if (!directory || !vm_cache_path(path, directory, name))
+    {
+        return false;
+    }
+
+    if (access(path, R_OK) == 0 && vm_cache_copy(path, output_path))
+    {
+        utime(path, NULL); // used now, as far as eviction goes
+        vm_cache_count(directory, 1, 0, 0);
+        return true;
+    }
+    vm_cache_count(directory, 0, 1, 0);
+    return false;
+}
+
+// keeps the image just written to output_path under key, then evicts down to vm_cache_limit
+void vm_cache_store(const char *key, const char *output_path)
+{
+    const char *directory = vm_cache_directory();
+    char name[VM_CACHE_KEY_LENGTH + 4], path[VM_CACHE_PATH_LENGTH];
+    snprintf(name, sizeof(name), "%s.vm", key);
+    if (!directory || !vm_cache_path(path, directory, name))
+    {
+        return;
+    }
+
+    if (!vm_cache_copy(output_path, path))
+    {
+        fprintf(stderr, "WARNING: could not add '%s' to the build cache in '%s'\n", output_path, directory);
+        return;
+    }
+    size_t evicted = vm_cache_evict(directory);
+    if (evicted > 0)
+    {
+        vm_cache_count(directory, 0, 0, evicted);
+    }
+}
+
+void vm_cache_print_stats(FILE *stream)
+{
+    const char *directory = vm_cache_directory();
+    if (!directory)
+    {
+        return;
+    }
+
+    size_t entries_size, bytes;
+    free((void *)vm_cache_list(directory, &entries_size, &bytes));
+    Vm_Cache_Stats stats = vm_cache_read_stats(directory);
+    unsigned long long lookups = stats.hits + stats.misses;
+
+    fprintf(stream, "Cache directory: %s\n", directory);
+    fprintf(stream, "Entries: %zu\n", entries_size);
+    fprintf(stream, "Size: %zu of %zu bytes\n", bytes, vm_cache_limit);
+    fprintf(stream, "Hits: %llu\n", stats.hits);
+    fprintf(stream, "Misses: %llu\n", stats.misses);
+    fprintf(stream, "Hit rate: %.1f%%\n", lookups > 0 ? 100.0 * (double)stats.hits / (double)lookups : 0.0);
+    fprintf(stream, "Evictions: %llu\n", stats.evictions);
+}
+
+// removes every entry and the counters
+void vm_cache_clean(FILE *stream)
+{
+    const char *directory = vm_cache_directory();
+    if (!directory)
+    {
+        return;
+    }
+
+    size_t entries_size, bytes, removed = 0;
+    Vm_Cache_Entry *entries = vm_cache_list(directory, &entries_size, &bytes);
+    for (size_t i = 0; i < entries_size; i++)
+    {
+        char path[VM_CACHE_PATH_LENGTH];
+        removed += vm_cache_path(path, directory, entries[i].name) && remove(path) == 0;
+    }
+    free((void *)entries);
+
+    char path[VM_CACHE_PATH_LENGTH];
+    if (vm_cache_path(path, directory, "stats"))
+    {
+        remove(path);
+    }
+    fprintf(stream, "Removed %zu entries (%zu bytes) from %s\n", removed, bytes, directory);
+}
+#endif
+
+#if VM_HAS_MMAP
+// vm_init()'s loader: maps the executable rather than reading it; a fixed size code section is run from the mapping as
+// it is and a compact one decoded out of it, and the data section is mapped copy-on-write at the front of static
+// memory, so a start costs page faults for what the program touches and processes running one image share its pages
+vm_header_ vm_map_program_file(VirtualMachine *vm, const char *file_path)
+{
+    int fd = open(file_path, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "ERROR: Could not open file '%s': %s\n", file_path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        fprintf(stderr, "ERROR: Could not read file '%s': %s\n", file_path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    size_t file_size = (size_t)st.st_size;
+    if (file_size == 0)
+    {
+        fprintf(stderr, "The provided file '%s' is not a vm executable\n", file_path);
+        exit(EXIT_FAILURE);
+    }
+
+    const uint8_t *image = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (image == MAP_FAILED)
+    {
+        fprintf(stderr, "ERROR: Could not map file '%s': %s\n", file_path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    vm_header_ header = vm_parse_executable(image, file_size, file_path, false);
+    vm_size_static_memory(header);
+    size_t data_offset = header.data_section_offset_in_executable;
+    size_t code_offset = header.code_section_offset_in_executable;
+
+    // static memory is zero pages with the file's pages holding the data section mapped over the front; file offsets
+    // have to be page aligned, so static_memory starts 'lead' bytes into the mapping
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t lead = data_offset % page;
+    vm->static_mapping_size = lead + vm_memory_capacity;
+    vm->static_mapping = mmap(NULL, vm->static_mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (vm->static_mapping == MAP_FAILED)
+    {
+        fprintf(stderr, "ERROR: static memory allocation failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    vm->static_memory = vm->static_mapping + lead;
+
+    if (header.data_section_size > 0)
+    {
+        if (mmap(vm->static_mapping, lead + header.data_section_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, (off_t)(data_offset - lead)) == MAP_FAILED)
+        {
+            fprintf(stderr, "ERROR: Could not map the data section of '%s': %s\n", file_path, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        // the rest of the last page is whatever follows the data section in the file; static memory past it is zero
+        size_t mapped = (lead + header.data_section_size + page - 1) / page * page;
+        if (mapped > vm->static_mapping_size)
+        {
+            mapped = vm->static_mapping_size;
+        }
+        memset(vm->static_memory + header.data_section_size, 0, mapped - lead - header.data_section_size);
+    }
+
+    if (header.vm_executable_identifier == VM_EXECUTABLE_IDENTIFIER && vm_fixed_code_is_native() && code_offset % _Alignof(Inst) == 0)
+    {
+        vm->program = (Inst *)(image + code_offset);
+        vm->program_capacity = 0;
+        vm->image = image;
+        vm->image_size = file_size;
+    }
+    else
+    {
+        vm->program_capacity = header.code_section_size > 0 ? header.code_section_size : 1;
+        vm->program = malloc(sizeof(Inst) * vm->program_capacity);
+        if (!vm->program)
+        {
+            fprintf(stderr, "ERROR: code section allocation failed: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        vm_decode_code_section(image, header, vm->program, file_path);
+        munmap((void *)image, file_size);
+        vm->image = NULL;
+    }
+
+    close(fd); // the mappings stay valid without it
+    return header;
+}
+#endif
+
+// a program run from its mapped image is read only; gives the machine a copy of its own before anything writes to it
+void vm_own_program(VirtualMachine *vm)
+{
+#if VM_HAS_MMAP
+    if (!vm->image)
+    {
+        return;
+    }
+
+    Inst *program = malloc(sizeof(Inst) * (vm->program_size > 0 ? vm->program_size : 1));
+    if (!program)
+    {
+        fprintf(stderr, "ERROR: code section allocation failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    memcpy(program, vm->program, sizeof(Inst) * vm->program_size);
+    munmap((void *)vm->image, vm->image_size);
+    vm->image = NULL;
+    vm->program = program;
+    vm->program_capacity = vm->program_size > 0 ? vm->program_size : 1;
+#else
+    (void)vm;
+#endif
+}
+
+Inst vm_translate_line(Vm_Assembler *as, String_View line, size_t current_program_counter)
+{
+    String_View inst_name = sv_chop_by_delim(&line, ' ');
+    sv_trim_left(&line);
+    bool has_operand_value = line.count > 0;
+
+    Inst_Type i = vm_inst_lookup(inst_name);
+    if (i == 0)
+    {
+        fprintf(as->errors, "Line Number %zu -> ERROR: invalid instruction %.*s\n",
+                as->line_no, (int)inst_name.count, inst_name.data);
+        as->compilation_successful = false;
+        return (Inst){0};
+    }
+
+    if (has_operand_function(i) != has_operand_value)
+    {
+        fprintf(as->errors, "Line Number %zu -> ERROR: %s %s an operand\n",
+                as->line_no, get_inst_name(i), has_operand_function(i) ? "requires" : "doesn't require");
+        as->compilation_successful = false;
+        return (Inst){0};
+    }
+
+    if (!has_operand_function(i))
+    {
+        return (Inst){.type = i};
+    }
+
+    Sv_Number operand = sv_to_number(&line);
+
+    if (str_errno == FAILURE)
+    {
+        push_to_not_resolved_yet(as, vm_intern(as, line), current_program_counter, as->line_no);
+        return (Inst){.type = i, .operand._as_u64 = 0};
+    }
+    else if (str_errno == OPERAND_OVERFLOW)
+    {
+        fprintf(as->errors, "Line Number %zu -> ERROR: %.*s overflows a 64 bit %s value\n",
+                as->line_no, (int)line.count, line.data,
+                get_operand_type(i) == TYPE_SIGNED_64INT ? "signed" : "unsigned");
+        as->compilation_successful = false;
+        return (Inst){0};
+    }
+
+    switch (get_operand_type(i))
+    {
+    case TYPE_SIGNED_64INT:
+        return (Inst){.type = i, .operand._as_s64 = operand.s64};
+    case TYPE_UNSIGNED_64INT:
+        if (operand.type != SV_UNSIGNED)
+        {
+            fprintf(as->errors, "Line Number %zu -> ERROR: illegal operand value for %s instruction: %.*s\n"
+                            "Must be an unsigned integral value\n",
+                    as->line_no, get_inst_name(i), (int)line.count, line.data);
+            as->compilation_successful = false;
+            return (Inst){0};
+        }
+        return (Inst){.type = i, .operand._as_u64 = operand.u64};
+    case TYPE_DOUBLE:
+        return (Inst){.type = i, .operand._as_f64 = operand.f64};
+    default:
+        fprintf(as->errors, "Line Number %zu -> ERROR: unknown operand type for instruction %s\n",
+                as->line_no, get_inst_name(i));
+        as->compilation_successful = false;
+        return (Inst){0};
+    }
+}
+
+static void process_label(Vm_Assembler *as, String_View label, size_t program_size, uint32_t section)
+{
+    /* if (label_array_counter >= label_capacity)
+    {
+        fprintf(as->errors, "Line Number %zu -> ERROR: label capacity exceeded at label: %.*s\n",
+                as->line_no, (int)label.count, label.data);
+        as->compilation_successful = false;
+        return;
+    } */
+
+    push_to_hashtable(as, vm_intern(as, label), (uint64_t)program_size, section);
+}
+
+static void resolve_labels(Vm_Assembler *as, Inst *program)
+{
+    for (size_t i = 0; i < as->not_resolved_yet_counter; i++)
+    {
+        Hashnode *node = search_for_node(as, as->not_resolved_yet[i].label);
+        // printf("%d\n", hash_sv(node->label));
+        if (!node && as->object)
+        {
+            continue; // an import; vm_save_object_to_file() records it for the linker
+        }
+        else if (!node)
+        {
+            fprintf(as->errors, "Line Number %zu -> ERROR: cannot resolve label: %.*s\n",
+                    as->not_resolved_yet[i].label_line_no, (int)as->not_resolved_yet[i].label.count, as->not_resolved_yet[i].label.data);
+            as->compilation_successful = false;
+        }
+        else
+        {
+            program[as->not_resolved_yet[i].inst_location].operand._as_u64 = node->value;
+        }
+    }
+}
+
+/* static void check_unresolved_labels()
+{
+    bool has_unresolved = false;
+    for (size_t i = 0; i < as->not_resolved_yet_counter; i++)
+    {
+        if (!as->not_resolved_yet[i].resolved)
+        {
+            has_unresolved = true;
+        }
+    }
+    if (has_unresolved)
+    {
+        as->compilation_successful = false;
+    }
+}
+ */
+
+int64_t check_start(const Vm_Assembler *as)
+{
+    String_View start_ = cstr_as_sv("start");
+    /* for (size_t i = 0; i < label_array_counter; i++)
+    {
+        if (sv_eq(label_array[i].label, start_))
+        {
+            return (int64_t)label_array[i].label_pointing_location;
+        }
+    } */
+
+    Hashnode *node = search_for_node(as, start_);
+    if (!node)
+    {
+        return -1;
+    }
+    else
+    {
+        return (int64_t)node->value;
+    }
+
+    /* return -1; */
+}
+
+// applies a preprocessor line marker, '# 12 "file.vasm"' or '#line 12 "file.vasm"' as MSVC writes it; a trailing
+// flag 1 says the file is entered by an %include of the one being read, 2 that the line returns to an includer
+static void vm_source_marker(Vm_Assembler *as, String_View marker)
+{
+    marker.data++;
+    marker.count--;
+    if (marker.count >= 4 && memcmp(marker.data, "line", 4) == 0)
+    {
+        marker.data += 4;
+        marker.count -= 4;
+    }
+    sv_trim_left(&marker);
+    String_View number = sv_chop_by_delim(&marker, ' ');
+    size_t line = sv_to_unsigned64(&number);
+    if (str_errno != SUCCESS || marker.count == 0 || marker.data[0] != '"')
+    {
+        return; // not a marker; the preprocessor left it alone, and so does the assembler
+    }
+    marker.data++;
+    marker.count--;
+    String_View name = sv_chop_by_delim(&marker, '"');
+    sv_trim_left(&marker);
+    char flag = marker.count > 0 ? marker.data[0] : '\0';
+
+    if (flag == '1' && as->source_frames_size > 0)
+    {
+        if (as->source_frames_size == as->source_frames_capacity)
+        {
+            as->source_frames = vm_grow_array(as->source_frames, &as->source_frames_capacity, as->source_frames_size + 1, sizeof(Vm_Source_Frame));
+        }
+        size_t parent_line = as->source_frames[as->source_frames_size - 1].line;
+        as->source_frames[as->source_frames_size++] = (Vm_Source_Frame){.name = vm_intern(as, name), .line = line, .parent_line = parent_line, .id = as->source_frames_made++};
+        return;
+    }
+    while (flag == '2' && as->source_frames_size > 1 && !sv_eq(as->source_frames[as->source_frames_size - 1].name, name))
+    {
+        as->source_frames_size--;
+    }
+    if (as->source_frames_size == 0 || !sv_eq(as->source_frames[as->source_frames_size - 1].name, name))
+    {
+        // a file of its own, not one an %include entered
+        if (as->source_frames_capacity == 0)
+        {
+            as->source_frames = vm_grow_array(as->source_frames, &as->source_frames_capacity, 1, sizeof(Vm_Source_Frame));
+        }
+        as->source_frames[0] = (Vm_Source_Frame){.name = vm_intern(as, name), .id = as->source_frames_made++};
+        as->source_frames_size = 1;
+    }
+    as->source_frames[as->source_frames_size - 1].line = line;
+}
+
+// the line being read, as a line of the file it came from; moves on to the next
+static size_t vm_source_next_line(Vm_Assembler *as)
+{
+    if (as->source_frames_size == 0)
+    {
+        // no markers (yet): the lines are the source's own
+        as->source_frames = vm_grow_array(as->source_frames, &as->source_frames_capacity, 1, sizeof(Vm_Source_Frame));
+        as->source_frames[0] = (Vm_Source_Frame){.name = cstr_as_sv(as->source_name ? as->source_name : "<source>"), .line = 1, .id = as->source_frames_made++};
+        as->source_frames_size = 1;
+    }
+    return as->source_frames[as->source_frames_size - 1].line++;
+}
+
+// notes that instruction inst came from line of the file being read, interning that file and its includers
+static void vm_source_record(Vm_Assembler *as, size_t inst, size_t line)
+{
+    for (size_t k = 0; k < as->source_frames_size; k++)
+    {
+        Vm_Source_Frame *frame = &as->source_frames[k];
+        if (frame->file == 0)
+        {
+            if (as->source_files_size == as->source_files_capacity)
+            {
+                size_t capacity = as->source_files_capacity;
+                as->source_files = vm_grow_array(as->source_files, &as->source_files_capacity, as->source_files_size + 1, sizeof(Vm_Source_File));
+                as->source_file_frames = vm_grow_array(as->source_file_frames, &capacity, as->source_files_size + 1, sizeof(size_t));
+            }
+            as->source_file_frames[as->source_files_size] = frame->id;
+            as->source_files[as->source_files_size++] = (Vm_Source_File){
+                .name = frame->name,
+                .parent = k > 0 ? as->source_frames[k - 1].file : 0,
+                .parent_line = k > 0 ? frame->parent_line : 0};
+            frame->file = as->source_files_size;
+        }
+    }
+
+    if (inst >= as->source_lines_capacity)
+    {
+        as->source_lines = vm_grow_array(as->source_lines, &as->source_lines_capacity, inst + 1, sizeof(Vm_Source_Line));
+    }
+    as->source_lines[inst] = (Vm_Source_Line){.file = (uint32_t)(as->source_frames[as->source_frames_size - 1].file - 1), .line = (uint32_t)line};
+}
+
+// encodes a line table for lines[0, lines_size) into as->debug_lines:
+//   u64 file count | a record per file, as vm_put_record() writes them: the line of the %include that entered it, the
+//   index + 1 of the file that %include is in (0 for none) and its name | then per instruction, a varint 0 and the
+//   varint file index when the file differs from the instruction before's, and the line's difference from the line
+//   before zigzag encoded, plus one, as a varint; one byte an instruction for straight line code
+static void vm_debug_encode_lines(Vm_Assembler *as, const Vm_Source_File *files, size_t files_size, const Vm_Source_Line *lines, size_t lines_size)
+{
+    size_t capacity = 0;
+    free((void *)as->debug_lines);
+    as->debug_lines = vm_grow_array(NULL, &capacity, 8 + lines_size * 2, sizeof(uint8_t));
+    vm_put_le(as->debug_lines, files_size, 8);
+    as->debug_lines_size = 8;
+    for (size_t f = 0; f < files_size; f++)
+    {
+        vm_put_record(&as->debug_lines, &as->debug_lines_size, &capacity, files[f].parent_line, (uint32_t)files[f].parent, files[f].name);
+    }
+
+    uint64_t file = UINT64_MAX;
+    int64_t line = 0;
+    for (size_t i = 0; i < lines_size; i++)
+    {
+        if (capacity - as->debug_lines_size < 3 * 10)
+        {
+            as->debug_lines = vm_grow_array(as->debug_lines, &capacity, as->debug_lines_size + 3 * 10, sizeof(uint8_t));
+        }
+        if (lines[i].file != file)
+        {
+            file = lines[i].file;
+            as->debug_lines_size += vm_put_varint(as->debug_lines + as->debug_lines_size, 0);
+            as->debug_lines_size += vm_put_varint(as->debug_lines + as->debug_lines_size, file);
+        }
+        int64_t delta = (int64_t)lines[i].line - line;
+        line = lines[i].line;
+        as->debug_lines_size += vm_put_varint(as->debug_lines + as->debug_lines_size, (((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63)) + 1);
+    }
 }
 
-vm_header_ vm_load_program_from_file(Inst *program, uint8_t *data_section, const char *file_path)
+// the labels in the assembler's table as symbol records, in the order they were defined, into as->debug_symbols
+static void vm_debug_encode_symbols(Vm_Assembler *as)
 {
-    FILE *f = fopen(file_path, "rb");
-    if (!f)
+    size_t capacity = 0;
+    free((void *)as->debug_symbols);
+    as->debug_symbols = NULL;
+    as->debug_symbols_size = as->debug_symbols_count = 0;
+    for (size_t i = 0; i < as->label_nodes_size; i++, as->debug_symbols_count++)
     {
-        fprintf(stderr, "ERROR: Could not open file '%s': %s\n", file_path, strerror(errno));
-        exit(EXIT_FAILURE);
+        vm_put_record(&as->debug_symbols, &as->debug_symbols_size, &capacity, as->label_nodes[i].value, as->label_nodes[i].section, as->label_nodes[i].label);
     }
+}
 
-    vm_header_ header = {0};
-    int ret_val = fread(&header, sizeof(vm_header_), 1, f);
-    if (ferror(f))
-    {
-        fclose(f);
-        fprintf(stderr, "ERROR: Could not read file '%s': %s\n", file_path, strerror(errno));
-        exit(EXIT_FAILURE);
-    }
+typedef struct // a run of source lines vm_translate_lines() assembles, and the code and data it made of them
+{
+    Vm_Assembler *as;
+    String_View source;
+    bool is_code; // whether the lines start out in .text or in .data, then whether the last one left them in .text
+    Inst *program;
+    size_t code_size;
+    size_t code_capacity;
+    uint8_t *data_section;
+    size_t data_size;
+    size_t data_capacity;
+} Vm_Asm_Chunk;
+
+typedef struct // vm_translate_file()'s view of its source: a buffer of it at a time, refilled as the lines run out
+{
+    FILE *file;
+    const char *path;
+    char *buffer;
+    size_t capacity; // grows only for a line longer than it
+    size_t begin;    // the lines not read yet are buffer[begin, end)
+    size_t end;
+    bool eof;
+} Vm_Line_Reader;
+
+// a line of source, newline cut off, without its comment and the blanks around it
+static String_View vm_source_line(String_View line)
+{
+    line = sv_chop_by_delim(&line, ';'); // Remove comments
+    sv_trim_left(&line);
+    sv_trim_right(&line);
+    return line;
+}
 
-    if (header.vm_executable_identifier != VM_EXECUTABLE_IDENTIFIER)
+// 1 for a .text line, 0 for a .data line, -1 for any other
+static int vm_section_directive(String_View line)
+{
+    String_View directive = sv_chop_by_delim(&line, ' ');
+    if (sv_eq(directive, cstr_as_sv(".text")))
     {
-        fprintf(stderr, "The provided file '%s' is not a vm executable\n", file_path);
-        exit(EXIT_FAILURE);
+        return 1;
     }
+    return sv_eq(directive, cstr_as_sv(".data")) ? 0 : -1;
+}
 
-    if (header.code_section_size > vm_program_capacity)
+static Vm_Asm_Chunk vm_asm_chunk_new(Vm_Assembler *as, String_View source, bool is_code)
+{
+    Vm_Asm_Chunk chunk = {.as = as, .source = source, .is_code = is_code, .code_capacity = VM_PROGRAM_CAPACITY, .data_capacity = VM_DEFAULT_MEMORY_SIZE};
+    chunk.program = vm_grow_array(NULL, &chunk.code_capacity, chunk.code_capacity, sizeof(Inst));
+    chunk.data_section = vm_grow_array(NULL, &chunk.data_capacity, chunk.data_capacity, sizeof(uint8_t));
+    return chunk;
+}
+
+// assembles the next line of source, newline cut off, into chunk; false once the program is too big to take it
+static bool vm_assemble_line(Vm_Asm_Chunk *chunk, String_View line)
+{
+    Vm_Assembler *as = chunk->as;
+    if (chunk->code_size >= vm_program_capacity)
     {
-        fprintf(stderr, "ERROR: Text section of the executable %s is of size %zu which exceeds the maximum text section capacity %zu of the virtual machine\n", file_path, header.code_section_size, vm_program_capacity);
-        exit(EXIT_FAILURE);
+        fprintf(as->errors, "Program Too Big\n");
+        as->compilation_successful = false;
+        return false;
     }
 
-    if (header.data_section_size > vm_default_memory_size)
+    as->line_no++;
+    line = vm_source_line(line);
+
+    if (line.count > 0 && line.data[0] == '#')
     {
-        fprintf(stderr, "ERROR: Data section of the executable %s is of size %zu which exceeds the maximum default data section capacity %zu of the virtual machine\n", file_path, header.data_section_size, vm_default_memory_size);
-        exit(EXIT_FAILURE);
+        vm_source_marker(as, line);
+        return true;
     }
+    size_t source_line = vm_source_next_line(as);
+    as->line_no = source_line; // errors point at the source line, not at the line of the preprocessor's output
 
-    assert(header.data_section_size <= vm_default_memory_size * sizeof(uint8_t));
+    if (line.count == 0)
+        return true; // Ignore empty lines
 
-    if (fseek(f, header.data_section_offset_in_executable, SEEK_SET))
+    int directive = vm_section_directive(line);
+    if (directive >= 0)
     {
-        fclose(f);
-        fprintf(stderr, "ERROR: Could not read file '%s': %s\n", file_path, strerror(errno));
-        exit(EXIT_FAILURE);
+        chunk->is_code = directive == 1;
     }
-
-    ret_val = fread(data_section, sizeof(uint8_t), header.data_section_size, f);
-    if (ferror(f))
+    else if (chunk->is_code)
     {
-        fclose(f);
-        fprintf(stderr, "ERROR: Could not read file '%s': %s\n", file_path, strerror(errno));
-        exit(EXIT_FAILURE);
+        // a line assembles to at most one instruction
+        if (chunk->code_size == chunk->code_capacity)
+        {
+            chunk->program = vm_grow_array(chunk->program, &chunk->code_capacity, chunk->code_size + 1, sizeof(Inst));
+        }
+        size_t inst = chunk->code_size;
+        process_code_line(as, line, chunk->program, &chunk->code_size);
+        if (chunk->code_size > inst)
+        {
+            vm_source_record(as, inst, source_line);
+        }
     }
-
-    /*     for (size_t i = 0; i < header.data_section_size; i++)
+    else
+    {
+        // and to at most as many data bytes as it is long or one .quadword/.double
+        if (chunk->data_capacity - chunk->data_size < line.count + sizeof(uint64_t))
         {
-            printf("%d\n", data_section[i]);
-        } */
-
-    assert(header.code_section_size <= vm_program_capacity * sizeof(Inst));
+            chunk->data_section = vm_grow_array(chunk->data_section, &chunk->data_capacity, chunk->data_size + line.count + sizeof(uint64_t), sizeof(uint8_t));
+        }
+        process_data_line(as, line, chunk->data_section, &chunk->data_size);
+    }
+    return true;
+}
 
-    if (fseek(f, header.code_section_offset_in_executable, SEEK_SET))
+static void vm_translate_lines(Vm_Asm_Chunk *chunk)
+{
+    String_View source = chunk->source;
+    while (source.count > 0 && vm_assemble_line(chunk, sv_chop_by_delim(&source, '\n')))
     {
-        fclose(f);
-        fprintf(stderr, "ERROR: Could not read file '%s': %s\n", file_path, strerror(errno));
-        exit(EXIT_FAILURE);
     }
+}
 
-    ret_val = fread(program, sizeof(Inst), header.code_section_size, f);
-    if (ferror(f))
+// the next line of the file, newline cut off, which stays where it is until the next call; false past the last one
+static bool vm_read_line(Vm_Line_Reader *reader, String_View *line)
+{
+    for (;;)
     {
-        fclose(f);
-        fprintf(stderr, "ERROR: Could not read file '%s': %s\n", file_path, strerror(errno));
-        exit(EXIT_FAILURE);
-    }
+        char *begin = reader->buffer + reader->begin;
+        size_t count = reader->end - reader->begin;
+        char *newline = memchr(begin, '\n', count);
+        if (newline || (reader->eof && count > 0))
+        {
+            size_t length = newline ? (size_t)(newline - begin) : count;
+            *line = (String_View){.data = begin, .count = length};
+            reader->begin += newline ? length + 1 : length;
+            return true;
+        }
+        if (reader->eof)
+        {
+            return false;
+        }
 
-    fclose(f);
-    return header;
+        // the start of the line moves to the front, and the rest of the buffer is read in after it
+        memmove(reader->buffer, begin, count);
+        reader->begin = 0;
+        reader->end = count;
+        if (reader->end == reader->capacity)
+        {
+            reader->buffer = vm_grow_array(reader->buffer, &reader->capacity, reader->capacity + 1, sizeof(char));
+        }
+        size_t read = fread(reader->buffer + reader->end, 1, reader->capacity - reader->end, reader->file);
+        if (read == 0 && ferror(reader->file))
+        {
+            fprintf(stderr, "ERROR: Could not read file '%s': %s\n", reader->path, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        reader->end += read;
+        reader->eof = read == 0;
+    }
 }
 
-Inst vm_translate_line(String_View line, size_t current_program_counter)
+#if VM_HAS_THREADS
+static void *vm_translate_chunk(void *chunk)
 {
-    String_View inst_name = sv_chop_by_delim(&line, ' ');
-    sv_trim_left(&line);
-    bool has_operand_value = line.count > 0;
+    vm_translate_lines(chunk);
+    return NULL;
+}
 
-    for (size_t i = 1; i < (size_t)INST_COUNT; i++)
+// appends what the chunks assembled to as, in order, each chunk's code, data, labels and fixups moved past those of
+// the chunks before it and its files numbered as if one assembler had read them all; false, with as left to be
+// cleared, where that isn't what the serial assembly would make of the source: a chunk failed, a label is defined in
+// two chunks or the program is too big, which the serial assembly then reports the way it always has
+static bool vm_merge_chunks(Vm_Assembler *as, Vm_Asm_Chunk *chunks, size_t chunks_size, Inst **program, uint8_t **data_section, size_t *code_size, size_t *data_size)
+{
+    size_t code_total = 0, data_total = 0, frames_made = 0;
+    for (size_t k = 0; k < chunks_size; k++)
     {
-        if (sv_eq(inst_name, cstr_as_sv(get_inst_name(i))))
+        if (!chunks[k].as->compilation_successful)
         {
-            if (has_operand_function(i) != has_operand_value)
-            {
-                fprintf(stderr, "Line Number %zu -> ERROR: %s %s an operand\n",
-                        line_no, get_inst_name(i), has_operand_function(i) ? "requires" : "doesn't require");
-                compilation_successful = false;
-                return (Inst){0};
-            }
-
-            if (!has_operand_function(i))
-            {
-                return (Inst){.type = i};
-            }
-
-            union
-            {
-                double f64;
-                int64_t s64;
-                uint64_t u64;
-            } operand = {0};
+            return false;
+        }
+        code_total += chunks[k].code_size;
+        data_total += chunks[k].data_size;
+        frames_made = chunks[k].as->source_frames_made > frames_made ? chunks[k].as->source_frames_made : frames_made;
+    }
+    if (code_total >= vm_program_capacity)
+    {
+        return false;
+    }
 
-            bool is_frac = is_fraction(line);
-            bool is_neg = is_negative(line);
+    size_t code_capacity = code_total > 0 ? code_total : 1;
+    size_t data_capacity = data_total > 0 ? data_total : 1;
+    *program = vm_grow_array(NULL, &code_capacity, code_capacity, sizeof(Inst));
+    *data_section = vm_grow_array(NULL, &data_capacity, data_capacity, sizeof(uint8_t));
+    as->source_lines = vm_grow_array(NULL, &as->source_lines_capacity, code_capacity, sizeof(Vm_Source_Line));
+    size_t *frame_files = calloc(frames_made + 1, sizeof(size_t)); // global index + 1 of each frame's file
+    if (!frame_files)
+    {
+        fprintf(stderr, "ERROR: assembler merge allocation failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
 
-            if (is_frac)
-            {
-                operand.f64 = sv_to_double(&line);
-            }
-            else if (is_neg)
-            {
-                operand.s64 = sv_to_signed64(&line);
-            }
-            else
-            {
-                operand.u64 = sv_to_unsigned64(&line);
-            }
+    bool merged = true;
+    size_t code_base = 0, data_base = 0;
+    for (size_t k = 0; k < chunks_size && merged; k++)
+    {
+        const Vm_Assembler *chunk = chunks[k].as;
+        memcpy(*program + code_base, chunks[k].program, chunks[k].code_size * sizeof(Inst));
+        memcpy(*data_section + data_base, chunks[k].data_section, chunks[k].data_size);
 
-            if (str_errno == FAILURE)
-            {
-                push_to_not_resolved_yet(line, current_program_counter, line_no);
-                return (Inst){.type = i, .operand._as_u64 = 0};
-            }
-            else if (str_errno == OPERAND_OVERFLOW)
+        for (size_t n = 0; n < chunk->label_nodes_size && merged; n++)
+        {
+            Hashnode node = chunk->label_nodes[n];
+            merged = !search_for_node(as, node.label);
+            if (merged)
             {
-                fprintf(stderr, "Line Number %zu -> ERROR: %.*s overflows a 64 bit %s value\n",
-                        line_no, (int)line.count, line.data,
-                        get_operand_type(i) == TYPE_SIGNED_64INT ? "signed" : "unsigned");
-                compilation_successful = false;
-                return (Inst){0};
+                push_to_hashtable(as, node.label, node.value + (node.section == VM_SECTION_DATA ? data_base : code_base), node.section);
             }
+        }
+        for (size_t f = 0; f < chunk->not_resolved_yet_counter; f++)
+        {
+            label_inst_location fixup = chunk->not_resolved_yet[f];
+            push_to_not_resolved_yet(as, fixup.label, fixup.inst_location + code_base, fixup.label_line_no);
+        }
 
-            switch (get_operand_type(i))
+        // a file is the frame it was read in; a chunk numbers the ones its instructions came from itself, in the
+        // order the serial assembly would have, so the ones no chunk before it came to go after theirs
+        for (size_t f = 0; f < chunk->source_files_size; f++)
+        {
+            size_t id = chunk->source_file_frames[f];
+            if (frame_files[id] == 0)
             {
-            case TYPE_SIGNED_64INT:
-                return (Inst){.type = i, .operand._as_s64 = operand.s64};
-            case TYPE_UNSIGNED_64INT:
-                if (is_frac || is_neg)
-                {
-                    fprintf(stderr, "Line Number %zu -> ERROR: illegal operand value for %s instruction: %.*s\n"
-                                    "Must be an unsigned integral value\n",
-                            line_no, get_inst_name(i), (int)line.count, line.data);
-                    compilation_successful = false;
-                    return (Inst){0};
-                }
-                return (Inst){.type = i, .operand._as_u64 = operand.u64};
-            case TYPE_DOUBLE:
-                return (Inst){.type = i, .operand._as_f64 = operand.f64};
-            default:
-                fprintf(stderr, "Line Number %zu -> ERROR: unknown operand type for instruction %s\n",
-                        line_no, get_inst_name(i));
-                compilation_successful = false;
-                return (Inst){0};
+                Vm_Source_File file = chunk->source_files[f];
+                file.parent = file.parent > 0 ? frame_files[chunk->source_file_frames[file.parent - 1]] : 0;
+                size_t capacity = as->source_files_capacity;
+                as->source_files = vm_grow_array(as->source_files, &as->source_files_capacity, as->source_files_size + 1, sizeof(Vm_Source_File));
+                as->source_file_frames = vm_grow_array(as->source_file_frames, &capacity, as->source_files_size + 1, sizeof(size_t));
+                as->source_file_frames[as->source_files_size] = id;
+                as->source_files[as->source_files_size++] = file;
+                frame_files[id] = as->source_files_size;
             }
         }
+        for (size_t i = 0; i < chunks[k].code_size; i++)
+        {
+            Vm_Source_Line line = chunk->source_lines[i];
+            as->source_lines[code_base + i] = (Vm_Source_Line){.file = (uint32_t)(frame_files[chunk->source_file_frames[line.file]] - 1), .line = line.line};
+        }
+
+        code_base += chunks[k].code_size;
+        data_base += chunks[k].data_size;
     }
 
-    fprintf(stderr, "Line Number %zu -> ERROR: invalid instruction %.*s\n",
-            line_no, (int)inst_name.count, inst_name.data);
-    compilation_successful = false;
-    return (Inst){0};
+    free((void *)frame_files);
+    *code_size = code_total;
+    *data_size = data_total;
+    return merged;
 }
 
-static void process_label(String_View label, size_t program_size)
+// splits source at line boundaries into chunks assembled each on its own thread while this one reads ahead for the
+// section and the line markers every chunk starts in, then merges them; false if it didn't, or the result isn't what
+// the serial assembly would make, for the caller to assemble it serially
+static bool vm_translate_parallel(Vm_Assembler *as, String_View source, size_t chunks_size, Inst **program, uint8_t **data_section, size_t *code_size, size_t *data_size)
 {
-    /* if (label_array_counter >= label_capacity)
+    FILE *null_stream = fopen("/dev/null", "w"); // a failed chunk is assembled again serially, which reports the errors
+    Vm_Asm_Chunk *chunks = calloc(chunks_size, sizeof(Vm_Asm_Chunk));
+    Vm_Assembler *assemblers = calloc(chunks_size, sizeof(Vm_Assembler));
+    pthread_t *threads = calloc(chunks_size, sizeof(pthread_t));
+    bool *started = calloc(chunks_size, sizeof(bool));
+    if (!null_stream || !chunks || !assemblers || !threads || !started)
     {
-        fprintf(stderr, "Line Number %zu -> ERROR: label capacity exceeded at label: %.*s\n",
-                line_no, (int)label.count, label.data);
-        compilation_successful = false;
-        return;
-    } */
+        if (null_stream)
+        {
+            fclose(null_stream);
+        }
+        free((void *)chunks);
+        free((void *)assemblers);
+        free((void *)threads);
+        free((void *)started);
+        return false;
+    }
 
-    push_to_hashtable(label, (uint64_t)program_size);
-}
+    // the chunks end at the first newline past an even share of the source
+    String_View rest = source;
+    for (size_t k = 0; k < chunks_size; k++)
+    {
+        size_t end = k + 1 < chunks_size ? source.count / chunks_size * (k + 1) : source.count;
+        size_t done = (size_t)(rest.data - source.data);
+        size_t share = end > done ? end - done : 0;
+        const char *newline = share < rest.count ? memchr(rest.data + share, '\n', rest.count - share) : NULL;
+        size_t length = newline ? (size_t)(newline - rest.data) + 1 : rest.count;
+        chunks[k].source = (String_View){.data = rest.data, .count = length};
+        rest.data += length;
+        rest.count -= length;
+    }
 
-static void resolve_labels(Inst *program)
-{
-    for (size_t i = 0; i < not_resolved_yet_counter; i++)
+    Vm_Assembler scan;
+    vm_assembler_init(&scan, as->source_name, as->object);
+    bool is_code = true;
+    for (size_t k = 0; k < chunks_size; k++)
     {
-        Hashnode *node = search_for_node(not_resolved_yet[i].label);
-        // printf("%d\n", hash_sv(node->label));
-        if (!node)
+        Vm_Assembler *chunk = &assemblers[k];
+        vm_assembler_init(chunk, as->source_name, as->object);
+        chunk->errors = null_stream;
+        chunk->source_frames_made = scan.source_frames_made;
+        if (scan.source_frames_size > 0)
         {
-            fprintf(stderr, "Line Number %zu -> ERROR: cannot resolve label: %.*s\n",
-                    not_resolved_yet[i].label_line_no, (int)not_resolved_yet[i].label.count, not_resolved_yet[i].label.data);
-            compilation_successful = false;
+            chunk->source_frames = vm_grow_array(NULL, &chunk->source_frames_capacity, scan.source_frames_size, sizeof(Vm_Source_Frame));
+            for (size_t f = 0; f < scan.source_frames_size; f++)
+            {
+                chunk->source_frames[f] = scan.source_frames[f];
+                chunk->source_frames[f].file = 0; // the chunk numbers its files itself
+            }
+            chunk->source_frames_size = scan.source_frames_size;
         }
-        else
+
+        chunks[k] = vm_asm_chunk_new(chunk, chunks[k].source, is_code);
+        started[k] = pthread_create(&threads[k], NULL, vm_translate_chunk, &chunks[k]) == 0;
+        if (!started[k])
         {
-            program[not_resolved_yet[i].inst_location].operand._as_u64 = node->value;
+            vm_translate_lines(&chunks[k]);
         }
-    }
-}
 
-/* static void check_unresolved_labels()
-{
-    bool has_unresolved = false;
-    for (size_t i = 0; i < not_resolved_yet_counter; i++)
-    {
-        if (!not_resolved_yet[i].resolved)
+        // what vm_translate_lines() does with lines besides assembling them
+        String_View lines = chunks[k].source;
+        while (k + 1 < chunks_size && lines.count > 0)
         {
-            has_unresolved = true;
+            String_View line = vm_source_line(sv_chop_by_delim(&lines, '\n'));
+            if (line.count > 0 && line.data[0] == '#')
+            {
+                vm_source_marker(&scan, line);
+                continue;
+            }
+            vm_source_next_line(&scan);
+            int directive = line.count > 0 && line.data[0] == '.' ? vm_section_directive(line) : -1;
+            is_code = directive >= 0 ? directive == 1 : is_code;
         }
     }
-    if (has_unresolved)
-    {
-        compilation_successful = false;
-    }
-}
- */
+    vm_assembler_free(&scan);
 
-int64_t check_start()
-{
-    String_View start_ = cstr_as_sv("start");
-    /* for (size_t i = 0; i < label_array_counter; i++)
+    for (size_t k = 0; k < chunks_size; k++)
     {
-        if (sv_eq(label_array[i].label, start_))
+        if (started[k])
         {
-            return (int64_t)label_array[i].label_pointing_location;
+            pthread_join(threads[k], NULL);
         }
-    } */
-
-    Hashnode *node = search_for_node(start_);
-    if (!node)
-    {
-        return -1;
     }
-    else
+    bool merged = vm_merge_chunks(as, chunks, chunks_size, program, data_section, code_size, data_size);
+
+    for (size_t k = 0; k < chunks_size; k++)
     {
-        return (int64_t)node->value;
+        vm_assembler_free(&assemblers[k]);
+        free((void *)chunks[k].program);
+        free((void *)chunks[k].data_section);
     }
+    fclose(null_stream);
+    free((void *)chunks);
+    free((void *)assemblers);
+    free((void *)threads);
+    free((void *)started);
+    return merged;
+}
+#endif
 
-    /* return -1; */
+#if VM_HAS_THREADS
+// the chunks to split a source of source_size bytes into, one per thread vm_asm_threads allows and VM_ASM_CHUNK_MIN
+// bytes of it, so 1 where it's assembled on the calling thread
+static size_t vm_asm_chunks(size_t source_size)
+{
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads = vm_asm_threads > 0 ? vm_asm_threads : (processors > 0 ? (size_t)processors : 1);
+    size_t chunks = source_size / VM_ASM_CHUNK_MIN < threads ? source_size / VM_ASM_CHUNK_MIN : threads;
+    return chunks > 0 ? chunks : 1;
 }
+#endif
 
-vm_header_ vm_translate_source(String_View source, Inst *program, uint8_t *data_section)
+// assembles source into *program and *data_section, which it allocates and grows as the source needs; the caller frees
+// them, and keeps source until label_free(), as the labels point into it
+// a source of more than VM_ASM_CHUNK_MIN bytes is split over up to vm_asm_threads threads, into the same bytes
+vm_header_ vm_translate_source(Vm_Assembler *as, String_View source, Inst **program, uint8_t **data_section)
 {
     size_t code_section_offset = 0;
     size_t data_section_offset = 0;
-    bool is_code = true;
-    bool is_data = false;
+    bool parallel = false;
+    *program = NULL;
+    *data_section = NULL;
 
-    while (source.count > 0)
+#if VM_HAS_THREADS
+    size_t chunks_size = vm_asm_chunks(source.count);
+    if (chunks_size > 1)
     {
-        if (code_section_offset >= vm_program_capacity)
+        parallel = vm_translate_parallel(as, source, chunks_size, program, data_section, &code_section_offset, &data_section_offset);
+        if (!parallel)
         {
-            fprintf(stderr, "Program Too Big\n");
-            compilation_successful = false;
-            break;
+            // back to where vm_assembler_init() left it
+            free((void *)*program);
+            free((void *)*data_section);
+            label_free(as);
+            as->not_resolved_yet = vm_arena_grow(&as->arena, NULL, &as->not_resolved_yet_capacity, label_capacity, sizeof(label_inst_location));
+            as->line_no = 0;
+            as->compilation_successful = true;
         }
+    }
+#endif
 
-        line_no++;
-        String_View line = sv_chop_by_delim(&source, '\n');
-        line = sv_chop_by_delim(&line, ';'); // Remove comments
-        sv_trim_left(&line);
-        sv_trim_right(&line);
-
-        if (line.count == 0)
-            continue; // Ignore empty lines
+    if (!parallel)
+    {
+        Vm_Asm_Chunk chunk = vm_asm_chunk_new(as, source, true);
+        vm_translate_lines(&chunk);
+        *program = chunk.program;
+        *data_section = chunk.data_section;
+        code_section_offset = chunk.code_size;
+        data_section_offset = chunk.data_size;
+    }
 
-        String_View section = line;
-        String_View directive = sv_chop_by_delim(&section, ' ');
+    return vm_translate_finish(as, *program, code_section_offset, data_section_offset);
+}
 
-        if (sv_eq(directive, cstr_as_sv(".text")))
-        {
-            is_code = true;
-            is_data = false;
-        }
-        else if (sv_eq(directive, cstr_as_sv(".data")))
-        {
-            is_code = false;
-            is_data = true;
-        }
-        else if (is_code)
-        {
-            process_code_line(line, program, &code_section_offset);
-        }
-        else if (is_data)
+// assembles the file at source_path as vm_translate_source() does its source, but reads it VM_LINE_READER_SIZE bytes
+// at a time and copies the names it keeps, so what it holds grows with the labels and the code, not with the source,
+// and the file may be bigger than memory; one to split over threads is mapped instead, until vm_assembler_free()
+vm_header_ vm_translate_file(Vm_Assembler *as, const char *source_path, Inst **program, uint8_t **data_section)
+{
+#if VM_HAS_THREADS
+    int fd = open(source_path, O_RDONLY);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && vm_asm_chunks((size_t)st.st_size) > 1)
+    {
+        void *mapping = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED)
         {
-            process_data_line(line, data_section, &data_section_offset);
+            close(fd);
+            as->source_mapping = mapping;
+            as->source_mapping_size = (size_t)st.st_size;
+            return vm_translate_source(as, (String_View){.data = mapping, .count = (size_t)st.st_size}, program, data_section);
         }
     }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+#endif
+
+    FILE *f = fopen(source_path, "rb");
+    if (!f)
+    {
+        fprintf(stderr, "ERROR: Couldn't open file: '%s': %s\n", source_path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    Vm_Line_Reader reader = {.file = f, .path = source_path, .capacity = VM_LINE_READER_SIZE};
+    reader.buffer = vm_grow_array(NULL, &reader.capacity, reader.capacity, sizeof(char));
 
-    compilation_successful = check_compilation_status(program, code_section_offset);
+    Vm_Asm_Chunk chunk = vm_asm_chunk_new(as, (String_View){0}, true);
+    String_View line;
+    as->interning = true;
+    while (vm_read_line(&reader, &line) && vm_assemble_line(&chunk, line))
+    {
+    }
+    as->interning = false;
+    free((void *)reader.buffer);
+    fclose(f);
+
+    *program = chunk.program;
+    *data_section = chunk.data_section;
+    return vm_translate_finish(as, *program, chunk.code_size, chunk.data_size);
+}
+
+// what's left once the lines are assembled: the checks, the labels resolved, the debug sections and the header
+static vm_header_ vm_translate_finish(Vm_Assembler *as, Inst *program, size_t code_section_offset, size_t data_section_offset)
+{
+    as->compilation_successful = check_compilation_status(as, program, code_section_offset);
 
-    if (compilation_successful)
+    if (as->compilation_successful)
     {
-        resolve_labels(program);
+        resolve_labels(as, program);
         /* check_unresolved_labels(); */
     }
     else
     {
-        fprintf(stderr, "Compilation Failed\n");
+        fprintf(as->errors, "Compilation Failed\n");
     }
 
-    return create_vm_header(code_section_offset, data_section_offset);
+    // the save functions write these; the names are copied out, so they outlive source and label_free()
+    vm_debug_encode_lines(as, as->source_files, as->source_files_size, as->source_lines, code_section_offset);
+    vm_debug_encode_symbols(as);
+
+    return create_vm_header(as, code_section_offset, data_section_offset);
 }
 /*
 static int process_section_directive(String_View section, bool *is_code, bool *is_data)
@@ -1994,39 +8556,52 @@ static int process_section_directive(String_View section, bool *is_code, bool *i
     else
     {
         fprintf(stderr, "ERROR: invalid section type '%.*s'\n", (int)directive.count, directive.data);
-        compilation_successful = false;
+        as->compilation_successful = false;
         return -1;
     }
 
     return 0;
 }
  */
-static void process_code_line(String_View line, Inst *program, size_t *code_section_offset)
+static void process_code_line(Vm_Assembler *as, String_View line, Inst *program, size_t *code_section_offset)
 {
     String_View label = sv_chop_by_delim(&line, ':');
     if (*(line.data - 1) == ':')
     { // If there's a label
-        process_label(label, *code_section_offset);
+        process_label(as, label, *code_section_offset, VM_SECTION_CODE);
         sv_trim_left(&line);
         if (line.count > 0)
         { // instruction remaining after the label
-            program[*code_section_offset] = vm_translate_line(line, *code_section_offset);
+            program[*code_section_offset] = vm_translate_line(as, line, *code_section_offset);
             (*code_section_offset)++;
         }
     }
     else
     {
-        program[*code_section_offset] = vm_translate_line(label, *code_section_offset);
+        program[*code_section_offset] = vm_translate_line(as, label, *code_section_offset);
         (*code_section_offset)++;
     }
 }
 
-static void process_data_line(String_View line, uint8_t *data_section, size_t *data_section_offset)
+// the integer of a .byte, .word, .doubleword or .quadword line, whose low bytes are stored, whether it's signed or not
+static uint64_t vm_data_integer(Vm_Assembler *as, String_View data_type, String_View literal)
+{
+    Sv_Number number = sv_to_number(&literal);
+    if (str_errno != SUCCESS || number.type == SV_DOUBLE)
+    {
+        fprintf(as->errors, "Line Number %zu -> ERROR: failed to parse value for %.*s\n", as->line_no, (int)data_type.count, data_type.data);
+        as->compilation_successful = false;
+        return 0;
+    }
+    return number.u64;
+}
+
+static void process_data_line(Vm_Assembler *as, String_View line, uint8_t *data_section, size_t *data_section_offset)
 {
     String_View label = sv_chop_by_delim(&line, ':');
     if (*(line.data - 1) == ':')
     {
-        process_label(label, *data_section_offset);
+        process_label(as, label, *data_section_offset, VM_SECTION_DATA);
     }
     else
     {
@@ -2040,92 +8615,34 @@ static void process_data_line(String_View line, uint8_t *data_section, size_t *d
     String_View data_type = sv_chop_by_delim(&line, ' ');
     sv_trim_left(&line);
 
-    bool is_neg = is_negative(line);
-
     if (sv_eq(data_type, cstr_as_sv(".byte")))
     {
-        if (*data_section_offset >= vm_default_memory_size - sizeof(int8_t))
-        {
-            fprintf(stderr, "Line Number: %zu -> ERROR: Not enough default static memory for .byte %.*s\n", line_no, (int)line.count, line.data);
-            exit(EXIT_FAILURE);
-        }
-        if (is_neg)
-        {
-            int8_t value = (int8_t)sv_to_signed64(&line);
-            *(int8_t *)&data_section[*data_section_offset] = value;
-        }
-        else
-        {
-            uint8_t value = (uint8_t)sv_to_unsigned64(&line);
-            *(uint8_t *)&data_section[*data_section_offset] = value;
-        }
+        *(uint8_t *)&data_section[*data_section_offset] = (uint8_t)vm_data_integer(as, data_type, line);
         *data_section_offset += sizeof(int8_t);
     }
     else if (sv_eq(data_type, cstr_as_sv(".word")))
     {
-        if (*data_section_offset >= vm_default_memory_size - sizeof(int16_t))
-        {
-            fprintf(stderr, "Line Number: %zu -> ERROR: Not enough default static memory for .word %.*s\n", line_no, (int)line.count, line.data);
-            exit(EXIT_FAILURE);
-        }
-        if (is_neg)
-        {
-            int16_t value = (int16_t)sv_to_signed64(&line);
-            *(int16_t *)&data_section[*data_section_offset] = value;
-        }
-        else
-        {
-            uint16_t value = (uint16_t)sv_to_unsigned64(&line);
-            *(uint16_t *)&data_section[*data_section_offset] = value;
-        }
+        *(uint16_t *)&data_section[*data_section_offset] = (uint16_t)vm_data_integer(as, data_type, line);
         *data_section_offset += sizeof(int16_t);
     }
     else if (sv_eq(data_type, cstr_as_sv(".doubleword")))
     {
-        if (*data_section_offset >= vm_default_memory_size - sizeof(int32_t))
-        {
-            fprintf(stderr, "Line Number: %zu -> ERROR: Not enough default static memory for .doubleword %.*s\n", line_no, (int)line.count, line.data);
-            exit(EXIT_FAILURE);
-        }
-        if (is_neg)
-        {
-            int32_t value = (int32_t)sv_to_signed64(&line);
-            *(int32_t *)&data_section[*data_section_offset] = value;
-        }
-        else
-        {
-            uint32_t value = (uint32_t)sv_to_unsigned64(&line);
-            *(uint32_t *)&data_section[*data_section_offset] = value;
-        }
+        *(uint32_t *)&data_section[*data_section_offset] = (uint32_t)vm_data_integer(as, data_type, line);
         *data_section_offset += sizeof(int32_t);
     }
     else if (sv_eq(data_type, cstr_as_sv(".quadword")))
     {
-        if (*data_section_offset >= vm_default_memory_size - sizeof(int64_t))
-        {
-            fprintf(stderr, "Line Number: %zu -> ERROR: Not enough default static memory for .quadword %.*s\n", line_no, (int)line.count, line.data);
-            exit(EXIT_FAILURE);
-        }
-        if (is_neg)
-        {
-            int64_t value = sv_to_signed64(&line);
-            *(int64_t *)&data_section[*data_section_offset] = value;
-        }
-        else
-        {
-            uint64_t value = sv_to_unsigned64(&line);
-            *(uint64_t *)&data_section[*data_section_offset] = value;
-        }
+        *(uint64_t *)&data_section[*data_section_offset] = vm_data_integer(as, data_type, line);
         *data_section_offset += sizeof(int64_t);
     }
     else if (sv_eq(data_type, cstr_as_sv(".double")))
     {
-        if (*data_section_offset >= vm_default_memory_size - sizeof(double))
+        double value = sv_to_double(&line);
+        if (str_errno != SUCCESS)
         {
-            fprintf(stderr, "Line Number: %zu -> ERROR: Not enough default static memory for .double %.*s\n", line_no, (int)line.count, line.data);
-            exit(EXIT_FAILURE);
+            fprintf(as->errors, "Line Number %zu -> ERROR: failed to parse value for %.*s\n", as->line_no, (int)data_type.count, data_type.data);
+            as->compilation_successful = false;
         }
-        double value = sv_to_double(&line);
         *(double *)&data_section[*data_section_offset] = value;
         *data_section_offset += sizeof(double);
     }
@@ -2138,14 +8655,8 @@ static void process_data_line(String_View line, uint8_t *data_section, size_t *d
         }
         else
         {
-            fprintf(stderr, "Line Number: %zu -> ERROR: %.*s not a valid vasm string\n", line_no, (int)line.count, line.data);
-            compilation_successful = false;
-        }
-
-        if (*data_section_offset > vm_default_memory_size - line.count - 1)
-        {
-            fprintf(stderr, "Line Number: %zu -> ERROR: Not enough default static memory for .string %.*s\n", line_no, (int)line.count, line.data);
-            exit(EXIT_FAILURE);
+            fprintf(as->errors, "Line Number: %zu -> ERROR: %.*s not a valid vasm string\n", as->line_no, (int)line.count, line.data);
+            as->compilation_successful = false;
         }
 
         /* for (size_t i = 0; i < line.count; i++)
@@ -2162,32 +8673,26 @@ static void process_data_line(String_View line, uint8_t *data_section, size_t *d
     }
     else
     {
-        fprintf(stderr, "Line Number: %zu -> ERROR: invalid data type '%.*s'\n", line_no, (int)data_type.count, data_type.data);
-        compilation_successful = false;
-        return;
-    }
-
-    if (str_errno != SUCCESS)
-    {
-        fprintf(stderr, "Line Number %zu -> ERROR: failed to parse value for %.*s\n", line_no, (int)data_type.count, data_type.data);
-        compilation_successful = false;
+        fprintf(as->errors, "Line Number: %zu -> ERROR: invalid data type '%.*s'\n", as->line_no, (int)data_type.count, data_type.data);
+        as->compilation_successful = false;
     }
 }
 
-static bool check_compilation_status(Inst *program, size_t code_section_offset)
+static bool check_compilation_status(const Vm_Assembler *as, Inst *program, size_t code_section_offset)
 {
-    if (code_section_offset > 0 && program[code_section_offset - 1].type != INST_HALT)
+    // a module of a linked program may end in anything; the executable is whatever the linker makes of it
+    if (!as->object && code_section_offset > 0 && program[code_section_offset - 1].type != INST_HALT)
     {
-        fprintf(stderr, "ERROR: halt required to mark the code end\n");
+        fprintf(as->errors, "ERROR: halt required to mark the code end\n");
         return false;
     }
     return true;
 }
 
-static vm_header_ create_vm_header(size_t code_section_offset, size_t data_section_offset)
+static vm_header_ create_vm_header(const Vm_Assembler *as, size_t code_section_offset, size_t data_section_offset)
 {
     bool has_start = true;
-    int64_t start_location = check_start();
+    int64_t start_location = check_start(as);
     if (start_location == -1)
     {
         has_start = false;
@@ -2196,28 +8701,27 @@ static vm_header_ create_vm_header(size_t code_section_offset, size_t data_secti
     return (vm_header_){
         .code_section_size = code_section_offset,
         .has_start = has_start,
-        .data_section_offset_in_executable = sizeof(vm_header_),
-        .code_section_offset_in_executable = sizeof(vm_header_) + sizeof(uint8_t) * data_section_offset,
         .start_location = start_location,
         .data_section_size = data_section_offset,
-        .vm_executable_identifier = VM_EXECUTABLE_IDENTIFIER};
+        .vm_executable_identifier = VM_EXECUTABLE_IDENTIFIER,
+        .format_version = VM_FORMAT_VERSION};
 }
 
 String_View slurp_file(const char *file_path)
 {
-    int ret = 0;
+    long ret = 0;
     FILE *f = fopen(file_path, "r");
     if (!f)
     {
         fprintf(stderr, "ERROR: Couldn't open file: '%s': %s\n", file_path, strerror(errno));
-        compilation_successful = false;
+        exit(EXIT_FAILURE);
     }
 
     if (fseek(f, 0, SEEK_END))
     {
         fclose(f);
         fprintf(stderr, "ERROR: Could not read file '%s': %s\n", file_path, strerror(errno));
-        compilation_successful = false;
+        exit(EXIT_FAILURE);
     }
 
     ret = ftell(f);
@@ -2225,7 +8729,7 @@ String_View slurp_file(const char *file_path)
     {
         fclose(f);
         fprintf(stderr, "ERROR: Could not read file '%s': %s\n", file_path, strerror(errno));
-        compilation_successful = false;
+        exit(EXIT_FAILURE);
     }
 
     // ret now contains the number of bytes in the file
@@ -2233,28 +8737,28 @@ String_View slurp_file(const char *file_path)
     {
         fclose(f);
         fprintf(stderr, "ERROR: Could not read file '%s': %s\n", file_path, strerror(errno));
-        compilation_successful = false;
+        exit(EXIT_FAILURE);
     }
 
-    char *buffer = malloc(ret);
+    char *buffer = malloc(ret > 0 ? (size_t)ret : 1);
     if (!buffer)
     {
         fprintf(stderr, "ERROR: Couldn't allocate memory for file '%s': %s\n", file_path, strerror(errno));
-        compilation_successful = false;
+        exit(EXIT_FAILURE);
     }
 
-    int ret_val = fread(buffer, 1, ret, f);
+    size_t size = fread(buffer, 1, (size_t)ret, f);
     if (ferror(f))
     {
         fclose(f);
         fprintf(stderr, "Could not read the file '%s': %s\n", file_path, strerror(errno));
-        compilation_successful = false;
+        exit(EXIT_FAILURE);
     }
 
     fclose(f);
 
     return (String_View){
-        .count = ret,
+        .count = size,
         .data = buffer,
     };
 }
@@ -1,5 +1,6 @@
 #define _VM_IMPLEMENTATION
 #define _SV_IMPLEMENTATION
+#define _DEFAULT_SOURCE // before any system header, see virt_mach.h
 
 #include <stdlib.h>
 #include <stdbool.h>
@@ -232,10 +233,17 @@ int main(int argc, char **argv) {
                  (int)(strrchr(input, '.') - input), input);
     }
 
+    // every switch between files gets a line marker, '# <line> "<file>"' as cpp writes them (a trailing 1 enters an
+    // %include, a 2 returns from one), so the assembler's line table can name the file and line each instruction is from
+    char current_file[MAX_PATH_LENGTH];
+    snprintf(current_file, sizeof(current_file), "%s", input);
+    bool first_pass = true;
+
     while (true) {
         String_View include_processing = slurp_file(input);
         String_View copy_one = include_processing;
         size_t line_no = 0;
+        size_t current_line = 1;
 
         if (include_processing.data == NULL) {
             fprintf(stderr, "ERROR: Failed to read input file: %s\n", 
@@ -250,10 +258,31 @@ int main(int argc, char **argv) {
             exit(EXIT_FAILURE);
         }
 
+        if (first_pass) {
+            fprintf(temp, "# 1 \"%s\"\n", current_file);
+            first_pass = false;
+        }
+
         size_t include_no = 0;
         while (include_processing.count > 0) {
             String_View line = sv_chop_by_delim(&include_processing, '\n');
 
+            if (line.count > 2 && line.data[0] == '#' && line.data[1] == ' ') {
+                // a marker from the pass before; the lines after it are that file's from that line on
+                String_View marker = line;
+                marker.data += 2; marker.count -= 2;
+                String_View number = sv_chop_by_delim(&marker, ' ');
+                current_line = sv_to_unsigned64(&number);
+                if (marker.count > 0 && marker.data[0] == '"') {
+                    marker.data++; marker.count--;
+                    String_View name = sv_chop_by_delim(&marker, '"');
+                    snprintf(current_file, sizeof(current_file), "%.*s", (int)name.count, name.data);
+                }
+                fprintf(temp, "%.*s\n", (int)line.count, line.data);
+                line_no++;
+                continue;
+            }
+
             if (*line.data == '%') {
                 String_View directive = sv_chop_by_delim(&line, ' ');
                 sv_trim_left(&line);
@@ -317,8 +346,9 @@ int main(int argc, char **argv) {
                     }
 
                     fread(buffer, 1, file_size, file);
+                    fprintf(temp, "# 1 \"%s\" 1\n", file_name);
                     fwrite(buffer, 1, file_size, temp);
-                    fprintf(temp, "\n");
+                    fprintf(temp, "\n# %zu \"%s\" 2\n", current_line + 1, current_file);
 
                     free(buffer);
                     fclose(file);
@@ -330,6 +360,7 @@ int main(int argc, char **argv) {
             } else {
                 fprintf(temp, "%.*s\n", (int)line.count, line.data);
             }
+            current_line++;
             line_no++;
         }
 
@@ -357,9 +388,12 @@ int main(int argc, char **argv) {
         sv_trim_left(&line);
         sv_trim_right(&line);
 
-        if (*line.data == '%') {
+        if (*line.data == '#') {
+            fprintf(vpp, "%.*s\n", (int)line.count, line.data); // line markers go through as they are
+        } else if (*line.data == '%') {
             String_View directive = sv_chop_by_delim(&line, ' ');
             sv_trim_left(&line);
+            fprintf(vpp, "\n"); // keeps the lines after it on their line numbers
 
             if (sv_eq(directive, cstr_as_sv("%define"))) {
                 if (line.count == 0) {